@@ -1,5 +1,6 @@
 #include "at3acm.h"
 #include "gui.h"
+#include "utils.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -109,6 +110,182 @@ bool registerBundledAtrac3Codec() {
     return isAtrac3CodecAvailable();
 }
 
+// ATRAC3 frames handed to the codec per conversion call. The source window and
+// the PCM buffer are allocated once for this size, so memory use does not
+// depend on the length of the track.
+#define ACM_WINDOW_FRAMES 64
+
+// The codec is not known to be safe to enter from several threads, so every
+// call into a stream takes this lock. Decoders of separate tracks can still
+// be used from separate threads, only their conversions take turns.
+static SRWLOCK g_codecLock = SRWLOCK_INIT;
+
+struct AT3_ACM_DECODER {
+    HACMDRIVER driver;
+    HACMSTREAM stream;
+    ACMSTREAMHEADER header;
+    unsigned char *sbuf;
+    DWORD slen;
+    unsigned char *dbuf;
+    DWORD pending;              // Bytes of sbuf not converted yet.
+    DWORD flags;
+    int channels;
+};
+
+// Opens the driver and the stream of decoder. Called with the codec lock held.
+static AT3_ACM_DECODER* openAt3Stream(AT3_ACM_DECODER* decoder, HACMDRIVERID at3hadid, const WAVEFORMATEX* format) {
+    WAVEFORMATEX dwfx;
+    memset(&dwfx, 0, sizeof(WAVEFORMATEX));
+    dwfx.wFormatTag = WAVE_FORMAT_PCM;
+    dwfx.nChannels = format->nChannels;
+    dwfx.nSamplesPerSec = format->nSamplesPerSec;
+    dwfx.wBitsPerSample = 16;
+    dwfx.nBlockAlign = dwfx.nChannels * (dwfx.wBitsPerSample / 8);
+    dwfx.nAvgBytesPerSec = dwfx.nSamplesPerSec * dwfx.nBlockAlign;
+    dwfx.cbSize = 0;
+
+    if (acmDriverOpen(&decoder->driver, at3hadid, 0)) {
+        printf("ERROR: ATRAC3 driver could not be opened\n");
+        delete decoder;
+        return nullptr;
+    }
+
+    if (acmStreamOpen(&decoder->stream, decoder->driver, (LPWAVEFORMATEX)format, &dwfx, nullptr, 0, 0, ACM_STREAMOPENF_NONREALTIME)) {
+        printf("ERROR: ATRAC3 stream initialization failed\n");
+        acmDriverClose(decoder->driver, 0);
+        delete decoder;
+        return nullptr;
+    }
+
+    decoder->slen = (DWORD)format->nBlockAlign * ACM_WINDOW_FRAMES;
+    DWORD dlen;
+    if (acmStreamSize(decoder->stream, decoder->slen, &dlen, ACM_STREAMSIZEF_SOURCE)) {
+        printf("ERROR: Could not infer stream size\n");
+        acmStreamClose(decoder->stream, 0);
+        acmDriverClose(decoder->driver, 0);
+        delete decoder;
+        return nullptr;
+    }
+
+    dlen += 0x400;
+    decoder->sbuf = new unsigned char[decoder->slen];
+    decoder->dbuf = new unsigned char[dlen];
+
+    ACMSTREAMHEADER *header = &decoder->header;
+    header->cbStruct = sizeof(ACMSTREAMHEADER);
+    header->pbSrc = decoder->sbuf;
+    header->cbSrcLength = decoder->slen;
+    header->pbDst = decoder->dbuf;
+    header->cbDstLength = dlen;
+
+    if (acmStreamPrepareHeader(decoder->stream, header, 0)) {
+        printf("ERROR: Could not prepare header\n");
+        acmStreamClose(decoder->stream, 0);
+        acmDriverClose(decoder->driver, 0);
+        delete[] decoder->sbuf;
+        delete[] decoder->dbuf;
+        delete decoder;
+        return nullptr;
+    }
+
+    decoder->flags = ACM_STREAMCONVERTF_BLOCKALIGN | ACM_STREAMCONVERTF_START;
+    return decoder;
+}
+
+AT3_ACM_DECODER* openAt3Decoder(HACMDRIVERID at3hadid, const WAVEFORMATEX* format) {
+    if (format->wFormatTag != WAVE_FORMAT_SONY_SCX || format->nBlockAlign == 0)
+        return nullptr;
+
+    AT3_ACM_DECODER *decoder = new AT3_ACM_DECODER;
+    memset(decoder, 0, sizeof(AT3_ACM_DECODER));
+    decoder->channels = format->nChannels;
+
+    AcquireSRWLockExclusive(&g_codecLock);
+    AT3_ACM_DECODER *opened = openAt3Stream(decoder, at3hadid, format);
+    ReleaseSRWLockExclusive(&g_codecLock);
+    return opened;
+}
+
+void closeAt3Decoder(AT3_ACM_DECODER* decoder) {
+    if (!decoder)
+        return;
+    decoder->header.cbSrcLength = decoder->slen;
+    AcquireSRWLockExclusive(&g_codecLock);
+    acmStreamUnprepareHeader(decoder->stream, &decoder->header, 0);
+    acmStreamClose(decoder->stream, 0);
+    acmDriverClose(decoder->driver, 0);
+    ReleaseSRWLockExclusive(&g_codecLock);
+    delete[] decoder->sbuf;
+    delete[] decoder->dbuf;
+    delete decoder;
+}
+
+int decodeAt3Window(AT3_ACM_DECODER* decoder, const unsigned char* data, unsigned int size, bool last, PCM_SINK sink, void* ctx) {
+    // Bytes the codec left over from the previous window are moved to the
+    // front and topped up, so every call still sees whole frames.
+    while (size > 0 || (last && decoder->pending > 0)) {
+        DWORD want = decoder->slen - decoder->pending;
+        if (want > size)
+            want = size;
+        memcpy(decoder->sbuf + decoder->pending, data, want);
+        data += want;
+        size -= want;
+        decoder->pending += want;
+
+        // Wait for more frame data until the source window is full.
+        if (size == 0 && !last && decoder->pending < decoder->slen)
+            return 0;
+        if (size == 0 && last)
+            decoder->flags |= ACM_STREAMCONVERTF_END;
+
+        ACMSTREAMHEADER *header = &decoder->header;
+        header->cbSrcLength = decoder->pending;
+        header->cbSrcLengthUsed = 0;
+        header->cbDstLengthUsed = 0;
+        AcquireSRWLockExclusive(&g_codecLock);
+        MMRESULT converted = acmStreamConvert(decoder->stream, header, decoder->flags);
+        ReleaseSRWLockExclusive(&g_codecLock);
+        if (converted) {
+            printf("ERROR: ATRAC3 conversion failed\n");
+            return -1;
+        }
+        decoder->flags &= ~ACM_STREAMCONVERTF_START;
+
+        int frames = (int)(header->cbDstLengthUsed / (decoder->channels * sizeof(short)));
+        if (frames > 0) {
+            int result = sink(ctx, (const int16_t*)decoder->dbuf, frames);
+            if (result != 0)
+                return (result > 0) ? 1 : -1;
+        }
+
+        decoder->pending -= header->cbSrcLengthUsed;
+        memmove(decoder->sbuf, decoder->sbuf + header->cbSrcLengthUsed, decoder->pending);
+        if (header->cbSrcLengthUsed == 0) {
+            if (size == 0)
+                break;  // Trailing partial frame.
+            printf("ERROR: ATRAC3 conversion stalled\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Sample data of the WAV file written by convertAt3ToWav.
+typedef struct {
+    FILE *file;
+    int channels;
+    DWORD32 dataSize;
+} ACM_WAV_SINK;
+
+static int writeWavSamples(void* ctx, const int16_t* samples, int frames) {
+    ACM_WAV_SINK *sink = (ACM_WAV_SINK*)ctx;
+    size_t bytes = (size_t)frames * sink->channels * sizeof(int16_t);
+    if (fwrite(samples, 1, bytes, sink->file) != bytes)
+        return -1;
+    sink->dataSize += (DWORD32)bytes;
+    return 0;
+}
+
 int convertAt3ToWav(const char* input, const char* output, HACMDRIVERID at3hadid) {
     FILE *sfp = fopen(input, "rb");
     if (!sfp) {
@@ -116,8 +293,9 @@ int convertAt3ToWav(const char* input, const char* output, HACMDRIVERID at3hadid
         return 1;
     }
 
-    unsigned char *bFmt = nullptr, *bData = nullptr;
+    unsigned char *bFmt = nullptr;
     unsigned int sizeFmt = 0, sizeData = 0;
+    long dataOffset = -1;
 
     char cb[12];
     fread(cb, 1, 12, sfp);
@@ -127,6 +305,7 @@ int convertAt3ToWav(const char* input, const char* output, HACMDRIVERID at3hadid
         return 1;
     }
 
+    // Only the format is loaded, the frame data is read a window at a time below.
     while (!feof(sfp)) {
         char magic[4];
         DWORD32 blockSize;
@@ -140,120 +319,59 @@ int convertAt3ToWav(const char* input, const char* output, HACMDRIVERID at3hadid
             sizeFmt = blockSize;
             fread(bFmt, 1, sizeFmt, sfp);
         }
-        else if (memcmp(magic, "data", 4) == 0 && !bData) {
-            bData = new unsigned char[blockSize];
-            sizeData = blockSize;
-            fread(bData, 1, sizeData, sfp);
-        }
         else {
+            if (memcmp(magic, "data", 4) == 0 && dataOffset < 0) {
+                dataOffset = ftell(sfp);
+                sizeData = blockSize;
+            }
             fseek(sfp, blockSize, SEEK_CUR);
         }
     }
-    fclose(sfp);
 
-    if (!bFmt || !bData) {
+    if (!bFmt || dataOffset < 0) {
         printf("ERROR: Invalid WAV file structure: %s\n", input);
+        fclose(sfp);
         delete[] bFmt;
-        delete[] bData;
         return 1;
     }
 
     WAVEFORMATEX *swfx = (WAVEFORMATEX*)bFmt;
-    if (swfx->wFormatTag != WAVE_FORMAT_SONY_SCX) {
+    if (swfx->wFormatTag != WAVE_FORMAT_SONY_SCX || swfx->nBlockAlign == 0) {
         printf("ERROR: Input file is not ATRAC3 format: %s\n", input);
+        fclose(sfp);
         delete[] bFmt;
-        delete[] bData;
         return 1;
     }
 
     // Driver is passed as parameter, no need to find it again
-
-    WAVEFORMATEX dwfx;
-    memset(&dwfx, 0, sizeof(WAVEFORMATEX));
-    dwfx.wFormatTag = WAVE_FORMAT_PCM;
-    dwfx.nChannels = swfx->nChannels;
-    dwfx.nSamplesPerSec = swfx->nSamplesPerSec;
-    dwfx.wBitsPerSample = 16;
-    dwfx.nBlockAlign = dwfx.nChannels * (dwfx.wBitsPerSample / 8);
-    dwfx.nAvgBytesPerSec = dwfx.nSamplesPerSec * dwfx.nBlockAlign;
-    dwfx.cbSize = 0;
-
-    HACMDRIVER at3had;
-    if (acmDriverOpen(&at3had, at3hadid, 0)) {
-        printf("ERROR: ATRAC3 driver could not be opened\n");
-        delete[] bFmt;
-        delete[] bData;
-        return 1;
-    }
-
-    HACMSTREAM stream;
-    if(acmStreamOpen(&stream, at3had, swfx, &dwfx, nullptr, 0, 0, ACM_STREAMOPENF_NONREALTIME)) {
-        printf("ERROR: ATRAC3 stream initialization failed\n");
-        acmDriverClose(at3had, 0);
-        delete[] bFmt;
-        delete[] bData;
-        return 1;
-    }
-
-    DWORD dlen;
-    if (acmStreamSize(stream, sizeData, &dlen, ACM_STREAMSIZEF_SOURCE)) {
-        acmStreamClose(stream, 0);
-        acmDriverClose(at3had, 0);
-        printf("ERROR: Could not infer stream size\n");
-        delete[] bFmt;
-        delete[] bData;
-        return 1;
-    }
-
-    dlen += 0x400;
-    unsigned char *dbuf = new unsigned char[dlen];
-
-    ACMSTREAMHEADER header;
-    memset(&header, 0, sizeof(header));
-    header.cbStruct = sizeof(header);
-    header.fdwStatus = 0;
-    header.pbSrc = bData;
-    header.cbSrcLength = sizeData;
-    header.cbSrcLengthUsed = 0;
-    header.pbDst = dbuf;
-    header.cbDstLength = dlen;
-    header.cbDstLengthUsed = 0;
-
-    if (acmStreamPrepareHeader(stream, &header, 0)) {
-        acmStreamClose(stream, 0);
-        acmDriverClose(at3had, 0);
-        printf("ERROR: Could not prepare header\n");
-        delete[] bFmt;
-        delete[] bData;
-        delete[] dbuf;
-        return 1;
-    }
-
-    if (acmStreamConvert(stream, &header, ACM_STREAMCONVERTF_BLOCKALIGN)) {
-        acmStreamUnprepareHeader(stream, &header, 0);
-        acmStreamClose(stream, 0);
-        acmDriverClose(at3had, 0);
-        printf("ERROR: ATRAC3 conversion failed\n");
+    AT3_ACM_DECODER *decoder = openAt3Decoder(at3hadid, swfx);
+    if (!decoder) {
+        fclose(sfp);
         delete[] bFmt;
-        delete[] bData;
-        delete[] dbuf;
         return 1;
     }
 
-    acmStreamUnprepareHeader(stream, &header, 0);
-    acmStreamClose(stream, 0);
-    acmDriverClose(at3had, 0);
-
     FILE *dfp = fopen(output, "wb");
     if (!dfp) {
         printf("ERROR: Cannot open output file: %s\n", output);
+        closeAt3Decoder(decoder);
+        fclose(sfp);
         delete[] bFmt;
-        delete[] bData;
-        delete[] dbuf;
         return 1;
     }
 
-    DWORD32 fileSize = 0xC + 8 + sizeof(WAVEFORMATEX) + 8 + header.cbDstLengthUsed;
+    WAVEFORMATEX dwfx;
+    memset(&dwfx, 0, sizeof(WAVEFORMATEX));
+    dwfx.wFormatTag = WAVE_FORMAT_PCM;
+    dwfx.nChannels = swfx->nChannels;
+    dwfx.nSamplesPerSec = swfx->nSamplesPerSec;
+    dwfx.wBitsPerSample = 16;
+    dwfx.nBlockAlign = dwfx.nChannels * (dwfx.wBitsPerSample / 8);
+    dwfx.nAvgBytesPerSec = dwfx.nSamplesPerSec * dwfx.nBlockAlign;
+    dwfx.cbSize = 0;
+
+    // The sizes are filled in once the whole track has been converted.
+    DWORD32 fileSize = 0;
     fwrite("RIFF", 1, 4, dfp);
     fwrite(&fileSize, 4, 1, dfp);
     fwrite("WAVE", 1, 4, dfp);
@@ -264,15 +382,43 @@ int convertAt3ToWav(const char* input, const char* output, HACMDRIVERID at3hadid
     fwrite(&dwfx, 1, sizeof(WAVEFORMATEX), dfp);
 
     fwrite("data", 1, 4, dfp);
-    DWORD32 dataSize = header.cbDstLengthUsed;
+    DWORD32 dataSize = 0;
+    long dataSizeOffset = ftell(dfp);
     fwrite(&dataSize, 4, 1, dfp);
-    fwrite(dbuf, 1, header.cbDstLengthUsed, dfp);
 
+    ACM_WAV_SINK sink;
+    sink.file = dfp;
+    sink.channels = swfx->nChannels;
+    sink.dataSize = 0;
+
+    fseek(sfp, dataOffset, SEEK_SET);
+    unsigned char window[0x10000];
+    DWORD left = sizeData;
+    int result = 0;
+    while (result == 0) {
+        DWORD want = (left > sizeof(window)) ? (DWORD)sizeof(window) : left;
+        DWORD got = (DWORD)fread(window, 1, want, sfp);
+        left = (got == want) ? left - got : 0;
+        if (decodeAt3Window(decoder, window, got, left == 0, writeWavSamples, &sink) != 0) {
+            printf("ERROR: Cannot convert %s to %s\n", input, output);
+            result = 1;
+        }
+        if (left == 0)
+            break;
+    }
+
+    closeAt3Decoder(decoder);
+    fclose(sfp);
+
+    dataSize = sink.dataSize;
+    fileSize = 0xC + 8 + sizeof(WAVEFORMATEX) + 8 + dataSize;
+    fseek(dfp, 4, SEEK_SET);
+    fwrite(&fileSize, 4, 1, dfp);
+    fseek(dfp, dataSizeOffset, SEEK_SET);
+    fwrite(&dataSize, 4, 1, dfp);
     fclose(dfp);
 
     delete[] bFmt;
-    delete[] bData;
-    delete[] dbuf;
 
-    return 0;
-}
\ No newline at end of file
+    return result;
+}
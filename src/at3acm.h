@@ -4,6 +4,7 @@
 #include <mmreg.h>
 #include <mmsystem.h>
 #include <msacm.h>
+#include "atrac3.h"
 
 // Function to find ATRAC3 driver
 void findAt3Driver(LPHACMDRIVERID lpHadid);
@@ -16,5 +17,21 @@ bool isAtrac3CodecAvailable();
 // Returns true if the codec is available afterwards.
 bool registerBundledAtrac3Codec();
 
+// ATRAC3 decoding through an ACM stream, fed from memory a window at a time
+// like the native decoder (see atrac3_decode_window). Each track needs its own
+// decoder; decoders may be used from separate threads, their calls into the
+// codec are serialized.
+typedef struct AT3_ACM_DECODER AT3_ACM_DECODER;
+
+// Opens a stream of the codec at3hadid from format, the "fmt " chunk of an AT3
+// file, to 16-bit PCM. Returns nullptr on errors.
+AT3_ACM_DECODER* openAt3Decoder(HACMDRIVERID at3hadid, const WAVEFORMATEX* format);
+void closeAt3Decoder(AT3_ACM_DECODER* decoder);
+
+// Converts size bytes of frame data into the sink. A frame split between two
+// windows is kept until the next call; last marks the final window of the
+// track. Returns 0 to keep going, 1 if the sink stopped early, -1 on errors.
+int decodeAt3Window(AT3_ACM_DECODER* decoder, const unsigned char* data, unsigned int size, bool last, PCM_SINK sink, void* ctx);
+
 // Function to convert ATRAC3 to WAV using ACM with pre-found driver
 int convertAt3ToWav(const char* input, const char* output, HACMDRIVERID at3hadid);
\ No newline at end of file
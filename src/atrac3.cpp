@@ -0,0 +1,1025 @@
+// ATRAC3 decoder, ported from libavcodec/atrac3.c of FFmpeg.
+// Copyright (c) 2006-2008 Maxim Poliakovski
+// Copyright (c) 2006-2008 Benjamin Larsson
+//
+// This file is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This file is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this file; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "atrac3.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define WAVE_FORMAT_SONY_SCX    0x0270
+
+#define A3_MDCT_SIZE            512
+#define A3_BAND_SIZE            256     // Spectral lines per QMF band.
+#define A3_QMF_DELAY            46
+#define A3_MAX_COMPONENTS       64
+#define A3_MAX_GAIN_POINTS      7
+#define A3_UNIT_ID              0x28    // Start of every sound unit...
+#define A3_JS_UNIT_ID           3       // ...except the second joint stereo one.
+#define A3_JS_SYNC              0xF8    // Padding in front of the reversed second unit.
+
+/*
+ * Bitstream tables. A frame holds one sound unit per channel; each unit
+ * carries gain control points, tonal components and the spectrum of up to
+ * four QMF bands of 256 lines, quantized per subband.
+ */
+
+// Spectral lines covered by each of the 32 subbands.
+static const int subband_tab[33] = {
+      0,   8,  16,  24,  32,  40,  48,  56,
+     64,  80,  96, 112, 128, 144, 160, 176,
+    192, 224, 256, 288, 320, 352, 384, 416,
+    448, 480, 512, 576, 640, 704, 768, 896,
+    1024
+};
+
+// Huffman codes of the seven quantizer selectors (MSB first).
+static const uint8_t huffcode1[9]  = { 0x0, 0x4, 0x5, 0xC, 0xD, 0x1C, 0x1D, 0x1E, 0x1F };
+static const uint8_t huffbits1[9]  = { 1, 3, 3, 4, 4, 5, 5, 5, 5 };
+static const uint8_t huffcode2[5]  = { 0x0, 0x4, 0x5, 0x6, 0x7 };
+static const uint8_t huffbits2[5]  = { 1, 3, 3, 3, 3 };
+static const uint8_t huffcode3[7]  = { 0x0, 0x4, 0x5, 0xC, 0xD, 0xE, 0xF };
+static const uint8_t huffbits3[7]  = { 1, 3, 3, 4, 4, 4, 4 };
+static const uint8_t huffcode4[9]  = { 0x0, 0x4, 0x5, 0xC, 0xD, 0x1C, 0x1D, 0x1E, 0x1F };
+static const uint8_t huffbits4[9]  = { 1, 3, 3, 4, 4, 5, 5, 5, 5 };
+static const uint8_t huffcode5[15] = {
+    0x00, 0x02, 0x03, 0x08, 0x09, 0x0A, 0x0B, 0x1C, 0x1D, 0x3C, 0x3D, 0x3E, 0x3F, 0x0C, 0x0D
+};
+static const uint8_t huffbits5[15] = { 2, 3, 3, 4, 4, 4, 4, 5, 5, 6, 6, 6, 6, 4, 4 };
+static const uint8_t huffcode6[31] = {
+    0x00, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x34, 0x35, 0x36,
+    0x37, 0x38, 0x39, 0x3A, 0x3B, 0x78, 0x79, 0x7A, 0x7B, 0x7C, 0x7D, 0x7E, 0x7F, 0x08, 0x09
+};
+static const uint8_t huffbits6[31] = {
+    3, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7, 4, 4
+};
+static const uint8_t huffcode7[63] = {
+    0x00, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0x68, 0x69, 0x6A, 0x6B, 0x6C,
+    0x6D, 0x6E, 0x6F, 0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0xEC, 0xED, 0xEE, 0xEF, 0xF0, 0xF1, 0xF2,
+    0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF, 0x02, 0x03
+};
+static const uint8_t huffbits7[63] = {
+    3, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 4, 4
+};
+
+static const uint8_t* const huff_codes[7] = { huffcode1, huffcode2, huffcode3, huffcode4, huffcode5, huffcode6, huffcode7 };
+static const uint8_t* const huff_bits[7]  = { huffbits1, huffbits2, huffbits3, huffbits4, huffbits5, huffbits6, huffbits7 };
+static const int huff_sizes[7] = { 9, 5, 7, 9, 15, 31, 63 };
+
+// Selector 1 codes pairs of values, from a VLC symbol or a 4-bit CLC code.
+static const int8_t mantissa_vlc_tab[18] = {
+    0, 0,  0, 1,  0, -1,  1, 0,  -1, 0,  1, 1,  1, -1,  -1, 1,  -1, -1
+};
+static const int8_t mantissa_clc_tab[4] = { 0, 1, -2, -1 };
+
+// Bits per value when the spectrum uses constant length codes.
+static const int clc_length_tab[8] = { 0, 4, 3, 3, 4, 4, 5, 6 };
+
+static const float inv_max_quant[8] = {
+    0.0f, 1.0f / 1.5f, 1.0f / 2.5f, 1.0f / 3.5f, 1.0f / 4.5f, 1.0f / 7.5f, 1.0f / 15.5f, 1.0f / 31.5f
+};
+
+// Joint stereo matrix per selector (left, right weight of the first unit).
+static const float matrix_coeffs[8] = { 0.0f, 2.0f, 2.0f, 2.0f, 0.0f, 0.0f, 1.0f, 1.0f };
+
+// Half of the symmetric 48-tap QMF prototype.
+static const float qmf_48tap_half[24] = {
+    -0.00001461907f, -0.00009205479f, -0.000056157569f, 0.00030117269f,
+     0.0002422519f,  -0.00085293897f, -0.0005205574f,   0.0020340169f,
+     0.00078333891f, -0.0042153862f,  -0.00075614988f,  0.0078402944f,
+    -0.000061169922f,-0.01344162f,     0.0024626821f,   0.021736089f,
+    -0.007801671f,   -0.034090221f,    0.01880949f,     0.054326009f,
+    -0.043596379f,   -0.099384367f,    0.13207909f,     0.46424159f
+};
+
+// Tables computed once at startup (see Atrac3Init).
+typedef struct {
+    uint8_t symbol;
+    uint8_t length;
+} A3_VLC_ENTRY;
+
+static A3_VLC_ENTRY g_vlc[7][256];          // Indexed by the next 8 bits.
+static float g_sf_table[64];                // Scale factor 2^((i - 15) / 3).
+static float g_qmf_window[48];
+static float g_mdct_window[A3_MDCT_SIZE];
+static float g_tcos[A3_MDCT_SIZE / 4];      // IMDCT pre/post rotation.
+static float g_tsin[A3_MDCT_SIZE / 4];
+static float g_fft_cos[A3_MDCT_SIZE / 8];   // Twiddles of the 128-point FFT.
+static float g_fft_sin[A3_MDCT_SIZE / 8];
+static uint8_t g_fft_rev[A3_MDCT_SIZE / 4];
+static float g_gain_level[16];              // Gain control level 2^(4 - i).
+static float g_gain_step[31];               // Per-sample ramp between two levels.
+
+/*
+ * Decoder state.
+ */
+typedef struct {
+    int num_points;
+    int lev_code[A3_MAX_GAIN_POINTS];
+    int loc_code[A3_MAX_GAIN_POINTS];
+} A3_GAIN;
+
+typedef struct {
+    A3_GAIN band[4];
+} A3_GAIN_BLOCK;
+
+typedef struct {
+    int pos;
+    int num_coefs;
+    float coef[8];
+} A3_TONAL;
+
+typedef struct {
+    int bands_coded;
+    int num_components;
+    A3_TONAL components[A3_MAX_COMPONENTS];
+    A3_GAIN_BLOCK gain_block[2];    // Gain points of the previous and current frame.
+    int gc_blk_switch;
+    float spectrum[ATRAC3_SAMPLES_PER_FRAME];
+    float imdct_buf[A3_MDCT_SIZE];
+    float prev_frame[ATRAC3_SAMPLES_PER_FRAME];
+    float delay_buf1[A3_QMF_DELAY];
+    float delay_buf2[A3_QMF_DELAY];
+    float delay_buf3[A3_QMF_DELAY];
+} A3_CHANNEL;
+
+struct ATRAC3_DECODER {
+    int channels;
+    int block_align;
+    bool joint_stereo;
+    A3_CHANNEL units[ATRAC3_MAX_CHANNELS];
+
+    // Joint stereo selectors of the previous, current and next frame.
+    int matrix_coeff_index_prev[4];
+    int matrix_coeff_index_now[4];
+    int matrix_coeff_index_next[4];
+    int weighting_delay[6];
+
+    float samples[ATRAC3_MAX_CHANNELS][ATRAC3_SAMPLES_PER_FRAME];
+    float qmf_temp[A3_QMF_DELAY + 2 * A3_MDCT_SIZE];
+    uint8_t* reversed;              // Byte-reversed copy of a joint stereo frame.
+};
+
+/*
+ * MSB-first bit reader. Reads past the end return zeroes and mark the
+ * reader as overrun, which fails the frame.
+ */
+typedef struct {
+    const uint8_t* data;
+    int size;
+    int pos;
+} A3_BITS;
+
+static void bits_init(A3_BITS* bits, const uint8_t* data, int size)
+{
+    bits->data = data;
+    bits->size = size;
+    bits->pos = 0;
+}
+
+static bool bits_overrun(const A3_BITS* bits)
+{
+    return bits->pos > bits->size * 8;
+}
+
+// Next n (1..24) bits without consuming them.
+static unsigned int bits_peek(const A3_BITS* bits, int n)
+{
+    int byte = bits->pos >> 3;
+    uint32_t window = 0;
+    for (int i = 0; i < 4; i++) {
+        window <<= 8;
+        if (byte + i < bits->size)
+            window |= bits->data[byte + i];
+    }
+    return (window << (bits->pos & 7)) >> (32 - n);
+}
+
+static unsigned int bits_get(A3_BITS* bits, int n)
+{
+    unsigned int value = bits_peek(bits, n);
+    bits->pos += n;
+    return value;
+}
+
+static int bits_get_signed(A3_BITS* bits, int n)
+{
+    int value = (int)bits_get(bits, n);
+    if (value & (1 << (n - 1)))
+        value -= 1 << n;
+    return value;
+}
+
+static int bits_get_vlc(A3_BITS* bits, int table)
+{
+    const A3_VLC_ENTRY* entry = &g_vlc[table][bits_peek(bits, 8)];
+    bits->pos += entry->length;
+    return entry->symbol;
+}
+
+/*
+ * Spectrum decoding.
+ */
+
+// Reads num_codes quantized values with the given selector. Selector 1 packs
+// two values per code.
+static void read_quant_spectral_coeffs(A3_BITS* bits, int selector, int coding_flag, int* mantissas, int num_codes)
+{
+    if (selector == 1)
+        num_codes /= 2;
+
+    if (coding_flag != 0) {
+        // Constant length codes.
+        int num_bits = clc_length_tab[selector];
+        if (selector > 1) {
+            for (int i = 0; i < num_codes; i++)
+                mantissas[i] = num_bits ? bits_get_signed(bits, num_bits) : 0;
+        } else {
+            for (int i = 0; i < num_codes; i++) {
+                int code = num_bits ? (int)bits_get(bits, num_bits) : 0;
+                mantissas[i * 2] = mantissa_clc_tab[code >> 2];
+                mantissas[i * 2 + 1] = mantissa_clc_tab[code & 3];
+            }
+        }
+    } else {
+        // Huffman codes. Symbols alternate between positive and negative values.
+        if (selector != 1) {
+            for (int i = 0; i < num_codes; i++) {
+                int symbol = bits_get_vlc(bits, selector - 1) + 1;
+                int code = symbol >> 1;
+                mantissas[i] = (symbol & 1) ? -code : code;
+            }
+        } else {
+            for (int i = 0; i < num_codes; i++) {
+                int symbol = bits_get_vlc(bits, 0);
+                mantissas[i * 2] = mantissa_vlc_tab[symbol * 2];
+                mantissas[i * 2 + 1] = mantissa_vlc_tab[symbol * 2 + 1];
+            }
+        }
+    }
+}
+
+// Decodes the subband coded spectrum. Returns the number of spectral lines
+// that may be non-zero.
+static int decode_spectrum(A3_BITS* bits, float* output)
+{
+    int subband_vlc_index[32];
+    int sf_index[32];
+    int mantissas[128];
+
+    int num_subbands = bits_get(bits, 5);   // Last coded subband.
+    int coding_mode = bits_get(bits, 1);    // 0 - VLC, 1 - CLC.
+
+    // Quantizer selector per subband, 0 means not coded.
+    for (int i = 0; i <= num_subbands; i++)
+        subband_vlc_index[i] = bits_get(bits, 3);
+
+    for (int i = 0; i <= num_subbands; i++) {
+        if (subband_vlc_index[i] != 0)
+            sf_index[i] = bits_get(bits, 6);
+    }
+
+    for (int i = 0; i <= num_subbands; i++) {
+        int first = subband_tab[i];
+        int last = subband_tab[i + 1];
+
+        if (subband_vlc_index[i] != 0) {
+            read_quant_spectral_coeffs(bits, subband_vlc_index[i], coding_mode, mantissas, last - first);
+
+            float scale_factor = g_sf_table[sf_index[i]] * inv_max_quant[subband_vlc_index[i]];
+            for (int j = 0; first < last; first++, j++)
+                output[first] = mantissas[j] * scale_factor;
+        } else {
+            memset(output + first, 0, (last - first) * sizeof(float));
+        }
+    }
+
+    int end = subband_tab[num_subbands + 1];
+    memset(output + end, 0, (ATRAC3_SAMPLES_PER_FRAME - end) * sizeof(float));
+    return end;
+}
+
+// Reads the tonal components, short runs of lines coded separately from the
+// spectrum. Returns their number, or -1 for a corrupt unit.
+static int decode_tonal_components(A3_BITS* bits, A3_TONAL* components, int num_bands)
+{
+    int band_flags[4];
+    int mantissa[8];
+    int component_count = 0;
+
+    int nb_components = bits_get(bits, 5);
+    if (nb_components == 0)
+        return 0;
+
+    int coding_mode_selector = bits_get(bits, 2);
+    if (coding_mode_selector == 2)
+        return -1;
+    int coding_mode = coding_mode_selector & 1;
+
+    for (int i = 0; i < nb_components; i++) {
+        for (int b = 0; b <= num_bands; b++)
+            band_flags[b] = bits_get(bits, 1);
+
+        int coded_values_per_component = bits_get(bits, 3);
+
+        int quant_step_index = bits_get(bits, 3);
+        if (quant_step_index <= 1)
+            return -1;
+
+        if (coding_mode_selector == 3)
+            coding_mode = bits_get(bits, 1);
+
+        for (int b = 0; b < (num_bands + 1) * 4; b++) {
+            if (band_flags[b >> 2] == 0)
+                continue;
+
+            int coded_components = bits_get(bits, 3);
+            for (int c = 0; c < coded_components; c++) {
+                if (component_count >= A3_MAX_COMPONENTS)
+                    return -1;
+                A3_TONAL* cmp = &components[component_count];
+
+                int sf_index = bits_get(bits, 6);
+                cmp->pos = b * 64 + bits_get(bits, 6);
+
+                int coded_values = coded_values_per_component + 1;
+                if (coded_values > ATRAC3_SAMPLES_PER_FRAME - cmp->pos)
+                    coded_values = ATRAC3_SAMPLES_PER_FRAME - cmp->pos;
+
+                float scale_factor = g_sf_table[sf_index] * inv_max_quant[quant_step_index];
+                read_quant_spectral_coeffs(bits, quant_step_index, coding_mode, mantissa, coded_values);
+
+                cmp->num_coefs = coded_values;
+                for (int m = 0; m < coded_values; m++)
+                    cmp->coef[m] = mantissa[m] * scale_factor;
+
+                component_count++;
+            }
+        }
+    }
+    return component_count;
+}
+
+// Adds the tonal components to the spectrum. Returns the end of the last one,
+// or -1 if there are none.
+static int add_tonal_components(float* spectrum, int num_components, const A3_TONAL* components)
+{
+    int last_pos = -1;
+    for (int i = 0; i < num_components; i++) {
+        int end = components[i].pos + components[i].num_coefs;
+        if (end > last_pos)
+            last_pos = end;
+        for (int j = 0; j < components[i].num_coefs; j++)
+            spectrum[components[i].pos + j] += components[i].coef[j];
+    }
+    return last_pos;
+}
+
+static int decode_gain_control(A3_BITS* bits, A3_GAIN_BLOCK* block, int num_bands)
+{
+    int b;
+    for (b = 0; b <= num_bands; b++) {
+        A3_GAIN* gain = &block->band[b];
+        gain->num_points = bits_get(bits, 3);
+        for (int j = 0; j < gain->num_points; j++) {
+            gain->lev_code[j] = bits_get(bits, 4);
+            gain->loc_code[j] = bits_get(bits, 5);
+            if (j && gain->loc_code[j] <= gain->loc_code[j - 1])
+                return -1;
+        }
+    }
+
+    // Bands that are not coded have no gain points.
+    for (; b < 4; b++)
+        block->band[b].num_points = 0;
+    return 0;
+}
+
+/*
+ * Synthesis: IMDCT per QMF band, gain control, then the QMF filter bank.
+ */
+
+// 128-point complex FFT in the e^(+i) direction, input in bit-reversed order.
+static void fft128_inverse(float* re, float* im)
+{
+    for (int size = 2; size <= 128; size <<= 1) {
+        int half = size >> 1;
+        int step = 128 / size;
+        for (int start = 0; start < 128; start += size) {
+            for (int j = 0; j < half; j++) {
+                float wr = g_fft_cos[j * step];
+                float wi = g_fft_sin[j * step];
+                int a = start + j;
+                int b = a + half;
+                float tr = re[b] * wr - im[b] * wi;
+                float ti = re[b] * wi + im[b] * wr;
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+}
+
+// Full 512-sample IMDCT of 256 lines through a quarter-size complex FFT.
+static void imdct512(const float* input, float* output)
+{
+    float re[128], im[128];
+
+    // Pre-rotation.
+    for (int k = 0; k < 128; k++) {
+        float in1 = input[2 * k];
+        float in2 = input[255 - 2 * k];
+        int j = g_fft_rev[k];
+        re[j] = in2 * g_tcos[k] - in1 * g_tsin[k];
+        im[j] = in2 * g_tsin[k] + in1 * g_tcos[k];
+    }
+
+    fft128_inverse(re, im);
+
+    // Post-rotation gives the middle half of the output.
+    float* z = output + 128;
+    for (int k = 0; k < 64; k++) {
+        int a = 63 - k;
+        int b = 64 + k;
+        float r0 = im[a] * g_tsin[a] - re[a] * g_tcos[a];
+        float i1 = im[a] * g_tcos[a] + re[a] * g_tsin[a];
+        float r1 = im[b] * g_tsin[b] - re[b] * g_tcos[b];
+        float i0 = im[b] * g_tcos[b] + re[b] * g_tsin[b];
+        z[2 * a] = r0;
+        z[2 * a + 1] = i0;
+        z[2 * b] = r1;
+        z[2 * b + 1] = i1;
+    }
+
+    // The outer quarters follow from the symmetries of the transform.
+    for (int k = 0; k < 128; k++) {
+        output[k] = -output[255 - k];
+        output[511 - k] = output[256 + k];
+    }
+}
+
+static void imlt(float* input, float* output, int odd_band)
+{
+    // Odd bands are stored spectrally inverted by the QMF.
+    if (odd_band) {
+        for (int i = 0; i < 128; i++) {
+            float tmp = input[i];
+            input[i] = input[255 - i];
+            input[255 - i] = tmp;
+        }
+    }
+
+    imdct512(input, output);
+
+    for (int i = 0; i < A3_MDCT_SIZE; i++)
+        output[i] *= g_mdct_window[i];
+}
+
+// Overlap-adds one band and applies the gain control of the frame.
+static void gain_compensation(const float* in, float* prev, const A3_GAIN* gc_now, const A3_GAIN* gc_next, float* out)
+{
+    const int num_samples = A3_BAND_SIZE;
+    float gc_scale = gc_next->num_points ? g_gain_level[gc_next->lev_code[0]] : 1.0f;
+
+    int pos = 0;
+    for (int i = 0; i < gc_now->num_points; i++) {
+        int lastpos = gc_now->loc_code[i] << 3;
+        float lev = g_gain_level[gc_now->lev_code[i]];
+        int next_level = (i + 1 < gc_now->num_points) ? gc_now->lev_code[i + 1] : 4;
+        float gain_inc = g_gain_step[next_level - gc_now->lev_code[i] + 15];
+
+        // Constant gain level up to the point, then ramp over 8 samples.
+        for (; pos < lastpos; pos++)
+            out[pos] = (in[pos] * gc_scale + prev[pos]) * lev;
+        for (; pos < lastpos + 8; pos++) {
+            out[pos] = (in[pos] * gc_scale + prev[pos]) * lev;
+            lev *= gain_inc;
+        }
+    }
+    for (; pos < num_samples; pos++)
+        out[pos] = in[pos] * gc_scale + prev[pos];
+
+    // The second half overlaps with the next frame.
+    memcpy(prev, in + num_samples, num_samples * sizeof(float));
+}
+
+// Merges a low and high band of n samples each into 2n samples.
+static void iqmf(const float* inlo, const float* inhi, int n, float* out, float* delay, float* temp)
+{
+    memcpy(temp, delay, A3_QMF_DELAY * sizeof(float));
+
+    float* p3 = temp + A3_QMF_DELAY;
+    for (int i = 0; i < n; i += 2) {
+        p3[2 * i + 0] = inlo[i] + inhi[i];
+        p3[2 * i + 1] = inlo[i] - inhi[i];
+        p3[2 * i + 2] = inlo[i + 1] + inhi[i + 1];
+        p3[2 * i + 3] = inlo[i + 1] - inhi[i + 1];
+    }
+
+    const float* p1 = temp;
+    for (int j = 0; j < n; j++) {
+        float s1 = 0.0f;
+        float s2 = 0.0f;
+        for (int i = 0; i < 48; i += 2) {
+            s1 += p1[i] * g_qmf_window[i];
+            s2 += p1[i + 1] * g_qmf_window[i + 1];
+        }
+        out[0] = s2;
+        out[1] = s1;
+        p1 += 2;
+        out += 2;
+    }
+
+    memcpy(delay, temp + 2 * n, A3_QMF_DELAY * sizeof(float));
+}
+
+static int decode_channel_sound_unit(A3_BITS* bits, A3_CHANNEL* snd, float* output, bool second_js_unit)
+{
+    A3_GAIN_BLOCK* gain1 = &snd->gain_block[snd->gc_blk_switch];
+    A3_GAIN_BLOCK* gain2 = &snd->gain_block[1 - snd->gc_blk_switch];
+
+    if (second_js_unit) {
+        if (bits_get(bits, 2) != A3_JS_UNIT_ID)
+            return -1;
+    } else {
+        if (bits_get(bits, 6) != A3_UNIT_ID)
+            return -1;
+    }
+
+    // Number of coded QMF bands.
+    snd->bands_coded = bits_get(bits, 2);
+
+    if (decode_gain_control(bits, gain2, snd->bands_coded) != 0)
+        return -1;
+
+    snd->num_components = decode_tonal_components(bits, snd->components, snd->bands_coded);
+    if (snd->num_components < 0)
+        return -1;
+
+    int last_coded = decode_spectrum(bits, snd->spectrum);
+    if (bits_overrun(bits))
+        return -1;
+
+    int last_tonal = add_tonal_components(snd->spectrum, snd->num_components, snd->components);
+    if (last_tonal > last_coded)
+        last_coded = last_tonal;
+
+    // Bands past the last coded line are silent, skip their IMDCT.
+    int num_bands = (last_coded - 1) >> 8;
+    for (int band = 0; band < 4; band++) {
+        if (band <= num_bands)
+            imlt(&snd->spectrum[band * A3_BAND_SIZE], snd->imdct_buf, band & 1);
+        else
+            memset(snd->imdct_buf, 0, sizeof(snd->imdct_buf));
+
+        gain_compensation(snd->imdct_buf, &snd->prev_frame[band * A3_BAND_SIZE],
+                          &gain1->band[band], &gain2->band[band], &output[band * A3_BAND_SIZE]);
+    }
+
+    // This frame's gain points apply to the next frame's overlap.
+    snd->gc_blk_switch ^= 1;
+    return 0;
+}
+
+/*
+ * Joint stereo.
+ */
+static float interpolate(float from, float to, int sample)
+{
+    return from + sample * 0.125f * (to - from);
+}
+
+// Turns the two coupled units back into left and right, band by band, fading
+// over 8 samples when the matrix changes.
+static void reverse_matrixing(float* su1, float* su2, const int* prev_code, const int* curr_code)
+{
+    for (int i = 0, band = 0; band < 4 * A3_BAND_SIZE; band += A3_BAND_SIZE, i++) {
+        int s1 = prev_code[i];
+        int s2 = curr_code[i];
+        int nsample = band;
+
+        if (s1 != s2) {
+            float mc1_l = matrix_coeffs[s1 * 2];
+            float mc1_r = matrix_coeffs[s1 * 2 + 1];
+            float mc2_l = matrix_coeffs[s2 * 2];
+            float mc2_r = matrix_coeffs[s2 * 2 + 1];
+
+            for (; nsample < band + 8; nsample++) {
+                float c1 = su1[nsample];
+                float c2 = su2[nsample];
+                c2 = c1 * interpolate(mc1_l, mc2_l, nsample - band) +
+                     c2 * interpolate(mc1_r, mc2_r, nsample - band);
+                su1[nsample] = c2;
+                su2[nsample] = c1 * 2.0f - c2;
+            }
+        }
+
+        switch (s2) {
+            case 0: // M/S
+                for (; nsample < band + A3_BAND_SIZE; nsample++) {
+                    float c1 = su1[nsample];
+                    float c2 = su2[nsample];
+                    su1[nsample] = c2 * 2.0f;
+                    su2[nsample] = (c1 - c2) * 2.0f;
+                }
+                break;
+            case 1:
+                for (; nsample < band + A3_BAND_SIZE; nsample++) {
+                    float c1 = su1[nsample];
+                    float c2 = su2[nsample];
+                    su1[nsample] = (c1 + c2) * 2.0f;
+                    su2[nsample] = c2 * -2.0f;
+                }
+                break;
+            default:
+                for (; nsample < band + A3_BAND_SIZE; nsample++) {
+                    float c1 = su1[nsample];
+                    float c2 = su2[nsample];
+                    su1[nsample] = c1 + c2;
+                    su2[nsample] = c1 - c2;
+                }
+                break;
+        }
+    }
+}
+
+static void get_channel_weights(int index, int flag, float ch[2])
+{
+    if (index == 7) {
+        ch[0] = 1.0f;
+        ch[1] = 1.0f;
+    } else {
+        ch[0] = (index & 7) / 7.0f;
+        ch[1] = sqrtf(2.0f - ch[0] * ch[0]);
+        if (flag) {
+            float tmp = ch[0];
+            ch[0] = ch[1];
+            ch[1] = tmp;
+        }
+    }
+}
+
+// Applies the left/right weights of the upper three bands, fading from the
+// previous frame's weights over the first 8 samples of each band.
+static void channel_weighting(float* su1, float* su2, const int* p3)
+{
+    if (p3[1] == 7 && p3[3] == 7)
+        return;
+
+    float w[2][2];  // [previous, current][left, right]
+    get_channel_weights(p3[1], p3[0], w[0]);
+    get_channel_weights(p3[3], p3[2], w[1]);
+
+    for (int band = A3_BAND_SIZE; band < 4 * A3_BAND_SIZE; band += A3_BAND_SIZE) {
+        int nsample;
+        for (nsample = band; nsample < band + 8; nsample++) {
+            su1[nsample] *= interpolate(w[0][0], w[1][0], nsample - band);
+            su2[nsample] *= interpolate(w[0][1], w[1][1], nsample - band);
+        }
+        for (; nsample < band + A3_BAND_SIZE; nsample++) {
+            su1[nsample] *= w[1][0];
+            su2[nsample] *= w[1][1];
+        }
+    }
+}
+
+static int decode_joint_stereo(ATRAC3_DECODER* decoder, const uint8_t* frame)
+{
+    A3_BITS bits;
+    int size = decoder->block_align;
+
+    bits_init(&bits, frame, size);
+    if (decode_channel_sound_unit(&bits, &decoder->units[0], decoder->samples[0], false) != 0)
+        return -1;
+
+    // The second unit is stored backwards from the end of the frame, after
+    // some 0xF8 padding.
+    uint8_t* reversed = decoder->reversed;
+    for (int i = 0; i < size; i++)
+        reversed[i] = frame[size - 1 - i];
+
+    int start = 0;
+    while (reversed[start] == A3_JS_SYNC) {
+        if (++start >= size - 4)
+            return -1;
+    }
+    bits_init(&bits, reversed + start, size - start);
+
+    memmove(decoder->weighting_delay, decoder->weighting_delay + 2, 4 * sizeof(int));
+    decoder->weighting_delay[4] = bits_get(&bits, 1);
+    decoder->weighting_delay[5] = bits_get(&bits, 3);
+
+    for (int i = 0; i < 4; i++) {
+        decoder->matrix_coeff_index_prev[i] = decoder->matrix_coeff_index_now[i];
+        decoder->matrix_coeff_index_now[i] = decoder->matrix_coeff_index_next[i];
+        decoder->matrix_coeff_index_next[i] = bits_get(&bits, 2);
+    }
+
+    if (decode_channel_sound_unit(&bits, &decoder->units[1], decoder->samples[1], true) != 0)
+        return -1;
+
+    reverse_matrixing(decoder->samples[0], decoder->samples[1],
+                      decoder->matrix_coeff_index_prev, decoder->matrix_coeff_index_now);
+    channel_weighting(decoder->samples[0], decoder->samples[1], decoder->weighting_delay);
+    return 0;
+}
+
+ATRAC3_DECODER* atrac3_create(int channels, int block_align, bool joint_stereo)
+{
+    if (channels < 1 || channels > ATRAC3_MAX_CHANNELS || block_align <= 0)
+        return NULL;
+    if (joint_stereo && channels != 2)
+        return NULL;
+
+    ATRAC3_DECODER* decoder = (ATRAC3_DECODER*)calloc(1, sizeof(ATRAC3_DECODER));
+    if (decoder == NULL)
+        return NULL;
+    decoder->reversed = (uint8_t*)malloc(block_align);
+    if (decoder->reversed == NULL) {
+        free(decoder);
+        return NULL;
+    }
+
+    decoder->channels = channels;
+    decoder->block_align = block_align;
+    decoder->joint_stereo = joint_stereo;
+
+    // Start out with plain L/R coupling and no weighting.
+    for (int i = 0; i < 6; i += 2) {
+        decoder->weighting_delay[i] = 0;
+        decoder->weighting_delay[i + 1] = 7;
+    }
+    for (int i = 0; i < 4; i++) {
+        decoder->matrix_coeff_index_prev[i] = 3;
+        decoder->matrix_coeff_index_now[i] = 3;
+        decoder->matrix_coeff_index_next[i] = 3;
+    }
+    return decoder;
+}
+
+void atrac3_destroy(ATRAC3_DECODER* decoder)
+{
+    if (decoder == NULL)
+        return;
+    free(decoder->reversed);
+    free(decoder);
+}
+
+int atrac3_decode_frame(ATRAC3_DECODER* decoder, const uint8_t* frame, int16_t* pcm)
+{
+    int result = 0;
+
+    if (decoder->joint_stereo) {
+        result = decode_joint_stereo(decoder, frame);
+    } else {
+        // One sound unit per channel, each in its own share of the frame.
+        int unit_size = decoder->block_align / decoder->channels;
+        for (int ch = 0; ch < decoder->channels && result == 0; ch++) {
+            A3_BITS bits;
+            bits_init(&bits, frame + ch * unit_size, unit_size);
+            result = decode_channel_sound_unit(&bits, &decoder->units[ch], decoder->samples[ch], false);
+        }
+    }
+
+    if (result != 0) {
+        memset(pcm, 0, ATRAC3_SAMPLES_PER_FRAME * decoder->channels * sizeof(int16_t));
+        return -1;
+    }
+
+    // Three QMF stages merge the four bands of each channel.
+    for (int ch = 0; ch < decoder->channels; ch++) {
+        A3_CHANNEL* unit = &decoder->units[ch];
+        float* p1 = decoder->samples[ch];
+        float* p2 = p1 + A3_BAND_SIZE;
+        float* p3 = p2 + A3_BAND_SIZE;
+        float* p4 = p3 + A3_BAND_SIZE;
+        iqmf(p1, p2, A3_BAND_SIZE, p1, unit->delay_buf1, decoder->qmf_temp);
+        iqmf(p4, p3, A3_BAND_SIZE, p3, unit->delay_buf2, decoder->qmf_temp);
+        iqmf(p1, p3, 2 * A3_BAND_SIZE, p1, unit->delay_buf3, decoder->qmf_temp);
+    }
+
+    for (int i = 0; i < ATRAC3_SAMPLES_PER_FRAME; i++) {
+        for (int ch = 0; ch < decoder->channels; ch++) {
+            long sample = lrintf(decoder->samples[ch][i]);
+            if (sample > 32767)
+                sample = 32767;
+            else if (sample < -32768)
+                sample = -32768;
+            pcm[i * decoder->channels + ch] = (int16_t)sample;
+        }
+    }
+    return 0;
+}
+
+/*
+ * RIFF container.
+ */
+static uint16_t read_le16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t read_le32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int atrac3_read_header(FILE* file, ATRAC3_FORMAT* format)
+{
+    memset(format, 0, sizeof(ATRAC3_FORMAT));
+
+    uint8_t riff[12];
+    if (fread(riff, 1, 12, file) != 12 || memcmp(riff, "RIFF", 4) || memcmp(riff + 8, "WAVE", 4))
+        return -1;
+
+    bool have_fmt = false;
+    uint8_t chunk[8];
+    while (fread(chunk, 1, 8, file) == 8) {
+        uint32_t chunk_size = read_le32(chunk + 4);
+
+        if (memcmp(chunk, "fmt ", 4) == 0 && !have_fmt) {
+            // WAVEFORMATEX followed by 14 bytes of codec data.
+            uint8_t fmt[32];
+            if (chunk_size < sizeof(fmt) || fread(fmt, 1, sizeof(fmt), file) != sizeof(fmt))
+                return -1;
+            if (read_le16(fmt) != WAVE_FORMAT_SONY_SCX || read_le16(fmt + 16) != 14)
+                return -1;
+            format->channels = read_le16(fmt + 2);
+            format->sample_rate = (int)read_le32(fmt + 4);
+            format->block_align = read_le16(fmt + 12);
+            format->joint_stereo = read_le16(fmt + 18 + 6) != 0;   // Coding mode.
+            have_fmt = true;
+            if (fseek(file, chunk_size - sizeof(fmt), SEEK_CUR) != 0)
+                return -1;
+        } else if (memcmp(chunk, "fact", 4) == 0 && chunk_size >= 4) {
+            uint8_t fact[4];
+            if (fread(fact, 1, 4, file) != 4)
+                return -1;
+            format->total_samples = read_le32(fact);
+            if (fseek(file, chunk_size - 4, SEEK_CUR) != 0)
+                return -1;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!have_fmt || format->channels < 1 || format->channels > ATRAC3_MAX_CHANNELS || format->block_align <= 0)
+                return -1;
+            if (format->joint_stereo && format->channels != 2)
+                return -1;
+            format->data_size = chunk_size;
+            return 0;
+        } else {
+            if (fseek(file, chunk_size, SEEK_CUR) != 0)
+                return -1;
+        }
+    }
+    return -1;
+}
+
+// Decodes the frames that next_frame hands out, until it runs out (NULL).
+typedef const uint8_t* (*FRAME_SOURCE)(void* src, uint32_t index);
+
+// Returns 0 once all frames are decoded, 1 if the sink stopped early or -1.
+static int decode_frames(ATRAC3_DECODER* decoder, FRAME_SOURCE next_frame, void* src, uint32_t frames, PCM_SINK sink, void* ctx, int* bad_frames)
+{
+    int16_t pcm[ATRAC3_SAMPLES_PER_FRAME * ATRAC3_MAX_CHANNELS];
+    for (uint32_t i = 0; i < frames; i++) {
+        const uint8_t* frame = next_frame(src, i);
+        if (frame == NULL)
+            return -1;
+        if (atrac3_decode_frame(decoder, frame, pcm) != 0)
+            ++*bad_frames;
+
+        int status = sink(ctx, pcm, ATRAC3_SAMPLES_PER_FRAME);
+        if (status != 0)
+            return (status < 0) ? -1 : 1;
+    }
+    return 0;
+}
+
+typedef struct {
+    FILE* file;
+    uint8_t* frame;
+    int block_align;
+} FILE_FRAMES;
+
+static const uint8_t* next_file_frame(void* src, uint32_t index)
+{
+    FILE_FRAMES* frames = (FILE_FRAMES*)src;
+    if (fread(frames->frame, 1, frames->block_align, frames->file) != (size_t)frames->block_align)
+        return NULL;
+    return frames->frame;
+}
+
+int atrac3_decode_stream(FILE* file, const ATRAC3_FORMAT* format, PCM_SINK sink, void* ctx, int* bad_frames)
+{
+    *bad_frames = 0;
+    ATRAC3_DECODER* decoder = atrac3_create(format->channels, format->block_align, format->joint_stereo);
+    FILE_FRAMES frames;
+    frames.file = file;
+    frames.block_align = format->block_align;
+    frames.frame = (uint8_t*)malloc(format->block_align);
+
+    int result = -1;
+    if (decoder != NULL && frames.frame != NULL)
+        result = decode_frames(decoder, next_file_frame, &frames, format->data_size / format->block_align, sink, ctx, bad_frames);
+
+    free(frames.frame);
+    atrac3_destroy(decoder);
+    return (result < 0) ? -1 : 0;
+}
+
+typedef struct {
+    const uint8_t* data;
+    int block_align;
+} MEMORY_FRAMES;
+
+static const uint8_t* next_memory_frame(void* src, uint32_t index)
+{
+    MEMORY_FRAMES* frames = (MEMORY_FRAMES*)src;
+    return frames->data + (size_t)index * frames->block_align;
+}
+
+int atrac3_decode_window(ATRAC3_DECODER* decoder, const uint8_t* data, uint32_t size, PCM_SINK sink, void* ctx, int* bad_frames)
+{
+    MEMORY_FRAMES frames;
+    frames.data = data;
+    frames.block_align = decoder->block_align;
+    return decode_frames(decoder, next_memory_frame, &frames, size / decoder->block_align, sink, ctx, bad_frames);
+}
+
+// Runs before main(), so decoders on any thread only ever read the tables.
+static struct Atrac3Init {
+    Atrac3Init()
+    {
+        for (int t = 0; t < 7; t++) {
+            for (int s = 0; s < huff_sizes[t]; s++) {
+                int length = huff_bits[t][s];
+                int first = huff_codes[t][s] << (8 - length);
+                for (int i = 0; i < (1 << (8 - length)); i++) {
+                    g_vlc[t][first + i].symbol = (uint8_t)s;
+                    g_vlc[t][first + i].length = (uint8_t)length;
+                }
+            }
+        }
+
+        for (int i = 0; i < 64; i++)
+            g_sf_table[i] = (float)pow(2.0, (i - 15) / 3.0);
+
+        for (int i = 0; i < 24; i++) {
+            g_qmf_window[i] = qmf_48tap_half[i] * 2.0f;
+            g_qmf_window[47 - i] = qmf_48tap_half[i] * 2.0f;
+        }
+
+        // Synthesis window matching the encoder's sine analysis window.
+        for (int i = 0, j = 255; i < 128; i++, j--) {
+            double wi = sin(((i + 0.5) / 256.0 - 0.5) * M_PI) + 1.0;
+            double wj = sin(((j + 0.5) / 256.0 - 0.5) * M_PI) + 1.0;
+            double w = 0.5 * (wi * wi + wj * wj);
+            g_mdct_window[i] = g_mdct_window[511 - i] = (float)(wi / w);
+            g_mdct_window[j] = g_mdct_window[511 - j] = (float)(wj / w);
+        }
+
+        for (int i = 0; i < A3_MDCT_SIZE / 4; i++) {
+            double alpha = 2.0 * M_PI * (i + 0.125) / A3_MDCT_SIZE;
+            g_tcos[i] = (float)-cos(alpha);
+            g_tsin[i] = (float)-sin(alpha);
+        }
+        for (int i = 0; i < A3_MDCT_SIZE / 8; i++) {
+            g_fft_cos[i] = (float)cos(2.0 * M_PI * i / 128.0);
+            g_fft_sin[i] = (float)sin(2.0 * M_PI * i / 128.0);
+        }
+        for (int i = 0; i < 128; i++) {
+            int rev = 0;
+            for (int bit = 0; bit < 7; bit++) {
+                if (i & (1 << bit))
+                    rev |= 1 << (6 - bit);
+            }
+            g_fft_rev[i] = (uint8_t)rev;
+        }
+
+        for (int i = 0; i < 16; i++)
+            g_gain_level[i] = (float)pow(2.0, 4 - i);
+        for (int i = -15; i < 16; i++)
+            g_gain_step[i + 15] = (float)pow(2.0, -i / 8.0);
+    }
+} g_atrac3_init;
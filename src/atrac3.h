@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Native ATRAC3 decoder for the CDDA tracks of PSOne Classics.
+//
+// Every frame of block_align bytes decodes to ATRAC3_SAMPLES_PER_FRAME 16-bit
+// samples per channel. Frames depend on the previous ones (overlap, filter
+// bank and gain control state), so a track is decoded in order by a single
+// decoder. Decoders share nothing but read-only tables, so separate tracks can
+// be decoded on separate threads.
+
+#define ATRAC3_SAMPLES_PER_FRAME 1024
+#define ATRAC3_MAX_CHANNELS      2
+
+typedef struct ATRAC3_DECODER ATRAC3_DECODER;
+
+// joint_stereo selects the coupled stereo layout (second sound unit stored
+// byte-reversed at the end of the frame) instead of one unit per channel.
+ATRAC3_DECODER* atrac3_create(int channels, int block_align, bool joint_stereo);
+void atrac3_destroy(ATRAC3_DECODER* decoder);
+
+// Decodes one frame into interleaved samples. Returns 0 on success or -1 if
+// the frame is corrupt, in which case pcm holds silence.
+int atrac3_decode_frame(ATRAC3_DECODER* decoder, const uint8_t* frame, int16_t* pcm);
+
+// Layout of an ATRAC3 RIFF file (WAVE_FORMAT_SONY_SCX, see fill_at3_header).
+typedef struct {
+    int channels;
+    int sample_rate;
+    int block_align;
+    bool joint_stereo;
+    uint32_t data_size;         // Bytes of frame data.
+    uint32_t total_samples;     // Samples per channel from the fact chunk (0 if absent).
+} ATRAC3_FORMAT;
+
+// Parses the RIFF headers and leaves the file at the start of the frame data.
+// Returns 0 on success, -1 if the file is not ATRAC3.
+int atrac3_read_header(FILE* file, ATRAC3_FORMAT* format);
+
+// Receives decoded audio as interleaved 16-bit samples, `frames` samples per
+// channel at a time. Returns 0 to keep going, a positive value to stop early
+// (the sink has all it needs) or a negative value on errors.
+typedef int (*PCM_SINK)(void* ctx, const int16_t* samples, int frames);
+
+// Decodes the frame data that follows atrac3_read_header into the sink, one
+// frame at a time. Corrupt frames come out as silence so the track keeps its
+// length; their number is stored in bad_frames. Returns 0 on success, -1 on
+// read or sink errors.
+int atrac3_decode_stream(FILE* file, const ATRAC3_FORMAT* format, PCM_SINK sink, void* ctx, int* bad_frames);
+
+// Decodes the whole frames in size bytes of frame data with a decoder from
+// atrac3_create. The decoder carries its state over from the previous call, so
+// a track can be fed through a fixed-size buffer window by window. Corrupt
+// frames are added to bad_frames. Returns 0 when all frames were decoded, 1 if
+// the sink stopped early, -1 on sink errors.
+int atrac3_decode_window(ATRAC3_DECODER* decoder, const uint8_t* data, uint32_t size, PCM_SINK sink, void* ctx, int* bad_frames);
@@ -0,0 +1,468 @@
+#include "batch.h"
+#include "crypto.h"
+#include "parallel.h"
+#include "gui.h"
+#include <shlwapi.h>
+
+extern int psxtract_main(const char* pbp_file, const char* document_file, const char* keys_file, bool cleanup, bool verbose);
+
+// Output titles a job may claim, one per disc is plenty.
+#define BATCH_MAX_CLAIMS 8
+
+// Budget a job should find free before it starts: the windows of its EBOOT
+// it maps, a data track window and a few audio tracks.
+#define BATCH_JOB_MEMORY ((long long)READER_WINDOWS * READER_WINDOW_SIZE + 64LL * 1024 * 1024)
+
+#define MB(bytes) ((bytes) / (1024 * 1024))
+
+struct BATCH_RUN;
+
+// A running job, reachable from every thread that works for it through
+// parallel_get_job().
+typedef struct {
+    BATCH_JOB* job;
+    struct BATCH_RUN* run;
+    FILE* log;
+    bool echo;
+    char claims[BATCH_MAX_CLAIMS][MAX_PATH];
+    int claim_count;
+    char waiting_for[MAX_PATH]; // Title claimed by another job it waits for.
+    long long reserved;         // Memory budget held by the job's stages.
+} JOB_STATE;
+
+typedef struct BATCH_RUN {
+    BATCH_JOB* jobs;
+    int count;
+    const BATCH_OPTIONS* options;
+    bool echo;
+    JOB_STATE** running;        // Per job, NULL unless it is running.
+    volatile LONG started;      // Jobs started so far, numbers their priority.
+    CRITICAL_SECTION lock;      // Guards running and the claims.
+    CONDITION_VARIABLE released; // Signalled when a job ends and drops its claims.
+} BATCH_RUN;
+
+// Memory budget of the running batch, shared by all of its jobs.
+static struct {
+    long long limit;            // 0 for no limit.
+    long long in_use;
+    long long peak;
+    long waits;
+    bool initialized;
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE freed;
+} g_memory;
+
+static JOB_STATE* current_job()
+{
+    return (JOB_STATE*)parallel_get_job();
+}
+
+const char* batch_temp_dir()
+{
+    JOB_STATE* state = current_job();
+    return (state != NULL) ? state->job->temp_dir : "TEMP";
+}
+
+void batch_temp_path(const char* name, char* path, int size)
+{
+    snprintf(path, size, "%s\\%s", batch_temp_dir(), name);
+}
+
+bool batch_cancelled()
+{
+    JOB_STATE* state = current_job();
+    if (state == NULL || state->run->options->cancel == NULL)
+        return false;
+    return *state->run->options->cancel != 0;
+}
+
+// Returns the job other than state that claimed title, or NULL.
+static JOB_STATE* claim_owner(BATCH_RUN* run, JOB_STATE* state, const char* title)
+{
+    for (int i = 0; i < run->count; i++) {
+        JOB_STATE* other = run->running[i];
+        if (other == NULL || other == state)
+            continue;
+        for (int j = 0; j < other->claim_count; j++) {
+            if (!_stricmp(other->claims[j], title))
+                return other;
+        }
+    }
+    return NULL;
+}
+
+// True if owner waits, directly or through other jobs, for a title of state.
+static bool claim_deadlock(BATCH_RUN* run, JOB_STATE* state, JOB_STATE* owner)
+{
+    for (int steps = 0; owner != NULL && steps < run->count; steps++) {
+        if (owner->waiting_for[0] == 0)
+            return false;
+        owner = claim_owner(run, owner, owner->waiting_for);
+        if (owner == state)
+            return true;
+    }
+    return false;
+}
+
+bool batch_claim_output(const char* title)
+{
+    JOB_STATE* state = current_job();
+    if (state == NULL)
+        return true;
+
+    BATCH_RUN* run = state->run;
+    bool claimed = true;
+    bool waited = false;
+    EnterCriticalSection(&run->lock);
+    for (;;) {
+        JOB_STATE* owner = claim_owner(run, state, title);
+        if (owner == NULL)
+            break;
+        if (claim_deadlock(run, state, owner)) {
+            printf("ERROR: %s.bin/.cue is being written by another EBOOT of this batch, which waits for this one.\n", title);
+            claimed = false;
+            break;
+        }
+        if (run->options->cancel != NULL && *run->options->cancel != 0) {
+            claimed = false;
+            break;
+        }
+        if (!waited) {
+            printf("Waiting for another EBOOT of this batch to finish writing %s.bin/.cue...\n", title);
+            strncpy(state->waiting_for, title, MAX_PATH - 1);
+            state->waiting_for[MAX_PATH - 1] = 0;
+            waited = true;
+        }
+        // Wake up now and then to notice a cancellation.
+        SleepConditionVariableCS(&run->released, &run->lock, 500);
+    }
+    state->waiting_for[0] = 0;
+    if (claimed && state->claim_count < BATCH_MAX_CLAIMS) {
+        strncpy(state->claims[state->claim_count], title, MAX_PATH - 1);
+        state->claims[state->claim_count][MAX_PATH - 1] = 0;
+        state->claim_count++;
+    }
+    LeaveCriticalSection(&run->lock);
+    return claimed;
+}
+
+bool batch_log(const char* text)
+{
+    JOB_STATE* state = current_job();
+    if (state == NULL || state->log == NULL)
+        return false;
+    fputs(text, state->log);
+    fflush(state->log);
+    return !state->echo;
+}
+
+// Waits until bytes fit into the budget and takes them for state if take is
+// set. Whatever is asked fits once nothing else is held, so a stage larger
+// than the budget runs on its own rather than never.
+static bool wait_for_memory(JOB_STATE* state, const char* stage, long long bytes, bool take)
+{
+    bool waited = false;
+    bool granted = true;
+    EnterCriticalSection(&g_memory.lock);
+    while (g_memory.in_use > 0 && g_memory.in_use + bytes > g_memory.limit) {
+        if (state->run->options->cancel != NULL && *state->run->options->cancel != 0) {
+            granted = false;
+            break;
+        }
+        if (!waited) {
+            printf("Waiting for %lld MB of memory for %s (%lld of %lld MB in use)...\n",
+                   MB(bytes), stage, MB(g_memory.in_use), MB(g_memory.limit));
+            g_memory.waits++;
+            waited = true;
+        }
+        // Wake up now and then to notice a cancellation.
+        SleepConditionVariableCS(&g_memory.freed, &g_memory.lock, 500);
+    }
+    if (granted && take) {
+        g_memory.in_use += bytes;
+        state->reserved += bytes;
+        if (g_memory.in_use > g_memory.peak)
+            g_memory.peak = g_memory.in_use;
+    }
+    LeaveCriticalSection(&g_memory.lock);
+    return granted;
+}
+
+bool batch_reserve_memory(const char* stage, long long bytes)
+{
+    JOB_STATE* state = current_job();
+    if (state == NULL || g_memory.limit <= 0 || bytes <= 0)
+        return true;
+    return wait_for_memory(state, stage, bytes, true);
+}
+
+void batch_release_memory(long long bytes)
+{
+    JOB_STATE* state = current_job();
+    if (state == NULL || g_memory.limit <= 0 || bytes <= 0)
+        return;
+    EnterCriticalSection(&g_memory.lock);
+    g_memory.in_use -= bytes;
+    state->reserved -= bytes;
+    WakeAllConditionVariable(&g_memory.freed);
+    LeaveCriticalSection(&g_memory.lock);
+}
+
+static void add_path(PATH_LIST* list, const wchar_t* wpath)
+{
+    int len = WideCharToMultiByte(CP_UTF8, 0, wpath, -1, NULL, 0, NULL, NULL);
+    char* path = (char*)malloc(len);
+    if (path == NULL)
+        return;
+    WideCharToMultiByte(CP_UTF8, 0, wpath, -1, path, len, NULL, NULL);
+
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        char** paths = (char**)realloc(list->paths, capacity * sizeof(char*));
+        if (paths == NULL) {
+            free(path);
+            return;
+        }
+        list->paths = paths;
+        list->capacity = capacity;
+    }
+    list->paths[list->count++] = path;
+}
+
+// Adds every *.PBP below dir, depth first.
+static void collect_eboots(const wchar_t* dir, PATH_LIST* list)
+{
+    wchar_t pattern[MAX_PATH];
+    if (_snwprintf(pattern, MAX_PATH, L"%ls\\*", dir) < 0)
+        return;
+
+    WIN32_FIND_DATAW find;
+    HANDLE handle = FindFirstFileW(pattern, &find);
+    if (handle == INVALID_HANDLE_VALUE)
+        return;
+    do {
+        if (!wcscmp(find.cFileName, L".") || !wcscmp(find.cFileName, L".."))
+            continue;
+        wchar_t path[MAX_PATH];
+        if (_snwprintf(path, MAX_PATH, L"%ls\\%ls", dir, find.cFileName) < 0)
+            continue;
+        if (find.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            collect_eboots(path, list);
+        else if (!_wcsicmp(PathFindExtensionW(find.cFileName), L".PBP"))
+            add_path(list, path);
+    } while (FindNextFileW(handle, &find));
+    FindClose(handle);
+}
+
+void batch_add_eboots(PATH_LIST* list, const char* path)
+{
+    int wlen = MultiByteToWideChar(CP_UTF8, 0, path, -1, NULL, 0);
+    wchar_t* wpath = (wchar_t*)malloc(wlen * sizeof(wchar_t));
+    if (wpath == NULL)
+        return;
+    MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, wlen);
+
+    DWORD attributes = GetFileAttributesW(wpath);
+    if (attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY))
+        collect_eboots(wpath, list);
+    else
+        add_path(list, wpath);
+    free(wpath);
+}
+
+void batch_free_paths(PATH_LIST* list)
+{
+    for (int i = 0; i < list->count; i++)
+        free(list->paths[i]);
+    free(list->paths);
+    list->paths = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+static void notify(BATCH_RUN* run, int index)
+{
+    if (run->options->notify != NULL)
+        run->options->notify(run->options->notify_ctx, index, &run->jobs[index]);
+}
+
+static int batch_worker(void* ctx, int index)
+{
+    BATCH_RUN* run = (BATCH_RUN*)ctx;
+    BATCH_JOB* job = &run->jobs[index];
+    const BATCH_OPTIONS* options = run->options;
+
+    if (options->cancel != NULL && *options->cancel != 0) {
+        job->status = BATCH_CANCELLED;
+        job->exit_code = -2;
+        notify(run, index);
+        return 0;
+    }
+
+    JOB_STATE state;
+    memset(&state, 0, sizeof(state));
+    state.job = job;
+    state.run = run;
+    state.echo = run->echo;
+
+    // Don't start while the jobs in flight hold most of the memory budget.
+    if (g_memory.limit > 0 && !wait_for_memory(&state, "the next EBOOT", BATCH_JOB_MEMORY, false)) {
+        job->status = BATCH_CANCELLED;
+        job->exit_code = -2;
+        notify(run, index);
+        return 0;
+    }
+    if (job->log_path[0] != 0) {
+        state.log = fopen(job->log_path, "w");
+        if (state.log == NULL)
+            job->log_path[0] = 0;
+    }
+
+    EnterCriticalSection(&run->lock);
+    run->running[index] = &state;
+    LeaveCriticalSection(&run->lock);
+
+    job->status = BATCH_RUNNING;
+    notify(run, index);
+
+    // Jobs that started earlier get their work done first.
+    void* outer = parallel_get_job();
+    int outer_priority = parallel_get_priority();
+    parallel_set_job(&state);
+    parallel_set_priority((int)InterlockedIncrement(&run->started));
+    DWORD start = GetTickCount();
+    job->exit_code = psxtract_main(job->pbp_file, job->document_file, job->keys_file, options->cleanup, options->verbose);
+    job->milliseconds = GetTickCount() - start;
+    bool cancelled = batch_cancelled();
+    parallel_set_job(outer);
+    parallel_set_priority(outer_priority);
+
+    EnterCriticalSection(&run->lock);
+    run->running[index] = NULL;
+    WakeAllConditionVariable(&run->released);
+    LeaveCriticalSection(&run->lock);
+
+    // Whatever a failed stage did not give back.
+    if (state.reserved != 0) {
+        EnterCriticalSection(&g_memory.lock);
+        g_memory.in_use -= state.reserved;
+        WakeAllConditionVariable(&g_memory.freed);
+        LeaveCriticalSection(&g_memory.lock);
+    }
+    if (state.log != NULL)
+        fclose(state.log);
+
+    if (job->exit_code == 0)
+        job->status = BATCH_SUCCEEDED;
+    else if (cancelled)
+        job->status = BATCH_CANCELLED;
+    else if (job->exit_code == -2)
+        job->status = BATCH_SKIPPED;
+    else
+        job->status = BATCH_FAILED;
+    notify(run, index);
+    return 0;
+}
+
+// <EBOOT name>.log, or <EBOOT name>_<n>.log if another job of the batch has
+// an EBOOT of the same name (every game folder holds an EBOOT.PBP).
+static void log_name(BATCH_JOB* jobs, int count, int index, char* name, int size)
+{
+    char base[MAX_PATH];
+    strncpy(base, PathFindFileNameA(jobs[index].pbp_file), MAX_PATH - 1);
+    base[MAX_PATH - 1] = 0;
+    PathRemoveExtensionA(base);
+
+    for (int i = 0; i < count; i++) {
+        if (i != index && !_stricmp(PathFindFileNameA(jobs[i].pbp_file), PathFindFileNameA(jobs[index].pbp_file))) {
+            snprintf(name, size, "%s_%d.log", base, index + 1);
+            return;
+        }
+    }
+    snprintf(name, size, "%s.log", base);
+}
+
+int batch_run(BATCH_JOB* jobs, int count, const BATCH_OPTIONS* options)
+{
+    if (count <= 0)
+        return 0;
+
+    set_output_directory(options->output_dir);
+
+    // Start KIRK, once for every job.
+    kirk_init();
+
+    if (!g_memory.initialized) {
+        InitializeCriticalSection(&g_memory.lock);
+        InitializeConditionVariable(&g_memory.freed);
+        g_memory.initialized = true;
+    }
+    g_memory.limit = options->max_memory;
+    g_memory.in_use = 0;
+    g_memory.peak = 0;
+    g_memory.waits = 0;
+
+    for (int i = 0; i < count; i++) {
+        BATCH_JOB* job = &jobs[i];
+        char name[MAX_PATH];
+        job->status = BATCH_PENDING;
+        job->exit_code = 0;
+        job->milliseconds = 0;
+
+        if (count > 1)
+            snprintf(name, sizeof(name), "TEMP_%d", i + 1);
+        else
+            strcpy(name, "TEMP");
+        if (build_output_path(name, job->temp_dir, MAX_PATH) != 0)
+            strcpy(job->temp_dir, name);
+
+        job->log_path[0] = 0;
+        if (options->log_files) {
+            log_name(jobs, count, i, name, sizeof(name));
+            if (build_output_path(name, job->log_path, MAX_PATH) != 0)
+                job->log_path[0] = 0;
+        }
+    }
+
+    BATCH_RUN run;
+    run.jobs = jobs;
+    run.count = count;
+    run.options = options;
+    int concurrency = options->concurrency;
+    if (concurrency < 1)
+        concurrency = 1;
+    if (concurrency > count)
+        concurrency = count;
+    run.echo = options->echo && concurrency == 1;
+    run.started = 0;
+    run.running = (JOB_STATE**)calloc(count, sizeof(JOB_STATE*));
+    if (run.running == NULL) {
+        printf("ERROR: Failed to allocate memory for %d jobs\n", count);
+        return count;
+    }
+    InitializeCriticalSection(&run.lock);
+    InitializeConditionVariable(&run.released);
+
+    run_pool(count, concurrency, batch_worker, &run);
+
+    DeleteCriticalSection(&run.lock);
+    free(run.running);
+    g_memory.limit = 0;
+
+    if (options->verbose) {
+        PARALLEL_STATS stats;
+        parallel_get_stats(&stats);
+        printf("Thread pool: %d threads, %ld helpers run (%ld stolen), %ld withdrawn, peak queue depth %ld\n",
+               stats.threads + 1, stats.executed, stats.stolen, stats.revoked, stats.peak_queued);
+        if (options->max_memory > 0)
+            printf("Memory budget: %lld MB, at most %lld MB in use, %ld waits\n",
+                   MB(options->max_memory), MB(g_memory.peak), g_memory.waits);
+    }
+
+    int failures = 0;
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].status == BATCH_FAILED)
+            failures++;
+    }
+    return failures;
+}
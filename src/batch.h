@@ -0,0 +1,100 @@
+#pragma once
+
+#include <windows.h>
+
+// In-process batch extraction, used by the GUI and by psxtract -j.
+//
+// Every EBOOT is a job that runs psxtract_main on a worker thread of this
+// process, so KIRK, the ATRAC3 codec and the embedded CUE files are set up
+// once per batch instead of once per EBOOT, and several EBOOTs can be
+// extracted at the same time. Jobs share the output folder and nothing else:
+// each one works in its own TEMP directory, may log to its own file, and the
+// worker threads it starts (see parallel.h) work for it too.
+
+typedef enum {
+    BATCH_PENDING,
+    BATCH_RUNNING,
+    BATCH_SUCCEEDED,
+    BATCH_SKIPPED,      // The user declined a prompt (psxtract_main returned -2).
+    BATCH_FAILED,
+    BATCH_CANCELLED,    // The batch was cancelled before or while the job ran.
+} BATCH_STATUS;
+
+typedef struct {
+    // Filled in by the caller.
+    const char* pbp_file;
+    const char* document_file;  // NULL for none.
+    const char* keys_file;      // NULL for none.
+
+    // Filled in by batch_run.
+    BATCH_STATUS status;
+    int exit_code;              // psxtract_main's return value.
+    DWORD milliseconds;
+    char temp_dir[MAX_PATH];    // TEMP, or TEMP_<n> when the batch has several jobs.
+    char log_path[MAX_PATH];    // Empty when the job's output was not logged.
+} BATCH_JOB;
+
+// Called on the job's worker thread when it starts and when it is done.
+typedef void (*BATCH_NOTIFY_FN)(void* ctx, int index, const BATCH_JOB* job);
+
+typedef struct {
+    int concurrency;            // Jobs run at the same time; they share the thread pool.
+    bool cleanup;               // Remove each job's TEMP directory afterwards.
+    bool verbose;
+    bool log_files;             // Write each job's output to <EBOOT name>.log in the output folder.
+    bool echo;                  // Also print it as usual, when only one job runs at a time.
+    const char* output_dir;     // NULL for the working directory.
+    long long max_memory;       // Bytes the jobs' large buffers may take together, 0 for no limit.
+    volatile LONG* cancel;      // Set to non-zero to cancel; NULL if the batch can't be.
+    BATCH_NOTIFY_FN notify;     // NULL for none.
+    void* notify_ctx;
+} BATCH_OPTIONS;
+
+// UTF-8 paths of EBOOTs, for the batch and for --inspect.
+typedef struct {
+    char** paths;
+    int count;
+    int capacity;
+} PATH_LIST;
+
+// Adds path, or every *.PBP below it (depth first) when it is a folder.
+void batch_add_eboots(PATH_LIST* list, const char* path);
+void batch_free_paths(PATH_LIST* list);
+
+// Runs every job and fills in its results. Returns the number that failed.
+int batch_run(BATCH_JOB* jobs, int count, const BATCH_OPTIONS* options);
+
+// The functions below are for the extraction code and refer to the job the
+// calling thread works for. Outside of a batch they fall back to TEMP in the
+// working directory, never report a cancellation and grant every claim.
+
+// TEMP directory of the job.
+const char* batch_temp_dir();
+
+// Path of name inside the job's TEMP directory.
+void batch_temp_path(const char* name, char* path, int size);
+
+// True once the batch was cancelled. Long-running steps check this and bail
+// out as if they had failed.
+bool batch_cancelled();
+
+// Reserves the output files named after title (title.bin/title.cue) for the
+// job until it ends. While another job of the batch has them, waits until
+// that job ends. Returns false if the batch was cancelled meanwhile, or if
+// the other job in turn waits for output this job has claimed.
+bool batch_claim_output(const char* title);
+
+// Takes bytes of the batch's memory budget for a stage of the job (stage
+// names it in the log), waiting while other jobs hold too much of it. A
+// stage larger than the whole budget waits until it is the only one. Returns
+// false, having taken nothing, if the batch was cancelled meanwhile. A stage
+// gives its memory back with batch_release_memory before it takes more.
+// Other stages of the same job (discs or tracks running side by side) may
+// hold memory while one waits, but they always run to the end and release
+// it, so waiting cannot deadlock.
+bool batch_reserve_memory(const char* stage, long long bytes);
+void batch_release_memory(long long bytes);
+
+// Sends text to the job's log file. Returns false if it should also be
+// printed as usual.
+bool batch_log(const char* text);
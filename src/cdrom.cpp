@@ -7,548 +7,657 @@
 // You may redistribute this program in unaltered form as you deem fit.
 
 #include "cdrom.h"
+#include <stdint.h>
+#include "edc.h"
+#include "ecc.h"
+#include "parallel.h"
+#include "reader.h"
 #include "gui.h"
 
 
-struct fixImageStatus fixImage(char* inputfilepath, char* outputfilepath, int num_sectors, enum EDCMode form2EDCMode, bool verbose)
+//Sync pattern
+static const unsigned char sync[SYNC_SIZE] = {0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00};
+
+//Converts a binary value (0-99) to BCD
+static unsigned char toBCD(int value)
 {
-    //Initialize return value struct
-    struct fixImageStatus status;
-    status.errorcode                  = 0;
-    status.mode0sectors               = 0;
-    status.mode1sectors               = 0;
-    status.mode2form1sectors          = 0;
-    status.mode2form2sectors          = 0;
-    status.form2bootsectorswithedc    = 0;
-    status.form2bootsectorswithoutedc = 0;
-    status.warnings                   = NULL;
-    status.warningscount              = 0;
-
-    //Sync pattern
-    unsigned char sync[SYNC_SIZE] = {0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00};
+    return (unsigned char)(((value / 10) << 4) | (value % 10));
+}
 
-    //Open the input file
-    FILE* inputfile;
-    inputfile = fopen(inputfilepath, "rb");
-    if(inputfile == NULL)
-    {
-        status.errorcode = ERROR_INPUT_IO_ERROR;
-        return status;
-    }
+//Computes the BCD MSF address of a sector in the data track (which starts at 00:02:00)
+static void sectorMSF(int index, unsigned char* minutes, unsigned char* seconds, unsigned char* blocks)
+{
+    int lba = index + 2 * 75;
+    *minutes = toBCD(lba / (60 * 75));
+    *seconds = toBCD((lba / 75) % 60);
+    *blocks  = toBCD(lba % 75);
+}
 
-    //Open the output file
-    FILE* outputfile;
-    outputfile = fopen(outputfilepath, "wb");
-    if(outputfile == NULL)
+//Checks that size bytes are all zero. Works on 64 bytes at a time by OR-ing
+//eight independent words, which compilers turn into SIMD, and only branches
+//once per block.
+static bool isZeroRange(const unsigned char* data, int size)
+{
+    int k = 0;
+    for(; k + 64 <= size; k += 64)
     {
-        //Close the input file
-        fclose(inputfile);
-
-        status.errorcode = ERROR_OUTPUT_IO_ERROR;
-        return status;
+        uint64_t w[8];
+        memcpy(w, data + k, sizeof(w));
+        if((w[0] | w[1] | w[2] | w[3] | w[4] | w[5] | w[6] | w[7]) != 0)
+        {
+            return false;
+        }
     }
-
-    //Determine file size
-    fseek(inputfile, 0, SEEK_END);
-    int filesize = ftell(inputfile);
-    if (filesize < num_sectors * SECTOR_SIZE)
+    for(; k + 8 <= size; k += 8)
     {
-        fclose(inputfile);
-        status.errorcode = ERROR_IMAGE_INCOMPLETE;
-        return status;
+        uint64_t w;
+        memcpy(&w, data + k, sizeof(w));
+        if(w != 0)
+        {
+            return false;
+        }
     }
-    fseek(inputfile, 0, SEEK_SET);
-
-    if(form2EDCMode == INFER)
+    for(; k < size; ++k)
     {
-        //If the EDC mode is to be inferred, do so by looking at the bootloader
-
-        //Allocate memory to hold bootloader
-        unsigned char* bootloader = (unsigned char*) malloc(BOOTLOADER_SIZE);
-
-        //Read bootloader
-        int bytesread = fread(bootloader, 1, BOOTLOADER_SIZE, inputfile);
-        if(bytesread != BOOTLOADER_SIZE)
+        if(data[k] != 0x00)
         {
-            //Free memory
-            free(bootloader);
-
-            status.errorcode = ERROR_IMAGE_INCOMPLETE;
-            fclose(inputfile);
-            fclose(outputfile);
-            return status;
+            return false;
         }
+    }
+    return true;
+}
 
-        //Inspect the EDC of the four form 2 sectors in the bootloader
-        unsigned int form2sectorsinbootloader[] = {12, 13, 14, 15};
-        for(int i = 0; i < sizeof(form2sectorsinbootloader) / sizeof(form2sectorsinbootloader[0]); ++i)
-        {
-            //Navigate to the current sector
-            unsigned char* sector = bootloader + form2sectorsinbootloader[i] * SECTOR_SIZE;
+static bool isZeroSector(const unsigned char* sector)
+{
+    return isZeroRange(sector, SECTOR_SIZE);
+}
+
+void initSectorFixer(struct sectorFixer* fixer, int num_sectors, enum EDCMode form2EDCMode, SECTOR_SINK sink, void* sink_ctx)
+{
+    memset(&fixer->status, 0, sizeof(fixer->status));
+    fixer->status.warnings = NULL;
+    fixer->form2EDCMode    = form2EDCMode;
+    fixer->num_sectors     = num_sectors;
+    fixer->input_sectors   = 0;
+    fixer->pending_start   = -1;
+    fixer->finished        = (num_sectors <= 0);
+    fixer->sink            = sink;
+    fixer->sink_ctx        = sink_ctx;
+}
 
-            //Extract EDC
-            unsigned int EDC = (sector[CDROMXA_FORM2_EDC_OFFSET + 0] << 0)
-                             | (sector[CDROMXA_FORM2_EDC_OFFSET + 1] << 8)
-                             | (sector[CDROMXA_FORM2_EDC_OFFSET + 2] << 16)
-                             | (sector[CDROMXA_FORM2_EDC_OFFSET + 3] << 24);
+void inferForm2EDCMode(struct sectorFixer* fixer, const unsigned char* bootloader)
+{
+    if(fixer->form2EDCMode != INFER)
+    {
+        return;
+    }
 
-            //Check if EDC is set and increment corresponding counters
-            if(EDC == 0x00000000)
-            {
-                ++status.form2bootsectorswithoutedc;
-            }
-            else
-            {
-                ++status.form2bootsectorswithedc;
-            }
-        }
+    //Inspect the EDC of the four form 2 sectors in the bootloader
+    unsigned int form2sectorsinbootloader[] = {12, 13, 14, 15};
+    for(unsigned int i = 0; i < sizeof(form2sectorsinbootloader) / sizeof(form2sectorsinbootloader[0]); ++i)
+    {
+        //Navigate to the current sector
+        const unsigned char* sector = bootloader + form2sectorsinbootloader[i] * SECTOR_SIZE;
 
-        //Change the EDC mode appropriately
-        if(status.form2bootsectorswithoutedc >= status.form2bootsectorswithedc)
+        //Extract EDC
+        unsigned int EDC = (sector[CDROMXA_FORM2_EDC_OFFSET + 0] << 0)
+                         | (sector[CDROMXA_FORM2_EDC_OFFSET + 1] << 8)
+                         | (sector[CDROMXA_FORM2_EDC_OFFSET + 2] << 16)
+                         | (sector[CDROMXA_FORM2_EDC_OFFSET + 3] << 24);
+
+        //Check if EDC is set and increment corresponding counters
+        if(EDC == 0x00000000)
         {
-            form2EDCMode = ZERO;
+            ++fixer->status.form2bootsectorswithoutedc;
         }
         else
         {
-            form2EDCMode = COMPUTE;
+            ++fixer->status.form2bootsectorswithedc;
         }
+    }
 
-        //Free memory
-        free(bootloader);
+    //Change the EDC mode appropriately
+    if(fixer->status.form2bootsectorswithoutedc >= fixer->status.form2bootsectorswithedc)
+    {
+        fixer->form2EDCMode = ZERO;
+    }
+    else
+    {
+        fixer->form2EDCMode = COMPUTE;
+    }
+}
+
+//Stops the fixer with the given error code
+static int failSectorFixer(struct sectorFixer* fixer, int errorcode)
+{
+    fixer->status.errorcode = errorcode;
+    fixer->finished = true;
+    return -1;
+}
 
-        //Reset input file position (the bootloader must be fixed as well)
-        fseek(inputfile, 0, SEEK_SET);
+static int emitSector(struct sectorFixer* fixer, const unsigned char* sector)
+{
+    if(fixer->sink(fixer->sink_ctx, sector) != 0)
+    {
+        return failSectorFixer(fixer, ERROR_OUTPUT_IO_ERROR);
     }
+    return 0;
+}
 
-    //Iterate over all sectors in the input file, fix them, and write
-    unsigned char  minutes = 0x00;
-    unsigned char  seconds = 0x02;
-    unsigned char  blocks  = 0x00;
-    unsigned char* sector  = (unsigned char*) malloc(SECTOR_SIZE);
-    if(sector == NULL)
+//Mode 2 sector with nothing but the sync field and header
+static void makeEmptyMode2Sector(unsigned char* sector, int index)
+{
+    memset(sector, 0, SECTOR_SIZE);
+
+    //Write sync field
+    memcpy(sector, sync, sizeof(sync));
+
+    //Write header
+    sectorMSF(index, &sector[HEADER_OFFSET + 0], &sector[HEADER_OFFSET + 1], &sector[HEADER_OFFSET + 2]);
+    sector[HEADER_OFFSET + 3] = MODE_2;
+}
+
+//A run of mode 0 sectors turned out to be followed by more data, so it is not
+//the zero-padding. Those sectors are kept as (empty) mode 2 sectors.
+static int flushPendingSectors(struct sectorFixer* fixer, int end)
+{
+    if(end > fixer->num_sectors)
     {
-        status.errorcode = ERROR_OUT_OF_MEMORY;
-        fclose(inputfile);
-        fclose(outputfile);
-        return status;
+        end = fixer->num_sectors;
     }
-    printf("Processing %d sectors\n", num_sectors);
-    status.totalsectors = 0;
-    bool reached_zero_padding = false;
-    for(int i = 0; i < num_sectors * SECTOR_SIZE; i += SECTOR_SIZE)
+
+    unsigned char sector[SECTOR_SIZE];
+    for(int i = fixer->pending_start; i < end; ++i)
     {
-        if(!reached_zero_padding)
-        {
-            //Read next sector
-            int bytesread = fread(sector, 1, SECTOR_SIZE, inputfile);
-            if(bytesread != SECTOR_SIZE)
-            {
-                //Free memory
-                free(sector);
+        //Notify the user of this unexpected condition
+        printf("Encountered a mode 0 sector at 0x%08X that is followed by more data. This is not expected to happen, but fixing will proceed.\n", i * SECTOR_SIZE);
 
-                //Close the input and output files
-                fclose(inputfile);
-                fclose(outputfile);
+        makeEmptyMode2Sector(sector, i);
 
-                status.errorcode = ERROR_IMAGE_INCOMPLETE;
-                return status;
-            }
+        //Update sector mode count
+        ++fixer->status.mode0sectors;
+        ++fixer->status.totalsectors;
+
+        if(emitSector(fixer, sector) != 0)
+        {
+            return -1;
         }
-        else
+    }
+    fixer->pending_start = -1;
+    return 0;
+}
+
+//Warns about CD-ROM XA subheaders whose two copies disagree
+static void checkSubheader(struct fixImageStatus* status, const unsigned char* sector, int index)
+{
+    unsigned char minutes, seconds, blocks;
+    sectorMSF(index, &minutes, &seconds, &blocks);
+
+    //Read subheader
+    unsigned char filenumber        = sector[CDROMXA_SUBHEADER_OFFSET + 0];
+    unsigned char channelnumber     = sector[CDROMXA_SUBHEADER_OFFSET + 1];
+    unsigned char submode           = sector[CDROMXA_SUBHEADER_OFFSET + 2];
+    unsigned char datatype          = sector[CDROMXA_SUBHEADER_OFFSET + 3];
+    unsigned char filenumbercopy    = sector[CDROMXA_SUBHEADER_OFFSET + 4];
+    unsigned char channelnumbercopy = sector[CDROMXA_SUBHEADER_OFFSET + 5];
+    unsigned char submodecopy       = sector[CDROMXA_SUBHEADER_OFFSET + 6];
+    unsigned char datatypecopy      = sector[CDROMXA_SUBHEADER_OFFSET + 7];
+
+    //Check that the two copies of the subheader data are equivalent
+    if(filenumber != filenumbercopy)
+    {
+        addWarning((*status), "Corrupt CD-ROM XA subheader will be copied to the output file. File number mismatch at %02X:%02X:%02X: 0x%02X vs 0x%02X", 255, minutes, seconds, blocks, filenumber, filenumbercopy);
+    }
+    if(channelnumber != channelnumbercopy)
+    {
+        addWarning((*status), "Corrupt CD-ROM XA subheader will be copied to the output file. Channel number mismatch at %02X:%02X:%02X: 0x%02X vs 0x%02X", 255, minutes, seconds, blocks, channelnumber, channelnumbercopy);
+    }
+    if(submode != submodecopy)
+    {
+        addWarning((*status), "Corrupt CD-ROM XA subheader will be copied to the output file. Submode mismatch at %02X:%02X:%02X: 0x%02X vs 0x%02X", 255, minutes, seconds, blocks, submode, submodecopy);
+    }
+    if(datatype != datatypecopy)
+    {
+        addWarning((*status), "Corrupt CD-ROM XA subheader will be copied to the output file. CD-ROM XA subheader corrupt. Data type mismatch at %02X:%02X:%02X: 0x%02X vs 0x%02X", 255, minutes, seconds, blocks, datatype, datatypecopy);
+    }
+}
+
+//Fixes a single mode 2 sector in place. Only depends on the sector and its
+//index, so sectors may be fixed on any thread and in any order.
+static void fixMode2Sector(enum EDCMode form2EDCMode, unsigned char* sector, int index)
+{
+    unsigned char mode = MODE_2;
+    unsigned char minutes, seconds, blocks;
+    sectorMSF(index, &minutes, &seconds, &blocks);
+
+    //Write sync field
+    memcpy(sector, sync, sizeof(sync));
+
+    unsigned char submode = sector[CDROMXA_SUBHEADER_OFFSET + 2];
+
+    //Determine CD ROM XA Mode 2 form
+    bool isForm2 = (submode & 0x20) == 0x20;
+
+    //Compute and write EDC
+    if(isForm2)
+    {
+        //Write header
+        sector[HEADER_OFFSET + 0] = minutes;
+        sector[HEADER_OFFSET + 1] = seconds;
+        sector[HEADER_OFFSET + 2] = blocks;
+        sector[HEADER_OFFSET + 3] = mode;
+
+        //Handle form 2 EDC
+        unsigned int EDC; //For some strange reason, a declaration in case COMPUTE would require a ; in front.
+        switch(form2EDCMode)
         {
-            //We've reached zero padding, generate all-zero sectors
-            memset(sector, 0, SECTOR_SIZE);
+            case KEEP:
+                //Leave the original in tact. Nothing to do here.
+                break;
+
+            case COMPUTE:
+                //Compute form 2 EDC
+                EDC = edc_compute(sector + CDROMXA_SUBHEADER_OFFSET, CDROMXA_FORM2_EDC_OFFSET - CDROMXA_SUBHEADER_OFFSET);
+
+                //Write EDC
+                sector[CDROMXA_FORM2_EDC_OFFSET + 0] = (EDC & 0x000000FF) >> 0;
+                sector[CDROMXA_FORM2_EDC_OFFSET + 1] = (EDC & 0x0000FF00) >> 8;
+                sector[CDROMXA_FORM2_EDC_OFFSET + 2] = (EDC & 0x00FF0000) >> 16;
+                sector[CDROMXA_FORM2_EDC_OFFSET + 3] = (EDC & 0xFF000000) >> 24;
+                break;
+
+            case ZERO:
+                //Write zeroed EDC
+                sector[CDROMXA_FORM2_EDC_OFFSET + 0] = 0;
+                sector[CDROMXA_FORM2_EDC_OFFSET + 1] = 0;
+                sector[CDROMXA_FORM2_EDC_OFFSET + 2] = 0;
+                sector[CDROMXA_FORM2_EDC_OFFSET + 3] = 0;
+                break;
         }
+    }
+    else
+    {
+        //Compute form 1 EDC
+        unsigned int EDC = edc_compute(sector + CDROMXA_SUBHEADER_OFFSET, CDROMXA_FORM1_EDC_OFFSET - CDROMXA_SUBHEADER_OFFSET);
+
+        //Write EDC
+        sector[CDROMXA_FORM1_EDC_OFFSET + 0] = (EDC & 0x000000FF) >> 0;
+        sector[CDROMXA_FORM1_EDC_OFFSET + 1] = (EDC & 0x0000FF00) >> 8;
+        sector[CDROMXA_FORM1_EDC_OFFSET + 2] = (EDC & 0x00FF0000) >> 16;
+        sector[CDROMXA_FORM1_EDC_OFFSET + 3] = (EDC & 0xFF000000) >> 24;
+
+        //Write error-correction data
+
+        //Temporarily clear header
+        sector[HEADER_OFFSET + 0] = 0x00;
+        sector[HEADER_OFFSET + 1] = 0x00;
+        sector[HEADER_OFFSET + 2] = 0x00;
+        sector[HEADER_OFFSET + 3] = 0x00;
+
+        //Calculate P and Q parity
+        ecc_generate(sector);
+
+        //Restore header
+        sector[HEADER_OFFSET + 0] = minutes;
+        sector[HEADER_OFFSET + 1] = seconds;
+        sector[HEADER_OFFSET + 2] = blocks;
+        sector[HEADER_OFFSET + 3] = mode;
+    }
+}
 
-        //Find mode (or set to 0 if we're generating zero sectors)
-        unsigned char mode;
-        if(reached_zero_padding)
+void prepareSectors(enum EDCMode form2EDCMode, unsigned char* sectors, int count, int first_index)
+{
+    for(int n = 0; n < count; ++n)
+    {
+        unsigned char* sector = sectors + n * SECTOR_SIZE;
+        if(sector[HEADER_OFFSET + 3] == MODE_2)
         {
-            mode = MODE_0;
+            fixMode2Sector(form2EDCMode, sector, first_index + n);
         }
-        else
+    }
+}
+
+//Sector n of the batch was already fixed by prepareSectors if prepared_first + n
+//is its index, otherwise it is fixed here (prepared_first is -1 for none).
+static int feedSectors(struct sectorFixer* fixer, unsigned char* sectors, int count, int prepared_first)
+{
+    for(int n = 0; n < count; ++n)
+    {
+        if(fixer->finished)
         {
-            mode = sector[HEADER_OFFSET + 3];
+            return -1;
         }
 
-        //Process sector based on mode
-        if(mode == MODE_0)
+        unsigned char* sector = sectors + n * SECTOR_SIZE;
+        int index = fixer->input_sectors++;
+
+        if(fixer->pending_start >= 0)
         {
-            
-            if(!reached_zero_padding)
+            //Still looking like zero-padding, keep going
+            if(isZeroSector(sector))
             {
-                //Check that the sector is really all-zero
-                for(int j = HEADER_OFFSET + HEADER_SIZE; j < SECTOR_SIZE; ++j)
-                {
-                    if(sector[j] != 0x00)
-                    {
-                        //Free memory
-                        free(sector);
-
-                        //Close the input and output files
-                        fclose(inputfile);
-                        fclose(outputfile);
-
-                        status.errorcode = ERROR_MODE0_IS_NOT_0;
-                        return status;
-                    }
-                }
+                continue;
             }
 
-            if(!reached_zero_padding)
+            //There is more data after the mode 0 sectors
+            if(flushPendingSectors(fixer, index) != 0)
             {
-                //We have probably reached the beginning of the zero-padding - verify if that's the case
-
-                //Make a backup of the current read position in the input file
-                int inputfile_position_backup = ftell(inputfile);
-
-            //Read the remainder of the input file and check that it is all-zero
-            bool remainder_is_zero = true;
-            unsigned char* temp = (unsigned char*) malloc(SECTOR_SIZE);
-            if(temp == NULL)
+                return -1;
+            }
+            if(index >= fixer->num_sectors)
             {
-                //Free memory
-                free(sector);
-
-                //Close the input and output files
-                fclose(inputfile);
-                fclose(outputfile);
-
-                status.errorcode = ERROR_OUT_OF_MEMORY;
-                return status;
+                fixer->finished = true;
+                return -1;
             }
+        }
 
-            for(int j = i + SECTOR_SIZE; j < filesize && remainder_is_zero; j += SECTOR_SIZE)
+        //Process sector based on mode
+        unsigned char mode = sector[HEADER_OFFSET + 3];
+        if(mode == MODE_0)
+        {
+            //Check that the sector is really all-zero
+            if(!isZeroRange(sector + HEADER_OFFSET + HEADER_SIZE, SECTOR_SIZE - HEADER_OFFSET - HEADER_SIZE))
             {
-                //Read next sector
-                int bytesread = fread(temp, 1, SECTOR_SIZE, inputfile);
-                if(bytesread != SECTOR_SIZE)
-                {
-                    //Free memory
-                    free(sector);
-                    free(temp);
-
-                    //Close the input and output files
-                    fclose(inputfile);
-                    fclose(outputfile);
-
-                    status.errorcode = ERROR_IMAGE_INCOMPLETE;
-                    return status;
-                }
-
-                //Check that the sector is all-zero
-                for(int k = 0; k < SECTOR_SIZE; ++k)
-                {
-                    if(temp[k] != 0x00)
-                    {
-                        remainder_is_zero = false;
-                        break;
-                    }
-                }
+                return failSectorFixer(fixer, ERROR_MODE0_IS_NOT_0);
             }
-            free(temp);
 
-            if(remainder_is_zero)
+            //We have probably reached the beginning of the zero-padding. That is
+            //only known once the rest of the input has been seen, so hold the
+            //sector back until then.
+            fixer->pending_start = index;
+            continue;
+        }
+        else if(mode == MODE_1)
+        {
+            return failSectorFixer(fixer, ERROR_UNSUPPORTED_MODE);
+        }
+        else if(mode == MODE_2)
+        {
+            checkSubheader(&fixer->status, sector, index);
+            if(prepared_first < 0 || prepared_first + n != index)
             {
-                //We had indeed reached the beginning of the zero-padding. 
-                //Continue processing to ensure we output the expected number of sectors.
-                //Set flag to generate zero sectors for remainder
-                reached_zero_padding = true;
-                
-                //Mode 0 sector should be completely zeroed out
-                memset(sector, 0, SECTOR_SIZE);
+                fixMode2Sector(fixer->form2EDCMode, sector, index);
+            }
 
-                //Update sector mode count
-                ++status.mode0sectors;
+            //Update sector mode count
+            if((sector[CDROMXA_SUBHEADER_OFFSET + 2] & 0x20) == 0x20)
+            {
+                ++fixer->status.mode2form2sectors;
             }
             else
             {
-                //The mode 0 sector did NOT belong to the zero-padding - it should be added to the output file
+                ++fixer->status.mode2form1sectors;
+            }
+            ++fixer->status.totalsectors;
+        }
+        else
+        {
+            return failSectorFixer(fixer, ERROR_UNEXPECTED_MODE);
+        }
 
-                //Notify the user of this unexpected condition
-                printf("Encountered a mode 0 sector at 0x%08X that is followed by more data. This is not expected to happen, but fixing will proceed.\n", i);
+        //Write fixed sector
+        if(emitSector(fixer, sector) != 0)
+        {
+            return -1;
+        }
 
-                //Restore input file position
-                fseek(inputfile, inputfile_position_backup, SEEK_SET);
+        if(index + 1 >= fixer->num_sectors)
+        {
+            fixer->finished = true;
+        }
+    }
+    return fixer->finished ? -1 : 0;
+}
 
-                //Write sync field
-                memcpy(sector, sync, sizeof(sync));
+int feedSectorFixer(struct sectorFixer* fixer, unsigned char* sectors, int count)
+{
+    return feedSectors(fixer, sectors, count, -1);
+}
 
-                //Write header
-                sector[HEADER_OFFSET + 0] = minutes;
-                sector[HEADER_OFFSET + 1] = seconds;
-                sector[HEADER_OFFSET + 2] = blocks;
-                sector[HEADER_OFFSET + 3] = MODE_2;
+int feedPreparedSectors(struct sectorFixer* fixer, unsigned char* sectors, int count, int first_index)
+{
+    return feedSectors(fixer, sectors, count, first_index);
+}
 
-                //Update sector mode count
-                ++status.mode0sectors;
-            }
-            }
-            else
-            {
-                //We're already in zero-padding mode, just count the mode 0 sector
-                ++status.mode0sectors;
-            }
-            ++status.totalsectors;
-        }
-        else if(mode == MODE_1)
+int lastDataSector(const unsigned char* sectors, int count)
+{
+    for(int n = count - 1; n >= 0; --n)
+    {
+        if(!isZeroSector(sectors + n * SECTOR_SIZE))
         {
-            //Free memory
-            free(sector);
+            return n;
+        }
+    }
+    return -1;
+}
 
-            //Close the input and output files
-            fclose(inputfile);
-            fclose(outputfile);
+int fixSectorsAt(enum EDCMode form2EDCMode, unsigned char* sectors, int count, int first_index, int last_data_sector)
+{
+    for(int n = 0; n < count; ++n)
+    {
+        unsigned char* sector = sectors + n * SECTOR_SIZE;
+        int index = first_index + n;
 
-            status.errorcode = ERROR_UNSUPPORTED_MODE;
-            return status;
-        }
-        else if(mode == MODE_2)
+        unsigned char mode = sector[HEADER_OFFSET + 3];
+        if(mode == MODE_0)
         {
-            //Write sync field
-            memcpy(sector, sync, sizeof(sync));
-
-            //Read subheader
-            unsigned char filenumber        = sector[CDROMXA_SUBHEADER_OFFSET + 0];
-            unsigned char channelnumber     = sector[CDROMXA_SUBHEADER_OFFSET + 1];
-            unsigned char submode           = sector[CDROMXA_SUBHEADER_OFFSET + 2];
-            unsigned char datatype          = sector[CDROMXA_SUBHEADER_OFFSET + 3];
-            unsigned char filenumbercopy    = sector[CDROMXA_SUBHEADER_OFFSET + 4];
-            unsigned char channelnumbercopy = sector[CDROMXA_SUBHEADER_OFFSET + 5];
-            unsigned char submodecopy       = sector[CDROMXA_SUBHEADER_OFFSET + 6];
-            unsigned char datatypecopy      = sector[CDROMXA_SUBHEADER_OFFSET + 7];
-
-            //Check that the two copies of the subheader data are equivalent
-            if(filenumber != filenumbercopy)
-            {
-                addWarning(status, "Corrupt CD-ROM XA subheader will be copied to the output file. File number mismatch at %02X:%02X:%02X: 0x%02X vs 0x%02X", 255, minutes, seconds, blocks, filenumber, filenumbercopy);
-            }
-            if(channelnumber != channelnumbercopy)
+            if(!isZeroRange(sector + HEADER_OFFSET + HEADER_SIZE, SECTOR_SIZE - HEADER_OFFSET - HEADER_SIZE))
             {
-                addWarning(status, "Corrupt CD-ROM XA subheader will be copied to the output file. Channel number mismatch at %02X:%02X:%02X: 0x%02X vs 0x%02X", 255, minutes, seconds, blocks, channelnumber, channelnumbercopy);
-            }
-            if(submode != submodecopy)
-            {
-                addWarning(status, "Corrupt CD-ROM XA subheader will be copied to the output file. Submode mismatch at %02X:%02X:%02X: 0x%02X vs 0x%02X", 255, minutes, seconds, blocks, submode, submodecopy);
-            }
-            if(datatype != datatypecopy)
-            {
-                addWarning(status, "Corrupt CD-ROM XA subheader will be copied to the output file. CD-ROM XA subheader corrupt. Data type mismatch at %02X:%02X:%02X: 0x%02X vs 0x%02X", 255, minutes, seconds, blocks, datatype, datatypecopy);
+                return ERROR_MODE0_IS_NOT_0;
             }
 
-            //Determine CD ROM XA Mode 2 form
-            bool isForm2 = (submode & 0x20) == 0x20;
-
-            //Compute and write EDC
-            if(isForm2)
+            //Same outcome as the pending run in feedSectors: kept as an empty
+            //mode 2 sector if any data follows, zero-padding otherwise.
+            if(index < last_data_sector)
             {
-                //Write header
-                sector[HEADER_OFFSET + 0] = minutes;
-                sector[HEADER_OFFSET + 1] = seconds;
-                sector[HEADER_OFFSET + 2] = blocks;
-                sector[HEADER_OFFSET + 3] = mode;
-
-                //Handle form 2 EDC
-                unsigned int EDC; //For some strange reason, a declaration in case COMPUTE would require a ; in front.
-                switch(form2EDCMode)
-                {
-                    case KEEP:
-                        //Leave the original in tact. Nothing to do here.
-                        break;
-
-                    case COMPUTE:
-                        //Compute form 2 EDC
-                        EDC = 0x00000000;
-                        for(int i = CDROMXA_SUBHEADER_OFFSET; i < CDROMXA_FORM2_EDC_OFFSET; ++i)
-                        {
-                            EDC = EDC ^ sector[i];
-                            EDC = (EDC >> 8) ^ EDCTable[EDC & 0x000000FF];
-                        }
-
-                        //Write EDC
-                        sector[CDROMXA_FORM2_EDC_OFFSET + 0] = (EDC & 0x000000FF) >> 0;
-                        sector[CDROMXA_FORM2_EDC_OFFSET + 1] = (EDC & 0x0000FF00) >> 8;
-                        sector[CDROMXA_FORM2_EDC_OFFSET + 2] = (EDC & 0x00FF0000) >> 16;
-                        sector[CDROMXA_FORM2_EDC_OFFSET + 3] = (EDC & 0xFF000000) >> 24;
-                        break;
-
-                    case ZERO:
-                        //Write zeroed EDC
-                        sector[CDROMXA_FORM2_EDC_OFFSET + 0] = 0;
-                        sector[CDROMXA_FORM2_EDC_OFFSET + 1] = 0;
-                        sector[CDROMXA_FORM2_EDC_OFFSET + 2] = 0;
-                        sector[CDROMXA_FORM2_EDC_OFFSET + 3] = 0;
-                        break;
-                }
-
-                //Update sector mode count
-                ++status.mode2form2sectors;
+                makeEmptyMode2Sector(sector, index);
             }
             else
             {
-                //Compute form 1 EDC
-                unsigned int EDC = 0x00000000;
-                for(int i = CDROMXA_SUBHEADER_OFFSET; i < CDROMXA_FORM1_EDC_OFFSET; ++i)
-                {
-                    EDC = EDC ^ sector[i];
-                    EDC = (EDC >> 8) ^ EDCTable[EDC & 0x000000FF];
-                }
-
-                //Write EDC
-                sector[CDROMXA_FORM1_EDC_OFFSET + 0] = (EDC & 0x000000FF) >> 0;
-                sector[CDROMXA_FORM1_EDC_OFFSET + 1] = (EDC & 0x0000FF00) >> 8;
-                sector[CDROMXA_FORM1_EDC_OFFSET + 2] = (EDC & 0x00FF0000) >> 16;
-                sector[CDROMXA_FORM1_EDC_OFFSET + 3] = (EDC & 0xFF000000) >> 24;
-
-                //Write error-correction data
-
-                //Temporarily clear header
-                sector[HEADER_OFFSET + 0] = 0x00;
-                sector[HEADER_OFFSET + 1] = 0x00;
-                sector[HEADER_OFFSET + 2] = 0x00;
-                sector[HEADER_OFFSET + 3] = 0x00;
-
-                //Calculate P parity
-                {
-                    unsigned char* src = sector + HEADER_OFFSET;
-                    unsigned char* dst = sector + CDROMXA_FORM1_PARITY_P_OFFSET;
-                    for(int i = 0; i < 43; ++i)
-                    {
-                        unsigned short x = 0x0000;
-                        unsigned short y = 0x0000;
-                        for(int j = 19; j < 43; ++j)
-                        {
-                            x ^= RSPCTable[j][src[0]]; //LSB
-                            y ^= RSPCTable[j][src[1]]; //MSB
-                            src += 2 * 43;
-                        }
-                        dst[         0] = x >> 8;
-                        dst[2 * 43 + 0] = x & 0xFF;
-                        dst[         1] = y >> 8;
-                        dst[2 * 43 + 1] = y & 0xFF;
-                        dst += 2;
-                        src -= (43 - 19) * 2 * 43; //Restore src to the state before the inner loop
-                        src += 2;
-                    }
-                }
-
-                //Calculate Q parity
-                {
-                    unsigned char* src = sector + HEADER_OFFSET;
-                    unsigned char* dst = sector + CDROMXA_FORM1_PARITY_Q_OFFSET;
-                    unsigned char* src_end = sector + CDROMXA_FORM1_PARITY_Q_OFFSET;
-                    for(int i = 0; i < 26; ++i)
-                    {
-                        unsigned char* src_backup = src;
-                        unsigned short x = 0x0000;
-                        unsigned short y = 0x0000;
-                        for(int j = 0; j < 43; ++j)
-                        {
-                            x ^= RSPCTable[j][src[0]]; //LSB
-                            y ^= RSPCTable[j][src[1]]; //MSB
-                            src += 2 * 44;
-                            if(src >= src_end)
-                            {
-                                src = src - (HEADER_SIZE + CDROMXA_SUBHEADER_SIZE + CDROMXA_FORM1_USER_DATA_SIZE + EDC_SIZE + CDROMXA_FORM1_PARITY_P_SIZE);
-                            }
-                        }
-
-                        dst[         0] = x >> 8;
-                        dst[2 * 26 + 0] = x & 0xFF;
-                        dst[         1] = y >> 8;
-                        dst[2 * 26 + 1] = y & 0xFF;
-                        dst += 2;
-                        src = src_backup;
-                        src += 2 * 43;
-                    }
-                }
-
-                //Restore header
-                sector[HEADER_OFFSET + 0] = minutes;
-                sector[HEADER_OFFSET + 1] = seconds;
-                sector[HEADER_OFFSET + 2] = blocks;
-                sector[HEADER_OFFSET + 3] = mode;
-
-                //Update sector mode count
-                ++status.mode2form1sectors;
+                memset(sector, 0, SECTOR_SIZE);
             }
-            ++status.totalsectors;
+        }
+        else if(mode == MODE_1)
+        {
+            return ERROR_UNSUPPORTED_MODE;
+        }
+        else if(mode == MODE_2)
+        {
+            fixMode2Sector(form2EDCMode, sector, index);
         }
         else
         {
-            //Free memory
-            free(sector);
+            return ERROR_UNEXPECTED_MODE;
+        }
+    }
+    return 0;
+}
 
-            //Close the input and output files
-            fclose(inputfile);
-            fclose(outputfile);
+struct fixImageStatus finishSectorFixer(struct sectorFixer* fixer)
+{
+    if(fixer->pending_start >= 0)
+    {
+        //The input ended in zeroes, so we had indeed reached the beginning of the
+        //zero-padding. Output all-zero sectors up to the expected number of sectors.
+        unsigned char sector[SECTOR_SIZE];
+        memset(sector, 0, SECTOR_SIZE);
+        for(int i = fixer->pending_start; i < fixer->num_sectors; ++i)
+        {
+            //Update sector mode count
+            ++fixer->status.mode0sectors;
+            ++fixer->status.totalsectors;
 
-            status.errorcode = ERROR_UNEXPECTED_MODE;
-            return status;
+            if(emitSector(fixer, sector) != 0)
+            {
+                break;
+            }
         }
+        fixer->pending_start = -1;
+    }
+    else if(!fixer->finished && fixer->input_sectors < fixer->num_sectors)
+    {
+        failSectorFixer(fixer, ERROR_IMAGE_INCOMPLETE);
+    }
+    fixer->finished = true;
+    return fixer->status;
+}
 
-        //Write fixed sector to output file
-        int byteswritten = fwrite(sector, 1, SECTOR_SIZE, outputfile);
-        if(byteswritten != SECTOR_SIZE)
-        {
-            //Free memory
-            free(sector);
+static int writeSectorToFile(void* ctx, const unsigned char* sector)
+{
+    return (fwrite(sector, 1, SECTOR_SIZE, (FILE*)ctx) == SECTOR_SIZE) ? 0 : -1;
+}
 
-            //Close the input and output files
-            fclose(inputfile);
-            fclose(outputfile);
+//fixImage works through the image in batches of this many sectors
+#define FIX_BATCH_SECTORS   64
+#define FIX_BATCH_SIZE      (FIX_BATCH_SECTORS * SECTOR_SIZE)
+//256 sectors is the smallest whole number of sectors that is also a multiple of
+//4 KiB, so the output buffer is always flushed at aligned file offsets
+#define FIX_WRITE_BUFFER    (256 * SECTOR_SIZE)
 
-            status.errorcode = ERROR_OUTPUT_IO_ERROR;
-            return status;
-        }
+struct fixImageJob
+{
+    INPUT_READER reader;
+    struct sectorFixer fixer;
+    enum EDCMode form2EDCMode;
+};
+
+struct fixImageBatch
+{
+    int bytesread;
+    unsigned char sectors[FIX_BATCH_SIZE];
+};
 
-        //Update position
-        ++blocks;
-        if((blocks & 0x0F) == 0x0A)
+//Worker side: reads one batch and does the EDC/ECC work on it
+static int readFixBatch(void* ctx, int index, unsigned char* slot)
+{
+    struct fixImageJob* job = (struct fixImageJob*)ctx;
+    struct fixImageBatch* batch = (struct fixImageBatch*)slot;
+    int first = index * FIX_BATCH_SECTORS;
+
+    batch->bytesread = reader_read(&job->reader, (long long)first * SECTOR_SIZE, batch->sectors, FIX_BATCH_SIZE);
+
+    //Sectors past the end of the track are never fixed, so skip them
+    int count = batch->bytesread / SECTOR_SIZE;
+    if(count > job->fixer.num_sectors - first)
+    {
+        count = job->fixer.num_sectors - first;
+    }
+    if(count > 0)
+    {
+        prepareSectors(job->form2EDCMode, batch->sectors, count, first);
+    }
+    return 0;
+}
+
+//Writer side: called in image order, updates the status and writes the batch
+static int commitFixBatch(void* ctx, int index, unsigned char* slot)
+{
+    struct fixImageJob* job = (struct fixImageJob*)ctx;
+    struct fixImageBatch* batch = (struct fixImageBatch*)slot;
+
+    if(batch->bytesread < 0)
+    {
+        failSectorFixer(&job->fixer, ERROR_INPUT_IO_ERROR);
+        return -1;
+    }
+
+    feedPreparedSectors(&job->fixer, batch->sectors, batch->bytesread / SECTOR_SIZE, index * FIX_BATCH_SECTORS);
+
+    //The image ends with an incomplete sector
+    if(!job->fixer.finished && batch->bytesread % SECTOR_SIZE != 0)
+    {
+        failSectorFixer(&job->fixer, ERROR_IMAGE_INCOMPLETE);
+    }
+    return job->fixer.finished ? -1 : 0;
+}
+
+struct fixImageStatus fixImage(char* inputfilepath, char* outputfilepath, int num_sectors, enum EDCMode form2EDCMode, bool verbose)
+{
+    //Initialize return value struct
+    struct fixImageJob job;
+    initSectorFixer(&job.fixer, num_sectors, form2EDCMode, writeSectorToFile, NULL);
+
+    //Open the input file
+    if(reader_open(&job.reader, inputfilepath) < 0)
+    {
+        job.fixer.status.errorcode = ERROR_INPUT_IO_ERROR;
+        return job.fixer.status;
+    }
+
+    //Open the output file
+    FILE* outputfile;
+    outputfile = fopen(outputfilepath, "wb");
+    if(outputfile == NULL)
+    {
+        //Close the input file
+        reader_close(&job.reader);
+
+        job.fixer.status.errorcode = ERROR_OUTPUT_IO_ERROR;
+        return job.fixer.status;
+    }
+    setvbuf(outputfile, NULL, _IOFBF, FIX_WRITE_BUFFER);
+    job.fixer.sink_ctx = outputfile;
+
+    //Determine file size
+    long long filesize = job.reader.size;
+    if (filesize < (long long)num_sectors * SECTOR_SIZE)
+    {
+        reader_close(&job.reader);
+        fclose(outputfile);
+        job.fixer.status.errorcode = ERROR_IMAGE_INCOMPLETE;
+        return job.fixer.status;
+    }
+
+    printf("Processing %d sectors\n", num_sectors);
+
+    //If the EDC mode is to be inferred, do so by looking at the bootloader.
+    //The workers need the final mode, so this has to happen first.
+    if(job.fixer.form2EDCMode == INFER)
+    {
+        unsigned char* bootloader = (unsigned char*) malloc(BOOTLOADER_SIZE);
+        if(bootloader == NULL)
+        {
+            job.fixer.status.errorcode = ERROR_OUT_OF_MEMORY;
+        }
+        else if(reader_read(&job.reader, 0, bootloader, BOOTLOADER_SIZE) != BOOTLOADER_SIZE)
         {
-            //Increment from BCD x9 to (x+1)0
-            blocks += 0x06;
+            job.fixer.status.errorcode = ERROR_IMAGE_INCOMPLETE;
         }
         else
         {
-            if(blocks == 0x75) //Can be in the else branch because blocks & 0x0F == 0x0A => blocks != 0x75
-            {
-                blocks = 0x00;
-                ++seconds;
-                if((seconds & 0x0F) == 0x0A)
-                {
-                    //Increment from BCD x9 to (x+1)0
-                    seconds += 0x06;
-                    if(seconds == 0x60) //Can be in the else branch because seconds & 0x0F == 0x0A => seconds != 0x60
-                    {
-                        seconds = 0x00;
-                        ++minutes;
-                        if((minutes & 0x0F) == 0x0A)
-                        {
-                            //Increment from BCD x9 to (x+1)0
-                            minutes += 0x06;
-                        }
-                    }
-                }
-            }
+            inferForm2EDCMode(&job.fixer, bootloader);
         }
+        free(bootloader);
     }
+    job.form2EDCMode = job.fixer.form2EDCMode;
 
-    //Free memory
-    free(sector);
+    //Sectors are independent once their index is known, so the batches are
+    //fixed on all cores and written back out in order
+    if(job.fixer.status.errorcode == 0)
+    {
+        int batches = (int)((filesize + FIX_BATCH_SIZE - 1) / FIX_BATCH_SIZE);
+        if(run_ordered(batches, sizeof(struct fixImageBatch), parallel_get_threads(), readFixBatch, commitFixBatch, &job) != 0 && !job.fixer.finished)
+        {
+            job.fixer.status.errorcode = ERROR_OUT_OF_MEMORY;
+        }
+    }
+    if(job.fixer.status.errorcode == 0)
+    {
+        finishSectorFixer(&job.fixer);
+    }
 
     //Close the input and output files
-    fclose(inputfile);
-    fclose(outputfile);
+    reader_close(&job.reader);
+    if(fclose(outputfile) != 0 && job.fixer.status.errorcode == 0)
+    {
+        job.fixer.status.errorcode = ERROR_OUTPUT_IO_ERROR;
+    }
 
-    //Signal successful operation and return status
-    return status;
+    return job.fixer.status;
 }
 
-int make_cdrom(char* inputfile, char* outputfile, int num_sectors, bool verbose)
+void printFixImageStatus(struct fixImageStatus status, bool verbose)
 {
-    // Use the INFER method for EDC calculation (proved to be the more accurate approach).
-	struct fixImageStatus status = fixImage(inputfile, outputfile, num_sectors, INFER, verbose);
     if (verbose)
     {
         printf("Number of mode 0 sectors:               %i\n", status.mode0sectors);
@@ -614,6 +723,13 @@ int make_cdrom(char* inputfile, char* outputfile, int num_sectors, bool verbose)
             printf("\n");
         }
     }
+}
+
+int make_cdrom(char* inputfile, char* outputfile, int num_sectors, bool verbose)
+{
+    // Use the INFER method for EDC calculation (proved to be the more accurate approach).
+	struct fixImageStatus status = fixImage(inputfile, outputfile, num_sectors, INFER, verbose);
+    printFixImageStatus(status, verbose);
 
     return status.totalsectors;
 }
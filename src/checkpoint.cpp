@@ -0,0 +1,435 @@
+#include "checkpoint.h"
+#include "md5_verify.h"
+#include "gui.h"
+#include <io.h>
+
+#define CHECKPOINT_MAX_DISCS    5
+#define CHECKPOINT_MAX_TRACKS   100             // Indexed by track number, audio tracks are 02 to 99.
+#define CHECKPOINT_PSAR_HEADER  0x500           // PSISOIMG/PSTITLEIMG header and the PGD after it.
+#define CHECKPOINT_HASH_BUFFER  (1024 * 1024)
+#define CHECKPOINT_LINE         600
+
+static const char checkpoint_magic[] = "PSXTRACT-CHECKPOINT";
+
+// Bytes of the BIN that a finished stage wrote, with their MD5.
+typedef struct {
+    bool valid;
+    long long offset;
+    long long bytes;
+    char md5[33];
+} CHECKPOINT_REGION;
+
+typedef struct {
+    char bin_name[256];
+    char cue_name[256];
+    CHECKPOINT_REGION data;
+    int data_gap;
+    CHECKPOINT_REGION tracks[CHECKPOINT_MAX_TRACKS];
+    bool done;
+    long long bin_bytes;
+    char cue_md5[33];
+} CHECKPOINT_DISC;
+
+struct CHECKPOINT {
+    char path[MAX_PATH];
+    char source[33];                    // MD5 of the PSAR, key and settings the records belong to.
+    CRITICAL_SECTION lock;              // Discs and their tracks finish on any thread.
+    bool save_failed;
+    CHECKPOINT_DISC discs[CHECKPOINT_MAX_DISCS];
+};
+
+static bool hash_source(PBP_SECTION* psar, const unsigned char* pgd_key, const char* settings, char* hash)
+{
+    unsigned char psar_header[CHECKPOINT_PSAR_HEADER];
+    unsigned char key[0x10] = {};
+    int version = CHECKPOINT_VERSION;
+    memset(psar_header, 0, sizeof(psar_header));
+    read_pbp_section(psar, 0, psar_header, sizeof(psar_header));
+    if (pgd_key != NULL)
+        memcpy(key, pgd_key, sizeof(key));
+
+    MD5_STREAM md5;
+    if (!md5_stream_begin(&md5))
+        return false;
+    md5_stream_update(&md5, &version, sizeof(version));
+    md5_stream_update(&md5, &psar->size, sizeof(psar->size));
+    md5_stream_update(&md5, psar_header, sizeof(psar_header));
+    md5_stream_update(&md5, key, sizeof(key));
+    md5_stream_update(&md5, settings, (unsigned int)strlen(settings));
+    return md5_stream_end(&md5, hash);
+}
+
+// MD5 of bytes bytes of file from offset. Returns false if they can't all be read.
+static bool hash_file_region(FILE* file, long long offset, long long bytes, char* md5_string)
+{
+    if (_fseeki64(file, offset, SEEK_SET) != 0)
+        return false;
+    unsigned char* buffer = (unsigned char*)malloc(CHECKPOINT_HASH_BUFFER);
+    if (buffer == NULL)
+        return false;
+
+    MD5_STREAM md5;
+    bool ok = md5_stream_begin(&md5);
+    while (ok && bytes > 0) {
+        int chunk = (bytes > CHECKPOINT_HASH_BUFFER) ? CHECKPOINT_HASH_BUFFER : (int)bytes;
+        ok = fread(buffer, 1, chunk, file) == (size_t)chunk && md5_stream_update(&md5, buffer, chunk);
+        bytes -= chunk;
+    }
+    free(buffer);
+    if (!ok) {
+        md5_stream_end(&md5, NULL);
+        return false;
+    }
+    return md5_stream_end(&md5, md5_string);
+}
+
+static bool region_matches(FILE* file, long long file_size, const CHECKPOINT_REGION* region)
+{
+    char md5_string[33];
+    if (!region->valid || region->offset < 0 || region->bytes <= 0 || region->offset + region->bytes > file_size)
+        return false;
+    return hash_file_region(file, region->offset, region->bytes, md5_string) && strcmp(md5_string, region->md5) == 0;
+}
+
+// MD5 of the whole file name in the output folder.
+static bool hash_output_file(const char* name, char* md5_string)
+{
+    char path[MAX_PATH];
+    if (build_output_path(name, path, MAX_PATH) != 0)
+        return false;
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
+    long long length = _filelengthi64(_fileno(file));
+    bool ok = length >= 0 && hash_file_region(file, 0, length, md5_string);
+    fclose(file);
+    return ok;
+}
+
+static CHECKPOINT_DISC* checkpoint_get_disc(CHECKPOINT* checkpoint, int disc_num)
+{
+    if (checkpoint == NULL || disc_num < 1 || disc_num > CHECKPOINT_MAX_DISCS)
+        return NULL;
+    return &checkpoint->discs[disc_num - 1];
+}
+
+// Copies what follows the fields of a record, without the line break.
+static void read_name(const char* text, char* name, int size)
+{
+    snprintf(name, size, "%s", text);
+    name[strcspn(name, "\r\n")] = 0;
+}
+
+static void parse_record(CHECKPOINT* checkpoint, const char* line)
+{
+    char kind[8];
+    int disc_num, used;
+    if (sscanf(line, "%7s %d %n", kind, &disc_num, &used) < 2)
+        return;
+    CHECKPOINT_DISC* disc = checkpoint_get_disc(checkpoint, disc_num);
+    if (disc == NULL)
+        return;
+    const char* rest = line + used;
+
+    if (strcmp(kind, "bin") == 0) {
+        read_name(rest, disc->bin_name, sizeof(disc->bin_name));
+    } else if (strcmp(kind, "cue") == 0) {
+        read_name(rest, disc->cue_name, sizeof(disc->cue_name));
+    } else if (strcmp(kind, "data") == 0) {
+        CHECKPOINT_REGION* region = &disc->data;
+        region->valid = sscanf(rest, "%lld %d %32s", &region->bytes, &disc->data_gap, region->md5) == 3;
+        region->offset = 0;
+    } else if (strcmp(kind, "track") == 0) {
+        int track_num;
+        CHECKPOINT_REGION region;
+        memset(&region, 0, sizeof(region));
+        if (sscanf(rest, "%d %lld %lld %32s", &track_num, &region.offset, &region.bytes, region.md5) == 4
+            && track_num > 0 && track_num < CHECKPOINT_MAX_TRACKS) {
+            region.valid = true;
+            disc->tracks[track_num] = region;
+        }
+    } else if (strcmp(kind, "done") == 0) {
+        disc->done = sscanf(rest, "%lld %32s", &disc->bin_bytes, disc->cue_md5) == 2;
+    }
+}
+
+// Loads the records at checkpoint->path if they belong to checkpoint->source.
+static void checkpoint_load(CHECKPOINT* checkpoint)
+{
+    FILE* file = fopen(checkpoint->path, "rb");
+    if (file == NULL)
+        return;
+
+    char line[CHECKPOINT_LINE];
+    char magic[32];
+    char source[33];
+    int version = 0;
+    bool ours = fgets(line, sizeof(line), file) != NULL
+        && sscanf(line, "%31s %d", magic, &version) == 2
+        && strcmp(magic, checkpoint_magic) == 0 && version == CHECKPOINT_VERSION
+        && fgets(line, sizeof(line), file) != NULL
+        && sscanf(line, "source %32s", source) == 1
+        && strcmp(source, checkpoint->source) == 0;
+    if (!ours) {
+        printf("Ignoring checkpoint %s, it was left by another EBOOT or other settings.\n", checkpoint->path);
+        fclose(file);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+        parse_record(checkpoint, line);
+    fclose(file);
+}
+
+// True if a stage of any disc is recorded.
+static bool checkpoint_has_records(const CHECKPOINT* checkpoint)
+{
+    for (int i = 0; i < CHECKPOINT_MAX_DISCS; i++) {
+        const CHECKPOINT_DISC* disc = &checkpoint->discs[i];
+        if (disc->data.valid || disc->done)
+            return true;
+        for (int t = 0; t < CHECKPOINT_MAX_TRACKS; t++) {
+            if (disc->tracks[t].valid)
+                return true;
+        }
+    }
+    return false;
+}
+
+// Writes every record to a new manifest and swaps it in, so a crash leaves
+// either the old manifest or the new one. Without any record there is
+// nothing to resume and the manifest is removed instead, so a disc that is
+// declined or not started yet leaves no file behind. Called with the lock held.
+static void checkpoint_save(CHECKPOINT* checkpoint)
+{
+    if (!checkpoint_has_records(checkpoint)) {
+        utf8_remove(checkpoint->path);
+        return;
+    }
+
+    char temp_path[MAX_PATH + 4];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", checkpoint->path);
+    FILE* file = fopen(temp_path, "wb");
+    bool ok = file != NULL;
+    if (ok) {
+        fprintf(file, "%s %d\n", checkpoint_magic, CHECKPOINT_VERSION);
+        fprintf(file, "source %s\n", checkpoint->source);
+        for (int i = 0; i < CHECKPOINT_MAX_DISCS; i++) {
+            const CHECKPOINT_DISC* disc = &checkpoint->discs[i];
+            if (disc->bin_name[0] == 0)
+                continue;
+            fprintf(file, "bin %d %s\n", i + 1, disc->bin_name);
+            fprintf(file, "cue %d %s\n", i + 1, disc->cue_name);
+            if (disc->data.valid)
+                fprintf(file, "data %d %lld %d %s\n", i + 1, disc->data.bytes, disc->data_gap, disc->data.md5);
+            for (int t = 0; t < CHECKPOINT_MAX_TRACKS; t++) {
+                const CHECKPOINT_REGION* track = &disc->tracks[t];
+                if (track->valid)
+                    fprintf(file, "track %d %d %lld %lld %s\n", i + 1, t, track->offset, track->bytes, track->md5);
+            }
+            if (disc->done)
+                fprintf(file, "done %d %lld %s\n", i + 1, disc->bin_bytes, disc->cue_md5);
+        }
+        ok = checkpoint_sync(file);
+        if (fclose(file) != 0)
+            ok = false;
+    }
+    if (ok)
+        ok = utf8_replace_file(temp_path, checkpoint->path) == 0;
+    if (!ok) {
+        utf8_remove(temp_path);
+        if (!checkpoint->save_failed)
+            printf("WARNING: Can't write checkpoint %s, this extraction can't be resumed.\n", checkpoint->path);
+        checkpoint->save_failed = true;
+    }
+}
+
+CHECKPOINT* checkpoint_open(const char* serial, PBP_SECTION* psar, const unsigned char* pgd_key, const char* settings)
+{
+    CHECKPOINT* checkpoint = (CHECKPOINT*)calloc(1, sizeof(CHECKPOINT));
+    if (checkpoint == NULL)
+        return NULL;
+
+    char name[MAX_PATH];
+    snprintf(name, sizeof(name), "%s.checkpoint", serial);
+    if (build_output_path(name, checkpoint->path, MAX_PATH) != 0
+        || !hash_source(psar, pgd_key, settings, checkpoint->source)) {
+        free(checkpoint);
+        return NULL;
+    }
+    InitializeCriticalSection(&checkpoint->lock);
+    checkpoint_load(checkpoint);
+    return checkpoint;
+}
+
+void checkpoint_close(CHECKPOINT* checkpoint, bool finished)
+{
+    if (checkpoint == NULL)
+        return;
+    if (finished)
+        utf8_remove(checkpoint->path);
+    DeleteCriticalSection(&checkpoint->lock);
+    free(checkpoint);
+}
+
+CHECKPOINT_RESUME checkpoint_begin_disc(CHECKPOINT* checkpoint, int disc_num, const char* bin_name, const char* cue_name)
+{
+    CHECKPOINT_DISC* disc = checkpoint_get_disc(checkpoint, disc_num);
+    if (disc == NULL)
+        return CHECKPOINT_NONE;
+
+    EnterCriticalSection(&checkpoint->lock);
+
+    // Records of another BIN (the user picked another CUE this time) are of no use.
+    char bin_path[MAX_PATH];
+    FILE* bin = NULL;
+    if (strcmp(disc->bin_name, bin_name) == 0 && strcmp(disc->cue_name, cue_name) == 0
+        && build_output_path(bin_name, bin_path, MAX_PATH) == 0)
+        bin = fopen(bin_path, "rb");
+    if (bin == NULL) {
+        memset(disc, 0, sizeof(*disc));
+        snprintf(disc->bin_name, sizeof(disc->bin_name), "%s", bin_name);
+        snprintf(disc->cue_name, sizeof(disc->cue_name), "%s", cue_name);
+        checkpoint_save(checkpoint);
+        LeaveCriticalSection(&checkpoint->lock);
+        return CHECKPOINT_NONE;
+    }
+
+    // Only keep the stages whose bytes are still in the BIN.
+    long long bin_size = _filelengthi64(_fileno(bin));
+    if (!region_matches(bin, bin_size, &disc->data))
+        disc->data.valid = false;
+    long long audio_bytes = 0;
+    int tracks = 0;
+    for (int t = 0; t < CHECKPOINT_MAX_TRACKS; t++) {
+        CHECKPOINT_REGION* track = &disc->tracks[t];
+        if (!track->valid)
+            continue;
+        track->valid = track->offset >= disc->data.bytes && region_matches(bin, bin_size, track);
+        if (track->valid) {
+            audio_bytes += track->bytes;
+            tracks++;
+        }
+    }
+    fclose(bin);
+
+    // The disc is done if its stages cover the whole BIN and the CUE is the
+    // one that was written.
+    if (disc->done) {
+        char cue_md5[33];
+        disc->done = disc->data.valid && bin_size == disc->bin_bytes
+            && disc->data.bytes + audio_bytes == bin_size
+            && hash_output_file(cue_name, cue_md5) && strcmp(cue_md5, disc->cue_md5) == 0;
+    }
+    checkpoint_save(checkpoint);
+    LeaveCriticalSection(&checkpoint->lock);
+
+    if (disc->done) {
+        printf("Disc %d (%s) was already extracted, skipping it.\n", disc_num, bin_name);
+        return CHECKPOINT_DONE;
+    }
+    if (!disc->data.valid && tracks == 0)
+        return CHECKPOINT_NONE;
+    printf("Resuming disc %d (%s): %s data track and %d audio tracks are already done.\n",
+           disc_num, bin_name, disc->data.valid ? "the" : "no", tracks);
+    return CHECKPOINT_PARTIAL;
+}
+
+bool checkpoint_data_done(CHECKPOINT* checkpoint, int disc_num, long long* bytes, int* gap, char* md5_string)
+{
+    CHECKPOINT_DISC* disc = checkpoint_get_disc(checkpoint, disc_num);
+    if (disc == NULL || !disc->data.valid)
+        return false;
+    *bytes = disc->data.bytes;
+    *gap = disc->data_gap;
+    strcpy(md5_string, disc->data.md5);
+    return true;
+}
+
+void checkpoint_data(CHECKPOINT* checkpoint, int disc_num, FILE* bin, long long bytes, int gap, const char* md5_string)
+{
+    CHECKPOINT_DISC* disc = checkpoint_get_disc(checkpoint, disc_num);
+    if (disc == NULL || md5_string[0] == 0 || !checkpoint_sync(bin))
+        return;
+
+    EnterCriticalSection(&checkpoint->lock);
+    disc->data.valid = true;
+    disc->data.offset = 0;
+    disc->data.bytes = bytes;
+    disc->data_gap = gap;
+    strcpy(disc->data.md5, md5_string);
+    checkpoint_save(checkpoint);
+    LeaveCriticalSection(&checkpoint->lock);
+}
+
+bool checkpoint_track_done(CHECKPOINT* checkpoint, int disc_num, int track_num, long long offset, long long bytes)
+{
+    CHECKPOINT_DISC* disc = checkpoint_get_disc(checkpoint, disc_num);
+    if (disc == NULL || track_num <= 0 || track_num >= CHECKPOINT_MAX_TRACKS)
+        return false;
+
+    EnterCriticalSection(&checkpoint->lock);
+    const CHECKPOINT_REGION* track = &disc->tracks[track_num];
+    bool done = track->valid && track->offset == offset && track->bytes == bytes;
+    LeaveCriticalSection(&checkpoint->lock);
+    return done;
+}
+
+void checkpoint_track(CHECKPOINT* checkpoint, int disc_num, int track_num, long long offset, long long bytes, const char* md5_string)
+{
+    CHECKPOINT_DISC* disc = checkpoint_get_disc(checkpoint, disc_num);
+    if (disc == NULL || track_num <= 0 || track_num >= CHECKPOINT_MAX_TRACKS || md5_string[0] == 0)
+        return;
+
+    EnterCriticalSection(&checkpoint->lock);
+    CHECKPOINT_REGION* track = &disc->tracks[track_num];
+    track->valid = true;
+    track->offset = offset;
+    track->bytes = bytes;
+    strcpy(track->md5, md5_string);
+    checkpoint_save(checkpoint);
+    LeaveCriticalSection(&checkpoint->lock);
+}
+
+void checkpoint_disc(CHECKPOINT* checkpoint, int disc_num)
+{
+    CHECKPOINT_DISC* disc = checkpoint_get_disc(checkpoint, disc_num);
+    if (disc == NULL)
+        return;
+
+    // The CUE was just closed, make sure it reached the disk before it is vouched for.
+    char cue_path[MAX_PATH];
+    char bin_path[MAX_PATH];
+    char cue_md5[33];
+    long long bin_bytes = -1;
+    bool ok = build_output_path(disc->cue_name, cue_path, MAX_PATH) == 0
+        && build_output_path(disc->bin_name, bin_path, MAX_PATH) == 0;
+    if (ok) {
+        FILE* cue = fopen(cue_path, "r+b");
+        ok = cue != NULL && checkpoint_sync(cue);
+        if (cue != NULL)
+            fclose(cue);
+    }
+    ok = ok && hash_output_file(disc->cue_name, cue_md5);
+    if (ok) {
+        FILE* bin = fopen(bin_path, "rb");
+        if (bin != NULL) {
+            bin_bytes = _filelengthi64(_fileno(bin));
+            fclose(bin);
+        }
+    }
+    if (!ok || bin_bytes < 0)
+        return;
+
+    EnterCriticalSection(&checkpoint->lock);
+    disc->done = true;
+    disc->bin_bytes = bin_bytes;
+    strcpy(disc->cue_md5, cue_md5);
+    checkpoint_save(checkpoint);
+    LeaveCriticalSection(&checkpoint->lock);
+}
+
+bool checkpoint_sync(FILE* file)
+{
+    return fflush(file) == 0 && _commit(_fileno(file)) == 0;
+}
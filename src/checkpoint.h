@@ -0,0 +1,61 @@
+#pragma once
+
+#include "crypto.h"
+
+// Checkpoint manifest that lets an interrupted extraction resume.
+//
+// <serial>.checkpoint sits in the output folder next to the BIN/CUE files and
+// records each stage of each disc that has finished: the data track, every
+// audio track (its region of the BIN), and finally the whole disc once its
+// CUE is written. Each record holds the MD5 of the bytes it covers. A stage
+// is recorded only after those bytes are flushed to disk, and the manifest is
+// replaced atomically on every update. On a rerun, a record is trusted only
+// if the BIN still holds exactly those bytes. The manifest is keyed by the
+// PSAR, the PGD key and the settings that change the output, so a manifest
+// from another EBOOT or from another decoder is ignored. It only exists while
+// it holds a record, and is removed once the whole title is extracted.
+
+#define CHECKPOINT_VERSION 1
+
+typedef struct CHECKPOINT CHECKPOINT;
+
+typedef enum {
+    CHECKPOINT_NONE,        // Nothing to keep, build the disc from scratch.
+    CHECKPOINT_PARTIAL,     // Some stages are still valid, reopen the BIN and build the rest.
+    CHECKPOINT_DONE,        // BIN and CUE are complete, skip the disc.
+} CHECKPOINT_RESUME;
+
+// Loads the manifest of the title serial, or starts an empty one if there is
+// none or it belongs to another PSAR, key or settings (settings is a short
+// word, e.g. the audio decoder). Returns NULL if it can't be allocated;
+// every function below accepts NULL and then records and resumes nothing.
+CHECKPOINT* checkpoint_open(const char* serial, PBP_SECTION* psar, const unsigned char* pgd_key, const char* settings);
+
+// Frees the checkpoint. When finished, the title is done and the manifest is
+// removed as well.
+void checkpoint_close(CHECKPOINT* checkpoint, bool finished);
+
+// Checks the recorded stages of disc disc_num (1-based) against bin_name and
+// cue_name in the output folder. Records that do not match the files are
+// dropped. The records of another BIN name are dropped too.
+CHECKPOINT_RESUME checkpoint_begin_disc(CHECKPOINT* checkpoint, int disc_num, const char* bin_name, const char* cue_name);
+
+// Returns true, and fills in what build_data_track would return, if the data
+// track of the disc was validated by checkpoint_begin_disc.
+bool checkpoint_data_done(CHECKPOINT* checkpoint, int disc_num, long long* bytes, int* gap, char* md5_string);
+
+// Records the data track, which fills the first bytes of bin. Flushes bin first.
+void checkpoint_data(CHECKPOINT* checkpoint, int disc_num, FILE* bin, long long bytes, int gap, const char* md5_string);
+
+// Returns true if the audio track track_num, which takes [offset, offset +
+// bytes) of the BIN, was validated by checkpoint_begin_disc.
+bool checkpoint_track_done(CHECKPOINT* checkpoint, int disc_num, int track_num, long long offset, long long bytes);
+
+// Records an audio track. Its bytes must already be flushed, see checkpoint_sync.
+void checkpoint_track(CHECKPOINT* checkpoint, int disc_num, int track_num, long long offset, long long bytes, const char* md5_string);
+
+// Records the disc as complete once its BIN and CUE are closed.
+void checkpoint_disc(CHECKPOINT* checkpoint, int disc_num);
+
+// Flushes file to disk, so a record may vouch for what was written.
+bool checkpoint_sync(FILE* file);
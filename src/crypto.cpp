@@ -39,23 +39,78 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include "crypto.h"
+#include "iso_header.h"
+#include "lz.h"
 #include "gui.h"
+#include "parallel.h"
 
 
-int decrypt_pgd(unsigned char* pgd_data, int pgd_size, int flag, unsigned char* key)
+// Bytes of PGD payload handed to one worker by pgd_cipher_update.
+#define PGD_CIPHER_CHUNK 0x10000
+
+typedef struct
+{
+	const u8* prefix;
+	u32 seed;
+	unsigned char* data;
+	int size;
+} PGD_CIPHER_JOB;
+
+static int pgd_cipher_chunk(void* ctx, int index)
+{
+	PGD_CIPHER_JOB* job = (PGD_CIPHER_JOB*)ctx;
+	int offset = index * PGD_CIPHER_CHUNK;
+	int size = job->size - offset;
+	if (size > PGD_CIPHER_CHUNK)
+		size = PGD_CIPHER_CHUNK;
+
+	bbcipher_xor_range(job->prefix, job->seed + offset / 16, job->data + offset, size);
+	return 0;
+}
+
+// Same result as sceDrmBBCipherUpdate, but the BB cipher is counter mode so
+// the keystream is generated directly with AES and large payloads are split
+// across worker threads instead of going through 0x800 byte KIRK round trips.
+static int pgd_cipher_update(KIRK_CTX* kctx, CIPHER_KEY* ckey, unsigned char* data, int size)
+{
+	u8 prefix[12];
+	int result = sceDrmBBCipherPrefix_ctx(kctx, ckey, prefix);
+	if (result)
+		return result;
+
+	PGD_CIPHER_JOB job;
+	job.prefix = prefix;
+	job.seed = ckey->seed;
+	job.data = data;
+	job.size = size;
+
+	int chunks = (size + PGD_CIPHER_CHUNK - 1) / PGD_CIPHER_CHUNK;
+	run_parallel(chunks, parallel_get_threads(), pgd_cipher_chunk, &job);
+
+	ckey->seed += (size + 15) / 16;
+	return 0;
+}
+
+// Decrypts a PGD without touching the source buffer, so it can point straight
+// into the mapped EBOOT. The decrypted 0x30 byte header goes to header_out and
+// the payload (data size rounded up to 16 bytes) to data_out; both may alias
+// the source for in-place decryption. All KIRK scratch state lives on the
+// stack, so several PGDs can be decrypted on different threads at once.
+static int decrypt_pgd_to(const unsigned char* pgd_data, int pgd_size, int flag, unsigned char* key, unsigned char* header_out, unsigned char* data_out)
 {
 	int result;
 	PGD_HEADER PGD[sizeof(PGD_HEADER)];
 	MAC_KEY mkey;
 	CIPHER_KEY ckey;
+	KIRK_CTX kctx;
 	unsigned char*fkey;
 
 	// Read in the PGD header parameters.
 	memset(PGD, 0, sizeof(PGD));
 
-	PGD->buf = pgd_data;
-	PGD->key_index = *(u32*)(pgd_data + 4);
-	PGD->drm_type  = *(u32*)(pgd_data + 8);
+	PGD->buf = (unsigned char*)pgd_data;
+	PGD->key_index = *(const u32*)(pgd_data + 4);
+	PGD->drm_type  = *(const u32*)(pgd_data + 8);
 
 	// Set the hashing, crypto and open modes.
 	if (PGD->drm_type == 1)
@@ -92,8 +147,8 @@ int decrypt_pgd(unsigned char* pgd_data, int pgd_size, int flag, unsigned char*
 
 	// Test MAC hash at 0x80 (DNAS hash).
 	sceDrmBBMacInit(&mkey, PGD->mac_type);
-	sceDrmBBMacUpdate(&mkey, pgd_data, 0x80);
-	result = sceDrmBBMacFinal2(&mkey, pgd_data + 0x80, fkey);
+	sceDrmBBMacUpdate_ctx(&kctx, &mkey, PGD->buf, 0x80);
+	result = sceDrmBBMacFinal2_ctx(&kctx, &mkey, PGD->buf + 0x80, fkey);
 
 	if (result)
 	{
@@ -103,12 +158,12 @@ int decrypt_pgd(unsigned char* pgd_data, int pgd_size, int flag, unsigned char*
 
 	// Test MAC hash at 0x70 (key hash).
 	sceDrmBBMacInit(&mkey, PGD->mac_type);
-	sceDrmBBMacUpdate(&mkey, pgd_data, 0x70);
+	sceDrmBBMacUpdate_ctx(&kctx, &mkey, PGD->buf, 0x70);
 
 	// If a key was provided, check it against MAC 0x70.
 	if (!isEmpty(key, 0x10))
 	{
-		result = sceDrmBBMacFinal2(&mkey, pgd_data + 0x70, key);
+		result = sceDrmBBMacFinal2_ctx(&kctx, &mkey, PGD->buf + 0x70, key);
 		if (result)
 		{
 			printf("PGD: Invalid 0x70 MAC hash!\n");
@@ -122,18 +177,19 @@ int decrypt_pgd(unsigned char* pgd_data, int pgd_size, int flag, unsigned char*
 	else
 	{
 		// Generate the key from MAC 0x70.
-		bbmac_getkey(&mkey, pgd_data + 0x70, PGD->vkey);
+		bbmac_getkey_ctx(&kctx, &mkey, PGD->buf + 0x70, PGD->vkey);
 	}
 
 	// Decrypt the PGD header block (0x30 bytes).
-	sceDrmBBCipherInit(&ckey, PGD->cipher_type, 2, pgd_data + 0x10, PGD->vkey, 0);
-	sceDrmBBCipherUpdate(&ckey, pgd_data + 0x30, 0x30);
+	memmove(header_out, pgd_data + 0x30, 0x30);
+	sceDrmBBCipherInit_ctx(&kctx, &ckey, PGD->cipher_type, 2, PGD->buf + 0x10, PGD->vkey, 0);
+	pgd_cipher_update(&kctx, &ckey, header_out, 0x30);
 	sceDrmBBCipherFinal(&ckey);
 
 	// Get the decryption parameters from the decrypted header.
-	PGD->data_size   = *(u32*)(pgd_data + 0x44);
-	PGD->block_size  = *(u32*)(pgd_data + 0x48);
-	PGD->data_offset = *(u32*)(pgd_data + 0x4c);
+	PGD->data_size   = *(u32*)(header_out + 0x14);
+	PGD->block_size  = *(u32*)(header_out + 0x18);
+	PGD->data_offset = *(u32*)(header_out + 0x1c);
 
 	// Additional size variables.
 	PGD->align_size = (PGD->data_size + 15) &~ 15;
@@ -149,8 +205,8 @@ int decrypt_pgd(unsigned char* pgd_data, int pgd_size, int flag, unsigned char*
 
 	// Test MAC hash at 0x60 (table hash).
 	sceDrmBBMacInit(&mkey, PGD->mac_type);
-	sceDrmBBMacUpdate(&mkey, pgd_data + PGD->table_offset, PGD->block_nr * 16);
-	result = sceDrmBBMacFinal2(&mkey, pgd_data + 0x60, PGD->vkey);
+	sceDrmBBMacUpdate_ctx(&kctx, &mkey, PGD->buf + PGD->table_offset, PGD->block_nr * 16);
+	result = sceDrmBBMacFinal2_ctx(&kctx, &mkey, PGD->buf + 0x60, PGD->vkey);
 
 	if(result)
 	{
@@ -159,13 +215,27 @@ int decrypt_pgd(unsigned char* pgd_data, int pgd_size, int flag, unsigned char*
 	}
 
 	// Decrypt the data.
-	sceDrmBBCipherInit(&ckey, PGD->cipher_type, 2, pgd_data + 0x30, PGD->vkey, 0);
-	sceDrmBBCipherUpdate(&ckey, pgd_data + 0x90, PGD->align_size);
+	memmove(data_out, pgd_data + 0x90, PGD->align_size);
+	sceDrmBBCipherInit_ctx(&kctx, &ckey, PGD->cipher_type, 2, header_out, PGD->vkey, 0);
+	pgd_cipher_update(&kctx, &ckey, data_out, PGD->align_size);
 	sceDrmBBCipherFinal(&ckey);
 
 	return PGD->data_size;
 }
 
+int decrypt_pgd(unsigned char* pgd_data, int pgd_size, int flag, unsigned char* key)
+{
+	return decrypt_pgd_to(pgd_data, pgd_size, flag, key, pgd_data + 0x30, pgd_data + 0x90);
+}
+
+int decrypt_pgd_copy(const unsigned char* pgd_data, int pgd_size, int flag, unsigned char* key, unsigned char* out)
+{
+	unsigned char header[0x30];
+	return decrypt_pgd_to(pgd_data, pgd_size, flag, key, header, out);
+}
+
+
+
 int decrypt_doc(unsigned char* data, int size)
 {
 	data += 0x10;  // Skip dummy PGD header.
@@ -196,25 +266,14 @@ int decrypt_doc(unsigned char* data, int size)
 	}
 }
 
-int unpack_pbp(FILE *infile) 
+int open_pbp_sections(INPUT_READER *infile, PBP_SECTION *sections)
 {
-	long long maxbuffer = 32 * 1024 * 1024;
 	PBP_HEADER header;
 	int loop0;
-	long long total_size;
-
-	// Get the size of the PBP
-	_fseeki64(infile, 0, SEEK_END);
-	total_size = _ftelli64(infile);
-	_fseeki64(infile, 0, SEEK_SET);
-
-	if (total_size < 0) {
-		printf("UNPACK_PBP ERROR: Could not get the input file size.\n");
-		return -1;
-	}
+	long long total_size = infile->size;
 
 	// Read in the header
-	if (fread(&header, sizeof(PBP_HEADER), 1, infile) < 0) {
+	if (reader_read(infile, 0, &header, sizeof(PBP_HEADER)) != sizeof(PBP_HEADER)) {
 		printf("UNPACK_PBP ERROR: Could not read the input file header.\n");
 		return -1;
 	}
@@ -227,9 +286,8 @@ int unpack_pbp(FILE *infile)
 		}
 	}
 
-	// For each file in the PBP
+	// Describe each file in the PBP
 	for (loop0 = 0; loop0 < 8; loop0++) {
-		void *buffer;
 		long long size;
 
 		// Get the size of this file
@@ -239,25 +297,144 @@ int unpack_pbp(FILE *infile)
 			size = header.offset[loop0 + 1] - header.offset[loop0];
 		}
 
+		if ((header.offset[loop0] < 0) || (size < 0) || (header.offset[loop0] + size > total_size)) {
+			printf("UNPACK_PBP ERROR: Invalid section table entry for %s.\n", pbp_filenames[loop0]);
+			return -1;
+		}
+
 		// Print out the file details
 		printf("[%d] %10lld bytes | %s\n", loop0, size, pbp_filenames[loop0]);
 
+		sections[loop0].reader = infile;
+		sections[loop0].offset = header.offset[loop0];
+		sections[loop0].size = size;
+	}
+
+	// Exit successful
+	return 0;
+}
+
+int read_pbp_section(PBP_SECTION *section, long long offset, void *buf, int size)
+{
+	// Reads past the end of the section are clamped; the tail of the
+	// buffer is zero filled so callers see the same data as before.
+	int available = size;
+	if (offset >= section->size)
+		available = 0;
+	else if (offset + size > section->size)
+		available = (int)(section->size - offset);
+
+	if (available < size)
+		memset((unsigned char *)buf + available, 0, size - available);
+
+	if (available == 0)
+		return 0;
+
+	return reader_read(section->reader, section->offset + offset, buf, available);
+}
+
+const unsigned char* view_pbp_section(PBP_SECTION *section, long long offset, long long size)
+{
+	if ((offset < 0) || (offset + size > section->size))
+		return NULL;
+	return reader_view(section->reader, section->offset + offset, size);
+}
+
+void release_pbp_section_view(PBP_SECTION *section, const unsigned char *view)
+{
+	reader_release_view(section->reader, view);
+}
+
+void advise_pbp_section(PBP_SECTION *section, long long offset, long long size)
+{
+	if (offset + size > section->size)
+		size = section->size - offset;
+	reader_advise_sequential(section->reader, section->offset + offset, size);
+}
+
+// Decrypt a PGD stored inside the DATA.PSAR. When the EBOOT is mapped the PGD
+// is decrypted straight out of a mapped window, otherwise it is read in first.
+// Returns the decrypted payload (delete[] by the caller) or NULL on failure.
+unsigned char* decrypt_psar_pgd(PBP_SECTION *psar, long long offset, int size, unsigned char *pgd_key, int *pgd_size)
+{
+	unsigned char *payload = new unsigned char[size];
+	const unsigned char *pgd = view_pbp_section(psar, offset, size);
+
+	if (pgd == NULL)
+	{
+		read_pbp_section(psar, offset, payload, size);
+		pgd = payload;
+	}
+
+	*pgd_size = decrypt_pgd_copy(pgd, size, 2, pgd_key, payload);
+	if (pgd != payload)
+		release_pbp_section_view(psar, pgd);
+	if (*pgd_size <= 0)
+	{
+		delete[] payload;
+		return NULL;
+	}
+	return payload;
+}
+
+// Decompress the ISO block of size bytes at offset in the DATA.PSAR into out
+// (ISO_BLOCK_SIZE bytes). Blocks of ISO_BLOCK_SIZE bytes are stored as is. When
+// the EBOOT is mapped the block is used in place, otherwise it is read in first.
+void decompress_psar_block(PBP_SECTION *psar, long long offset, int size, unsigned char *out)
+{
+	unsigned char block_comp[ISO_BLOCK_SIZE];
+	if (size > ISO_BLOCK_SIZE)
+		size = ISO_BLOCK_SIZE;
+
+	const unsigned char *block = view_pbp_section(psar, offset, size);
+	if (block == NULL)
+	{
+		memset(block_comp, 0, ISO_BLOCK_SIZE);
+		read_pbp_section(psar, offset, block_comp, size);
+		block = block_comp;
+	}
+
+	memset(out, 0, ISO_BLOCK_SIZE);
+	if (size < ISO_BLOCK_SIZE)	// Compressed.
+		decompress(out, block, ISO_BLOCK_SIZE);
+	else						// Not compressed.
+		memcpy(out, block, ISO_BLOCK_SIZE);
+
+	if (block != block_comp)
+		release_pbp_section_view(psar, block);
+}
+
+int unpack_pbp(PBP_SECTION *sections, const char *dir)
+{
+	long long maxbuffer = 32 * 1024 * 1024;
+	int loop0;
+
+	// For each file in the PBP
+	for (loop0 = 0; loop0 < 8; loop0++) {
+		void *buffer;
+		long long size = sections[loop0].size;
+		long long offset = 0;
+
 		// Skip the file if empty
 		if (!size) continue;
 
-		// Seek to the proper position in the file
-		if (_fseeki64(infile, header.offset[loop0], SEEK_SET) != 0) {
-			printf("UNPACK_PBP ERROR: Could not seek in the input file.\n");
-			return -1;
-		}
-
 		// Open the output file
-		FILE *outfile = fopen(pbp_filenames[loop0], "wb");
+		char outpath[MAX_PATH];
+		snprintf(outpath, MAX_PATH, "%s\\%s", dir, pbp_filenames[loop0]);
+		FILE *outfile = fopen(outpath, "wb");
 		if (outfile == NULL) {
 			printf("UNPACK_PBP ERROR: Could not open the output file. (%s)\n", pbp_filenames[loop0]);
 			return -1;
 		}
 
+		// Create the read buffer
+		buffer = malloc((size_t)(size > maxbuffer ? maxbuffer : size));
+		if (buffer == NULL) {
+			printf("UNPACK_PBP ERROR: Could not allocate the section data buffer. (%lld)\n", size > maxbuffer ? maxbuffer : size);
+			fclose(outfile);
+			return -1;
+		}
+
 		do {
 			long long readsize;
 
@@ -269,31 +446,29 @@ int unpack_pbp(FILE *infile)
 			}
 			size -= readsize;
 
-			// Create the read buffer
-			buffer = malloc(readsize);
-			if (buffer == NULL) {
-				printf("UNPACK_PBP ERROR: Could not allocate the section data buffer. (%lld)\n", readsize);
-				return -1;
-			}
-
 			// Read in the data from the PBP
-			if (fread(buffer, readsize, 1, infile) < 0) {
+			if (read_pbp_section(&sections[loop0], offset, buffer, (int)readsize) != readsize) {
 				printf("UNPACK_PBP ERROR: Could not read in the section data.\n");
+				free(buffer);
+				fclose(outfile);
 				return -1;
 			}
+			offset += readsize;
 
 			// Write the contents of the buffer to the output file
-			if (fwrite(buffer, readsize, 1, outfile) < 0) {
+			if (fwrite(buffer, (size_t)readsize, 1, outfile) != 1) {
 				printf("UNPACK_PBP ERROR: Could not write out the section data.\n");
+				free(buffer);
+				fclose(outfile);
 				return -1;
 			}
 
-			// Clean up the buffer
-			free(buffer);
-
 			// Repeat if we haven't finished writing the file
 		} while (size);
 
+		// Clean up the buffer
+		free(buffer);
+
 		// Close the output file
 		if (fclose(outfile) < 0) {
 			printf("UNPACK_PBP ERROR: Could not close the output file.\n");
@@ -302,12 +477,6 @@ int unpack_pbp(FILE *infile)
 
 	}
 
-	// Close the PBP
-	if (fclose(infile) < 0) {
-		printf("UNPACK_PBP ERROR: Could not close the input file.\n");
-		return -1;
-	}
-
 	// Exit successful
 	return 0;
-}
\ No newline at end of file
+}
@@ -36,12 +36,16 @@
 // Unpack PBP comes from "PSPSDK - PSPDEV Open Source Project" (check above disclaimer).
 // Decrypt PGD is based on "pgdecrypt" by tpunix. 
 
+#pragma once
+
 #define _CRT_SECURE_NO_WARNINGS
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <malloc.h>
 
+#include "reader.h"
+
 extern "C" {
 	#include "libkirk/kirk_engine.h"
 	#include "libkirk/amctrl.h"
@@ -105,6 +109,26 @@ static const char *pbp_filenames[8] = {
 	"DATA.PSAR"
 };
 
+// Index of the DATA.PSAR section inside the PBP.
+#define PBP_DATA_PSAR 7
+
+// Offset/length window over one section of an open PBP file.
+// Sections are read in place from the original EBOOT instead of being
+// copied out to disk first.
+typedef struct {
+	INPUT_READER* reader;  // Open PBP (shared by all sections, owned by the caller).
+	long long offset;   // Absolute offset of the section inside the PBP.
+	long long size;     // Section size in bytes.
+} PBP_SECTION;
+
 int decrypt_pgd(unsigned char* pgd_data, int pgd_size, int flag, unsigned char* key);
+int decrypt_pgd_copy(const unsigned char* pgd_data, int pgd_size, int flag, unsigned char* key, unsigned char* out);
 int decrypt_doc(unsigned char* data, int size);
-int unpack_pbp(FILE *infile);
+int open_pbp_sections(INPUT_READER *infile, PBP_SECTION *sections);
+int read_pbp_section(PBP_SECTION *section, long long offset, void *buf, int size);
+const unsigned char* view_pbp_section(PBP_SECTION *section, long long offset, long long size);
+void release_pbp_section_view(PBP_SECTION *section, const unsigned char *view);
+void advise_pbp_section(PBP_SECTION *section, long long offset, long long size);
+unsigned char* decrypt_psar_pgd(PBP_SECTION *psar, long long offset, int size, unsigned char *pgd_key, int *pgd_size);
+void decompress_psar_block(PBP_SECTION *psar, long long offset, int size, unsigned char *out);
+int unpack_pbp(PBP_SECTION *sections, const char *dir);
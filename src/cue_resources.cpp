@@ -251,9 +251,8 @@ int select_cue_variant_and_update_serial(char* disc_serial) {
     
     // Prepare options array for GUI (only show titles, not serials)
     const char* options[12]; // Max candidates we support
+    char option_buffers[12][512]; // Per call, batch jobs may prompt from several threads
     for (int i = 0; i < candidate_count; i++) {
-        // Create a static buffer for each option (this is a limitation, but works for our use case)
-        static char option_buffers[12][512];
         snprintf(option_buffers[i], sizeof(option_buffers[i]), "%s", candidates[i].title);
         options[i] = option_buffers[i];
     }
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+// CD-ROM Reed-Solomon product code (ECMA-130 annex A) for mode 1 and mode 2
+// form 1 sectors. Both functions fill in the 172 byte P parity and 104 byte Q
+// parity of a full 2352 byte sector from bytes 12..2075. For mode 2 the
+// caller must zero the header (bytes 12..15) first.
+
+// Processes many parity columns at once (SSE2 when available, otherwise
+// eight columns per 64-bit word).
+void ecc_generate(uint8_t* sector);
+
+// Original one-byte-at-a-time RSPCTable version, kept for cross-checking.
+void ecc_generate_reference(uint8_t* sector);
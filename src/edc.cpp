@@ -0,0 +1,233 @@
+#include "edc.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define EDC_CLMUL_X86
+#include <cpuid.h>
+#define EDC_CLMUL_TARGET __attribute__((target("pclmul,sse2")))
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#define EDC_CLMUL_X86
+#include <intrin.h>
+#define EDC_CLMUL_TARGET
+#endif
+
+#ifdef EDC_CLMUL_X86
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+// Byte-wise EDC table (reflected CRC-32, polynomial 0xD8018001). Row 0 of the
+// slice-by-16 tables; the other rows are derived from it at startup.
+static const uint32_t EDCTable[256] =
+{
+    /*          0           1           2           3           4           5           6           7           8           9           A           B           C           D           E           F            */
+    /* 0 */ 0x00000000, 0x90910101, 0x91210201, 0x01B00300, 0x92410401, 0x02D00500, 0x03600600, 0x93F10701, 0x94810801, 0x04100900, 0x05A00A00, 0x95310B01, 0x06C00C00, 0x96510D01, 0x97E10E01, 0x07700F00, /* 0 */
+    /* 1 */ 0x99011001, 0x09901100, 0x08201200, 0x98B11301, 0x0B401400, 0x9BD11501, 0x9A611601, 0x0AF01700, 0x0D801800, 0x9D111901, 0x9CA11A01, 0x0C301B00, 0x9FC11C01, 0x0F501D00, 0x0EE01E00, 0x9E711F01, /* 1 */
+    /* 2 */ 0x82012001, 0x12902100, 0x13202200, 0x83B12301, 0x10402400, 0x80D12501, 0x81612601, 0x11F02700, 0x16802800, 0x86112901, 0x87A12A01, 0x17302B00, 0x84C12C01, 0x14502D00, 0x15E02E00, 0x85712F01, /* 2 */
+    /* 3 */ 0x1B003000, 0x8B913101, 0x8A213201, 0x1AB03300, 0x89413401, 0x19D03500, 0x18603600, 0x88F13701, 0x8F813801, 0x1F103900, 0x1EA03A00, 0x8E313B01, 0x1DC03C00, 0x8D513D01, 0x8CE13E01, 0x1C703F00, /* 3 */
+    /* 4 */ 0xB4014001, 0x24904100, 0x25204200, 0xB5B14301, 0x26404400, 0xB6D14501, 0xB7614601, 0x27F04700, 0x20804800, 0xB0114901, 0xB1A14A01, 0x21304B00, 0xB2C14C01, 0x22504D00, 0x23E04E00, 0xB3714F01, /* 4 */
+    /* 5 */ 0x2D005000, 0xBD915101, 0xBC215201, 0x2CB05300, 0xBF415401, 0x2FD05500, 0x2E605600, 0xBEF15701, 0xB9815801, 0x29105900, 0x28A05A00, 0xB8315B01, 0x2BC05C00, 0xBB515D01, 0xBAE15E01, 0x2A705F00, /* 5 */
+    /* 6 */ 0x36006000, 0xA6916101, 0xA7216201, 0x37B06300, 0xA4416401, 0x34D06500, 0x35606600, 0xA5F16701, 0xA2816801, 0x32106900, 0x33A06A00, 0xA3316B01, 0x30C06C00, 0xA0516D01, 0xA1E16E01, 0x31706F00, /* 6 */
+    /* 7 */ 0xAF017001, 0x3F907100, 0x3E207200, 0xAEB17301, 0x3D407400, 0xADD17501, 0xAC617601, 0x3CF07700, 0x3B807800, 0xAB117901, 0xAAA17A01, 0x3A307B00, 0xA9C17C01, 0x39507D00, 0x38E07E00, 0xA8717F01, /* 7 */
+    /* 8 */ 0xD8018001, 0x48908100, 0x49208200, 0xD9B18301, 0x4A408400, 0xDAD18501, 0xDB618601, 0x4BF08700, 0x4C808800, 0xDC118901, 0xDDA18A01, 0x4D308B00, 0xDEC18C01, 0x4E508D00, 0x4FE08E00, 0xDF718F01, /* 8 */
+    /* 9 */ 0x41009000, 0xD1919101, 0xD0219201, 0x40B09300, 0xD3419401, 0x43D09500, 0x42609600, 0xD2F19701, 0xD5819801, 0x45109900, 0x44A09A00, 0xD4319B01, 0x47C09C00, 0xD7519D01, 0xD6E19E01, 0x46709F00, /* 9 */
+    /* A */ 0x5A00A000, 0xCA91A101, 0xCB21A201, 0x5BB0A300, 0xC841A401, 0x58D0A500, 0x5960A600, 0xC9F1A701, 0xCE81A801, 0x5E10A900, 0x5FA0AA00, 0xCF31AB01, 0x5CC0AC00, 0xCC51AD01, 0xCDE1AE01, 0x5D70AF00, /* A */
+    /* B */ 0xC301B001, 0x5390B100, 0x5220B200, 0xC2B1B301, 0x5140B400, 0xC1D1B501, 0xC061B601, 0x50F0B700, 0x5780B800, 0xC711B901, 0xC6A1BA01, 0x5630BB00, 0xC5C1BC01, 0x5550BD00, 0x54E0BE00, 0xC471BF01, /* B */
+    /* C */ 0x6C00C000, 0xFC91C101, 0xFD21C201, 0x6DB0C300, 0xFE41C401, 0x6ED0C500, 0x6F60C600, 0xFFF1C701, 0xF881C801, 0x6810C900, 0x69A0CA00, 0xF931CB01, 0x6AC0CC00, 0xFA51CD01, 0xFBE1CE01, 0x6B70CF00, /* C */
+    /* D */ 0xF501D001, 0x6590D100, 0x6420D200, 0xF4B1D301, 0x6740D400, 0xF7D1D501, 0xF661D601, 0x66F0D700, 0x6180D800, 0xF111D901, 0xF0A1DA01, 0x6030DB00, 0xF3C1DC01, 0x6350DD00, 0x62E0DE00, 0xF271DF01, /* D */
+    /* E */ 0xEE01E001, 0x7E90E100, 0x7F20E200, 0xEFB1E301, 0x7C40E400, 0xECD1E501, 0xED61E601, 0x7DF0E700, 0x7A80E800, 0xEA11E901, 0xEBA1EA01, 0x7B30EB00, 0xE8C1EC01, 0x7850ED00, 0x79E0EE00, 0xE971EF01, /* E */
+    /* F */ 0x7700F000, 0xE791F101, 0xE621F201, 0x76B0F300, 0xE541F401, 0x75D0F500, 0x7460F600, 0xE4F1F701, 0xE381F801, 0x7310F900, 0x72A0FA00, 0xE231FB01, 0x71C0FC00, 0xE151FD01, 0xE0E1FE01, 0x7070FF00  /* F */
+    /*          0           1           2           3           4           5           6           7           8           9           A           B           C           D           E           F            */
+};
+
+static uint32_t g_slice[16][256];
+
+typedef uint32_t (*EDC_FN)(uint32_t edc, const uint8_t* data, size_t size);
+static EDC_FN g_edc_update;
+
+static inline uint32_t load32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t edc_update_bytewise(uint32_t edc, const uint8_t* data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        edc = (edc >> 8) ^ EDCTable[(edc ^ data[i]) & 0xFF];
+    return edc;
+}
+
+// Consumes 16 bytes per step with one table lookup per byte and no serial
+// dependency between the lookups. Assumes a little-endian host.
+static uint32_t edc_update_slice16(uint32_t edc, const uint8_t* data, size_t size)
+{
+    while (size >= 16) {
+        uint32_t w0 = load32(data) ^ edc;
+        uint32_t w1 = load32(data + 4);
+        uint32_t w2 = load32(data + 8);
+        uint32_t w3 = load32(data + 12);
+        edc = g_slice[15][w0 & 0xFF] ^ g_slice[14][(w0 >> 8) & 0xFF] ^ g_slice[13][(w0 >> 16) & 0xFF] ^ g_slice[12][w0 >> 24]
+            ^ g_slice[11][w1 & 0xFF] ^ g_slice[10][(w1 >> 8) & 0xFF] ^ g_slice[9][(w1 >> 16) & 0xFF] ^ g_slice[8][w1 >> 24]
+            ^ g_slice[7][w2 & 0xFF] ^ g_slice[6][(w2 >> 8) & 0xFF] ^ g_slice[5][(w2 >> 16) & 0xFF] ^ g_slice[4][w2 >> 24]
+            ^ g_slice[3][w3 & 0xFF] ^ g_slice[2][(w3 >> 8) & 0xFF] ^ g_slice[1][(w3 >> 16) & 0xFF] ^ g_slice[0][w3 >> 24];
+        data += 16;
+        size -= 16;
+    }
+    return edc_update_bytewise(edc, data, size);
+}
+
+#ifdef EDC_CLMUL_X86
+
+// Folding constants for the reflected polynomial: reflect32(x^n mod P) << 1,
+// for n = 4*128+32 / 4*128-32 (fold by four blocks) and 128+32 / 128-32
+// (fold by one block). Computed from the polynomial at startup.
+static uint64_t g_fold4_lo, g_fold4_hi, g_fold1_lo, g_fold1_hi;
+
+static uint32_t xpow_mod(int n)
+{
+    // x^n mod P in normal (non-reflected) bit order, P = 0x1_8001801B.
+    uint32_t r = 1;
+    for (int i = 0; i < n; i++)
+        r = (r & 0x80000000) ? (r << 1) ^ 0x8001801B : (r << 1);
+    return r;
+}
+
+static uint64_t fold_constant(int n)
+{
+    uint32_t r = xpow_mod(n);
+    uint32_t reflected = 0;
+    for (int i = 0; i < 32; i++)
+        if (r & (1u << i))
+            reflected |= 0x80000000u >> i;
+    return (uint64_t)reflected << 1;
+}
+
+static int clmul_supported()
+{
+    unsigned int ecx;
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 1);
+    ecx = (unsigned int)regs[2];
+#else
+    unsigned int eax, ebx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+#endif
+    // bit 1: PCLMULQDQ (every CPU that has it also has SSE2)
+    return (ecx & (1u << 1)) != 0;
+}
+
+EDC_CLMUL_TARGET static inline __m128i fold(__m128i x, __m128i k, __m128i next)
+{
+    __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+    __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(lo, hi), next);
+}
+
+// Folds 64 bytes per step with four independent carry-less multiply chains,
+// then down to one 128-bit remainder. With a zero starting value the EDC
+// only depends on the message modulo P, so the remainder is finished with
+// the table code as if it were a 16 byte message.
+EDC_CLMUL_TARGET static uint32_t edc_update_clmul(uint32_t edc, const uint8_t* data, size_t size)
+{
+    if (size < 64)
+        return edc_update_slice16(edc, data, size);
+
+    __m128i k4 = _mm_set_epi32((int)(g_fold4_hi >> 32), (int)g_fold4_hi, (int)(g_fold4_lo >> 32), (int)g_fold4_lo);
+    __m128i k1 = _mm_set_epi32((int)(g_fold1_hi >> 32), (int)g_fold1_hi, (int)(g_fold1_lo >> 32), (int)g_fold1_lo);
+
+    __m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)data), _mm_cvtsi32_si128((int)edc));
+    __m128i x1 = _mm_loadu_si128((const __m128i*)(data + 16));
+    __m128i x2 = _mm_loadu_si128((const __m128i*)(data + 32));
+    __m128i x3 = _mm_loadu_si128((const __m128i*)(data + 48));
+    data += 64;
+    size -= 64;
+
+    while (size >= 64) {
+        x0 = fold(x0, k4, _mm_loadu_si128((const __m128i*)data));
+        x1 = fold(x1, k4, _mm_loadu_si128((const __m128i*)(data + 16)));
+        x2 = fold(x2, k4, _mm_loadu_si128((const __m128i*)(data + 32)));
+        x3 = fold(x3, k4, _mm_loadu_si128((const __m128i*)(data + 48)));
+        data += 64;
+        size -= 64;
+    }
+
+    x0 = fold(x0, k1, x1);
+    x0 = fold(x0, k1, x2);
+    x0 = fold(x0, k1, x3);
+
+    while (size >= 16) {
+        x0 = fold(x0, k1, _mm_loadu_si128((const __m128i*)data));
+        data += 16;
+        size -= 16;
+    }
+
+    uint8_t rest[16];
+    _mm_storeu_si128((__m128i*)rest, x0);
+    edc = edc_update_slice16(0, rest, 16);
+    return edc_update_bytewise(edc, data, size);
+}
+
+static int clmul_selfcheck()
+{
+    uint8_t buf[1000];
+    for (size_t i = 0; i < sizeof(buf); i++)
+        buf[i] = (uint8_t)(i * 131 + 17);
+
+    // Cover the four-way loop, the single-block tail and the byte tail.
+    static const size_t sizes[] = { 64, 80, 127, 2056, 2332 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t size = sizes[i] < sizeof(buf) ? sizes[i] : sizeof(buf);
+        if (edc_update_clmul(0x12345678, buf, size) != edc_update_bytewise(0x12345678, buf, size))
+            return 0;
+    }
+    return 1;
+}
+
+#endif
+
+static void edc_init()
+{
+    for (int i = 0; i < 256; i++)
+        g_slice[0][i] = EDCTable[i];
+    for (int t = 1; t < 16; t++) {
+        for (int i = 0; i < 256; i++)
+            g_slice[t][i] = (g_slice[t - 1][i] >> 8) ^ EDCTable[g_slice[t - 1][i] & 0xFF];
+    }
+
+    g_edc_update = edc_update_slice16;
+
+#ifdef EDC_CLMUL_X86
+    if (clmul_supported()) {
+        g_fold4_lo = fold_constant(4 * 128 + 32);
+        g_fold4_hi = fold_constant(4 * 128 - 32);
+        g_fold1_lo = fold_constant(128 + 32);
+        g_fold1_hi = fold_constant(128 - 32);
+        if (clmul_selfcheck())
+            g_edc_update = edc_update_clmul;
+    }
+#endif
+}
+
+// Runs before main(), so the worker threads only ever read the tables.
+static struct EdcInit {
+    EdcInit() { edc_init(); }
+} g_edc_init;
+
+uint32_t edc_update(uint32_t edc, const uint8_t* data, size_t size)
+{
+    return g_edc_update(edc, data, size);
+}
+
+uint32_t edc_compute(const uint8_t* data, size_t size)
+{
+    return g_edc_update(0, data, size);
+}
+
+uint32_t edc_compute_bytewise(const uint8_t* data, size_t size)
+{
+    return edc_update_bytewise(0, data, size);
+}
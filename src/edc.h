@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CD-ROM error detection code (the 32-bit CRC stored after the user data of
+// mode 1 and mode 2 sectors). Picks a PCLMULQDQ folding implementation when
+// the CPU supports it and falls back to slice-by-16 tables otherwise.
+
+// EDC of a whole buffer (starting value 0).
+uint32_t edc_compute(const uint8_t* data, size_t size);
+
+// Continue an EDC over more data; edc_compute(a+b) == edc_update(edc_compute(a), b).
+uint32_t edc_update(uint32_t edc, const uint8_t* data, size_t size);
+
+// Reference byte-at-a-time version, kept for cross-checking.
+uint32_t edc_compute_bytewise(const uint8_t* data, size_t size);
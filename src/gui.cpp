@@ -2,6 +2,7 @@
 #include "gui.h"
 #include "utils.h"
 #include "at3acm.h"
+#include "batch.h"
 #include <commctrl.h>
 #include <commdlg.h>
 #include <shlobj.h>
@@ -22,6 +23,7 @@
 #define ID_OUTPUT_EDIT      1007
 #define ID_CANCEL_BUTTON    1008
 #define ID_LOGCLEANUP_CHECK 1009
+#define ID_JOBS_EDIT        1010
 
 // Custom message for thread-safe logging
 #define WM_APPEND_LOG       (WM_USER + 1)
@@ -37,44 +39,22 @@ static HWND g_hCancelButton = NULL;
 static HWND g_hCleanupCheck = NULL;
 static HWND g_hLogCleanupCheck = NULL;
 static HWND g_hOutputEdit = NULL;
+static HWND g_hJobsEdit = NULL;
 static wchar_t g_selectedFilesW[32768] = L"";  // Buffer for multiple file paths (Unicode)
 static char g_selectedFiles[32768] = "";  // Buffer for multiple file paths (UTF-8 converted)
 static int g_fileCount = 0;
 static char g_outputFolder[MAX_PATH];
-static FILE* g_logFile = NULL;
 
 // Thread management
 static HANDLE g_hExtractionThread = NULL;
-static HANDLE g_hLogTailThread = NULL;
-static bool g_logTailActive = false;
-static char g_currentLogPath[MAX_PATH] = "";
 
-// Every extraction runs in a child process. They are placed in a job object
-// configured to kill-on-close, so that if this GUI process exits or is killed,
-// Windows terminates the in-flight extraction rather than orphaning it.
-static HANDLE g_hExtractionJob = NULL;
+// Extractions run in-process as batch jobs (see batch.h). Cancel sets this and
+// the jobs stop at their next checkpoint.
+static volatile LONG g_cancelBatch = 0;
 
-static void ensureExtractionJob() {
-    if (g_hExtractionJob) return;
-    g_hExtractionJob = CreateJobObject(NULL, NULL);
-    if (g_hExtractionJob) {
-        JOBOBJECT_EXTENDED_LIMIT_INFORMATION jeli;
-        ZeroMemory(&jeli, sizeof(jeli));
-        jeli.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
-        SetInformationJobObject(g_hExtractionJob, JobObjectExtendedLimitInformation, &jeli, sizeof(jeli));
-    }
-}
-
-// Put a freshly spawned extraction child under the kill-on-close job.
-static void superviseChild(HANDLE hProcess) {
-    ensureExtractionJob();
-    if (g_hExtractionJob) AssignProcessToJobObject(g_hExtractionJob, hProcess);
-}
-
-// Kill any running extraction child processes immediately (used by Cancel).
-static void killExtractionChildren() {
-    if (g_hExtractionJob) TerminateJobObject(g_hExtractionJob, 1);
-}
+// Jobs running at the same time may all want to ask something; one question
+// at a time.
+static SRWLOCK g_promptLock = SRWLOCK_INIT;
 
 // Progress dialog
 static HWND g_hProgressDialog = NULL;
@@ -91,14 +71,8 @@ void onExtract();
 void onCancel();
 void appendToLog(const char* text);
 void appendToLogDirect(const char* text);
-void openLogFile(const char* pbpPath);
-void openLogFileForWriting(const char* pbpPath);
-void closeLogFile();
-void cleanupLogFile(const char* pbpPath);
-void startLogTailing(const char* logPath);
-void stopLogTailing();
+void cleanupLogFile(const char* logPath);
 void clearGUILog();
-DWORD WINAPI logTailThread(LPVOID lpParam);
 LRESULT CALLBACK ProgressDialogProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
 void showProgressDialog();
 void hideProgressDialog();
@@ -155,12 +129,17 @@ int gui_printf_impl(const char* format, ...) {
     int result = vsnprintf(buffer, sizeof(buffer), format, args);
     va_end(args);
     
+    // Output of a batch job goes to its log file first
+    if (batch_log(buffer)) {
+        return result;
+    }
+    
     if (isGUIMode()) {
         if (g_hLogEdit) {
-            // Parent GUI process - send to GUI log
+            // GUI process - send to GUI log
             appendToLog(buffer);
         } else {
-            // Child process with --gui flag - write to log file
+            // Command line with --gui flag - no log window
             appendToLogDirect(buffer);
         }
     } else {
@@ -172,8 +151,67 @@ int gui_printf_impl(const char* format, ...) {
     return result;
 }
 
-// Forward declaration of the main extraction function
-extern int psxtract_main(const char* pbp_file, const char* document_file, const char* keys_file, bool cleanup, bool verbose, const char* output_dir);
+// Progress of the batch, shared by its jobs
+typedef struct {
+    int total;
+    int concurrency;
+    bool showProgressDlg;
+    volatile LONG started;
+} GUI_BATCH;
+
+// Called by every job when it starts and when it's done.
+static void onJobStatus(void* ctx, int index, const BATCH_JOB* job) {
+    GUI_BATCH* batch = (GUI_BATCH*)ctx;
+    char logMsg[1024];
+    
+    // Use just the file name (basename) in progress/log messages.
+    const char* displayName = strrchr(job->pbp_file, '\\');
+    displayName = displayName ? displayName + 1 : job->pbp_file;
+    
+    switch (job->status) {
+    case BATCH_RUNNING:
+        {
+            LONG started = InterlockedIncrement(&batch->started);
+            
+            // Clear GUI log for each file (except first) to keep it clean in batch mode,
+            // unless other files are still writing to it
+            if (started > 1 && batch->concurrency == 1) {
+                clearGUILog();
+            }
+            
+            // Always send processing message to GUI log
+            sprintf(logMsg, "\n=== Processing file %d/%d: %s ===\n", index + 1, batch->total, displayName);
+            appendToLog(logMsg);
+            
+            // Update progress dialog if shown
+            if (batch->showProgressDlg) {
+                sprintf(logMsg, "BATCH_UPDATE_PROGRESS:%d:%d:%s", (int)started, batch->total, displayName);
+                PostMessage(g_hMainWnd, WM_UPDATE_PROGRESS, 0, (LPARAM)_strdup(logMsg));
+            }
+        }
+        break;
+    case BATCH_SUCCEEDED:
+        sprintf(logMsg, "File %d/%d completed successfully: %s (%.1f s)\n", index + 1, batch->total, displayName, job->milliseconds / 1000.0);
+        appendToLog(logMsg);
+        break;
+    case BATCH_SKIPPED:
+        sprintf(logMsg, "File %d/%d extraction cancelled by user: %s\n", index + 1, batch->total, displayName);
+        appendToLog(logMsg);
+        break;
+    case BATCH_CANCELLED:
+        sprintf(logMsg, "File %d/%d cancelled: %s\n", index + 1, batch->total, displayName);
+        appendToLog(logMsg);
+        break;
+    default:
+        if (job->log_path[0] != 0) {
+            sprintf(logMsg, "File %d/%d failed with exit code %d: %s\nSee %s\n", index + 1, batch->total, job->exit_code, displayName, job->log_path);
+        } else {
+            sprintf(logMsg, "File %d/%d failed with exit code %d: %s\n", index + 1, batch->total, job->exit_code, displayName);
+        }
+        appendToLog(logMsg);
+        break;
+    }
+}
 
 // Thread function for extraction
 DWORD WINAPI extractionThread(LPVOID lpParam) {
@@ -193,10 +231,17 @@ DWORD WINAPI extractionThread(LPVOID lpParam) {
     bool cleanup = (BST_CHECKED == SendMessage(g_hCleanupCheck, BM_GETCHECK, 0, 0));
     bool logCleanup = (BST_CHECKED == SendMessage(g_hLogCleanupCheck, BM_GETCHECK, 0, 0));
     
+    // Number of files extracted at the same time
+    int concurrency = (int)GetDlgItemInt(g_hMainWnd, ID_JOBS_EDIT, NULL, FALSE);
+    if (concurrency < 1) {
+        concurrency = 1;
+    }
+    
     // Debug: Always show checkbox states
-    sprintf(logMsg, "Debug: Cleanup checkbox = %s, Log cleanup checkbox = %s\n", 
+    sprintf(logMsg, "Debug: Cleanup checkbox = %s, Log cleanup checkbox = %s, Parallel jobs = %d\n", 
             cleanup ? "CHECKED" : "UNCHECKED", 
-            logCleanup ? "CHECKED" : "UNCHECKED");
+            logCleanup ? "CHECKED" : "UNCHECKED",
+            concurrency);
     appendToLog(logMsg);
     
     if (!showProgressDlg && cleanup) {
@@ -210,265 +255,75 @@ DWORD WINAPI extractionThread(LPVOID lpParam) {
     int successCount = 0;
     int failureCount = 0;
     int skippedCount = 0;
+    int cancelledCount = 0;
+    
+    BATCH_JOB* jobs = (BATCH_JOB*)calloc(g_fileCount, sizeof(BATCH_JOB));
+    if (!jobs) {
+        appendToLog("Failed to allocate memory for the extraction jobs.\n");
+        PostMessage(g_hMainWnd, WM_EXTRACTION_DONE, (WPARAM)-1, 0);
+        return 0;
+    }
     
-    // Parse and process each file
+    // g_selectedFiles holds a sequence of full, null-terminated paths (built
+    // during selection), so use each directly.
     char* currentPos = g_selectedFiles;
+    for (int i = 0; i < g_fileCount; i++) {
+        jobs[i].pbp_file = currentPos;
+        currentPos += strlen(currentPos) + 1;
+    }
     
-    if (g_fileCount == 1) {
-        // Single file - g_selectedFiles contains the full path
-        if (!showProgressDlg) {
-            sprintf(logMsg, "\n=== Processing file 1/1: %s ===\n", strrchr(currentPos, '\\') ? strrchr(currentPos, '\\') + 1 : currentPos);
-            appendToLog(logMsg);
-        }
-        
-        // Open log file for this extraction
-        openLogFile(currentPos);
-        
-        // Run extraction in separate process to avoid memory accumulation
-        char cmdLine[2048];
-        char cleanupFlag[8] = "";
-        if (cleanup) {
-            strcpy(cleanupFlag, "-c ");
-        }
-        
-        // Get current executable path
-        char exePath[MAX_PATH];
-        if (GetModuleFileNameA(NULL, exePath, sizeof(exePath)) == 0) {
-            strcpy(exePath, "psxtract.exe"); // fallback
-        }
-        
-        // Build command line using Unicode APIs
-        wchar_t wcmdLine[4096];
-        wchar_t wexePath[MAX_PATH];
-        wchar_t wcleanupFlag[16];
-        wchar_t wcurrentPos[MAX_PATH];
-        
-        MultiByteToWideChar(CP_UTF8, 0, exePath, -1, wexePath, MAX_PATH);
-        MultiByteToWideChar(CP_UTF8, 0, cleanupFlag, -1, wcleanupFlag, 16);
-        MultiByteToWideChar(CP_UTF8, 0, currentPos, -1, wcurrentPos, MAX_PATH);
-        
-        swprintf(wcmdLine, 4096, L"\"%ls\" %ls--gui \"%ls\"", wexePath, wcleanupFlag, wcurrentPos);
-        
-        // Change to output directory for this extraction
-        char originalDir[MAX_PATH];
-        wchar_t woriginal[MAX_PATH];
-        if (GetCurrentDirectoryW(MAX_PATH, woriginal) != 0) {
-            WideCharToMultiByte(CP_UTF8, 0, woriginal, -1, originalDir, sizeof(originalDir), NULL, NULL);
-        } else {
-            strcpy(originalDir, ".");
-        }
-        
-        // Convert output folder to wide char and change directory
-        int wlen = MultiByteToWideChar(CP_UTF8, 0, g_outputFolder, -1, NULL, 0);
-        wchar_t* woutputfolder = (wchar_t*)malloc(wlen * sizeof(wchar_t));
-        if (woutputfolder) {
-            MultiByteToWideChar(CP_UTF8, 0, g_outputFolder, -1, woutputfolder, wlen);
-            SetCurrentDirectoryW(woutputfolder);
-            free(woutputfolder);
-        }
-        
-        STARTUPINFOW si;
-        PROCESS_INFORMATION pi;
-        ZeroMemory(&si, sizeof(si));
-        ZeroMemory(&pi, sizeof(pi));
-        si.cb = sizeof(si);
-        
-        
-        if (CreateProcessW(NULL, wcmdLine, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi)) {
-            // Tie the child's lifetime to this GUI process (kill-on-close job).
-            superviseChild(pi.hProcess);
-            // Wait for the process to complete
-            WaitForSingleObject(pi.hProcess, INFINITE);
-            
-            // Get exit code
-            DWORD exitCode;
-            GetExitCodeProcess(pi.hProcess, &exitCode);
-            
-            CloseHandle(pi.hProcess);
-            CloseHandle(pi.hThread);
-            
-            // Close log file for this extraction
-            closeLogFile();
-            
-            if (exitCode == 0) {
-                successCount++;
-                sprintf(logMsg, "File completed successfully.\n");
-                appendToLog(logMsg);
-                
-                // Clean up log file if requested
-                if (logCleanup) {
-                    cleanupLogFile(currentPos);
-                }
-            } else if (exitCode == (DWORD)-2 || exitCode == 4294967294U) { // -2 as unsigned (user cancellation)
-                skippedCount++;
-                sprintf(logMsg, "File extraction cancelled by user.\n");
-                appendToLog(logMsg);
-            } else {
-                failureCount++;
-                overallResult = exitCode;
-                sprintf(logMsg, "File failed with exit code %d.\n", (int)exitCode);
-                appendToLog(logMsg);
+    GUI_BATCH batch;
+    batch.total = g_fileCount;
+    batch.concurrency = concurrency;
+    batch.showProgressDlg = showProgressDlg;
+    batch.started = 0;
+    
+    BATCH_OPTIONS options;
+    memset(&options, 0, sizeof(options));
+    options.concurrency = concurrency;
+    options.cleanup = cleanup;
+    options.verbose = false;
+    options.log_files = true;
+    options.echo = true;
+    options.output_dir = g_outputFolder;
+    options.cancel = &g_cancelBatch;
+    options.notify = onJobStatus;
+    options.notify_ctx = &batch;
+    
+    batch_run(jobs, g_fileCount, &options);
+    
+    for (int i = 0; i < g_fileCount; i++) {
+        switch (jobs[i].status) {
+        case BATCH_SUCCEEDED:
+            successCount++;
+            // Clean up log file if requested
+            if (logCleanup && jobs[i].log_path[0] != 0) {
+                cleanupLogFile(jobs[i].log_path);
             }
-        } else {
+            break;
+        case BATCH_SKIPPED:
+            skippedCount++;
+            break;
+        case BATCH_CANCELLED:
+            cancelledCount++;
+            break;
+        default:
             failureCount++;
-            overallResult = -1;
-            sprintf(logMsg, "Failed to start extraction process.\n");
-            appendToLog(logMsg);
-        }
-        
-        // Restore original directory
-        int woriglen = MultiByteToWideChar(CP_UTF8, 0, originalDir, -1, NULL, 0);
-        wchar_t* woriginaldir = (wchar_t*)malloc(woriglen * sizeof(wchar_t));
-        if (woriginaldir) {
-            MultiByteToWideChar(CP_UTF8, 0, originalDir, -1, woriginaldir, woriglen);
-            SetCurrentDirectoryW(woriginaldir);
-            free(woriginaldir);
-        }
-    } else {
-        // Multiple files - g_selectedFiles holds a sequence of full,
-        // null-terminated paths (built during selection), so use each directly.
-        // Selection already flattened the raw Win32 "directory\0file\0file"
-        // format into full paths, so we must NOT treat the first entry as a base
-        // directory - doing that dropped the first file and mangled the rest into
-        // paths like "C:\dir\a.PBP\C:\dir\b.PBP".
-        int fileIndex = 1;
-        while (*currentPos != '\0') {
-            // Each entry is already a complete path.
-            char fullPath[MAX_PATH];
-            strncpy(fullPath, currentPos, sizeof(fullPath) - 1);
-            fullPath[sizeof(fullPath) - 1] = '\0';
-
-            // Use just the file name (basename) in progress/log messages.
-            const char* displayName = strrchr(currentPos, '\\');
-            displayName = displayName ? displayName + 1 : currentPos;
-            
-            // Clear GUI log for each file (except first) to keep it clean in batch mode
-            if (fileIndex > 1) {
-                clearGUILog();
-            }
-            
-            // Always send processing message to GUI log
-            sprintf(logMsg, "\n=== Processing file %d/%d: %s ===\n", fileIndex, g_fileCount, displayName);
-            appendToLog(logMsg);
-            
-            // Update progress dialog if shown
-            if (showProgressDlg) {
-                sprintf(logMsg, "BATCH_UPDATE_PROGRESS:%d:%d:%s", fileIndex, g_fileCount, displayName);
-                PostMessage(g_hMainWnd, WM_UPDATE_PROGRESS, 0, (LPARAM)_strdup(logMsg));
-                Sleep(50); // Brief delay to let UI update
-            }
-            
-            
-            // Open log file for this extraction
-            openLogFile(fullPath);
-            
-            // Run extraction in separate process to avoid memory accumulation
-            char cmdLine[2048];
-            char cleanupFlag[8] = "";
-            if (cleanup) {
-                strcpy(cleanupFlag, "-c ");
-            }
-            
-            // Get current executable path
-            char exePath[MAX_PATH];
-            if (GetModuleFileNameA(NULL, exePath, sizeof(exePath)) == 0) {
-                strcpy(exePath, "psxtract.exe"); // fallback
-            }
-            
-            // Build command line using Unicode APIs
-            wchar_t wcmdLine[4096];
-            wchar_t wexePath[MAX_PATH];
-            wchar_t wcleanupFlag[16];
-            wchar_t wfullPath[MAX_PATH];
-            
-            MultiByteToWideChar(CP_UTF8, 0, exePath, -1, wexePath, MAX_PATH);
-            MultiByteToWideChar(CP_UTF8, 0, cleanupFlag, -1, wcleanupFlag, 16);
-            MultiByteToWideChar(CP_UTF8, 0, fullPath, -1, wfullPath, MAX_PATH);
-            
-            swprintf(wcmdLine, 4096, L"\"%ls\" %ls--gui \"%ls\"", wexePath, wcleanupFlag, wfullPath);
-            
-            // Change to output directory for this extraction
-            char originalDir[MAX_PATH];
-            wchar_t woriginal[MAX_PATH];
-            if (GetCurrentDirectoryW(MAX_PATH, woriginal) != 0) {
-                WideCharToMultiByte(CP_UTF8, 0, woriginal, -1, originalDir, sizeof(originalDir), NULL, NULL);
-            } else {
-                strcpy(originalDir, ".");
-            }
-            
-            // Convert output folder to wide char and change directory
-            int wlen = MultiByteToWideChar(CP_UTF8, 0, g_outputFolder, -1, NULL, 0);
-            wchar_t* woutputfolder = (wchar_t*)malloc(wlen * sizeof(wchar_t));
-            if (woutputfolder) {
-                MultiByteToWideChar(CP_UTF8, 0, g_outputFolder, -1, woutputfolder, wlen);
-                SetCurrentDirectoryW(woutputfolder);
-                free(woutputfolder);
-            }
-            
-            STARTUPINFOW si;
-            PROCESS_INFORMATION pi;
-            ZeroMemory(&si, sizeof(si));
-            ZeroMemory(&pi, sizeof(pi));
-            si.cb = sizeof(si);
-            
-            
-            if (CreateProcessW(NULL, wcmdLine, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi)) {
-                // Tie the child's lifetime to this GUI process (kill-on-close job).
-                superviseChild(pi.hProcess);
-                // Wait for the process to complete
-                WaitForSingleObject(pi.hProcess, INFINITE);
-                
-                // Get exit code
-                DWORD exitCode;
-                GetExitCodeProcess(pi.hProcess, &exitCode);
-                
-                CloseHandle(pi.hProcess);
-                CloseHandle(pi.hThread);
-                
-                // Close log file for this extraction
-                closeLogFile();
-                
-                if (exitCode == 0) {
-                    successCount++;
-                    sprintf(logMsg, "File completed successfully.\n");
-                    appendToLog(logMsg);
-                    
-                    // Clean up log file if requested
-                    if (logCleanup) {
-                        cleanupLogFile(fullPath);
-                    }
-                } else {
-                    failureCount++;
-                    overallResult = exitCode;
-                    sprintf(logMsg, "File failed with exit code %d.\n", (int)exitCode);
-                    appendToLog(logMsg);
-                }
-            } else {
-                failureCount++;
-                overallResult = -1;
-                sprintf(logMsg, "Failed to start extraction process.\n");
-                appendToLog(logMsg);
-            }
-            
-            // Restore original directory
-            int woriglen = MultiByteToWideChar(CP_UTF8, 0, originalDir, -1, NULL, 0);
-            wchar_t* woriginaldir = (wchar_t*)malloc(woriglen * sizeof(wchar_t));
-            if (woriginaldir) {
-                MultiByteToWideChar(CP_UTF8, 0, originalDir, -1, woriginaldir, woriglen);
-                SetCurrentDirectoryW(woriginaldir);
-                free(woriginaldir);
-            }
-            
-            // Move to next filename
-            currentPos += strlen(currentPos) + 1;
-            fileIndex++;
+            overallResult = jobs[i].exit_code ? jobs[i].exit_code : -1;
+            break;
         }
     }
+    free(jobs);
+    
+    if (g_cancelBatch) {
+        appendToLog("Extraction cancelled.\n");
+        overallResult = -2;
+    }
     
     // Log batch completion summary
     if (showProgressDlg) {
         // Update progress dialog with completion summary
-        sprintf(logMsg, "Complete! %d successful, %d skipped, %d failed", successCount, skippedCount, failureCount);
+        sprintf(logMsg, "Complete! %d successful, %d skipped, %d failed", successCount, skippedCount + cancelledCount, failureCount);
         if (g_hProgressText) {
             SetWindowText(g_hProgressText, logMsg);
         }
@@ -489,6 +344,10 @@ DWORD WINAPI extractionThread(LPVOID lpParam) {
     appendToLog(logMsg);
     sprintf(logMsg, "Skipped: %d\n", skippedCount);
     appendToLog(logMsg);
+    if (cancelledCount > 0) {
+        sprintf(logMsg, "Cancelled: %d\n", cancelledCount);
+        appendToLog(logMsg);
+    }
     sprintf(logMsg, "Failed: %d\n", failureCount);
     appendToLog(logMsg);
     
@@ -666,23 +525,17 @@ void onExtract() {
     EnableWindow(g_hCancelButton, TRUE);
     
     // Start extraction in a separate thread
+    InterlockedExchange(&g_cancelBatch, 0);
     g_hExtractionThread = CreateThread(NULL, 0, extractionThread, NULL, 0, NULL);
 }
 
 void onCancel() {
-    if (g_hExtractionThread) {
-        // Stop log tailing immediately
-        stopLogTailing();
-
-        // Kill the running extraction child process, then terminate the thread
-        // that was blocked waiting on it (thread alone would orphan the child).
-        killExtractionChildren();
-        TerminateThread(g_hExtractionThread, 1);
-        
-        appendToLog("Extraction cancelled.\n");
-        
-        // Manually trigger completion handling
-        PostMessage(g_hMainWnd, WM_EXTRACTION_DONE, (WPARAM)-2, 0);
+    if (g_hExtractionThread && !g_cancelBatch) {
+        // Ask the running jobs to stop; the extraction thread reports back
+        // once they have, and the files not started yet are skipped.
+        InterlockedExchange(&g_cancelBatch, 1);
+        EnableWindow(g_hCancelButton, FALSE);
+        appendToLog("Cancelling, waiting for the running extractions to stop...\n");
     }
 }
 
@@ -698,55 +551,9 @@ void appendToLog(const char* text) {
     }
 }
 
-void openLogFile(const char* pbpPath) {
-    stopLogTailing();
-    
-    char logFileName[MAX_PATH];
-    strcpy(logFileName, PathFindFileNameA(pbpPath));
-    PathRemoveExtensionA(logFileName);
-    strcat(logFileName, ".log");
-    
-    // Build path in output folder (where the CLI will create the log file)
-    char logPath[MAX_PATH];
-    PathCombineA(logPath, g_outputFolder, logFileName);
-    
-    startLogTailing(logPath);
-}
-
-void openLogFileForWriting(const char* pbpPath) {
-    if (g_logFile) {
-        fclose(g_logFile);
-        g_logFile = NULL;
-    }
-    
-    char logFileName[MAX_PATH];
-    strcpy(logFileName, PathFindFileNameA(pbpPath));
-    PathRemoveExtensionA(logFileName);
-    strcat(logFileName, ".log");
-    
-    // Write log file to current working directory (which is the output folder when launched from GUI)
-    g_logFile = fopen(logFileName, "w");
-}
-
-void closeLogFile() {
-    // Stop log tailing
-    stopLogTailing();
-    
-    if (g_logFile) {
-        fclose(g_logFile);
-        g_logFile = NULL;
-    }
-}
-
-void cleanupLogFile(const char* pbpPath) {
-    // Create log filename the same way openLogFileForWriting does
-    char logFileName[MAX_PATH];
-    strcpy(logFileName, PathFindFileNameA(pbpPath));
-    PathRemoveExtensionA(logFileName);
-    strcat(logFileName, ".log");
-    
+void cleanupLogFile(const char* logPath) {
     // Convert to wide characters for Unicode-aware delete
-    int wlen = MultiByteToWideChar(CP_UTF8, 0, logFileName, -1, NULL, 0);
+    int wlen = MultiByteToWideChar(CP_UTF8, 0, logPath, -1, NULL, 0);
     wchar_t* wlogPath = (wchar_t*)malloc(wlen * sizeof(wchar_t));
     if (!wlogPath) {
         char errorMsg[512];
@@ -754,9 +561,10 @@ void cleanupLogFile(const char* pbpPath) {
         appendToLog(errorMsg);
         return;
     }
-    MultiByteToWideChar(CP_UTF8, 0, logFileName, -1, wlogPath, wlen);
+    MultiByteToWideChar(CP_UTF8, 0, logPath, -1, wlogPath, wlen);
     
     // Delete the log file using Unicode-aware function
+    const char* logFileName = PathFindFileNameA(logPath);
     if (DeleteFileW(wlogPath)) {
         char successMsg[512];
         sprintf(successMsg, "Cleaned up log file: %s\n", logFileName);
@@ -780,88 +588,11 @@ void clearGUILog() {
     }
 }
 
-void startLogTailing(const char* logPath) {
-    stopLogTailing(); // Stop any existing tailing
-    
-    strcpy(g_currentLogPath, logPath);
-    g_logTailActive = true;
-    
-    g_hLogTailThread = CreateThread(NULL, 0, logTailThread, NULL, 0, NULL);
-}
-
-void stopLogTailing() {
-    if (g_logTailActive) {
-        g_logTailActive = false;
-        if (g_hLogTailThread) {
-            WaitForSingleObject(g_hLogTailThread, 1000); // Wait up to 1 second
-            CloseHandle(g_hLogTailThread);
-            g_hLogTailThread = NULL;
-        }
-    }
-}
-
-DWORD WINAPI logTailThread(LPVOID lpParam) {
-    FILE* logFile = NULL;
-    long lastPosition = 0;
-    char buffer[1024];
-    
-    while (g_logTailActive) {
-        // Try to open the log file if not already open
-        if (!logFile) {
-            logFile = fopen(g_currentLogPath, "r");
-            if (!logFile) {
-                Sleep(100); // Wait and retry
-                continue;
-            }
-            lastPosition = 0;
-        }
-        
-        // Seek to last known position
-        fseek(logFile, lastPosition, SEEK_SET);
-        
-        // Read new content
-        size_t bytesRead = fread(buffer, 1, sizeof(buffer) - 1, logFile);
-        if (bytesRead > 0) {
-            buffer[bytesRead] = '\0';
-            
-            // Send new content to GUI log
-            appendToLog(buffer);
-            
-            // Update position
-            lastPosition = ftell(logFile);
-        }
-        
-        // Check if file was truncated or recreated
-        long currentSize = ftell(logFile);
-        fseek(logFile, 0, SEEK_END);
-        long endSize = ftell(logFile);
-        
-        if (currentSize > endSize) {
-            // File was truncated, start from beginning
-            lastPosition = 0;
-        }
-        
-        Sleep(50); // Check every 50ms
-    }
-    
-    if (logFile) {
-        fclose(logFile);
-    }
-    
-    return 0;
-}
-
 void appendToLogDirect(const char* text) {
-    // This is used by the psxtract core to write directly to log files
-    if (g_logFile) {
-        // Write to log file if one is open
-        fprintf(g_logFile, "%s", text);
-        fflush(g_logFile);
-    } else {
-        // Write to stdout if no log file
-        fprintf(stdout, "%s", text);
-        fflush(stdout);
-    }
+    // Used with --gui from the command line, where there is no log window;
+    // the log file itself is written by the batch (see batch_log)
+    fprintf(stdout, "%s", text);
+    fflush(stdout);
 }
 
 // Function for important messages that should go to GUI log
@@ -928,6 +659,12 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                         WS_VISIBLE | WS_CHILD | BS_AUTOCHECKBOX,
                         10, 115, 300, 20, hWnd, (HMENU)ID_LOGCLEANUP_CHECK, GetModuleHandle(NULL), NULL);
             
+            CreateWindow("STATIC", "Parallel jobs:", WS_VISIBLE | WS_CHILD,
+                        330, 90, 90, 20, hWnd, NULL, GetModuleHandle(NULL), NULL);
+            
+            g_hJobsEdit = CreateWindow("EDIT", "2", WS_VISIBLE | WS_CHILD | WS_BORDER | ES_NUMBER,
+                        425, 88, 45, 22, hWnd, (HMENU)ID_JOBS_EDIT, GetModuleHandle(NULL), NULL);
+            
             // Default cleanup to checked in GUI mode
             SendMessage(g_hCleanupCheck, BM_SETCHECK, BST_CHECKED, 0);
             SendMessage(g_hLogCleanupCheck, BM_SETCHECK, BST_CHECKED, 0);
@@ -960,6 +697,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             SendMessage(g_hCancelButton, WM_SETFONT, (WPARAM)hFont, TRUE);
             SendMessage(g_hCleanupCheck, WM_SETFONT, (WPARAM)hFont, TRUE);
             SendMessage(g_hLogCleanupCheck, WM_SETFONT, (WPARAM)hFont, TRUE);
+            SendMessage(g_hJobsEdit, WM_SETFONT, (WPARAM)hFont, TRUE);
             SendMessage(g_hLogEdit, WM_SETFONT, (WPARAM)hFont, TRUE);
         }
         break;
@@ -1069,9 +807,6 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
                 }
             }
             
-            // Stop log tailing
-            stopLogTailing();
-            
             // Clean up thread handle
             if (g_hExtractionThread) {
                 CloseHandle(g_hExtractionThread);
@@ -1101,6 +836,9 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 
 int showGUI() {
     WNDCLASSEX wcex;
+    
+    // Extractions run in this process, so their output and prompts go to the window
+    setGUIMode(true);
     const char* className = "PSXExtractorGUI";
     
     // Register window class
@@ -1171,11 +909,13 @@ void enableExtractButton(bool enabled) {
 
 // GUI-aware prompt function
 bool gui_prompt(const char* message, const char* title) {
+    bool answer = false;
+    AcquireSRWLockExclusive(&g_promptLock);
     if (g_guiMode) {
-        // Use MessageBox in GUI mode (use NULL as parent for subprocess)
+        // Use MessageBox in GUI mode (use NULL as parent for --gui)
         HWND parent = g_hMainWnd ? g_hMainWnd : NULL;
         int result = MessageBox(parent, message, title, MB_YESNO | MB_ICONQUESTION);
-        return (result == IDYES);
+        answer = (result == IDYES);
     } else {
         // Fall back to console prompt
         fprintf(stdout, "%s (y/N): ", message);
@@ -1184,10 +924,12 @@ bool gui_prompt(const char* message, const char* title) {
         char input[10];
         if (fgets(input, sizeof(input), stdin) != NULL) {
             char response = input[0];
-            return (response == 'y' || response == 'Y');
+            answer = (response == 'y' || response == 'Y');
         }
-        return false; // Default to No if input fails
+        // Default to No if input fails
     }
+    ReleaseSRWLockExclusive(&g_promptLock);
+    return answer;
 }
 
 // Progress Dialog Implementation
@@ -1195,12 +937,10 @@ LRESULT CALLBACK ProgressDialogProc(HWND hWnd, UINT message, WPARAM wParam, LPAR
     switch (message) {
     case WM_COMMAND:
         if (LOWORD(wParam) == IDCANCEL) {
-            // Cancel button pressed - kill the child process then the thread
-            if (g_hExtractionThread) {
-                killExtractionChildren();
-                TerminateThread(g_hExtractionThread, 1);
-                appendToLog("Batch extraction cancelled by user.\n");
-                PostMessage(g_hMainWnd, WM_EXTRACTION_DONE, (WPARAM)-2, 0);
+            // Cancel button pressed - stop the batch like the main Cancel button
+            onCancel();
+            if (g_hProgressCancel) {
+                EnableWindow(g_hProgressCancel, FALSE);
             }
             return 0;
         }
@@ -1454,18 +1194,19 @@ int gui_create_selection_dialog(const char* title, const char* message, const ch
 
 // GUI-aware selection function
 int gui_select_option(const char* title, const char* message, const char* options[], int option_count) {
+    int choice = 0;
+    AcquireSRWLockExclusive(&g_promptLock);
     if (!isGUIMode()) {
-        // Console mode - use existing console selection logic
-        printf("\n%s\n", message);
+        // Console mode - straight to stdout, as a batch job's printf goes to its log
+        fprintf(stdout, "\n%s\n", message);
         
         for (int i = 0; i < option_count; i++) {
-            printf("  %d) %s\n", i + 1, options[i]);
+            fprintf(stdout, "  %d) %s\n", i + 1, options[i]);
         }
         
-        printf("\nEnter your choice (1-%d): ", option_count);
+        fprintf(stdout, "\nEnter your choice (1-%d): ", option_count);
         fflush(stdout);
         
-        int choice = 0;
         char input[16];
         
         if (fgets(input, sizeof(input), stdin)) {
@@ -1474,16 +1215,19 @@ int gui_select_option(const char* title, const char* message, const char* option
         
         // Validate choice
         if (choice < 1 || choice > option_count) {
-            printf("Invalid choice. Using first option: %s\n", options[0]);
-            return 0; // Return 0-based index
+            fprintf(stdout, "Invalid choice. Using first option: %s\n", options[0]);
+            choice = 1;
+        } else {
+            fprintf(stdout, "Selected: %s\n\n", options[choice - 1]);
         }
-        
-        printf("Selected: %s\n\n", options[choice - 1]);
-        return choice - 1; // Return 0-based index
+        fflush(stdout);
+        choice--; // Return 0-based index
     } else {
         // GUI mode - create a proper dialog with individual buttons
-        return gui_create_selection_dialog(title, message, options, option_count);
+        choice = gui_create_selection_dialog(title, message, options, option_count);
     }
+    ReleaseSRWLockExclusive(&g_promptLock);
+    return choice;
 }
 
 void showAtrac3CodecWarning() {
@@ -0,0 +1,374 @@
+#include "inspect.h"
+#include "iso_header.h"
+#include "crypto.h"
+#include "reader.h"
+#include "pxidx.h"
+#include "vdisc.h"
+#include "parallel.h"
+#include "cue_resources.h"
+#include "batch.h"
+#include <stdarg.h>
+
+#define INSPECT_MAX_DISCS 5
+#define INSPECT_MAX_CUES  12
+#define INSPECT_MAX_DIR_SECTORS 16  // Root directory sectors searched for SYSTEM.CNF.
+
+// Growable line of JSON text.
+typedef struct {
+    char* data;
+    int length;
+    int capacity;
+} JSON_BUFFER;
+
+static void json_append(JSON_BUFFER* json, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int needed = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (needed < 0)
+        return;
+
+    if (json->length + needed + 1 > json->capacity) {
+        int capacity = json->capacity ? json->capacity : 1024;
+        while (json->length + needed + 1 > capacity)
+            capacity *= 2;
+        char* data = (char*)realloc(json->data, capacity);
+        if (data == NULL)
+            return;
+        json->data = data;
+        json->capacity = capacity;
+    }
+
+    va_start(args, format);
+    vsnprintf(json->data + json->length, json->capacity - json->length, format, args);
+    va_end(args);
+    json->length += needed;
+}
+
+// Appends value as a quoted JSON string. The text is UTF-8 already, so only
+// quotes, backslashes and control characters need escaping.
+static void json_string(JSON_BUFFER* json, const char* value)
+{
+    json_append(json, "\"");
+    for (const unsigned char* c = (const unsigned char*)value; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            json_append(json, "\\%c", *c);
+        else if (*c < 0x20)
+            json_append(json, "\\u%04x", *c);
+        else
+            json_append(json, "%c", *c);
+    }
+    json_append(json, "\"");
+}
+
+// Prebaked CUE files for a disc serial (SLUS_000.01 is stored as SLUS-000.01).
+static void json_cue_matches(JSON_BUFFER* json, const char* serial)
+{
+    char cue_name[0x20];
+    snprintf(cue_name, sizeof(cue_name), "%s", serial);
+    for (int i = 0; cue_name[i]; i++) {
+        if (cue_name[i] == '_')
+            cue_name[i] = '-';
+    }
+
+    CueCandidate candidates[INSPECT_MAX_CUES];
+    int count = find_cue_candidates(cue_name, candidates, INSPECT_MAX_CUES);
+    json_append(json, "\"cue\":[");
+    for (int i = 0; i < count; i++) {
+        if (i > 0)
+            json_append(json, ",");
+        json_string(json, candidates[i].game_id);
+    }
+    json_append(json, "]");
+}
+
+// Copies the 2048 bytes of user data of ISO 9660 sector lba into data.
+static bool read_user_data(VIRTUAL_DISC* disc, int lba, unsigned char* data)
+{
+    unsigned char sector[SECTOR_SIZE];
+    if (vdisc_read_sectors(disc, lba, 1, sector) != 1)
+        return false;
+    // Mode 1 data follows the header, mode 2 form 1 the subheader as well.
+    memcpy(data, sector + ((sector[15] == 2) ? 24 : 16), 2048);
+    return true;
+}
+
+static unsigned int le32(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+// Looks up SYSTEM.CNF in the root directory of the data track and copies the
+// value of its BOOT line (e.g. cdrom:\SLUS_000.01;1) into boot. Returns false
+// if the disc has none.
+static bool read_boot_file(VIRTUAL_DISC* disc, char* boot, int size)
+{
+    unsigned char data[2048];
+    if (!read_user_data(disc, 16, data) || data[0] != 1 || memcmp(data + 1, "CD001", 5))
+        return false;
+
+    // Root directory record of the primary volume descriptor.
+    int dir_lba = (int)le32(data + 156 + 2);
+    int dir_sectors = (int)((le32(data + 156 + 10) + 2047) / 2048);
+    if (dir_sectors > INSPECT_MAX_DIR_SECTORS)
+        dir_sectors = INSPECT_MAX_DIR_SECTORS;
+
+    int file_lba = -1;
+    unsigned int file_size = 0;
+    for (int i = 0; i < dir_sectors && file_lba < 0; i++) {
+        if (!read_user_data(disc, dir_lba + i, data))
+            return false;
+        // Records don't cross sectors, a zero length pads to the next one.
+        for (int pos = 0; pos + 33 <= 2048 && data[pos] != 0; pos += data[pos]) {
+            int name_length = data[pos + 32];
+            if (pos + 33 + name_length > 2048)
+                break;
+            if ((name_length == 10 || name_length == 12) && !_strnicmp((const char*)data + pos + 33, "SYSTEM.CNF;1", name_length)) {
+                file_lba = (int)le32(data + pos + 2);
+                file_size = le32(data + pos + 10);
+                break;
+            }
+        }
+    }
+    if (file_lba < 0 || !read_user_data(disc, file_lba, data))
+        return false;
+
+    // KEY = VALUE lines, the first sector is plenty for SYSTEM.CNF.
+    int length = (file_size < sizeof(data)) ? (int)file_size : (int)sizeof(data);
+    for (int line = 0; line < length; ) {
+        int end = line;
+        while (end < length && data[end] != '\r' && data[end] != '\n')
+            end++;
+        int key = line;
+        while (key < end && (data[key] == ' ' || data[key] == '\t'))
+            key++;
+        if (end - key > 4 && !_strnicmp((const char*)data + key, "BOOT", 4)) {
+            int value = key + 4;
+            while (value < end && (data[value] == ' ' || data[value] == '\t'))
+                value++;
+            if (value < end && data[value] == '=') {
+                value++;
+                while (value < end && (data[value] == ' ' || data[value] == '\t'))
+                    value++;
+                int value_end = end;
+                while (value_end > value && (data[value_end - 1] == ' ' || data[value_end - 1] == '\t' || data[value_end - 1] == 0))
+                    value_end--;
+                int count = value_end - value;
+                if (count > size - 1)
+                    count = size - 1;
+                memcpy(boot, data + value, count);
+                boot[count] = 0;
+                return count > 0;
+            }
+        }
+        line = end + 1;
+    }
+    return false;
+}
+
+// Decrypted ISO header of the disc at disc_offset, from the index if allowed
+// and up to date.
+static unsigned char* load_iso_header(const char* eboot, PBP_SECTION* psar, unsigned int disc_offset, int disc_num,
+                                      unsigned char* pgd_key, bool use_index, int* header_size)
+{
+    char index_path[MAX_PATH];
+    PXIDX_INFO info;
+    memset(&info, 0, sizeof(info));
+    if (use_index) {
+        pxidx_path(eboot, disc_num, index_path, sizeof(index_path));
+        unsigned char* iso_header = pxidx_load(index_path, psar, pgd_key, header_size, &info);
+        if (iso_header != NULL && info.disc_offset == disc_offset)
+            return iso_header;
+        delete[] iso_header;
+    }
+
+    unsigned char* iso_header = decrypt_psar_pgd(psar, (long long)disc_offset + ISO_HEADER_OFFSET, ISO_HEADER_SIZE, pgd_key, header_size);
+    if (iso_header != NULL && use_index) {
+        memset(&info, 0, sizeof(info));
+        info.disc_offset = disc_offset;
+        pxidx_save(index_path, psar, pgd_key, iso_header, *header_size, &info);
+    }
+    return iso_header;
+}
+
+// Appends the JSON object of one disc. Returns -1, having appended nothing, if
+// its header can't be read.
+static int inspect_disc(JSON_BUFFER* json, const char* eboot, PBP_SECTION* psar, unsigned int disc_offset, int disc_num,
+                        unsigned char* pgd_key, bool use_index, bool read_boot)
+{
+    int header_size = 0;
+    unsigned char* iso_header = load_iso_header(eboot, psar, disc_offset, disc_num, pgd_key, use_index, &header_size);
+    if (iso_header == NULL)
+        return -1;
+    ISO_HEADER header;
+    int result = parse_iso_header(iso_header, header_size, &header);
+    delete[] iso_header;
+    if (result < 0)
+        return -1;
+
+    long long compressed = 0;
+    for (int i = 0; i < header.num_blocks; i++)
+        compressed += header.blocks[i].size;
+    int data_sectors = data_track_sectors(&header);
+
+    json_append(json, "{\"disc\":%d,\"serial\":", (disc_num > 0) ? disc_num : 1);
+    json_string(json, header.disc_name);
+    json_append(json, ",\"title\":");
+    json_string(json, header.title);
+    json_append(json, ",\"tracks\":%d,\"data_sectors\":%d,\"data_bytes\":%lld,\"data_compressed_bytes\":%lld,\"cdda\":[",
+                header.num_cdda + 1, data_sectors, (long long)data_sectors * SECTOR_SIZE, compressed);
+    for (int i = 0; i < header.num_cdda; i++) {
+        int sectors = get_track_size_from_cue(&header, i + 2);
+        json_append(json, "%s{\"track\":%d,\"sectors\":%d,\"bytes\":%lld,\"at3_bytes\":%u}",
+                    (i > 0) ? "," : "", i + 2, sectors, (long long)sectors * SECTOR_SIZE, header.cdda[i].size);
+    }
+    json_append(json, "],");
+
+    // The boot executable names the disc even when its serial is generic,
+    // but finding it means decompressing data blocks, so only on request.
+    if (read_boot) {
+        VIRTUAL_DISC* disc = vdisc_open(eboot, (disc_num > 0) ? disc_num - 1 : 0, pgd_key, use_index);
+        char boot[0x80];
+        if (disc != NULL && read_boot_file(disc, boot, sizeof(boot))) {
+            json_append(json, "\"boot\":");
+            json_string(json, boot);
+            json_append(json, ",");
+        }
+        vdisc_close(disc);
+    }
+
+    json_cue_matches(json, header.disc_name);
+    json_append(json, "}");
+
+    free_iso_header(&header);
+    return 0;
+}
+
+// Builds the JSON line of one EBOOT, without the trailing newline. Returns -1
+// (with an "error" member in the line) if it can't be read.
+static int inspect_eboot(JSON_BUFFER* json, const char* eboot, unsigned char* pgd_key, bool use_index, bool read_boot)
+{
+    json_append(json, "{\"file\":");
+    json_string(json, eboot);
+
+    const char* error = NULL;
+    INPUT_READER reader;
+    PBP_SECTION sections[8];
+    PBP_SECTION* psar = &sections[PBP_DATA_PSAR];
+    unsigned char magic[0x10];
+    if (reader_open(&reader, eboot) < 0) {
+        json_append(json, ",\"error\":\"can't open file\"}");
+        return -1;
+    }
+
+    if (open_pbp_sections(&reader, sections) < 0)
+        error = "not a PBP file";
+    else if (psar->size == 0)
+        error = "no DATA.PSAR";
+    else if (read_pbp_section(psar, 0, magic, sizeof(magic)) != sizeof(magic))
+        error = "can't read DATA.PSAR";
+    else if (memcmp(magic, "PSISOIMG0000", 0xC) == 0) {
+        json_append(json, ",\"discs\":[");
+        if (inspect_disc(json, eboot, psar, 0, 0, pgd_key, use_index, read_boot) < 0)
+            error = "can't decrypt the ISO header";
+        json_append(json, "]");
+    } else if (memcmp(magic, "PSTITLEIMG000000", 0x10) == 0) {
+        // Multi-disc: disc offsets, collection serial and title from the map.
+        int map_size = 0;
+        unsigned char* iso_map = decrypt_psar_pgd(psar, 0x200, 0x2A0, pgd_key, &map_size);
+        if (iso_map == NULL || map_size < 0x18C) {
+            error = "can't decrypt the ISO disc map";
+        } else {
+            unsigned int disc_offset[INSPECT_MAX_DISCS];
+            char serial[0x10] = {};
+            char title[0x81] = {};
+            memcpy(disc_offset, iso_map, sizeof(disc_offset));
+            memcpy(serial, iso_map + 0x65, 0x0F);
+            memcpy(title, iso_map + 0x10C, 0x80);
+
+            json_append(json, ",\"serial\":");
+            json_string(json, serial);
+            json_append(json, ",\"title\":");
+            json_string(json, title);
+            json_append(json, ",\"discs\":[");
+            int discs = 0;
+            for (int i = 0; i < INSPECT_MAX_DISCS && error == NULL; i++) {
+                if (disc_offset[i] == 0)
+                    continue;
+                int mark = json->length;
+                if (discs > 0)
+                    json_append(json, ",");
+                if (inspect_disc(json, eboot, psar, disc_offset[i], i + 1, pgd_key, use_index, read_boot) < 0) {
+                    json->length = mark;    // Drop the separator.
+                    json->data[mark] = 0;
+                    error = "can't decrypt the ISO header";
+                }
+                discs++;
+            }
+            json_append(json, "]");
+        }
+        delete[] iso_map;
+    } else {
+        error = "not a PSOne Classic";
+    }
+    reader_close(&reader);
+
+    if (error != NULL)
+        json_append(json, ",\"error\":\"%s\"", error);
+    json_append(json, "}");
+    return (error != NULL) ? -1 : 0;
+}
+
+typedef struct {
+    PATH_LIST* list;
+    unsigned char* pgd_key;
+    bool use_index;
+    bool read_boot;
+    CRITICAL_SECTION output_lock;
+    volatile LONG failures;
+} INSPECT_JOB;
+
+// Lines go out as soon as each EBOOT is done, so the order follows the
+// workers rather than the directory listing.
+static int inspect_worker(void* ctx, int index)
+{
+    INSPECT_JOB* job = (INSPECT_JOB*)ctx;
+    JSON_BUFFER json = { NULL, 0, 0 };
+    if (inspect_eboot(&json, job->list->paths[index], job->pgd_key, job->use_index, job->read_boot) < 0)
+        InterlockedIncrement(&job->failures);
+
+    if (json.data != NULL) {
+        EnterCriticalSection(&job->output_lock);
+        fputs(json.data, stdout);
+        fputc('\n', stdout);
+        fflush(stdout);
+        LeaveCriticalSection(&job->output_lock);
+        free(json.data);
+    }
+    return 0;
+}
+
+int inspect_main(const char* path, const unsigned char* pgd_key, bool use_index, bool read_boot)
+{
+    PATH_LIST list = { NULL, 0, 0 };
+    batch_add_eboots(&list, path);
+
+    kirk_init();
+
+    INSPECT_JOB job;
+    job.list = &list;
+    unsigned char key[0x10] = {};
+    if (pgd_key != NULL)
+        memcpy(key, pgd_key, sizeof(key));
+    job.pgd_key = key;
+    job.use_index = use_index;
+    job.read_boot = read_boot;
+    job.failures = 0;
+    InitializeCriticalSection(&job.output_lock);
+    run_parallel(list.count, parallel_get_threads(), inspect_worker, &job);
+    DeleteCriticalSection(&job.output_lock);
+
+    batch_free_paths(&list);
+    return (job.failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+// Metadata-only scan of EBOOTs (--inspect), for cataloguing large libraries.
+//
+// Only the PBP header, the PSAR magic, the multi-disc map and the ISO header
+// PGDs are read and decrypted; no data block is decompressed and no audio is
+// touched. Every EBOOT becomes one JSON object on its own line on stdout:
+//
+//   {"file":"...","discs":[{"disc":1,"serial":"...","title":"...",
+//    "tracks":3,"data_sectors":N,"data_bytes":N,"data_compressed_bytes":N,
+//    "cdda":[{"track":2,"sectors":N,"bytes":N,"at3_bytes":N}],
+//    "cue":["SLUS-00001"]}]}
+//
+// Multi-disc EBOOTs also carry the collection "serial" and "title", and an
+// "error" member is added when an EBOOT can't be read. "cue" lists the
+// matching prebaked CUE files.
+//
+// On request (--boot) each disc is also opened as a VIRTUAL_DISC to add the
+// BOOT line of its SYSTEM.CNF, e.g. "boot":"cdrom:\\SLUS_000.01;1". That
+// decompresses the blocks of the root directory and SYSTEM.CNF, and the last
+// blocks of the track unless the .pxidx index knows where its data ends.
+
+// Inspects path, or every *.PBP below it when it is a directory, on
+// parallel_get_threads() workers. With use_index the ISO headers come from
+// (and go to) .pxidx sidecars, with read_boot the "boot" member is added.
+// Returns 0 if every EBOOT could be read.
+int inspect_main(const char* path, const unsigned char* pgd_key, bool use_index, bool read_boot);
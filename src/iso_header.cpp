@@ -0,0 +1,103 @@
+#include "iso_header.h"
+#include "gui.h"
+
+int parse_iso_header(const unsigned char* data, int size, ISO_HEADER* header)
+{
+    memset(header, 0, sizeof(ISO_HEADER));
+    if (size < ISO_TABLE_OFFSET) {
+        printf("ERROR: ISO header is too short (%d bytes)!\n", size);
+        return -1;
+    }
+
+    memcpy(header->disc_name, data + 1, 0x0F);
+    memcpy(header->title, data + 0xE2C, 0x80);
+    memcpy(&header->special_data_offset, data + 0xE20, sizeof(int));  // Always at 0xE20.
+    memcpy(&header->unknown_data_offset, data + 0xED4, sizeof(int));  // Always at 0xED4.
+    memcpy(&header->leadout, data + CUE_LEADOUT_OFFSET, sizeof(CUE_ENTRY));
+    memcpy(header->tracks, data + CUE_TABLE_OFFSET, MAX_CUE_TRACKS * sizeof(CUE_ENTRY));
+
+    // The CDDA table ends at the first empty entry.
+    for (int i = 0; i < MAX_CUE_TRACKS - 1; i++) {
+        memcpy(&header->cdda[i], data + CDDA_TABLE_OFFSET + i * sizeof(CDDA_ENTRY), sizeof(CDDA_ENTRY));
+        if (header->cdda[i].offset == 0)
+            break;
+        header->num_cdda++;
+    }
+
+    // So does the block table. Blocks are read into ISO_BLOCK_SIZE buffers,
+    // and stored blocks are never larger than that.
+    int max_blocks = (size - ISO_TABLE_OFFSET) / sizeof(ISO_ENTRY);
+    const ISO_ENTRY* table = (const ISO_ENTRY*)(data + ISO_TABLE_OFFSET);
+    while (header->num_blocks < max_blocks && table[header->num_blocks].size > 0) {
+        if (table[header->num_blocks].size > ISO_BLOCK_SIZE) {
+            printf("ERROR: ISO block %d is too large (%u bytes)!\n", header->num_blocks, (unsigned int)table[header->num_blocks].size);
+            return -1;
+        }
+        header->num_blocks++;
+    }
+    header->blocks = new ISO_ENTRY[header->num_blocks + 1];
+    memcpy(header->blocks, table, header->num_blocks * sizeof(ISO_ENTRY));
+    memset(&header->blocks[header->num_blocks], 0, sizeof(ISO_ENTRY));
+
+    return 0;
+}
+
+void free_iso_header(ISO_HEADER* header)
+{
+    delete[] header->blocks;
+    header->blocks = NULL;
+}
+
+int extract_frames_from_cue(const CUE_ENTRY* cue_entry, int gap)
+{
+    int mm1, ss1, ff1;
+    unsigned char mm = cue_entry->I1m;
+    unsigned char ss = cue_entry->I1s;
+    unsigned char ff = cue_entry->I1f;
+    // According to documentation http://endlessparadigm.com/forum/showthread.php?tid=14
+    // and for the vast majority of games tested Audio track type should be 0x01,
+    // however at least one case exists (Castlevania: SOTN) where the track types
+    // are increased by 0x20 (so data track is 0x61 rather than 0x41 and audio is
+    // 0x21 rather than 0x01).
+    if (cue_entry->type == 0x01 || cue_entry->type == 0x21
+        || cue_entry->type == 0x41 || cue_entry->type == 0x61) {
+        // convert 0xXY into decimal XY
+        mm1 = 10 * (mm - mm % 16) / 16 + mm % 16;
+        ss1 = (10 * (ss - ss % 16) / 16 + ss % 16) - gap;
+        ff1 = 10 * (ff - ff % 16) / 16 + ff % 16;
+        printf("Offset %dm:%ds:%df\n", mm1, ss1, ff1);
+        return (mm1 * 60 * 75) + (ss1 * 75) + ff1;
+    }
+    // once we hit invalid track type, indicate this is last track
+    // at which point we'll need to get entire disc size to calculate its length
+    return -1;
+}
+
+int get_track_size_from_cue(const ISO_HEADER* header, int track_num)
+{
+    int cur_track_offset = extract_frames_from_cue(&header->tracks[track_num - 1], 2);
+    if (cur_track_offset < 0) {
+        printf("ERROR: unable to get current track offset, aborting...\n");
+        return -1;
+    }
+    int next_track_offset = extract_frames_from_cue(&header->tracks[track_num], 2);
+    if (next_track_offset < 0) {
+        // get disc size to calculate last track, no gap after last track
+        next_track_offset = extract_frames_from_cue(&header->leadout, 0);
+        if (next_track_offset < 0) {
+            printf("ERROR: last track size calculation failed, aborting...\n");
+            return -1;
+        }
+    }
+    return next_track_offset - cur_track_offset;
+}
+
+int data_track_sectors(const ISO_HEADER* header)
+{
+    int track_size = get_track_size_from_cue(header, 1) - GAP_FRAMES;  // subtract 2 seconds
+    if (track_size < 0) {
+        printf("Unable to get data track size\n");
+        return -1;
+    }
+    return track_size;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "cdrom.h"
+
+// Layout of the ISO header of a PSOne Classic disc (decrypted PGD at
+// ISO_HEADER_OFFSET in DATA.PSAR, or at the disc offset + ISO_HEADER_OFFSET
+// for multi-disc games) and of the compressed data track that follows it.
+
+#define GAP_FRAMES	2 * 75	// 2 seconds
+#define GAP_SIZE	GAP_FRAMES * SECTOR_SIZE  // 2 seconds * 75 frames * 2352 sector size
+#define ISO_BLOCK_SIZE	16 * SECTOR_SIZE
+#define ISO_HEADER_OFFSET 0x400
+#define ISO_HEADER_SIZE	0xB6600
+#define ISO_BASE_OFFSET	0x100000
+#define CUE_LEADOUT_OFFSET	0x414
+#define CUE_TABLE_OFFSET	0x41E	// Track 01, followed by the other tracks.
+#define CDDA_TABLE_OFFSET	0x800
+#define ISO_TABLE_OFFSET	0x3C00
+#define MAX_CUE_TRACKS	99
+
+// CUE structure
+typedef struct {
+    unsigned short   type;          // Track Type = 41h for DATA, 01h for CDDA, A2h for lead out
+    unsigned char    number;        // Track Number (01h to 99h)
+    unsigned char    I0m;           // INDEX 00 MM
+    unsigned char    I0s;           // INDEX 00 SS
+    unsigned char    I0f;           // INDEX 00 FF
+    unsigned char    padding;       // NULL
+    unsigned char    I1m;           // INDEX 01 MM
+    unsigned char    I1s;           // INDEX 01 SS
+    unsigned char    I1f;           // INDEX 01 FF
+} CUE_ENTRY;
+
+// CDDA table entry structure.
+typedef struct {
+    unsigned int     offset;
+    unsigned int     size;
+    unsigned char    padding[0x4];
+    unsigned int     checksum;
+} CDDA_ENTRY;
+
+// ISO table entry structure.
+typedef struct {
+    unsigned int     offset;
+    unsigned short   size;
+    unsigned short   marker;            // 0x01 or 0x00
+    unsigned char    checksum[0x10];    // first 0x10 bytes of sha1 sum of 0x10 disc sectors
+    unsigned char    padding[0x8];
+} ISO_ENTRY;
+
+// Decrypted ISO header of one disc, parsed once by parse_iso_header.
+typedef struct {
+    char             disc_name[0x10];   // Disc serial at 0x1.
+    char             title[0x81];       // UTF-8 title at 0xE2C.
+    int              special_data_offset;   // At 0xE20.
+    int              unknown_data_offset;   // At 0xED4.
+    CUE_ENTRY        leadout;           // At CUE_LEADOUT_OFFSET.
+    CUE_ENTRY        tracks[MAX_CUE_TRACKS + 1];    // tracks[0] is track 01, the last entry is always empty.
+    int              num_cdda;
+    CDDA_ENTRY       cdda[MAX_CUE_TRACKS - 1];      // Tracks 02 onwards, up to the first empty entry.
+    int              num_blocks;
+    ISO_ENTRY       *blocks;            // Block table, followed by an empty entry.
+} ISO_HEADER;
+
+// Copies the tables of a decrypted ISO header into header. Returns -1 if the
+// header is too short to hold the tables. free_iso_header releases the block table.
+int parse_iso_header(const unsigned char* data, int size, ISO_HEADER* header);
+void free_iso_header(ISO_HEADER* header);
+
+// Start of a track in frames, from its CUE entry (BCD MSF) minus gap seconds.
+// Returns -1 if the entry is not a data or audio track.
+int extract_frames_from_cue(const CUE_ENTRY* cue_entry, int gap);
+
+// Length in frames of track_num (1-based), up to the next track or the lead out.
+int get_track_size_from_cue(const ISO_HEADER* header, int track_num);
+
+// Number of sectors of the data track (track 01 without its 2 second gap).
+int data_track_sectors(const ISO_HEADER* header);
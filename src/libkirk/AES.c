@@ -31,6 +31,7 @@
 #include <string.h>
 
 #include "AES.h"
+#include "aes_hw.h"
 
 #undef FULL_UNROLL
 
@@ -1279,6 +1280,64 @@ rijndael_encrypt(rijndael_ctx *ctx, const u8 *src, u8 *dst)
 	rijndaelEncrypt(ctx->ek, ctx->Nr, src, dst);
 }
 
+/*
+ * Backend selection: AES-NI when the CPU has it and it agrees with the table
+ * code on the self-check below, otherwise the T-table code above. -1 until
+ * first use; the check always yields the same answer, so threads racing on
+ * it are harmless.
+ */
+static volatile int aes_hw_state = -1;
+
+static int aes_hw_selfcheck(void)
+{
+	/* FIPS-197 appendix C.1 */
+	static const u8 key[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+	static const u8 pt[16] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+	static const u8 ct[16] = {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a};
+	rijndael_ctx ctx;
+	u8 data[16*7], hw[16*7], sw[16*7], prev[16];
+	int i, j;
+
+	rijndael_set_key(&ctx, key, 128);
+
+	aes_hw_encrypt_blocks(ctx.ek, ctx.Nr, pt, hw, 1);
+	if(memcmp(hw, ct, 16))
+		return 0;
+	aes_hw_decrypt_blocks(ctx.dk, ctx.Nr, ct, hw, 1);
+	if(memcmp(hw, pt, 16))
+		return 0;
+
+	/* Cross-check the multi-block paths (4-wide plus tail) against the table code. */
+	for(i=0; i<(int)sizeof(data); i++)
+		data[i] = (u8)(i*29+7);
+
+	aes_hw_encrypt_blocks(ctx.ek, ctx.Nr, data, hw, 7);
+	for(i=0; i<7; i++)
+		rijndaelEncrypt(ctx.ek, ctx.Nr, data+16*i, sw+16*i);
+	if(memcmp(hw, sw, sizeof(hw)))
+		return 0;
+
+	aes_hw_cbc_decrypt(ctx.dk, ctx.Nr, data, hw, 7);
+	memset(prev, 0, 16);
+	for(i=0; i<7; i++){
+		rijndaelDecrypt(ctx.dk, ctx.Nr, data+16*i, sw+16*i);
+		for(j=0; j<16; j++)
+			sw[16*i+j] ^= prev[j];
+		memcpy(prev, data+16*i, 16);
+	}
+	if(memcmp(hw, sw, sizeof(hw)))
+		return 0;
+
+	return 1;
+}
+
+static int use_aes_hw(void)
+{
+	if(aes_hw_state < 0)
+		aes_hw_state = aes_hw_supported() && aes_hw_selfcheck();
+	return aes_hw_state;
+}
+
 int AES_set_key(AES_ctx *ctx, const u8 *key, int bits)
 {
 	return rijndael_set_key((rijndael_ctx *)ctx, key, bits);
@@ -1286,12 +1345,43 @@ int AES_set_key(AES_ctx *ctx, const u8 *key, int bits)
 
 void AES_decrypt(AES_ctx *ctx, const u8 *src, u8 *dst)
 {
-	rijndaelDecrypt(ctx->dk, ctx->Nr, src, dst);
+	if(use_aes_hw())
+		aes_hw_decrypt_blocks(ctx->dk, ctx->Nr, src, dst, 1);
+	else
+		rijndaelDecrypt(ctx->dk, ctx->Nr, src, dst);
 }
 
 void AES_encrypt(AES_ctx *ctx, const u8 *src, u8 *dst)
 {
-	rijndaelEncrypt(ctx->ek, ctx->Nr, src, dst);
+	if(use_aes_hw())
+		aes_hw_encrypt_blocks(ctx->ek, ctx->Nr, src, dst, 1);
+	else
+		rijndaelEncrypt(ctx->ek, ctx->Nr, src, dst);
+}
+
+/* ECB over independent blocks, pipelined on the hardware backend. */
+void AES_decrypt_blocks(AES_ctx *ctx, const u8 *src, u8 *dst, int blocks)
+{
+	int i;
+
+	if(use_aes_hw()){
+		aes_hw_decrypt_blocks(ctx->dk, ctx->Nr, src, dst, blocks);
+		return;
+	}
+	for(i=0; i<blocks; i++)
+		rijndaelDecrypt(ctx->dk, ctx->Nr, src+16*i, dst+16*i);
+}
+
+void AES_encrypt_blocks(AES_ctx *ctx, const u8 *src, u8 *dst, int blocks)
+{
+	int i;
+
+	if(use_aes_hw()){
+		aes_hw_encrypt_blocks(ctx->ek, ctx->Nr, src, dst, blocks);
+		return;
+	}
+	for(i=0; i<blocks; i++)
+		rijndaelEncrypt(ctx->ek, ctx->Nr, src+16*i, dst+16*i);
 }
 
 void xor_128(unsigned char *a, unsigned char *b, unsigned char *out)
@@ -1309,6 +1399,11 @@ void AES_cbc_encrypt(AES_ctx *ctx, u8 *src, u8 *dst, int size)
 	u8 block_buff[16];
 	
 	int i;
+
+	if(use_aes_hw()){
+		aes_hw_cbc_encrypt(ctx->ek, ctx->Nr, src, dst, (size+15)/16);
+		return;
+	}
 	for(i = 0; i < size; i+=16)
 	{
 		//step 1: copy block to dst
@@ -1330,6 +1425,12 @@ void AES_cbc_decrypt(AES_ctx *ctx, u8 *src, u8 *dst, int size)
 	u8 block_buff[16];
 	u8 block_buff_previous[16];
 	int i;
+
+	if(use_aes_hw()){
+		/* the table loop below always handles at least one block */
+		aes_hw_cbc_decrypt(ctx->dk, ctx->Nr, src, dst, (size>16)? (size+15)/16 : 1);
+		return;
+	}
 	
 	memcpy(block_buff, src, 16);
 	memcpy(block_buff_previous, src, 16);
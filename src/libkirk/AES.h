@@ -40,6 +40,8 @@ void rijndael_encrypt(rijndael_ctx *, const u8 *, u8 *);
 int AES_set_key(AES_ctx *ctx, const u8 *key, int bits);
 void AES_encrypt(AES_ctx *ctx, const u8 *src, u8 *dst);
 void AES_decrypt(AES_ctx *ctx, const u8 *src, u8 *dst);
+void AES_encrypt_blocks(AES_ctx *ctx, const u8 *src, u8 *dst, int blocks);
+void AES_decrypt_blocks(AES_ctx *ctx, const u8 *src, u8 *dst, int blocks);
 void AES_cbc_encrypt(AES_ctx *ctx, u8 *src, u8 *dst, int size);
 void AES_cbc_decrypt(AES_ctx *ctx, u8 *src, u8 *dst, int size);
 void AES_CMAC(AES_ctx *ctx, unsigned char *input, int length, unsigned char *mac);
@@ -0,0 +1,209 @@
+/*
+ *  aes_hw.c  -- AES-NI backend for AES.c
+ */
+
+#include "AES.h"
+#include "aes_hw.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define AES_HW_X86
+#include <cpuid.h>
+#define AES_HW_TARGET __attribute__((target("aes,ssse3")))
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#define AES_HW_X86
+#include <intrin.h>
+#define AES_HW_TARGET
+#endif
+
+#ifdef AES_HW_X86
+
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+
+int aes_hw_supported(void)
+{
+	unsigned int ecx;
+#ifdef _MSC_VER
+	int regs[4];
+	__cpuid(regs, 1);
+	ecx = (unsigned int)regs[2];
+#else
+	unsigned int eax, ebx, edx;
+	if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+#endif
+	/* bit 25: AES-NI, bit 9: SSSE3 (pshufb for the key schedule) */
+	return (ecx & (1u<<25)) && (ecx & (1u<<9));
+}
+
+/*
+ * The rijndael schedules store each round key as four big-endian words.
+ * Byte-swapping them gives the layout AESENC/AESDEC expect; dk is already
+ * the reversed, InvMixColumns'd schedule of the equivalent inverse cipher.
+ */
+AES_HW_TARGET static inline void load_schedule(const u32 *rk, int Nr, __m128i *k)
+{
+	const __m128i bswap = _mm_set_epi8(12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3);
+	int i;
+
+	for(i=0; i<=Nr; i++)
+		k[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(rk+4*i)), bswap);
+}
+
+AES_HW_TARGET static inline __m128i encrypt1(const __m128i *k, int Nr, __m128i b)
+{
+	int r;
+
+	b = _mm_xor_si128(b, k[0]);
+	for(r=1; r<Nr; r++)
+		b = _mm_aesenc_si128(b, k[r]);
+	return _mm_aesenclast_si128(b, k[Nr]);
+}
+
+AES_HW_TARGET static inline __m128i decrypt1(const __m128i *k, int Nr, __m128i b)
+{
+	int r;
+
+	b = _mm_xor_si128(b, k[0]);
+	for(r=1; r<Nr; r++)
+		b = _mm_aesdec_si128(b, k[r]);
+	return _mm_aesdeclast_si128(b, k[Nr]);
+}
+
+/* Four independent blocks per pass keep the AES unit's pipeline full. */
+AES_HW_TARGET static inline void decrypt4(const __m128i *k, int Nr, __m128i *b)
+{
+	int r;
+
+	b[0] = _mm_xor_si128(b[0], k[0]);
+	b[1] = _mm_xor_si128(b[1], k[0]);
+	b[2] = _mm_xor_si128(b[2], k[0]);
+	b[3] = _mm_xor_si128(b[3], k[0]);
+	for(r=1; r<Nr; r++){
+		b[0] = _mm_aesdec_si128(b[0], k[r]);
+		b[1] = _mm_aesdec_si128(b[1], k[r]);
+		b[2] = _mm_aesdec_si128(b[2], k[r]);
+		b[3] = _mm_aesdec_si128(b[3], k[r]);
+	}
+	b[0] = _mm_aesdeclast_si128(b[0], k[Nr]);
+	b[1] = _mm_aesdeclast_si128(b[1], k[Nr]);
+	b[2] = _mm_aesdeclast_si128(b[2], k[Nr]);
+	b[3] = _mm_aesdeclast_si128(b[3], k[Nr]);
+}
+
+AES_HW_TARGET static inline void encrypt4(const __m128i *k, int Nr, __m128i *b)
+{
+	int r;
+
+	b[0] = _mm_xor_si128(b[0], k[0]);
+	b[1] = _mm_xor_si128(b[1], k[0]);
+	b[2] = _mm_xor_si128(b[2], k[0]);
+	b[3] = _mm_xor_si128(b[3], k[0]);
+	for(r=1; r<Nr; r++){
+		b[0] = _mm_aesenc_si128(b[0], k[r]);
+		b[1] = _mm_aesenc_si128(b[1], k[r]);
+		b[2] = _mm_aesenc_si128(b[2], k[r]);
+		b[3] = _mm_aesenc_si128(b[3], k[r]);
+	}
+	b[0] = _mm_aesenclast_si128(b[0], k[Nr]);
+	b[1] = _mm_aesenclast_si128(b[1], k[Nr]);
+	b[2] = _mm_aesenclast_si128(b[2], k[Nr]);
+	b[3] = _mm_aesenclast_si128(b[3], k[Nr]);
+}
+
+AES_HW_TARGET void aes_hw_encrypt_blocks(const u32 *ek, int Nr, const u8 *src, u8 *dst, int blocks)
+{
+	__m128i k[AES_MAXROUNDS+1], b[4];
+	int i;
+
+	load_schedule(ek, Nr, k);
+
+	for(; blocks>=4; blocks-=4, src+=64, dst+=64){
+		for(i=0; i<4; i++)
+			b[i] = _mm_loadu_si128((const __m128i*)(src+16*i));
+		encrypt4(k, Nr, b);
+		for(i=0; i<4; i++)
+			_mm_storeu_si128((__m128i*)(dst+16*i), b[i]);
+	}
+	for(; blocks>0; blocks--, src+=16, dst+=16)
+		_mm_storeu_si128((__m128i*)dst, encrypt1(k, Nr, _mm_loadu_si128((const __m128i*)src)));
+}
+
+AES_HW_TARGET void aes_hw_decrypt_blocks(const u32 *dk, int Nr, const u8 *src, u8 *dst, int blocks)
+{
+	__m128i k[AES_MAXROUNDS+1], b[4];
+	int i;
+
+	load_schedule(dk, Nr, k);
+
+	for(; blocks>=4; blocks-=4, src+=64, dst+=64){
+		for(i=0; i<4; i++)
+			b[i] = _mm_loadu_si128((const __m128i*)(src+16*i));
+		decrypt4(k, Nr, b);
+		for(i=0; i<4; i++)
+			_mm_storeu_si128((__m128i*)(dst+16*i), b[i]);
+	}
+	for(; blocks>0; blocks--, src+=16, dst+=16)
+		_mm_storeu_si128((__m128i*)dst, decrypt1(k, Nr, _mm_loadu_si128((const __m128i*)src)));
+}
+
+/* CBC encryption is inherently serial; this only saves the per-block
+ * schedule reload. Zero IV, like AES_cbc_encrypt. */
+AES_HW_TARGET void aes_hw_cbc_encrypt(const u32 *ek, int Nr, const u8 *src, u8 *dst, int blocks)
+{
+	__m128i k[AES_MAXROUNDS+1], prev;
+
+	load_schedule(ek, Nr, k);
+
+	prev = _mm_setzero_si128();
+	for(; blocks>0; blocks--, src+=16, dst+=16){
+		prev = encrypt1(k, Nr, _mm_xor_si128(_mm_loadu_si128((const __m128i*)src), prev));
+		_mm_storeu_si128((__m128i*)dst, prev);
+	}
+}
+
+/*
+ * Zero IV, like AES_cbc_decrypt. Each batch is loaded before anything is
+ * stored, so dst may overlap src as long as dst <= src (KIRK decrypts its
+ * buffer in place, 0x14 bytes down).
+ */
+AES_HW_TARGET void aes_hw_cbc_decrypt(const u32 *dk, int Nr, const u8 *src, u8 *dst, int blocks)
+{
+	__m128i k[AES_MAXROUNDS+1], c[4], b[4], prev;
+	int i;
+
+	load_schedule(dk, Nr, k);
+
+	prev = _mm_setzero_si128();
+	for(; blocks>=4; blocks-=4, src+=64, dst+=64){
+		for(i=0; i<4; i++)
+			b[i] = c[i] = _mm_loadu_si128((const __m128i*)(src+16*i));
+		decrypt4(k, Nr, b);
+		b[0] = _mm_xor_si128(b[0], prev);
+		b[1] = _mm_xor_si128(b[1], c[0]);
+		b[2] = _mm_xor_si128(b[2], c[1]);
+		b[3] = _mm_xor_si128(b[3], c[2]);
+		prev = c[3];
+		for(i=0; i<4; i++)
+			_mm_storeu_si128((__m128i*)(dst+16*i), b[i]);
+	}
+	for(; blocks>0; blocks--, src+=16, dst+=16){
+		c[0] = _mm_loadu_si128((const __m128i*)src);
+		_mm_storeu_si128((__m128i*)dst, _mm_xor_si128(decrypt1(k, Nr, c[0]), prev));
+		prev = c[0];
+	}
+}
+
+#else
+
+int aes_hw_supported(void)
+{
+	return 0;
+}
+
+void aes_hw_encrypt_blocks(const u32 *ek, int Nr, const u8 *src, u8 *dst, int blocks) {}
+void aes_hw_decrypt_blocks(const u32 *dk, int Nr, const u8 *src, u8 *dst, int blocks) {}
+void aes_hw_cbc_encrypt(const u32 *ek, int Nr, const u8 *src, u8 *dst, int blocks) {}
+void aes_hw_cbc_decrypt(const u32 *dk, int Nr, const u8 *src, u8 *dst, int blocks) {}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef AES_HW_H
+#define AES_HW_H
+
+#include "kirk_engine.h"
+
+/*
+ * AES-NI versions of the AES.c block routines. They work directly on the
+ * rijndael ek/dk key schedules, so an AES_ctx set up by AES_set_key can be
+ * used with either backend. Only call them when aes_hw_supported() is true;
+ * AES.c does the dispatching.
+ */
+int aes_hw_supported(void);
+
+void aes_hw_encrypt_blocks(const u32 *ek, int Nr, const u8 *src, u8 *dst, int blocks);
+void aes_hw_decrypt_blocks(const u32 *dk, int Nr, const u8 *src, u8 *dst, int blocks);
+void aes_hw_cbc_encrypt(const u32 *ek, int Nr, const u8 *src, u8 *dst, int blocks);
+void aes_hw_cbc_decrypt(const u32 *dk, int Nr, const u8 *src, u8 *dst, int blocks);
+
+#endif
@@ -8,13 +8,19 @@
 #include <string.h>
 
 #include "kirk_engine.h"
+#include "AES.h"
 #include "amctrl.h"
 
 static u8 loc_1CD4[16] = {0xE3, 0x50, 0xED, 0x1D, 0x91, 0x0A, 0x1F, 0xD0, 0x29, 0xBB, 0x1C, 0x3E, 0xF3, 0x40, 0x77, 0xFB};
 static u8 loc_1CE4[16] = {0x13, 0x5F, 0xA4, 0x7C, 0xAB, 0x39, 0x5B, 0xA4, 0x76, 0xB8, 0xCC, 0xA9, 0x8F, 0x3A, 0x04, 0x45};
 static u8 loc_1CF4[16] = {0x67, 0x8D, 0x7F, 0xA3, 0x2A, 0x9C, 0xA0, 0xD1, 0x50, 0x8A, 0xD8, 0x38, 0x5E, 0x4B, 0x01, 0x7E};
 
-static u8 kirk_buf[0x0814];
+/*
+ * Scratch buffer used by the legacy entry points below. The *_ctx variants
+ * take their own KIRK_CTX instead so that several threads can run MAC and
+ * cipher operations at the same time.
+ */
+static KIRK_CTX default_ctx;
 
 static int kirk4(u8 *buf, int size, int type)
 {
@@ -185,6 +191,80 @@ static int sub_428(u8 *kbuf, u8 *dbuf, int size, CIPHER_KEY *ckey)
 	return 0;
 }
 
+/*
+ * Counter-mode view of sub_428. Every 16 byte block of keystream is
+ * AES_dec_k63(prefix|seed) ^ (prefix|seed-1), with an all-zero mask for
+ * seed 1, so any range of blocks can be produced independently once the
+ * 12 byte prefix of a key is known.
+ */
+int sceDrmBBCipherPrefix_ctx(KIRK_CTX *ctx, CIPHER_KEY *ckey, u8 *prefix)
+{
+	int i, retv;
+	u8 *kbuf = ctx->buf;
+
+	memcpy(kbuf+0x14, ckey->key, 16);
+
+	for(i=0; i<16; i++){
+		kbuf[0x14+i] ^= loc_1CF4[i];
+	}
+
+	if(ckey->type==2)
+		retv = kirk8(kbuf, 16);
+	else
+		retv = kirk7(kbuf, 16, 0x39);
+	if(retv)
+		return retv;
+
+	for(i=0; i<12; i++){
+		prefix[i] = kbuf[i] ^ loc_1CE4[i];
+	}
+
+	return 0;
+}
+
+#define BBCIPHER_BATCH 16
+
+/*
+ * XOR the keystream for blocks seed, seed+1, ... into data. Touches no
+ * shared state, so disjoint ranges may be processed on different threads.
+ */
+void bbcipher_xor_range(const u8 *prefix, u32 seed, u8 *data, int size)
+{
+	AES_ctx aes;
+	u8 ctr[BBCIPHER_BATCH*16], ks[BBCIPHER_BATCH*16];
+	int i, j, n, len;
+
+	AES_set_key(&aes, kirk_4_7_get_key(0x63), 128);
+
+	for(i=0; i<BBCIPHER_BATCH; i++)
+		memcpy(ctr+i*16, prefix, 12);
+
+	while(size>0){
+		len = (size>=BBCIPHER_BATCH*16)? BBCIPHER_BATCH*16 : size;
+		n = (len+15)/16;
+
+		for(i=0; i<n; i++)
+			*(u32*)(ctr+i*16+12) = seed+i;
+		AES_decrypt_blocks(&aes, ctr, ks, n);
+
+		/* Chain mask: the previous counter block, or zero for seed 1. */
+		for(i=0; i<n; i++){
+			if(seed+i==1)
+				continue;
+			for(j=0; j<12; j++)
+				ks[i*16+j] ^= prefix[j];
+			*(u32*)(ks+i*16+12) ^= seed+i-1;
+		}
+
+		for(i=0; i<len; i++)
+			data[i] ^= ks[i];
+
+		data += len;
+		size -= len;
+		seed += n;
+	}
+}
+
 int sceDrmBBMacInit(MAC_KEY *mkey, int type)
 {
 	mkey->type = type;
@@ -196,7 +276,7 @@ int sceDrmBBMacInit(MAC_KEY *mkey, int type)
 	return 0;
 }
 
-int sceDrmBBMacUpdate(MAC_KEY *mkey, u8 *buf, int size)
+int sceDrmBBMacUpdate_ctx(KIRK_CTX *ctx, MAC_KEY *mkey, u8 *buf, int size)
 {
 	int retv = 0, ksize, p, type;
 	u8 *kbuf;
@@ -211,7 +291,7 @@ int sceDrmBBMacUpdate(MAC_KEY *mkey, u8 *buf, int size)
 		mkey->pad_size += size;
 		retv = 0;
 	}else{
-		kbuf = kirk_buf+0x14;
+		kbuf = ctx->buf+0x14;
 		memcpy(kbuf, mkey->pad, mkey->pad_size);
 
 		p = mkey->pad_size;
@@ -229,7 +309,7 @@ int sceDrmBBMacUpdate(MAC_KEY *mkey, u8 *buf, int size)
 		while(size){
 			ksize = (size+p>=0x0800)? 0x0800 : size+p;
 			memcpy(kbuf+p, buf, ksize-p);
-			retv = sub_158(kirk_buf, ksize, mkey->key, type);
+			retv = sub_158(ctx->buf, ksize, mkey->key, type);
 			if(retv)
 				goto _exit;
 			size -= (ksize-p);
@@ -243,7 +323,7 @@ _exit:
 
 }
 
-int sceDrmBBMacFinal(MAC_KEY *mkey, u8 *buf, u8 *vkey)
+int sceDrmBBMacFinal_ctx(KIRK_CTX *ctx, MAC_KEY *mkey, u8 *buf, u8 *vkey)
 {
 	int i, retv, code;
 	u8 *kbuf, tmp[16], tmp1[16];
@@ -253,10 +333,10 @@ int sceDrmBBMacFinal(MAC_KEY *mkey, u8 *buf, u8 *vkey)
 		return 0x80510302;
 
 	code = (mkey->type==2)? 0x3A : 0x38;
-	kbuf = kirk_buf+0x14;
+	kbuf = ctx->buf+0x14;
 
 	memset(kbuf, 0, 16);
-	retv = kirk4(kirk_buf, 16, code);
+	retv = kirk4(ctx->buf, 16, code);
 	if(retv)
 		goto _exit;
 	memcpy(tmp, kbuf, 16);
@@ -302,7 +382,7 @@ int sceDrmBBMacFinal(MAC_KEY *mkey, u8 *buf, u8 *vkey)
 	memcpy(kbuf, mkey->pad, 16);
 	memcpy(tmp1, mkey->key, 16);
 
-	retv = sub_158(kirk_buf, 0x10, tmp1, code);
+	retv = sub_158(ctx->buf, 0x10, tmp1, code);
 	if(retv)
 		return retv;
 
@@ -313,11 +393,11 @@ int sceDrmBBMacFinal(MAC_KEY *mkey, u8 *buf, u8 *vkey)
 	if(mkey->type==2){
 		memcpy(kbuf, tmp1, 16);
 
-		retv = kirk5(kirk_buf, 0x10);
+		retv = kirk5(ctx->buf, 0x10);
 		if(retv)
 			goto _exit;
 
-		retv = kirk4(kirk_buf, 0x10, code);
+		retv = kirk4(ctx->buf, 0x10, code);
 		if(retv)
 			goto _exit;
 
@@ -330,7 +410,7 @@ int sceDrmBBMacFinal(MAC_KEY *mkey, u8 *buf, u8 *vkey)
 		}
 		memcpy(kbuf, tmp1, 16);
 
-		retv = kirk4(kirk_buf, 0x10, code);
+		retv = kirk4(ctx->buf, 0x10, code);
 		if(retv)
 			goto _exit;
 
@@ -350,28 +430,28 @@ _exit:
 	return retv;
 }
 
-int sceDrmBBMacFinal2(MAC_KEY *mkey, u8 *out, u8 *vkey)
+int sceDrmBBMacFinal2_ctx(KIRK_CTX *ctx, MAC_KEY *mkey, u8 *out, u8 *vkey)
 {
 	int i, retv, type;
 	u8 *kbuf, tmp[16];
 
 	type = mkey->type;
-	retv = sceDrmBBMacFinal(mkey, tmp, vkey);
+	retv = sceDrmBBMacFinal_ctx(ctx, mkey, tmp, vkey);
 	if(retv)
 		return retv;
 
-	kbuf = kirk_buf+0x14;
+	kbuf = ctx->buf+0x14;
 
 	if(type==3){
 		memcpy(kbuf, out, 0x10);
-		kirk7(kirk_buf, 0x10, 0x63);
+		kirk7(ctx->buf, 0x10, 0x63);
 	}else{
-		memcpy(kirk_buf, out, 0x10);
+		memcpy(ctx->buf, out, 0x10);
 	}
 
 	retv = 0;
 	for(i=0; i<0x10; i++){
-		if(kirk_buf[i]!=tmp[i]){
+		if(ctx->buf[i]!=tmp[i]){
 			retv = 0x80510300;
 			break;
 		}
@@ -380,12 +460,12 @@ int sceDrmBBMacFinal2(MAC_KEY *mkey, u8 *out, u8 *vkey)
 	return retv;
 }
 
-int sceDrmBBCipherInit(CIPHER_KEY *ckey, int type, int mode, u8 *header_key, u8 *version_key, u32 seed)
+int sceDrmBBCipherInit_ctx(KIRK_CTX *ctx, CIPHER_KEY *ckey, int type, int mode, u8 *header_key, u8 *version_key, u32 seed)
 {
 	int i, retv;
 	u8 *kbuf;
 
-	kbuf = kirk_buf+0x14;
+	kbuf = ctx->buf+0x14;
 	ckey->type = type;
 	if(mode==2){
 		ckey->seed = seed+1;
@@ -400,18 +480,18 @@ int sceDrmBBCipherInit(CIPHER_KEY *ckey, int type, int mode, u8 *header_key, u8
 		retv = 0;
 	}else if(mode==1){
 		ckey->seed = 1;
-		retv = kirk14(kirk_buf);
+		retv = kirk14(ctx->buf);
 		if(retv)
 			return retv;
 
-		memcpy(kbuf, kirk_buf, 0x10);
+		memcpy(kbuf, ctx->buf, 0x10);
 		memset(kbuf+0x0c, 0, 4);
 
 		if(ckey->type==2){
 			for(i=0; i<16; i++){
 				kbuf[i] ^= loc_1CE4[i];
 			}
-			retv = kirk5(kirk_buf, 0x10);
+			retv = kirk5(ctx->buf, 0x10);
 			for(i=0; i<16; i++){
 				kbuf[i] ^= loc_1CF4[i];
 			}
@@ -419,7 +499,7 @@ int sceDrmBBCipherInit(CIPHER_KEY *ckey, int type, int mode, u8 *header_key, u8
 			for(i=0; i<16; i++){
 				kbuf[i] ^= loc_1CE4[i];
 			}
-			retv = kirk4(kirk_buf, 0x10, 0x39);
+			retv = kirk4(ctx->buf, 0x10, 0x39);
 			for(i=0; i<16; i++){
 				kbuf[i] ^= loc_1CF4[i];
 			}
@@ -442,7 +522,7 @@ int sceDrmBBCipherInit(CIPHER_KEY *ckey, int type, int mode, u8 *header_key, u8
 	return retv;
 }
 
-int sceDrmBBCipherUpdate(CIPHER_KEY *ckey, u8 *data, int size)
+int sceDrmBBCipherUpdate_ctx(KIRK_CTX *ctx, CIPHER_KEY *ckey, u8 *data, int size)
 {
 	int p, retv, dsize;
 
@@ -451,7 +531,7 @@ int sceDrmBBCipherUpdate(CIPHER_KEY *ckey, u8 *data, int size)
 
 	while(size>0){
 		dsize = (size>=0x0800)? 0x0800 : size;
-		retv = sub_428(kirk_buf, data+p, dsize, ckey);
+		retv = sub_428(ctx->buf, data+p, dsize, ckey);
 		if(retv)
 			break;
 		size -= dsize;
@@ -470,52 +550,52 @@ int sceDrmBBCipherFinal(CIPHER_KEY *ckey)
 	return 0;
 }
 
-int bbmac_build_final2(int type, u8 *mac)
+int bbmac_build_final2_ctx(KIRK_CTX *ctx, int type, u8 *mac)
 {
-	u8 *kbuf = kirk_buf+0x14;
+	u8 *kbuf = ctx->buf+0x14;
 
 	if(type==3){
 		memcpy(kbuf, mac, 16);
-		kirk4(kirk_buf, 0x10, 0x63);
+		kirk4(ctx->buf, 0x10, 0x63);
 		memcpy(mac, kbuf, 16);
 	}
 
 	return 0;
 }
 
-int bbmac_getkey(MAC_KEY *mkey, u8 *bbmac, u8 *vkey)
+int bbmac_getkey_ctx(KIRK_CTX *ctx, MAC_KEY *mkey, u8 *bbmac, u8 *vkey)
 {
 	int i, retv, type, code;
 	u8 *kbuf, tmp[16], tmp1[16];
 
 	type = mkey->type;
-	retv = sceDrmBBMacFinal(mkey, tmp, NULL);
+	retv = sceDrmBBMacFinal_ctx(ctx, mkey, tmp, NULL);
 	if(retv)
 		return retv;
 
-	kbuf = kirk_buf+0x14;
+	kbuf = ctx->buf+0x14;
 
 	if(type==3){
 		memcpy(kbuf, bbmac, 0x10);
-		kirk7(kirk_buf, 0x10, 0x63);
+		kirk7(ctx->buf, 0x10, 0x63);
 	}else{
-		memcpy(kirk_buf, bbmac, 0x10);
+		memcpy(ctx->buf, bbmac, 0x10);
 	}
 
-	memcpy(tmp1, kirk_buf, 16);
+	memcpy(tmp1, ctx->buf, 16);
 	memcpy(kbuf, tmp1, 16);
 
 	code = (type==2)? 0x3A : 0x38;
-	kirk7(kirk_buf, 0x10, code);
+	kirk7(ctx->buf, 0x10, code);
 
 	for(i=0; i<0x10; i++){
-		vkey[i] = tmp[i] ^ kirk_buf[i];
+		vkey[i] = tmp[i] ^ ctx->buf[i];
 	}
 
 	return 0;
 }
 
-int bbmac_forge(MAC_KEY *mkey, u8 *bbmac, u8 *vkey, u8 *buf)
+int bbmac_forge_ctx(KIRK_CTX *ctx, MAC_KEY *mkey, u8 *bbmac, u8 *vkey, u8 *buf)
 {
 	int i, retv, type;
 	u8 *kbuf, tmp[16], tmp1[16];
@@ -525,10 +605,10 @@ int bbmac_forge(MAC_KEY *mkey, u8 *bbmac, u8 *vkey, u8 *buf)
 		return 0x80510302;
 
 	type = (mkey->type==2)? 0x3A : 0x38;
-	kbuf = kirk_buf+0x14;
+	kbuf = ctx->buf+0x14;
 
 	memset(kbuf, 0, 16);
-	retv = kirk4(kirk_buf, 16, type);
+	retv = kirk4(ctx->buf, 16, type);
 	if(retv)
 		return retv;
 	memcpy(tmp, kbuf, 16);
@@ -575,12 +655,12 @@ int bbmac_forge(MAC_KEY *mkey, u8 *bbmac, u8 *vkey, u8 *buf)
 	}
 
 	memcpy(kbuf, bbmac, 0x10);
-	kirk7(kirk_buf, 0x10, 0x63);
+	kirk7(ctx->buf, 0x10, 0x63);
 
-	memcpy(kbuf, kirk_buf, 0x10);
-	kirk7(kirk_buf, 0x10, type);
+	memcpy(kbuf, ctx->buf, 0x10);
+	kirk7(ctx->buf, 0x10, type);
 
-	memcpy(tmp1, kirk_buf, 0x10);
+	memcpy(tmp1, ctx->buf, 0x10);
 	for(i=0; i<0x10; i++){
 		tmp1[i] ^= vkey[i];
 	}
@@ -589,9 +669,9 @@ int bbmac_forge(MAC_KEY *mkey, u8 *bbmac, u8 *vkey, u8 *buf)
 	}
 
 	memcpy(kbuf, tmp1, 0x10);
-	kirk7(kirk_buf, 0x10, type);
+	kirk7(ctx->buf, 0x10, type);
 
-	memcpy(tmp1, kirk_buf, 0x10);
+	memcpy(tmp1, ctx->buf, 0x10);
 	for(i=0; i<16; i++){
 		mkey->pad[i] ^= tmp1[i];
 	}
@@ -601,4 +681,47 @@ int bbmac_forge(MAC_KEY *mkey, u8 *bbmac, u8 *vkey, u8 *buf)
 	}
 
 	return 0;
-}
\ No newline at end of file
+}
+
+/* Legacy entry points, all sharing default_ctx. Not safe to call from more
+ * than one thread at a time. */
+
+int sceDrmBBMacUpdate(MAC_KEY *mkey, u8 *buf, int size)
+{
+	return sceDrmBBMacUpdate_ctx(&default_ctx, mkey, buf, size);
+}
+
+int sceDrmBBMacFinal(MAC_KEY *mkey, u8 *buf, u8 *vkey)
+{
+	return sceDrmBBMacFinal_ctx(&default_ctx, mkey, buf, vkey);
+}
+
+int sceDrmBBMacFinal2(MAC_KEY *mkey, u8 *out, u8 *vkey)
+{
+	return sceDrmBBMacFinal2_ctx(&default_ctx, mkey, out, vkey);
+}
+
+int sceDrmBBCipherInit(CIPHER_KEY *ckey, int type, int mode, u8 *header_key, u8 *version_key, u32 seed)
+{
+	return sceDrmBBCipherInit_ctx(&default_ctx, ckey, type, mode, header_key, version_key, seed);
+}
+
+int sceDrmBBCipherUpdate(CIPHER_KEY *ckey, u8 *data, int size)
+{
+	return sceDrmBBCipherUpdate_ctx(&default_ctx, ckey, data, size);
+}
+
+int bbmac_build_final2(int type, u8 *mac)
+{
+	return bbmac_build_final2_ctx(&default_ctx, type, mac);
+}
+
+int bbmac_getkey(MAC_KEY *mkey, u8 *bbmac, u8 *vkey)
+{
+	return bbmac_getkey_ctx(&default_ctx, mkey, bbmac, vkey);
+}
+
+int bbmac_forge(MAC_KEY *mkey, u8 *bbmac, u8 *vkey, u8 *buf)
+{
+	return bbmac_forge_ctx(&default_ctx, mkey, bbmac, vkey, buf);
+}
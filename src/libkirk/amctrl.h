@@ -15,6 +15,16 @@ typedef struct
 	u8 key[16];
 } CIPHER_KEY;
 
+/*
+ * Per-thread KIRK scratch state. Every MAC/cipher call stages its data in
+ * this buffer, so each thread needs its own context. The engine itself must
+ * have been set up with kirk_init() before any thread uses a context.
+ */
+typedef struct
+{
+	u8 buf[0x0814];
+} KIRK_CTX;
+
 int sceDrmBBMacInit(MAC_KEY *mkey, int type);
 int sceDrmBBMacUpdate(MAC_KEY *mkey, u8 *buf, int size);
 int sceDrmBBMacFinal(MAC_KEY *mkey, u8 *buf, u8 *vkey);
@@ -28,4 +38,23 @@ int sceDrmBBCipherInit(CIPHER_KEY *ckey, int type, int mode, u8 *header_key, u8
 int sceDrmBBCipherUpdate(CIPHER_KEY *ckey, u8 *data, int size);
 int sceDrmBBCipherFinal(CIPHER_KEY *ckey);
 
+int sceDrmBBMacUpdate_ctx(KIRK_CTX *ctx, MAC_KEY *mkey, u8 *buf, int size);
+int sceDrmBBMacFinal_ctx(KIRK_CTX *ctx, MAC_KEY *mkey, u8 *buf, u8 *vkey);
+int sceDrmBBMacFinal2_ctx(KIRK_CTX *ctx, MAC_KEY *mkey, u8 *out, u8 *vkey);
+
+int bbmac_build_final2_ctx(KIRK_CTX *ctx, int type, u8 *mac);
+int bbmac_getkey_ctx(KIRK_CTX *ctx, MAC_KEY *mkey, u8 *bbmac, u8 *vkey);
+int bbmac_forge_ctx(KIRK_CTX *ctx, MAC_KEY *mkey, u8 *bbmac, u8 *vkey, u8 *buf);
+
+int sceDrmBBCipherInit_ctx(KIRK_CTX *ctx, CIPHER_KEY *ckey, int type, int mode, u8 *header_key, u8 *version_key, u32 seed);
+int sceDrmBBCipherUpdate_ctx(KIRK_CTX *ctx, CIPHER_KEY *ckey, u8 *data, int size);
+
+/*
+ * Bulk path for sceDrmBBCipherUpdate: fetch the key's counter prefix once,
+ * then decrypt any seed range with bbcipher_xor_range. The block at byte
+ * offset n of a stream starting at ckey->seed uses seed ckey->seed + n/16.
+ */
+int sceDrmBBCipherPrefix_ctx(KIRK_CTX *ctx, CIPHER_KEY *ckey, u8 *prefix);
+void bbcipher_xor_range(const u8 *prefix, u32 seed, u8 *data, int size);
+
 #endif
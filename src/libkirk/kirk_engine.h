@@ -205,6 +205,9 @@ int kirk_CMD14(u8* outbuff, int outsize);
 int kirk_CMD16(u8* outbuff, int outsize,u8* inbuff, int insize);
 int kirk_CMD17(u8* inbuff, int insize);
 
+// kirk_init() sets up the shared engine keys and must run once before any
+// other thread touches KIRK. After that the AES commands (4/7) only read the
+// global state and can be used concurrently.
 int kirk_init(); //CMD 0xF?
 int kirk_init2(u8 *, u32, u32, u32);
 
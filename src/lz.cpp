@@ -4,7 +4,7 @@
 
 #include "lz.h"
 
-int decode_range(unsigned int *range, unsigned int *code, unsigned char **src)
+int decode_range(unsigned int *range, unsigned int *code, const unsigned char **src)
 {
 	if (!((*range) >> 24)) 
 	{
@@ -16,7 +16,7 @@ int decode_range(unsigned int *range, unsigned int *code, unsigned char **src)
 		return 0;
 }
 
-int decode_bit(unsigned int *range, unsigned int *code, int *index, unsigned char **src, unsigned char *c)
+int decode_bit(unsigned int *range, unsigned int *code, int *index, const unsigned char **src, unsigned char *c)
 {
 	unsigned int val = *range;
 
@@ -43,7 +43,7 @@ int decode_bit(unsigned int *range, unsigned int *code, int *index, unsigned cha
 	}
 }
 
-int decode_number(unsigned char *ptr, int index, int *bit_flag, unsigned int *range, unsigned int *code, unsigned char **src)
+int decode_number(unsigned char *ptr, int index, int *bit_flag, unsigned int *range, unsigned int *code, const unsigned char **src)
 {
 	int i = 1;
 
@@ -83,7 +83,7 @@ int decode_number(unsigned char *ptr, int index, int *bit_flag, unsigned int *ra
 	return i;
 }
 
-int decode_word(unsigned char *ptr, int index, int *bit_flag, unsigned int *range, unsigned int *code, unsigned char **src)
+int decode_word(unsigned char *ptr, int index, int *bit_flag, unsigned int *range, unsigned int *code, const unsigned char **src)
 {
 	int i = 1;
 	index /= 8;
@@ -124,11 +124,11 @@ int decode_word(unsigned char *ptr, int index, int *bit_flag, unsigned int *rang
 	return i;
 }
 
-int decompress(unsigned char *out, unsigned char *in, unsigned int size)
+int decompress(unsigned char *out, const unsigned char *in, unsigned int size)
 {
 	int result;
 
-	unsigned char *tmp = new unsigned char[0xA70];
+	unsigned char tmp[0xA70];
 
 	int offset = 0;
 	int bit_flag = 0;
@@ -269,6 +269,5 @@ int decompress(unsigned char *out, unsigned char *in, unsigned int size)
 		}
 		result = (start - out);
 	}
-	delete[] tmp;
 	return result;
 }
\ No newline at end of file
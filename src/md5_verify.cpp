@@ -7,17 +7,66 @@
 #include <string.h>
 
 
+// Start an incremental MD5 computation
+bool md5_stream_begin(MD5_STREAM* stream)
+{
+    stream->hProv = 0;
+    stream->hHash = 0;
+
+    if (!CryptAcquireContext(&stream->hProv, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT))
+    {
+        return false;
+    }
+
+    if (!CryptCreateHash(stream->hProv, CALG_MD5, 0, 0, &stream->hHash))
+    {
+        CryptReleaseContext(stream->hProv, 0);
+        stream->hProv = 0;
+        return false;
+    }
+
+    return true;
+}
+
+bool md5_stream_update(MD5_STREAM* stream, const void* data, unsigned int size)
+{
+    return CryptHashData(stream->hHash, (const BYTE*)data, size, 0) != FALSE;
+}
+
+// Finish the computation and release the hash. md5_string may be NULL to just discard it.
+bool md5_stream_end(MD5_STREAM* stream, char* md5_string)
+{
+    BYTE rgbHash[16];
+    DWORD cbHash = 16;
+    bool ok = true;
+
+    if (md5_string != NULL)
+    {
+        ok = CryptGetHashParam(stream->hHash, HP_HASHVAL, rgbHash, &cbHash, 0) != FALSE;
+        if (ok)
+        {
+            // Convert to hex string
+            for (DWORD i = 0; i < cbHash; i++)
+            {
+                sprintf(&md5_string[i * 2], "%02x", rgbHash[i]);
+            }
+        }
+    }
+
+    CryptDestroyHash(stream->hHash);
+    CryptReleaseContext(stream->hProv, 0);
+    stream->hHash = 0;
+    stream->hProv = 0;
+    return ok;
+}
+
 // MD5 hash calculation function
 bool calculate_md5(const char* filename, char* md5_string)
 {
-    HCRYPTPROV hProv = 0;
-    HCRYPTHASH hHash = 0;
     HANDLE hFile = NULL;
     BYTE rgbFile[1024];
     DWORD cbRead = 0;
-    BYTE rgbHash[16];
-    DWORD cbHash = 16;
-    CHAR rgbDigits[] = "0123456789abcdef";
+    MD5_STREAM stream;
     
     hFile = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
     if (hFile == INVALID_HANDLE_VALUE)
@@ -25,19 +74,12 @@ bool calculate_md5(const char* filename, char* md5_string)
         return false;
     }
     
-    if (!CryptAcquireContext(&hProv, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT))
+    if (!md5_stream_begin(&stream))
     {
         CloseHandle(hFile);
         return false;
     }
     
-    if (!CryptCreateHash(hProv, CALG_MD5, 0, 0, &hHash))
-    {
-        CloseHandle(hFile);
-        CryptReleaseContext(hProv, 0);
-        return false;
-    }
-    
     while (ReadFile(hFile, rgbFile, 1024, &cbRead, NULL))
     {
         if (0 == cbRead)
@@ -45,34 +87,18 @@ bool calculate_md5(const char* filename, char* md5_string)
             break;
         }
         
-        if (!CryptHashData(hHash, rgbFile, cbRead, 0))
+        if (!md5_stream_update(&stream, rgbFile, cbRead))
         {
-            CryptReleaseContext(hProv, 0);
-            CryptDestroyHash(hHash);
+            md5_stream_end(&stream, NULL);
             CloseHandle(hFile);
             return false;
         }
     }
     
-    if (!CryptGetHashParam(hHash, HP_HASHVAL, rgbHash, &cbHash, 0))
-    {
-        CryptReleaseContext(hProv, 0);
-        CryptDestroyHash(hHash);
-        CloseHandle(hFile);
-        return false;
-    }
-    
-    // Convert to hex string
-    for (DWORD i = 0; i < cbHash; i++)
-    {
-        sprintf(&md5_string[i * 2], "%02x", rgbHash[i]);
-    }
-    
-    CryptReleaseContext(hProv, 0);
-    CryptDestroyHash(hHash);
+    bool ok = md5_stream_end(&stream, md5_string);
     CloseHandle(hFile);
     
-    return true;
+    return ok;
 }
 
 // Print MD5 hash of data track (always)
@@ -91,6 +117,24 @@ void print_data_track_md5(const char* data_track_file, const char* disc_serial)
 // Verify data track MD5 using prebaked CUE files only
 bool verify_data_track_md5_cue(const char* data_track_file, const char* disc_serial)
 {
+    // Calculate actual MD5 of the data track first
+    char actual_md5[33];
+    if (!calculate_md5(data_track_file, actual_md5)) {
+        printf("Failed to calculate MD5 for data track: %s\n", data_track_file);
+        return false;
+    }
+
+    return verify_data_track_md5_value(actual_md5, disc_serial);
+}
+
+// Verify an already computed data track MD5 using prebaked CUE files only
+bool verify_data_track_md5_value(const char* actual_md5, const char* disc_serial)
+{
+    if (actual_md5[0] == 0) {
+        printf("Failed to calculate MD5 for data track of %s\n", disc_serial);
+        return false;
+    }
+
     // Convert disc serial to CUE format (underscore to dash)
     char cue_name[0x20];
     strcpy(cue_name, disc_serial);
@@ -100,13 +144,6 @@ bool verify_data_track_md5_cue(const char* data_track_file, const char* disc_ser
         }
     }
     
-    // Calculate actual MD5 of the data track first
-    char actual_md5[33];
-    if (!calculate_md5(data_track_file, actual_md5)) {
-        printf("Failed to calculate MD5 for data track: %s\n", data_track_file);
-        return false;
-    }
-    
     // Get expected MD5 from prebaked CUE file
     char expected_md5[33];
     if (!extract_cue_md5(cue_name, expected_md5)) {
@@ -1,6 +1,20 @@
 #pragma once
 
+#include <windows.h>
+#include <wincrypt.h>
+
+// Incremental MD5, for hashing data while it is being written
+typedef struct {
+    HCRYPTPROV hProv;
+    HCRYPTHASH hHash;
+} MD5_STREAM;
+
+bool md5_stream_begin(MD5_STREAM* stream);
+bool md5_stream_update(MD5_STREAM* stream, const void* data, unsigned int size);
+bool md5_stream_end(MD5_STREAM* stream, char* md5_string);
+
 // MD5 verification using prebaked CUE files only
 bool calculate_md5(const char* filename, char* md5_string);
 void print_data_track_md5(const char* data_track_file, const char* disc_serial);
-bool verify_data_track_md5_cue(const char* data_track_file, const char* disc_serial);
\ No newline at end of file
+bool verify_data_track_md5_cue(const char* data_track_file, const char* disc_serial);
+bool verify_data_track_md5_value(const char* actual_md5, const char* disc_serial);
\ No newline at end of file
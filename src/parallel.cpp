@@ -0,0 +1,568 @@
+#include "parallel.h"
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+// Slots kept in flight per worker. More slots let fast workers run ahead of a
+// slow block without stalling on the in-order commit.
+#define ORDERED_SLOTS_PER_THREAD 4
+
+// Most helpers one run asks the pool for.
+#define MAX_HELPERS MAXIMUM_WAIT_OBJECTS
+
+static int g_thread_count = 0;
+
+// Job the thread works for, handed down to the helpers of every run it starts.
+static thread_local void* g_job = NULL;
+
+// Priority of the thread's work, handed down the same way.
+static thread_local int g_priority = 0;
+
+// Pool deque of the thread, -1 unless it is a pool thread.
+static thread_local int g_queue = -1;
+
+typedef enum {
+    TASK_QUEUED,
+    TASK_TAKEN,
+    TASK_REVOKED,
+} TASK_STATE;
+
+struct TASK_GROUP;
+
+// Request for one pool thread to join a run. The run keeps its own next-index
+// counter, so a helper works on the run until nothing is left.
+typedef struct POOL_TASK {
+    void (*fn)(void* ctx);
+    void* ctx;
+    void* job;
+    int priority;
+    TASK_STATE state;           // Guarded by the lock of the deque it sits in.
+    int queue;
+    struct TASK_GROUP* group;
+    struct POOL_TASK* prev;
+    struct POOL_TASK* next;
+} POOL_TASK;
+
+// The helpers of one run.
+typedef struct TASK_GROUP {
+    POOL_TASK tasks[MAX_HELPERS];
+    int count;
+    volatile LONG active;       // Taken and not done yet.
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE idle;    // Signalled when a helper is done.
+} TASK_GROUP;
+
+// One deque per pool thread, sorted by priority. Its owner takes from it first;
+// idle threads steal from whichever deque holds the most urgent task.
+typedef struct {
+    CRITICAL_SECTION lock;
+    POOL_TASK* head;
+    POOL_TASK* tail;
+    volatile LONG best;         // Priority of head, INT_MAX when empty. Read without the lock.
+} TASK_QUEUE;
+
+static struct {
+    volatile LONG state;        // 0 = not started, 1 = starting, 2 = ready.
+    int threads;
+    TASK_QUEUE* queues;
+    HANDLE wake;                // Counts tasks pushed, idle threads wait on it.
+    volatile LONG next_queue;   // Round robin for tasks pushed by other threads.
+    volatile LONG queued;
+    volatile LONG peak_queued;
+    volatile LONG submitted;
+    volatile LONG executed;
+    volatile LONG stolen;
+    volatile LONG revoked;
+} g_pool;
+
+typedef struct {
+    int count;
+    int slot_size;
+    int window;
+    ORDERED_WORK_FN work;
+    void* ctx;
+    unsigned char* slots;
+    int* results;
+    HANDLE* done;          // One auto-reset event per slot, set when the slot is filled.
+    HANDLE free_slots;     // Counts slots that may be claimed by a worker.
+    volatile LONG next;    // Next item index to hand out.
+    volatile LONG abort;
+} ORDERED_RUN;
+
+int parallel_default_threads()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int threads = (int)info.dwNumberOfProcessors;
+    if (threads < 1)
+        threads = 1;
+    if (threads > MAXIMUM_WAIT_OBJECTS)
+        threads = MAXIMUM_WAIT_OBJECTS;
+    return threads;
+}
+
+void parallel_set_threads(int threads)
+{
+    g_thread_count = threads;
+}
+
+void parallel_set_job(void* job)
+{
+    g_job = job;
+}
+
+void* parallel_get_job()
+{
+    return g_job;
+}
+
+void parallel_set_priority(int priority)
+{
+    g_priority = priority;
+}
+
+int parallel_get_priority()
+{
+    return g_priority;
+}
+
+int parallel_get_threads()
+{
+    if (g_thread_count > 0)
+        return (g_thread_count > MAXIMUM_WAIT_OBJECTS) ? MAXIMUM_WAIT_OBJECTS : g_thread_count;
+    return parallel_default_threads();
+}
+
+void parallel_get_stats(PARALLEL_STATS* stats)
+{
+    stats->threads = g_pool.threads;
+    stats->queued = g_pool.queued;
+    stats->peak_queued = g_pool.peak_queued;
+    stats->submitted = g_pool.submitted;
+    stats->executed = g_pool.executed;
+    stats->stolen = g_pool.stolen;
+    stats->revoked = g_pool.revoked;
+}
+
+static void queue_unlink(TASK_QUEUE* queue, POOL_TASK* task)
+{
+    if (task->prev)
+        task->prev->next = task->next;
+    else
+        queue->head = task->next;
+    if (task->next)
+        task->next->prev = task->prev;
+    else
+        queue->tail = task->prev;
+    task->prev = task->next = NULL;
+    InterlockedExchange(&queue->best, queue->head ? queue->head->priority : INT_MAX);
+    InterlockedDecrement(&g_pool.queued);
+}
+
+static void queue_push(POOL_TASK* task)
+{
+    TASK_QUEUE* queue = &g_pool.queues[task->queue];
+    EnterCriticalSection(&queue->lock);
+
+    // Behind every task of the same or a more urgent priority.
+    POOL_TASK* after = queue->tail;
+    while (after != NULL && after->priority > task->priority)
+        after = after->prev;
+    task->prev = after;
+    task->next = after ? after->next : queue->head;
+    if (task->next)
+        task->next->prev = task;
+    else
+        queue->tail = task;
+    if (after)
+        after->next = task;
+    else
+        queue->head = task;
+    task->state = TASK_QUEUED;
+    InterlockedExchange(&queue->best, queue->head->priority);
+
+    LONG queued = InterlockedIncrement(&g_pool.queued);
+    LONG peak = g_pool.peak_queued;
+    while (queued > peak && InterlockedCompareExchange(&g_pool.peak_queued, queued, peak) != peak)
+        peak = g_pool.peak_queued;
+    LeaveCriticalSection(&queue->lock);
+}
+
+// Takes the most urgent task of any deque, preferring the thread's own deque
+// on a tie. Returns NULL once every deque is empty.
+static POOL_TASK* pool_take()
+{
+    int own = (g_queue >= 0) ? g_queue : 0;
+    while (1) {
+        int victim = -1;
+        LONG best = INT_MAX;
+        for (int i = 0; i < g_pool.threads; i++) {
+            int q = (own + i) % g_pool.threads;
+            LONG priority = g_pool.queues[q].best;
+            if (priority < best) {
+                best = priority;
+                victim = q;
+            }
+        }
+        if (victim < 0)
+            return NULL;
+
+        TASK_QUEUE* queue = &g_pool.queues[victim];
+        POOL_TASK* task = NULL;
+        EnterCriticalSection(&queue->lock);
+        if (queue->head != NULL) {
+            task = queue->head;
+            queue_unlink(queue, task);
+            task->state = TASK_TAKEN;
+            InterlockedIncrement(&task->group->active);
+        }
+        LeaveCriticalSection(&queue->lock);
+
+        // Lost the race for it, look again.
+        if (task == NULL)
+            continue;
+        if (victim != g_queue)
+            InterlockedIncrement(&g_pool.stolen);
+        return task;
+    }
+}
+
+static void pool_execute(POOL_TASK* task)
+{
+    TASK_GROUP* group = task->group;
+    void* outer_job = g_job;
+    int outer_priority = g_priority;
+    g_job = task->job;
+    g_priority = task->priority;
+    task->fn(task->ctx);
+    g_job = outer_job;
+    g_priority = outer_priority;
+    InterlockedIncrement(&g_pool.executed);
+
+    // The run may return, and its group go away, as soon as active drops to 0.
+    EnterCriticalSection(&group->lock);
+    InterlockedDecrement(&group->active);
+    WakeAllConditionVariable(&group->idle);
+    LeaveCriticalSection(&group->lock);
+}
+
+static DWORD WINAPI pool_thread(LPVOID param)
+{
+    g_queue = (int)(INT_PTR)param;
+    while (1) {
+        POOL_TASK* task = pool_take();
+        if (task == NULL) {
+            WaitForSingleObject(g_pool.wake, INFINITE);
+            continue;
+        }
+        // A wake-up may have gone to a thread that found nothing, so pass one on.
+        if (g_pool.queued > 0)
+            ReleaseSemaphore(g_pool.wake, 1, NULL);
+        pool_execute(task);
+    }
+}
+
+// Starts the pool on first use. The threads starting runs take part in them,
+// so the pool has one thread less than parallel_get_threads(); its threads
+// live as long as the process.
+static bool pool_ready()
+{
+    if (g_pool.state == 2)
+        return g_pool.threads > 0;
+    if (InterlockedCompareExchange(&g_pool.state, 1, 0) != 0) {
+        while (g_pool.state != 2)
+            Sleep(0);
+        return g_pool.threads > 0;
+    }
+
+    int threads = parallel_get_threads() - 1;
+    if (threads > 0) {
+        g_pool.queues = (TASK_QUEUE*)calloc(threads, sizeof(TASK_QUEUE));
+        g_pool.wake = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+        if (g_pool.queues == NULL || g_pool.wake == NULL)
+            threads = 0;
+    }
+    for (int i = 0; i < threads; i++) {
+        InitializeCriticalSection(&g_pool.queues[i].lock);
+        g_pool.queues[i].best = INT_MAX;
+    }
+
+    // Threads that failed to start leave their deques to be stolen from.
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        HANDLE thread = CreateThread(NULL, 0, pool_thread, (LPVOID)(INT_PTR)i, 0, NULL);
+        if (thread != NULL) {
+            CloseHandle(thread);
+            started++;
+        }
+    }
+    g_pool.threads = (started > 0) ? threads : 0;
+    InterlockedExchange(&g_pool.state, 2);
+    return g_pool.threads > 0;
+}
+
+// Asks the pool for up to helpers threads to call fn(ctx) for the calling
+// thread's job, at the given priority.
+static void group_start(TASK_GROUP* group, int helpers, int priority, void (*fn)(void*), void* ctx)
+{
+    group->count = 0;
+    group->active = 0;
+    InitializeCriticalSection(&group->lock);
+    InitializeConditionVariable(&group->idle);
+    if (helpers <= 0 || !pool_ready())
+        return;
+    if (helpers > g_pool.threads)
+        helpers = g_pool.threads;
+    if (helpers > MAX_HELPERS)
+        helpers = MAX_HELPERS;
+
+    for (int i = 0; i < helpers; i++) {
+        POOL_TASK* task = &group->tasks[i];
+        memset(task, 0, sizeof(*task));
+        task->fn = fn;
+        task->ctx = ctx;
+        task->job = g_job;
+        task->priority = priority;
+        task->group = group;
+        task->queue = (g_queue >= 0) ? g_queue : (int)((unsigned long)InterlockedIncrement(&g_pool.next_queue) % g_pool.threads);
+        queue_push(task);
+    }
+    group->count = helpers;
+    InterlockedExchangeAdd(&g_pool.submitted, helpers);
+    ReleaseSemaphore(g_pool.wake, helpers, NULL);
+}
+
+// Withdraws the helpers no thread has taken yet and waits for the others.
+// Called once the run has handed out its last item, so helpers that are
+// still queued would find nothing to do.
+static void group_finish(TASK_GROUP* group)
+{
+    for (int i = 0; i < group->count; i++) {
+        POOL_TASK* task = &group->tasks[i];
+        TASK_QUEUE* queue = &g_pool.queues[task->queue];
+        EnterCriticalSection(&queue->lock);
+        if (task->state == TASK_QUEUED) {
+            queue_unlink(queue, task);
+            task->state = TASK_REVOKED;
+            InterlockedIncrement(&g_pool.revoked);
+        }
+        LeaveCriticalSection(&queue->lock);
+    }
+
+    EnterCriticalSection(&group->lock);
+    while (group->active > 0)
+        SleepConditionVariableCS(&group->idle, &group->lock, INFINITE);
+    LeaveCriticalSection(&group->lock);
+    DeleteCriticalSection(&group->lock);
+}
+
+// Claims and fills one slot. With wait false it returns false instead of
+// waiting for a free slot; it also returns false once there is nothing left.
+static bool ordered_step(ORDERED_RUN* run, bool wait)
+{
+    if (WaitForSingleObject(run->free_slots, wait ? INFINITE : 0) != WAIT_OBJECT_0)
+        return false;
+
+    // Pass the token on so every other waiting worker wakes up and exits too.
+    if (run->abort) {
+        ReleaseSemaphore(run->free_slots, 1, NULL);
+        return false;
+    }
+    LONG index = InterlockedIncrement(&run->next) - 1;
+    if (index >= run->count) {
+        ReleaseSemaphore(run->free_slots, 1, NULL);
+        return false;
+    }
+
+    // A token guarantees the commit loop is done with this slot's previous item.
+    int slot = index % run->window;
+    run->results[slot] = run->work(run->ctx, index, run->slots + (size_t)slot * run->slot_size);
+    SetEvent(run->done[slot]);
+    return true;
+}
+
+static void ordered_worker(void* param)
+{
+    ORDERED_RUN* run = (ORDERED_RUN*)param;
+    while (ordered_step(run, true))
+        ;
+}
+
+static int run_sequential(int count, int slot_size, ORDERED_WORK_FN work, ORDERED_COMMIT_FN commit, void* ctx)
+{
+    unsigned char* slot = (unsigned char*)malloc(slot_size);
+    if (slot == NULL)
+        return -1;
+
+    int result = 0;
+    for (int i = 0; i < count; i++) {
+        if (work(ctx, i, slot) < 0 || commit(ctx, i, slot) < 0) {
+            result = -1;
+            break;
+        }
+    }
+    free(slot);
+    return result;
+}
+
+int run_ordered_window(int count, int threads)
+{
+    if (threads > MAXIMUM_WAIT_OBJECTS)
+        threads = MAXIMUM_WAIT_OBJECTS;
+    if (threads > count)
+        threads = count;
+    if (threads <= 1)
+        return 1;
+    int window = threads * ORDERED_SLOTS_PER_THREAD;
+    return (window > count) ? count : window;
+}
+
+int run_ordered(int count, int slot_size, int threads, ORDERED_WORK_FN work, ORDERED_COMMIT_FN commit, void* ctx)
+{
+    if (count <= 0)
+        return 0;
+    if (threads > MAXIMUM_WAIT_OBJECTS)
+        threads = MAXIMUM_WAIT_OBJECTS;
+    if (threads > count)
+        threads = count;
+    if (threads <= 1 || !pool_ready())
+        return run_sequential(count, slot_size, work, commit, ctx);
+
+    ORDERED_RUN run;
+    memset(&run, 0, sizeof(run));
+    run.count = count;
+    run.slot_size = slot_size;
+    run.window = run_ordered_window(count, threads);
+    run.work = work;
+    run.ctx = ctx;
+    run.slots = (unsigned char*)malloc((size_t)run.window * slot_size);
+    run.results = (int*)calloc(run.window, sizeof(int));
+    run.done = (HANDLE*)calloc(run.window, sizeof(HANDLE));
+    TASK_GROUP* group = (TASK_GROUP*)malloc(sizeof(TASK_GROUP));
+
+    int result = 0;
+    if (run.slots == NULL || run.results == NULL || run.done == NULL || group == NULL) {
+        result = -1;
+        goto cleanup;
+    }
+
+    run.free_slots = CreateSemaphore(NULL, run.window, 0x7FFFFFFF, NULL);
+    if (run.free_slots == NULL) {
+        result = -1;
+        goto cleanup;
+    }
+    for (int i = 0; i < run.window; i++) {
+        run.done[i] = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (run.done[i] == NULL) {
+            result = -1;
+            goto cleanup;
+        }
+    }
+
+    group_start(group, threads, g_priority, ordered_worker, &run);
+
+    // Commit the slots in order as they become ready, filling slots on this
+    // thread too while the next one isn't, so the run never waits for helpers
+    // that are still queued behind other work.
+    for (int i = 0; i < count; i++) {
+        int slot = i % run.window;
+        while (WaitForSingleObject(run.done[slot], 0) != WAIT_OBJECT_0) {
+            if (!ordered_step(&run, false)) {
+                WaitForSingleObject(run.done[slot], INFINITE);
+                break;
+            }
+        }
+        if (run.results[slot] < 0 || commit(ctx, i, run.slots + (size_t)slot * slot_size) < 0) {
+            result = -1;
+            InterlockedExchange(&run.abort, 1);
+            ReleaseSemaphore(run.free_slots, 1, NULL);
+            break;
+        }
+        ReleaseSemaphore(run.free_slots, 1, NULL);
+    }
+
+    group_finish(group);
+
+cleanup:
+    if (run.done) {
+        for (int i = 0; i < run.window; i++) {
+            if (run.done[i])
+                CloseHandle(run.done[i]);
+        }
+    }
+    if (run.free_slots)
+        CloseHandle(run.free_slots);
+    free(group);
+    free(run.done);
+    free(run.results);
+    free(run.slots);
+    return result;
+}
+
+typedef struct {
+    int count;
+    PARALLEL_FN work;
+    void* ctx;
+    bool stop_on_failure;
+    volatile LONG next;
+    volatile LONG failed;
+} PARALLEL_RUN;
+
+static void parallel_worker(void* param)
+{
+    PARALLEL_RUN* run = (PARALLEL_RUN*)param;
+    while (!(run->stop_on_failure && run->failed)) {
+        LONG index = InterlockedIncrement(&run->next) - 1;
+        if (index >= run->count)
+            break;
+        if (run->work(run->ctx, index) < 0)
+            InterlockedExchange(&run->failed, 1);
+    }
+}
+
+// run_parallel and run_pool: the calling thread works through the items with
+// up to helpers pool threads.
+static int run_group(int count, int helpers, int priority, bool stop_on_failure, PARALLEL_FN work, void* ctx)
+{
+    if (count <= 0)
+        return 0;
+
+    PARALLEL_RUN run;
+    memset(&run, 0, sizeof(run));
+    run.count = count;
+    run.work = work;
+    run.ctx = ctx;
+    run.stop_on_failure = stop_on_failure;
+
+    TASK_GROUP* group = (helpers > 0) ? (TASK_GROUP*)malloc(sizeof(TASK_GROUP)) : NULL;
+    if (group != NULL)
+        group_start(group, helpers, priority, parallel_worker, &run);
+
+    parallel_worker(&run);
+
+    if (group != NULL) {
+        group_finish(group);
+        free(group);
+    }
+    return run.failed ? -1 : 0;
+}
+
+int run_parallel(int count, int threads, PARALLEL_FN work, void* ctx)
+{
+    if (threads > count)
+        threads = count;
+    return run_group(count, threads - 1, g_priority, true, work, ctx);
+}
+
+int run_pool(int count, int width, PARALLEL_FN work, void* ctx)
+{
+    if (width > count)
+        width = count;
+    return run_group(count, width - 1, PARALLEL_PRIORITY_LAST, false, work, ctx);
+}
+
+int run_split(int count, PARALLEL_FN work, void* ctx)
+{
+    return run_group(count, count - 1, g_priority, false, work, ctx);
+}
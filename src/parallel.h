@@ -0,0 +1,81 @@
+#pragma once
+
+// Parallel processing on one process-wide, work-stealing Win32 thread pool.
+//
+// The pool has parallel_get_threads() - 1 threads, started on first use; the
+// thread that starts a run always works on it too. A run asks the pool for
+// helpers, which queue up on per-thread deques ordered by priority. Idle pool
+// threads take the most urgent helper of any deque, their own first, so runs
+// started from inside other runs (blocks inside a disc inside an EBOOT of a
+// batch) share the same threads instead of multiplying them. Helpers nobody
+// took by the time the run has handed out its last item are withdrawn, so a
+// run never waits for work that is stuck behind other work.
+//
+// Ordered runs: items 0..count-1 are handed out to workers, each of which
+// fills its own slot buffer through work(). The calling thread then receives
+// the slots strictly in index order through commit(), so output files are
+// written sequentially no matter which worker finishes first. At most
+// `window` items are in flight at once, which bounds the memory used for
+// reordering.
+//
+// Both callbacks return 0 on success or a negative value to abort the run.
+typedef int (*ORDERED_WORK_FN)(void* ctx, int index, unsigned char* slot);
+typedef int (*ORDERED_COMMIT_FN)(void* ctx, int index, unsigned char* slot);
+
+// Number of threads to use when the user did not ask for a specific count
+// (one per logical CPU).
+int parallel_default_threads();
+
+// Thread count chosen on the command line (0 means parallel_default_threads()).
+// Must be set before the first run, which sizes the pool.
+void parallel_set_threads(int threads);
+int parallel_get_threads();
+
+int run_ordered(int count, int slot_size, int threads, ORDERED_WORK_FN work, ORDERED_COMMIT_FN commit, void* ctx);
+
+// Slots run_ordered keeps for count items on threads workers, so callers can
+// tell how much memory a run takes.
+int run_ordered_window(int count, int threads);
+
+// Unordered variant: calls work(ctx, index) for every index on up to
+// `threads` workers and returns once all of them are done. Returns -1 if any
+// call failed (remaining items are skipped).
+typedef int (*PARALLEL_FN)(void* ctx, int index);
+
+int run_parallel(int count, int threads, PARALLEL_FN work, void* ctx);
+
+// Calls work(ctx, index) for every index on up to `width` workers, for large
+// jobs that parallelize internally, like whole EBOOTs of a batch. Its helpers
+// rank behind all other work, so idle threads finish the jobs in flight
+// before they start new ones. Every call runs to the end; returns -1 if any
+// failed.
+int run_pool(int count, int width, PARALLEL_FN work, void* ctx);
+
+// run_pool with one worker per item at the caller's priority, for a few jobs
+// that should all make progress at once, like the discs of a multi-disc EBOOT.
+int run_split(int count, PARALLEL_FN work, void* ctx);
+
+// Opaque job (see batch.h) the calling thread works for, NULL if none. The
+// helpers of every run started on a thread work for that thread's job.
+void parallel_set_job(void* job);
+void* parallel_get_job();
+
+// Priority of the calling thread's work, handed down like the job. Lower is
+// more urgent; the batch numbers its EBOOTs in the order they start.
+#define PARALLEL_PRIORITY_LAST 0x7FFFFFFE
+
+void parallel_set_priority(int priority);
+int parallel_get_priority();
+
+// Pool counters since the process started.
+typedef struct {
+    int threads;            // Pool threads (0 until the first run, or with one thread).
+    long queued;            // Helpers waiting for a thread right now.
+    long peak_queued;
+    long submitted;         // Helpers asked for.
+    long executed;          // Helpers that ran.
+    long stolen;            // Of those, taken from another thread's deque.
+    long revoked;           // Withdrawn because their run was done first.
+} PARALLEL_STATS;
+
+void parallel_get_stats(PARALLEL_STATS* stats);
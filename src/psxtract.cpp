@@ -5,20 +5,46 @@
 #include "psxtract.h"
 #include "md5_verify.h"
 #include "at3acm.h"
+#include "atrac3.h"
 #include "gui.h"
 #include "cue_resources.h"
+#include "parallel.h"
+#include "unscramble.h"
+#include "pxidx.h"
+#include "inspect.h"
+#include "batch.h"
+#include "checkpoint.h"
+
+
+// BIN and CUE names of a disc: <title>.bin/.cue with a prebaked CUE, the
+// generated CDROM.BIN/.CUE (CDROM_<n> for multi-disc) otherwise.
+static void output_file_names(const char* game_title, bool use_prebaked_cue, char* bin_name, char* cue_name) {
+    sprintf(bin_name, use_prebaked_cue ? "%s.bin" : "%s.BIN", game_title);
+    sprintf(cue_name, use_prebaked_cue ? "%s.cue" : "%s.CUE", game_title);
+}
 
-extern void openLogFileForWriting(const char* pbpPath);
-
-
-
-// Helper function to check if output files exist and prompt for overwrite
-static bool check_output_files_overwrite(const char* game_title, bool use_prebaked_cue) {
+// Helper function to check if output files exist and prompt for overwrite.
+// Files that the checkpoint of an interrupted run vouches for are resumed
+// instead, resume tells how much of them is kept.
+static bool check_output_files_overwrite(const char* game_title, bool use_prebaked_cue, CHECKPOINT* checkpoint, int disc_num, CHECKPOINT_RESUME* resume) {
     char cue_path[512];
     char bin_path[512];
     char cue_filename[300];
     char bin_filename[300];
+    *resume = CHECKPOINT_NONE;
     
+    // EBOOTs extracted at the same time must not write the same files, the
+    // later one waits for the earlier one to finish and then asks to overwrite.
+    if (!batch_claim_output(game_title))
+        return false;
+
+    char output_bin_name[256];
+    char output_cue_name[256];
+    output_file_names(game_title, use_prebaked_cue, output_bin_name, output_cue_name);
+    *resume = checkpoint_begin_disc(checkpoint, disc_num, output_bin_name, output_cue_name);
+    if (*resume != CHECKPOINT_NONE)
+        return true;
+
     // Build filenames
     sprintf(cue_filename, "%s.cue", game_title);
     sprintf(bin_filename, "%s.bin", game_title);
@@ -78,14 +104,9 @@ static bool check_output_files_overwrite(const char* game_title, bool use_prebak
         }
     } else {
         // For console mode, ask user for action
-        char input[10];
-        printf("Do you want to overwrite existing files? (y/N): ");
-        if (fgets(input, sizeof(input), stdin) != NULL) {
-            char response = input[0];
-            if (response == 'y' || response == 'Y') {
-                printf("Overwriting existing files.\n");
-                return true; // Overwrite
-            }
+        if (gui_prompt("Do you want to overwrite existing files?", "Output Files Exist")) {
+            printf("Overwriting existing files.\n");
+            return true; // Overwrite
         }
         printf("Operation cancelled.\n");
         return false; // Cancel
@@ -132,8 +153,39 @@ static char* get_next_line(char** data_ptr, char* line_buffer, size_t buffer_siz
     }
 }
 
-// Dynamic pregap override storage
-static PREGAP_OVERRIDE* g_dynamic_pregap_override = NULL;
+// Dynamic pregap override storage. Batch jobs each run on a thread of their
+// own, so this and g_index_eboot are per thread.
+static thread_local PREGAP_OVERRIDE* g_dynamic_pregap_override = NULL;
+
+// Write the PBP sections out to TEMP/PBP (-u); normally they are read in place.
+static bool g_unpack_pbp = false;
+
+// Also write the intermediate DATA_TRACK.BIN / DATA_TRACK.BIN.ISO images and
+// the AT3/WAV of each audio track (-k); normally every track goes straight
+// into the final BIN.
+static bool g_keep_temp = false;
+
+// Decode the audio tracks with the Sony ATRAC3 ACM codec. The built-in decoder
+// (-n) stays opt-in until tools/at3compare has matched it against ACM on real
+// tracks.
+static bool g_use_acm = true;
+
+// Guards registering and looking up the ACM codec, also across batch jobs.
+// Calls into the codec itself are serialized by at3acm.
+static SRWLOCK g_acm_lock = SRWLOCK_INIT;
+
+// Take the ISO headers from .pxidx sidecars next to the EBOOT (-i), and write
+// them after decrypting. Holds the full EBOOT path, empty when disabled.
+static bool g_use_index = false;
+static thread_local char g_index_eboot[MAX_PATH] = "";
+
+// Opens one of the intermediate files in the job's TEMP directory.
+static FILE* temp_fopen(const char* name, const char* mode)
+{
+	char path[MAX_PATH];
+	batch_temp_path(name, path, MAX_PATH);
+	return fopen(path, mode);
+}
 
 char* exec(const char* cmd) {
     HANDLE hRead, hWrite;
@@ -197,7 +249,7 @@ char* exec(const char* cmd) {
     return output;
 }
 
-unsigned long extract_startdat(FILE *psar, bool isMultidisc)
+unsigned long extract_startdat(PBP_SECTION *psar, bool isMultidisc)
 {
 	if (psar == NULL)
 	{
@@ -207,11 +259,7 @@ unsigned long extract_startdat(FILE *psar, bool isMultidisc)
 
 	// Get the STARTDAT offset (0xC for single disc and 0x10 for multidisc due to header magic length).
 	unsigned long startdat_offset;
-	if (isMultidisc)
-		fseek(psar, 0x10, SEEK_SET);
-	else
-		fseek(psar, 0xC, SEEK_SET);
-	fread(&startdat_offset, sizeof(startdat_offset), 1, psar);
+	read_pbp_section(psar, isMultidisc ? 0x10 : 0xC, &startdat_offset, sizeof(startdat_offset));
 
 	if (startdat_offset)
 	{
@@ -222,26 +270,27 @@ unsigned long extract_startdat(FILE *psar, bool isMultidisc)
 		memset(startdat_header, 0, sizeof(startdat_header));
 
 		// Save the header as well.
-		_fseeki64(psar, startdat_offset, SEEK_SET);
-		fread(startdat_header, sizeof(STARTDAT_HEADER), 1, psar);
-		_fseeki64(psar, startdat_offset, SEEK_SET);
+		read_pbp_section(psar, startdat_offset, startdat_header, sizeof(STARTDAT_HEADER));
 
 		// Read the STARTDAT data.
 		int startdat_size = startdat_header->header_size + startdat_header->data_size;
+		if (!batch_reserve_memory("STARTDAT", startdat_size))
+			return startdat_offset;
 		unsigned char *startdat_data = new unsigned char[startdat_size];   
-		fread(startdat_data, 1, startdat_size, psar);
+		read_pbp_section(psar, startdat_offset, startdat_data, startdat_size);
 
 		// Store the STARTDAT.
-		FILE* startdat = fopen("STARTDAT.BIN", "wb");
+		FILE* startdat = temp_fopen("STARTDAT.BIN", "wb");
 		fwrite(startdat_data, startdat_size, 1, startdat);
 		fclose(startdat);
 
 		// Store the STARTDAT.PNG
-		FILE* startdatpng = fopen("STARTDAT.PNG", "wb");
+		FILE* startdatpng = temp_fopen("STARTDAT.PNG", "wb");
 		fwrite(startdat_data + startdat_header->header_size, startdat_header->data_size, 1, startdatpng);
 		fclose(startdatpng);
 
 		delete[] startdat_data;
+		batch_release_memory(startdat_size);
 
 		printf("Saving STARTDAT as STARTDAT.BIN...\n\n");
 	}
@@ -270,7 +319,9 @@ int decrypt_document(FILE* document)
 		printf("DOCUMENT.DAT successfully decrypted! Saving as DOCUMENT_DEC.DAT...\n\n");
 
 		// Store the decrypted DOCUMENT.DAT.
-		FILE* dec_document = fopen("DOCUMENT_DEC.DAT", "wb");
+		char dec_document_path[MAX_PATH];
+		build_output_path("DOCUMENT_DEC.DAT", dec_document_path, MAX_PATH);
+		FILE* dec_document = fopen(dec_document_path, "wb");
 		fwrite(document_data, document_size, 1, dec_document);
 		fclose(dec_document);
 	}
@@ -288,7 +339,9 @@ int decrypt_document(FILE* document)
 			printf("DOCUMENT.DAT successfully decrypted! Saving as DOCUMENT_DEC.DAT...\n\n");
 
 			// Store the decrypted DOCUMENT.DAT.
-			FILE* dec_document = fopen("DOCUMENT_DEC.DAT", "wb");
+			char dec_document_path[MAX_PATH];
+			build_output_path("DOCUMENT_DEC.DAT", dec_document_path, MAX_PATH);
+			FILE* dec_document = fopen(dec_document_path, "wb");
 			fwrite(document_data, document_size - 0x10, 1, dec_document);
 			fclose(dec_document);
 		}
@@ -297,7 +350,7 @@ int decrypt_document(FILE* document)
 	return 0;
 }
 
-int decrypt_special_data(FILE *psar, long long psar_size, int special_data_offset)
+int decrypt_special_data(PBP_SECTION *psar, int special_data_offset)
 {
 	if ((psar == NULL))
 	{
@@ -309,43 +362,44 @@ int decrypt_special_data(FILE *psar, long long psar_size, int special_data_offse
 	{
 		printf("Found special data offset: 0x%08x\n", special_data_offset);
 
-		// Seek to the special data.
-		fseek(psar, special_data_offset, SEEK_SET);
-
-		// Read the data.
-		int special_data_size = psar_size - special_data_offset;  // Always the last portion of the DATA.PSAR.
-		unsigned char *special_data = new unsigned char[static_cast<unsigned int>(special_data_size)];
-		fread(special_data, special_data_size, 1, psar);
+		int special_data_size = psar->size - special_data_offset;  // Always the last portion of the DATA.PSAR.
 
 		printf("Decrypting special data...\n");
 
+		// The whole region is decrypted at once.
+		if (!batch_reserve_memory("the special data", special_data_size))
+			return -1;
+
 		// Decrypt the PGD and save the data.
-		int pgd_size = decrypt_pgd(special_data, special_data_size, 2, NULL);
+		int pgd_size = 0;
+		unsigned char *special_data = decrypt_psar_pgd(psar, special_data_offset, special_data_size, NULL, &pgd_size);
 
-		if (pgd_size > 0)
+		if (special_data != NULL)
 			printf("Special data successfully decrypted! Saving as SPECIAL_DATA.BIN...\n\n");
 		else
 		{
 			printf("ERROR: Special data decryption failed!\n\n");
+			batch_release_memory(special_data_size);
 			return -1;
 		}
 
 		// Store the decrypted special data.
-		FILE* dec_special_data = fopen("SPECIAL_DATA.BIN", "wb");
-		fwrite(special_data + 0x90, pgd_size, 1, dec_special_data);
+		FILE* dec_special_data = temp_fopen("SPECIAL_DATA.BIN", "wb");
+		fwrite(special_data, pgd_size, 1, dec_special_data);
 		fclose(dec_special_data);
 
 		// Store the decrypted special data png.
-		FILE* dec_special_data_png = fopen("SPECIAL_DATA.PNG", "wb");
-		fwrite(special_data + 0xAC, pgd_size - 0x1C, 1, dec_special_data_png);
+		FILE* dec_special_data_png = temp_fopen("SPECIAL_DATA.PNG", "wb");
+		fwrite(special_data + 0x1C, pgd_size - 0x1C, 1, dec_special_data_png);
 		fclose(dec_special_data_png);
 
 		delete[] special_data;
+		batch_release_memory(special_data_size);
 	}
 	return 0;
 }
 
-int decrypt_unknown_data(FILE *psar, int unknown_data_offset, int startdat_offset)
+int decrypt_unknown_data(PBP_SECTION *psar, int unknown_data_offset, int startdat_offset)
 {
 	if ((psar == NULL))
 	{
@@ -357,38 +411,38 @@ int decrypt_unknown_data(FILE *psar, int unknown_data_offset, int startdat_offse
 	{
 		printf("Found unknown data offset: 0x%08x\n", unknown_data_offset);
 
-		// Seek to the unknown data.
-		fseek(psar, unknown_data_offset, SEEK_SET);
-
-		// Read the data.
 		int unknown_data_size = startdat_offset - unknown_data_offset;   // Always located before the STARDAT and after the ISO.
-		unsigned char *unknown_data = new unsigned char[unknown_data_size];
-		fread(unknown_data, unknown_data_size, 1, psar);
 
 		printf("Decrypting unknown data...\n");
 
+		if (!batch_reserve_memory("the unknown data", unknown_data_size))
+			return -1;
+
 		// Decrypt the PGD and save the data.
-		int pgd_size = decrypt_pgd(unknown_data, unknown_data_size, 2, NULL);
+		int pgd_size = 0;
+		unsigned char *unknown_data = decrypt_psar_pgd(psar, unknown_data_offset, unknown_data_size, NULL, &pgd_size);
 
-		if (pgd_size > 0)
+		if (unknown_data != NULL)
 			printf("Unknown data successfully decrypted! Saving as UNKNOWN_DATA.BIN...\n\n");
 		else
 		{
 			printf("ERROR: Unknown data decryption failed!\n\n");
+			batch_release_memory(unknown_data_size);
 			return -1;
 		}
 
 		// Store the decrypted unknown data.
-		FILE* dec_unknown_data = fopen("UNKNOWN_DATA.BIN", "wb");
-		fwrite(unknown_data + 0x90, pgd_size, 1, dec_unknown_data);
+		FILE* dec_unknown_data = temp_fopen("UNKNOWN_DATA.BIN", "wb");
+		fwrite(unknown_data, pgd_size, 1, dec_unknown_data);
 		fclose(dec_unknown_data);
 		delete[] unknown_data;
+		batch_release_memory(unknown_data_size);
 	}
 
 	return 0;
 }
 
-int decrypt_iso_header(FILE *psar, unsigned int header_offset, unsigned char *pgd_key, int disc_num)
+int decrypt_iso_header(PBP_SECTION *psar, unsigned int header_offset, unsigned char *pgd_key, int disc_num, ISO_HEADER *header)
 {
 	if (psar == NULL)
 	{
@@ -396,24 +450,45 @@ int decrypt_iso_header(FILE *psar, unsigned int header_offset, unsigned char *pg
 		return -1;
 	}
 
-	// Seek to the ISO header.
-	_fseeki64(psar, header_offset, SEEK_SET);
+	// Reuse the header from the index when it is up to date.
+	int pgd_size = 0;
+	unsigned char *iso_header = NULL;
+	char index_path[MAX_PATH];
+	PXIDX_INFO index_info;
+	memset(&index_info, 0, sizeof(index_info));
+	index_info.disc_offset = header_offset - ISO_HEADER_OFFSET;
+	if (g_index_eboot[0] != 0)
+	{
+		PXIDX_INFO loaded_info;
+		pxidx_path(g_index_eboot, disc_num, index_path, sizeof(index_path));
+		iso_header = pxidx_load(index_path, psar, pgd_key, &pgd_size, &loaded_info);
+		if (iso_header != NULL && loaded_info.disc_offset != index_info.disc_offset)
+		{
+			delete[] iso_header;
+			iso_header = NULL;
+		}
+		if (iso_header != NULL)
+			printf("ISO header loaded from %s, not saving the partial header to TEMP\n\n", index_path);
+	}
+	bool from_index = iso_header != NULL;
 
-	// Read the ISO header.
-	unsigned char *iso_header = new unsigned char[ISO_HEADER_SIZE];
-	fread(iso_header, ISO_HEADER_SIZE, 1, psar);
+	if (iso_header == NULL)
+	{
+		printf("Decrypting ISO header...\n");
 
-	printf("Decrypting ISO header...\n");
+		// Decrypt the PGD and get the block table.
+		iso_header = decrypt_psar_pgd(psar, header_offset, ISO_HEADER_SIZE, pgd_key, &pgd_size);
 
-	// Decrypt the PGD and get the block table.
-	int pgd_size = decrypt_pgd(iso_header, ISO_HEADER_SIZE, 2, pgd_key);
+		if (iso_header != NULL)
+			printf("ISO header successfully decrypted! Saving as ISO_HEADER_%d.BIN...\n\n", disc_num);
+		else
+		{
+			printf("ERROR: ISO header decryption failed!\n\n");
+			return -1;
+		}
 
-	if (pgd_size > 0)
-		printf("ISO header successfully decrypted! Saving as ISO_HEADER_%d.BIN...\n\n", disc_num);
-	else
-	{
-		printf("ERROR: ISO header decryption failed!\n\n");
-		return -1;
+		if (g_index_eboot[0] != 0)
+			pxidx_save(index_path, psar, pgd_key, iso_header, pgd_size, &index_info);
 	}
 
 	// Choose the output ISO header file name based on the disc number.
@@ -423,17 +498,22 @@ int decrypt_iso_header(FILE *psar, unsigned int header_offset, unsigned char *pg
 	else
 		sprintf(iso_header_filename, "ISO_HEADER.BIN");
 
-	// Store the decrypted ISO header.
-	FILE* dec_iso_header = fopen(iso_header_filename, "wb");
-	fwrite(iso_header + 0x90, pgd_size, 1, dec_iso_header);
+	// Store the decrypted ISO header. The index only keeps the part of it
+	// that is used, so that one is not stored.
+	FILE* dec_iso_header = from_index ? NULL : temp_fopen(iso_header_filename, "wb");
+	if (dec_iso_header != NULL)
+	{
+		fwrite(iso_header, pgd_size, 1, dec_iso_header);
+		fclose(dec_iso_header);
+	}
 
-	fclose(dec_iso_header);
+	int result = parse_iso_header(iso_header, pgd_size, header);
 	delete[] iso_header;
 
-	return 0;
+	return result;
 }
 
-int decrypt_iso_map(FILE *psar, int map_offset, int map_size, unsigned char *pgd_key)
+int decrypt_iso_map(PBP_SECTION *psar, int map_offset, int map_size, unsigned char *pgd_key)
 {
 	if (psar == NULL)
 	{
@@ -441,19 +521,13 @@ int decrypt_iso_map(FILE *psar, int map_offset, int map_size, unsigned char *pgd
 		return -1;
 	}
 
-	// Seek to the ISO map.
-	fseek(psar, map_offset, SEEK_SET);
-
-	// Read the ISO map.
-	unsigned char *iso_map = new unsigned char[map_size];
-	fread(iso_map, map_size, 1, psar);
-
 	printf("Decrypting ISO disc map...\n");
 
 	// Decrypt the PGD and get the block table.
-	int pgd_size = decrypt_pgd(iso_map, map_size, 2, pgd_key);
+	int pgd_size = 0;
+	unsigned char *iso_map = decrypt_psar_pgd(psar, map_offset, map_size, pgd_key, &pgd_size);
 
-	if (pgd_size > 0)
+	if (iso_map != NULL)
 		printf("ISO disc map successfully decrypted! Saving as ISO_MAP.BIN...\n\n");
 	else
 	{
@@ -462,178 +536,20 @@ int decrypt_iso_map(FILE *psar, int map_offset, int map_size, unsigned char *pgd
 	}
 
 	// Store the decrypted ISO disc map.
-	FILE* dec_iso_map = fopen("ISO_MAP.BIN", "wb");
-	fwrite(iso_map + 0x90, pgd_size, 1, dec_iso_map);
+	FILE* dec_iso_map = temp_fopen("ISO_MAP.BIN", "wb");
+	fwrite(iso_map, pgd_size, 1, dec_iso_map);
 	fclose(dec_iso_map);
 	delete[] iso_map;
 
 	return 0;
 }
 
-int build_data_track(FILE *psar, FILE *iso_table, unsigned int disc_offset, int disc_num)
-{
-	if ((psar == NULL) || (iso_table == NULL))
-	{
-		printf("ERROR: Can't open input files for ISO!\n");
-		return -1;
-	}
-
-	// Setup buffers.
-	unsigned char iso_block_comp[ISO_BLOCK_SIZE];   // Compressed block.
-	unsigned char iso_block_decomp[ISO_BLOCK_SIZE]; // Decompressed block.
-	memset(iso_block_comp, 0, ISO_BLOCK_SIZE);
-	memset(iso_block_decomp, 0, ISO_BLOCK_SIZE);
-
-	// Locate the block table.
-	int table_offset = 0x3C00;  // Fixed offset.
-	fseek(iso_table, table_offset, SEEK_SET);
-
-	// Choose the output file name based on the disc number.
-	char iso_filename[0x10];
-	if (disc_num > 0)
-		sprintf(iso_filename, "DATA_%d.BIN", disc_num);  // multi-disc
-	else
-		sprintf(iso_filename, "DATA_TRACK.BIN");  // single disc
-
-	// Open a new file to write overdump
-	FILE* overdump = fopen("OVERDUMP.BIN", "wb");
-	// Open a new file to write the ISO image.
-	FILE* iso = fopen(iso_filename, "wb");
-	if (iso == NULL)
-	{
-		printf("ERROR: Can't open output file for ISO!\n");
-		return -1;
-	}
-
-	long long iso_offset = ISO_BASE_OFFSET + disc_offset;  // Start of compressed ISO data.
-	printf("ISO offset %llx\n", iso_offset);
-	int read_size = 0;
-	int block_count = 0;
-	ISO_ENTRY entry[sizeof(ISO_ENTRY)];
-	memset(entry, 0, sizeof(entry));
-
-	// Read the first entry.
-	fread(entry, sizeof(ISO_ENTRY), 1, iso_table);
-
-	// Keep reading entries until we reach the end of the table.
-	while (entry->size > 0)
-	{
-		read_size += entry->size;
-		if (block_count % 100 == 0) printf(".");
-		// Locate the block offset in the DATA.PSAR.
-		_fseeki64(psar, iso_offset + entry->offset, SEEK_SET);
-		fread(iso_block_comp, entry->size, 1, psar);
-
-		// Decompress if necessary.
-		if (entry->size < ISO_BLOCK_SIZE)   // Compressed.
-			decompress(iso_block_decomp, iso_block_comp, ISO_BLOCK_SIZE);
-		else								// Not compressed.
-			memcpy(iso_block_decomp, iso_block_comp, ISO_BLOCK_SIZE);
-
-		// trash and overdump generating
-		if (entry->marker == 0)
-		{
-			int trash_start = 0, trash_size = 0;
-			unsigned int sector;			
-			do
-			{
-				// search for first non 00 FF FF FF
-				sector = iso_block_decomp[trash_start] + 256 * (iso_block_decomp[trash_start + 1] + 256 * (iso_block_decomp[trash_start + 2] + 256 * iso_block_decomp[trash_start + 3]));
-				trash_start = trash_start + SECTOR_SIZE;
-			} while (sector == 0xFFFFFF00);
-			trash_start = trash_start - SECTOR_SIZE;
-			do
-			{
-				// search for first zero padding (4 bytes length)
-				sector = iso_block_decomp[trash_start + trash_size] + 256 * (iso_block_decomp[trash_start + trash_size + 1] + 256 * (iso_block_decomp[trash_start + trash_size + 2] + 256 * iso_block_decomp[trash_start + trash_size + 3]));
-				trash_size = trash_size + 4;
-			} while (sector != 0);
-			trash_size = trash_size - 4;
-			if (trash_size != 0)
-			{
-				FILE* trash = fopen("TRASH.BIN", "wb");
-				fwrite(iso_block_decomp + trash_start, trash_size, 1, trash);
-				fclose(trash);
-				fwrite(iso_block_decomp + trash_start + trash_size, ISO_BLOCK_SIZE - trash_start - trash_size, 1, overdump);
-			}
-			else
-				fwrite(iso_block_decomp, ISO_BLOCK_SIZE, 1, overdump);
-		}
-
-		// Write it to the output file.
-		fwrite(iso_block_decomp, ISO_BLOCK_SIZE, 1, iso);
-		block_count++;
-					
-		// Clear buffers.
-		memset(iso_block_comp, 0, ISO_BLOCK_SIZE);
-		memset(iso_block_decomp, 0, ISO_BLOCK_SIZE);
-
-		// Go to next entry.
-		table_offset += sizeof(ISO_ENTRY);
-		fseek(iso_table, table_offset, SEEK_SET);
-		fread(entry, sizeof(ISO_ENTRY), 1, iso_table);
-	}
-	printf("\n");
-	printf("Raw data track written to %s\n", iso_filename);
-	fclose(overdump);
-	fclose(iso);
-	return 0;
-}
 						             
-unsigned int ROTR32(unsigned int v, int n)
-{
-  return (((n &= 32 - 1) == 0) ? v : (v >> n) | (v << (32 - n)));
-}
-
-
-
-int unscramble_atrac_data(unsigned char *track_data, CDDA_ENTRY *track)
+// Unscrambling is chunk-parallel, see unscramble.cpp.
+// Unscrambles size bytes of the track starting at byte offset (a multiple of NBYTES).
+int unscramble_atrac_data(unsigned char *track_data, int size, CDDA_ENTRY *track, int offset)
 {
-	unsigned int blocks = (track->size / NBYTES) / 0x10;
-	unsigned int chunks_rest = (track->size / NBYTES) % 0x10;
-	unsigned int *ptr = (unsigned int*)track_data;
-	unsigned int tmp = 0, tmp2 = track->checksum, value = 0;
-	
-	// for each block
-	while(blocks)
-	{
-		// for each chunk of block
-		for(int i = 0; i < 0x10; i++)
-		{
-			tmp = tmp2;
-			
-			// for each value of chunk
-			for(int k = 0; k < (NBYTES / 4); k++)
-			{
-				value = ptr[k];
-				ptr[k] = (tmp ^ value);
-		    tmp = tmp2 + (value * 123456789);
-			}
-			
-			tmp2 = ROTR32(tmp2, 1);
-			ptr += (NBYTES / 4); // pointer on next chunk
-		}
-		
-		blocks--;
-	}
-	
-	// do rest chunks
-	for(unsigned int i = 0; i < chunks_rest; i++)
-	{
-		tmp = tmp2;
-	  
-		// for each value of chunk
-		for(int k = 0; k < (NBYTES / 4); k++)
-		{
-		value = ptr[k];
-			ptr[k] = (tmp ^ value);
-			tmp = tmp2 + (value * 123456789);
-		}
-    
-		tmp2 = ROTR32(tmp2, 1);
-		ptr += (NBYTES / 4); // next chunk
-	}
-  
+	unscramble_atrac_window(track_data, size, track->checksum, offset / NBYTES);
 	return 0;
 }
 
@@ -666,110 +582,55 @@ int fill_at3_header(AT3_HEADER *header, CDDA_ENTRY *audio_entry, int track_secto
 	return 0;
 }
 
-int extract_frames_from_cue(FILE *iso_table, int cue_offset, int gap)
-{
-	CUE_ENTRY cue_entry[sizeof(CUE_ENTRY)];
-	memset(cue_entry, 0, sizeof(cue_entry));
-
-	fseek(iso_table, cue_offset, SEEK_SET);
-	fread(cue_entry, sizeof(CUE_ENTRY), 1, iso_table);
-	int mm1, ss1, ff1;
-	unsigned char mm = cue_entry->I1m;
-	unsigned char ss = cue_entry->I1s;
-	unsigned char ff = cue_entry->I1f;
-	// According to documentation http://endlessparadigm.com/forum/showthread.php?tid=14
-	// and for the vast majority of games tested Audio track type should be 0x01,
-	// however at least one case exists (Castlevania: SOTN) where the track types
-	// are increased by 0x20 (so data track is 0x61 rather than 0x41 and audio is
-	// 0x21 rather than 0x01).
-	if (cue_entry->type == 0x01 || cue_entry->type == 0x21
-		|| cue_entry->type == 0x41 || cue_entry->type == 0x61)
-	{
-		// convert 0xXY into decimal XY
-		mm1 = 10 * (mm - mm % 16) / 16 + mm % 16;
-		ss1 = (10 * (ss - ss % 16) / 16 + ss % 16) - gap;
-		ff1 = 10 * (ff - ff % 16) / 16 + ff % 16;
-		printf("Offset %dm:%ds:%df at %04x\n", mm1, ss1, ff1, cue_offset);
-		return (mm1 * 60 * 75) + (ss1 * 75) + ff1;
-	}
-	// once we hit invalid track type, indicate this is last track
-	// at which point we'll need to get entire disc size to calculate its length
-	return -1;
-}
-
-int get_track_size_from_cue(FILE *iso_table, int cue_offset)
-{
-	int cur_track_offset = extract_frames_from_cue(iso_table, cue_offset, 2);
-	if (cur_track_offset < 0) {
-		printf("ERROR: unable to get current track offset, aborting...\n");
-		return -1;
-	}
-	int next_track_offset = extract_frames_from_cue(iso_table, cue_offset + sizeof(CUE_ENTRY), 2);
-	if (next_track_offset < 0)
-	{
-		// get disc size to calculate last track, no gap after last track
-		next_track_offset = extract_frames_from_cue(iso_table, CUE_LEADOUT_OFFSET, 0);
-		if (next_track_offset < 0)
-		{
-			printf("ERROR: last track size calculation failed, aborting...\n");
-			return -1;
-		}
-	}
-	return next_track_offset - cur_track_offset;
-}
-
-int data_track_sectors(FILE *iso_table)
-{
-	// int track = 1;  // unused variable
-	int cue_offset = 0x41E;  // track 01 offset
-	int track_size = get_track_size_from_cue(iso_table, cue_offset) - GAP_FRAMES;  // subtract 2 seconds
-	if (track_size < 0) {
-		printf("Unable to get data track size\n");
-		return -1;
-	}
-	return track_size;
-}
-
+// Path of an audio track's intermediate file in the job's TEMP directory
+// (filename holds MAX_PATH chars).
 void audio_file_name(char* filename, int disc_num, int track_num, char* extension)
 {
-	sprintf(filename, "D%02d_TRACK%02d.%s", disc_num, track_num, extension);
+	char name[0x20];
+	sprintf(name, "D%02d_TRACK%02d.%s", disc_num, track_num, extension);
+	batch_temp_path(name, filename, MAX_PATH);
 }
 
-int build_audio_at3(FILE *psar, FILE *iso_table, int base_audio_offset, unsigned char *pgd_key, int disc_num, const PREGAP_OVERRIDE* pregap_override)
-{	
-	if ((psar == NULL) || (iso_table == NULL))
-	{
-		printf("ERROR: Can't open input files for extracting audio tracks!\n");
-		return -1;
-	}
-	char track_filename[0x10];
-	int track_num = 1;
-	
-	AT3_HEADER at3_header[sizeof(AT3_HEADER)];
-	CDDA_ENTRY audio_entry[sizeof(CDDA_ENTRY)];
-	memset(audio_entry, 0, sizeof(audio_entry));
-
-	CUE_ENTRY cue_entry_cur[sizeof(CUE_ENTRY)];
-	memset(cue_entry_cur, 0, sizeof(cue_entry_cur));
-
-	CUE_ENTRY cue_entry_next[sizeof(CUE_ENTRY)];
-	memset(cue_entry_next, 0, sizeof(cue_entry_next));
-
-	// Read track 02
-	int cue_offset = 0x428;  // track 02 offset
-	int audio_offset = 0x800;  // Fixed audio table offset.
-	
-	fseek(iso_table, audio_offset, SEEK_SET);
-	fread(audio_entry, sizeof(CDDA_ENTRY), 1, iso_table);
-	if (audio_entry->offset == 0)
+// One CDDA track of the disc. The tracks are located up front and then
+// converted independently of each other.
+typedef struct {
+	int track_num;
+	int track_size;         // Sectors, including pregap override adjustments.
+	CDDA_ENTRY entry;
+	int pregap_size;        // Bytes of silence in front of the audio.
+	int audio_size;         // Bytes of decoded audio kept (padded if the track is shorter).
+	int region_size;        // Total bytes of the track in the BIN.
+	long long region_offset;
+	int failed;             // AUDIO_FAILED_* stage, 0 if the track went through.
+} AUDIO_TRACK;
+
+#define MAX_AUDIO_TRACKS	(MAX_CUE_TRACKS - 1)	// Tracks 02 to 99.
+#define AUDIO_FAILED_EXTRACT	1
+#define AUDIO_FAILED_DECODE	2
+#define AUDIO_FAILED_BIN	3
+#define AUDIO_WRITE_BUFFER	(64 * 4096)	// 64 decoded ATRAC3 frames.
+
+// Tracks are read, unscrambled and decoded this much at a time, so the memory
+// used per track does not grow with its length. NBYTES is both the scrambled
+// chunk size and the ATRAC3 frame size (see fill_at3_header), so every window
+// holds whole chunks and whole frames.
+#define AUDIO_READ_WINDOW	(160 * NBYTES)
+
+// Walks the CDDA table and the CUE entries of the ISO header. Returns the
+// number of audio tracks, or -1 on error.
+int collect_audio_tracks(const ISO_HEADER *header, const PREGAP_OVERRIDE* pregap_override, AUDIO_TRACK *tracks)
+{
+	if (header->num_cdda == 0)
 	{
 		printf("There are no CDDA audio tracks, continuing...\n");
 		return 0;
 	}
-	while (audio_entry->offset)
+
+	int num_tracks = 0;
+	for (int i = 0; i < header->num_cdda; i++)
 	{
-		track_num++;
-		int track_size = get_track_size_from_cue(iso_table, cue_offset);
+		int track_num = i + 2;
+		int track_size = get_track_size_from_cue(header, track_num);
 
         if (pregap_override != NULL)
         {
@@ -801,101 +662,42 @@ int build_audio_at3(FILE *psar, FILE *iso_table, int base_audio_offset, unsigned
 			printf("ERROR: retrieving offset for track %d, aborting...\n", track_num);
 			return -1;
 		}
-		
-		// Locate the block offset in the DATA.PSAR.
-		printf("seeking to %x + %x (%x)\n", base_audio_offset, audio_entry->offset, base_audio_offset + audio_entry->offset);
-		fseek(psar, base_audio_offset + audio_entry->offset, SEEK_SET);
-
-		// Read the data.
-		unsigned char *track_data = new unsigned char[audio_entry->size + NBYTES];
-		fread(track_data, audio_entry->size + NBYTES, 1, psar);
-		
-		
-		// Store the decrypted track data.
-		// Open a new file to write the track image with AT3 header
-		audio_file_name(track_filename, disc_num, track_num, (char*)"AT3");
-		FILE* track = fopen(track_filename, "wb");
-		if (track == NULL)
-		{
-			printf("ERROR: Can't open output file for audio track %d!\n", track_num);
-			return -1;
-		}
-
-		printf("Extracting audio track %d (%d sectors, %d bytes)\n", track_num, track_size, audio_entry->size + NBYTES);
-		
-		unscramble_atrac_data(track_data, audio_entry);
-		
-		fill_at3_header(at3_header, audio_entry, track_size);
 
-		fwrite(at3_header, sizeof(AT3_HEADER), 1, track);
-		fwrite(track_data, audio_entry->size, 1, track);
-		
-		fclose(track);
-		delete[] track_data;
-		
-		audio_offset += sizeof(CDDA_ENTRY);
-		cue_offset += sizeof(CUE_ENTRY);
-		// Go to next entry.
-		fseek(iso_table, audio_offset, SEEK_SET);
-		fread(audio_entry, sizeof(CDDA_ENTRY), 1, iso_table);
+		AUDIO_TRACK *track = &tracks[num_tracks++];
+		memset(track, 0, sizeof(AUDIO_TRACK));
+		track->track_num = track_num;
+		track->track_size = track_size;
+		track->entry = header->cdda[i];
 	}
-	return track_num - 1;
+	return num_tracks;
 }
 
-int convert_at3_to_wav(int disc_num, int num_tracks)
+// Creates Dxx_TRACKyy.AT3 for the unscrambled track, which is appended to it as it is read.
+FILE* open_track_at3(int disc_num, AUDIO_TRACK *track, AT3_HEADER *at3_header)
 {
-	if (num_tracks > 0)
-		printf("\nAttempting to convert from ATRAC3 to WAV, this may take awhile...\n\n");
-	
-	// Find ATRAC3 driver once for all conversions (we know it's available at this point)
-	HACMDRIVERID at3hadid = nullptr;
-	findAt3Driver(&at3hadid);
-	
-	for (int i = 2; i <= num_tracks + 1; i++)
+	char at3_filename[MAX_PATH];
+	audio_file_name(at3_filename, disc_num, track->track_num, (char*)"AT3");
+	FILE* at3_file = fopen(at3_filename, "wb");
+	if (at3_file == NULL)
 	{
-		char at3_filename[0x10];
-		audio_file_name(at3_filename, disc_num, i, (char*)"AT3");
-		struct stat st;
-		if (stat(at3_filename, &st) != 0 || st.st_size == 0)
-		{
-			printf("%s doesn't exist or empty, aborting...\n", at3_filename);
-			return -1;
-		}
-
-		char wav_filename[0x10];
-		audio_file_name(wav_filename, disc_num, i, (char*)"WAV");
+		printf("ERROR: Can't open output file for audio track %d!\n", track->track_num);
+		return NULL;
+	}
 
-		printf("Converting %s to %s using ATRAC3 ACM...\n", at3_filename, wav_filename);
-		int conversion_result = convertAt3ToWav(at3_filename, wav_filename, at3hadid);
-		if (conversion_result != 0)
-		{
-			printf("ERROR: Failed to convert %s using ATRAC3 ACM\n", at3_filename);
-			return -1;
-		}
-		if (stat(wav_filename, &st) != 0 || st.st_size <= 44)
-		{
-			printf("%s failed to convert, ignoring audio tracks...\n", wav_filename);
-			return -1;
-		}
-		if (stat(wav_filename, &st) == 0)
-		{
-			FILE* at3_file = fopen(at3_filename, "rb");
-			if (at3_file == NULL)
-			{
-				printf("ERROR: Can't open %s for verification, aborting...\n", at3_filename);
-				return -1;
-			}
-			AT3_HEADER at3_header[sizeof(AT3_HEADER)];
-			fread(at3_header, sizeof(AT3_HEADER), 1, at3_file);
-			printf("%s created with size %ld (expected %d)...\n", wav_filename, st.st_size, 44 + at3_header->fact_param1 * 4);
-			fclose(at3_file);
-		}
-		else
-			printf("Unable to open %s for verification...\n", wav_filename);
-		printf("\n");
+	fwrite(at3_header, sizeof(AT3_HEADER), 1, at3_file);
+	return at3_file;
+}
 
-	}
-	return num_tracks;
+// Decoder settings matching an AT3 header from fill_at3_header.
+void at3_format(const AT3_HEADER *header, ATRAC3_FORMAT *format)
+{
+	memset(format, 0, sizeof(ATRAC3_FORMAT));
+	format->channels = header->channels;
+	format->sample_rate = header->sample_rate;
+	format->block_align = header->bytes_per_frame & 0xFFFF;  // Upper half is the bits per sample (0).
+	format->joint_stereo = header->param4 != 0;               // Coding mode.
+	format->data_size = header->data_size;
+	format->total_samples = header->fact_param1;
 }
 
 // EBOOT stores audio tracks with the assumption that a 2 second pregap exists on each track.
@@ -916,7 +718,7 @@ int convert_at3_to_wav(int disc_num, int num_tracks)
 // and there are also two specific eboots that have 1 second pregaps, so special handling is
 // required to produce working results in all cases.
 //
-// In any case, we need to strip the WAVE header and generate the required gaps
+// In any case, we need to generate the required gaps
 // by moving pregap silence to the front, then further prepad the track
 // to ensure it has expected length gap, as defined by the CUE values relative to
 // actual data size of the previous track. Such prepadding only really works with track 2, i.e.
@@ -926,229 +728,726 @@ int convert_at3_to_wav(int disc_num, int num_tracks)
 // On further audio tracks we assume 2 second gaps unless the game is known to have different
 // pregap timings. Finally we pad the last track with zeroes until the disc reaches its expected
 // length.
-int convert_wav_to_bin(int data_gap, int disc_num, int num_tracks, const PREGAP_OVERRIDE* pregap_override)
+//
+// All of this only depends on the CUE data and PREGAP_OVERRIDE, so the size and
+// position of every track in the final BIN is known before any audio is decoded.
+void plan_audio_track(AUDIO_TRACK *track, int data_gap, const PREGAP_OVERRIDE* pregap_override)
 {
-	printf("\nAttempting to convert WAV audio to BIN...\n\n");
-	for (int i = 2; i <= num_tracks + 1; i++)
+	int track_num = track->track_num;
+
+	// Same as fact_param1 * 4 in the AT3 header.
+	int expected_size = track->track_size * SECTOR_SIZE;
+
+    int gap_frames = GAP_FRAMES;
+    if (pregap_override != NULL && track_num - 2 < pregap_override->num_tracks)
+    {
+        // check if the pregap for this track gets an override
+        const TIMESTAMP* t = &pregap_override->timestamps[track_num - 2];
+        printf("Overriding pregap with %02d:%02d:%02d\n", t->mm, t->ss, t->ff);
+        gap_frames = (t->mm * 60 + t->ss) * 75 + t->ff;
+    }
+    
+	int pregap_size = (((track_num == 2) ? data_gap : gap_frames) - 1) * SECTOR_SIZE;
+	if (pregap_size < 0)
+		pregap_size = 0;
+	printf("Track %d: adding gap %d bytes...\n", track_num, pregap_size);
+
+	// Calculate target track size from CUE file if available
+	int target_track_size = expected_size;
+	if (pregap_override != NULL && track_num - 2 < pregap_override->num_tracks)
 	{
-		char wav_filename[0x10];
-		audio_file_name(wav_filename, disc_num, i, (char*)"WAV");
-		struct stat st;
-		if (stat(wav_filename, &st) != 0 || st.st_size == 0)
-		{
-			printf("%s doesn't exist or empty, aborting...\n", wav_filename);
-			return -1;
-		}
-		FILE* wav_file = fopen(wav_filename, "rb");
-		if (wav_file == NULL)
-		{
-			printf("ERROR: Can't open %s, aborting...\n", wav_filename);
-			return -1;
+		const TIMESTAMP* expected_length = &pregap_override->track_lengths[track_num - 2];
+		int expected_frames = expected_length->mm * 60 * 75 + expected_length->ss * 75 + expected_length->ff;
+		int cue_track_size = expected_frames * SECTOR_SIZE;
+		
+		// Only use CUE size if it's reasonable (not 0 or too small)
+		if (cue_track_size > pregap_size) {
+			target_track_size = cue_track_size;
 		}
+	}
+	
+	// Audio data size to reach target track size, the track is then padded
+	// with zeroes if it is still shorter than the AT3 header says.
+	int data_size = target_track_size - pregap_size;
+	if (data_size < 0)
+		data_size = 0;
+
+	track->pregap_size = pregap_size;
+	track->audio_size = data_size;
+	track->region_size = pregap_size + data_size;
+	if (track->region_size < expected_size)
+		track->region_size = expected_size;
+}
 
-		fseek(wav_file, 0, SEEK_END);
-		long wav_size = ftell(wav_file);
-		fseek(wav_file, wav_size - GAP_SIZE, SEEK_SET);
+// Final BIN shared by the audio track workers. Every track owns a region of it
+// laid out by plan_audio_track, so the workers only serialize the seek + write.
+typedef struct {
+	FILE *file;
+	CRITICAL_SECTION lock;
+} AUDIO_BIN;
+
+// Buffered writer for the region of one track.
+typedef struct {
+	AUDIO_BIN *bin;
+	long long offset;           // BIN position of buffer[0].
+	int used;
+	int audio_left;             // Decoded audio bytes the track still takes.
+	bool failed;
+	unsigned char *buffer;
+	MD5_STREAM md5;             // Of the region, for the checkpoint.
+	bool hashing;
+} TRACK_WRITER;
+
+static int flush_track_writer(TRACK_WRITER *writer)
+{
+	if (writer->used == 0)
+		return 0;
 
-		char bin_filename[0x10];
-		audio_file_name(bin_filename, disc_num, i, (char*)"BIN");
-		FILE* bin_file = fopen(bin_filename, "wb");
-		if (bin_file == NULL)
-		{
-			printf("ERROR: Can't open %s, aborting...\n", bin_filename);
-			fclose(wav_file);
-			return -1;
-		}
+	EnterCriticalSection(&writer->bin->lock);
+	bool written = _fseeki64(writer->bin->file, writer->offset, SEEK_SET) == 0 &&
+		fwrite(writer->buffer, 1, writer->used, writer->bin->file) == (size_t)writer->used;
+	LeaveCriticalSection(&writer->bin->lock);
 
-		// grab the expected size from the AT3 header
-		long expected_size = -1;
-		char at3_filename[0x10];
-		audio_file_name(at3_filename, disc_num, i, (char*)"AT3");
-		FILE* at3_file = fopen(at3_filename, "rb");
-		if (at3_file != NULL)
+	if (written && writer->hashing)
+		writer->hashing = md5_stream_update(&writer->md5, writer->buffer, writer->used);
+	writer->offset += writer->used;
+	writer->used = 0;
+	if (!written)
+	{
+		printf("ERROR: Can't write audio to the BIN!\n");
+		writer->failed = true;
+		return -1;
+	}
+	return 0;
+}
+
+// Appends size bytes of data, or of zeroes if data is NULL.
+static int put_track_bytes(TRACK_WRITER *writer, const void *data, int size)
+{
+	const unsigned char *bytes = (const unsigned char*)data;
+	while (size > 0)
+	{
+		int chunk = AUDIO_WRITE_BUFFER - writer->used;
+		if (chunk > size)
+			chunk = size;
+		if (bytes != NULL)
 		{
-			AT3_HEADER at3_header[sizeof(AT3_HEADER)];
-			fread(at3_header, sizeof(AT3_HEADER), 1, at3_file);
-			expected_size = at3_header->fact_param1 * 4;
+			memcpy(writer->buffer + writer->used, bytes, chunk);
+			bytes += chunk;
 		}
 		else
-			printf("WARNING: Can't open %s, skipping padding step...\n", at3_filename);
-        int gap_frames = GAP_FRAMES;
-        if (pregap_override != NULL && i >= 2 && i - 2 < pregap_override->num_tracks)
-        {
-            // check if the pregap for this track gets an override
-            const TIMESTAMP* t = &pregap_override->timestamps[i - 2];
-            printf("Overriding pregap with %02d:%02d:%02d\n", t->mm, t->ss, t->ff);
-            gap_frames = (t->mm * 60 + t->ss) * 75 + t->ff;
-        }
-        
-		int pregap_size = (((i == 2) ? data_gap : gap_frames) - 1) * SECTOR_SIZE;
+			memset(writer->buffer + writer->used, 0, chunk);
+		writer->used += chunk;
+		size -= chunk;
 
-		char zero = '\0';
-		printf("Adding gap %d bytes...\n", pregap_size);
-		fseek(bin_file, pregap_size - 1, SEEK_SET);
-		fwrite(&zero, 1, 1, bin_file);
+		if (writer->used == AUDIO_WRITE_BUFFER && flush_track_writer(writer) < 0)
+			return -1;
+	}
+	return 0;
+}
 
-		fseek(wav_file, 44, SEEK_SET);  // skip the WAVE header
-		
-		// Calculate target track size from CUE file if available
-		int target_track_size = expected_size;
-		if (pregap_override != NULL && i - 2 < pregap_override->num_tracks)
-		{
-			const TIMESTAMP* expected_length = &pregap_override->track_lengths[i - 2];
-			int expected_frames = expected_length->mm * 60 * 75 + expected_length->ss * 75 + expected_length->ff;
-			int cue_track_size = expected_frames * SECTOR_SIZE;
-			
-			// Only use CUE size if it's reasonable (not 0 or too small)
-			if (cue_track_size > pregap_size) {
-				target_track_size = cue_track_size;
-			}
-		}
-		
-		// Calculate audio data size to reach target track size
-		int data_size = target_track_size - pregap_size;
-		
-		// Ensure we don't read more than available in WAV file
-		int max_wav_data = wav_size - 44;
-		if (data_size > max_wav_data) {
-			printf("Warning: Need %d bytes but WAV only has %d, will use available data and pad\n", data_size, max_wav_data);
-			// We'll read all available data and pad the rest
-		}
+// PCM_SINK keeping the first audio_size bytes of the decoded track.
+static int put_track_audio(void *ctx, const int16_t *samples, int frames)
+{
+	TRACK_WRITER *writer = (TRACK_WRITER*)ctx;
+	int size = frames * 2 * (int)sizeof(int16_t);  // 16-bit stereo, as written by fill_at3_header.
+	if (size > writer->audio_left)
+		size = writer->audio_left;
+	if (put_track_bytes(writer, samples, size) < 0)
+		return -1;
+	writer->audio_left -= size;
+	return (writer->audio_left > 0) ? 0 : 1;
+}
 
-		// Read available WAV data
-		int read_size = (data_size > max_wav_data) ? max_wav_data : data_size;
-		unsigned char* audio_data = (unsigned char*)malloc(read_size);
-		if (audio_data == NULL) {
-			printf("Unable to allocated audio data size %d, aborting...\n", read_size);
-			if (at3_file != NULL) fclose(at3_file);
-			fclose(bin_file);
-			fclose(wav_file);
-			return -1;
-		}
-		
-		fread(audio_data, read_size, 1, wav_file);
-		fwrite(audio_data, read_size, 1, bin_file);
-		free(audio_data);
-		
-		// Pad the rest if needed
-		if (data_size > read_size) {
-			int padding_needed = data_size - read_size;
-			printf("Padding track %d with %d bytes to reach expected length\n", i, padding_needed);
-			unsigned char* padding = (unsigned char*)calloc(padding_needed, 1);
-			if (padding != NULL) {
-				fwrite(padding, padding_needed, 1, bin_file);
-				free(padding);
-			}
-		}
+// State shared by the audio track workers.
+typedef struct {
+	PBP_SECTION *psar;
+	int base_audio_offset;
+	int disc_num;
+	bool convert;               // False if the ACM codec was asked for but is missing.
+	HACMDRIVERID at3hadid;
+	AUDIO_BIN *bin;
+	AUDIO_TRACK *tracks;
+	CHECKPOINT *checkpoint;     // NULL to neither resume nor record tracks.
+} AUDIO_JOB;
+
+// Sample data of a WAV file written by convert_at3_to_wav.
+typedef struct {
+	FILE* file;
+	int channels;
+} WAV_SINK;
+
+static int write_wav_samples(void* ctx, const int16_t* samples, int frames)
+{
+	WAV_SINK* wav = (WAV_SINK*)ctx;
+	size_t count = (size_t)frames * wav->channels;
+	return (fwrite(samples, sizeof(int16_t), count, wav->file) == count) ? 0 : -1;
+}
 
-		fseek(bin_file, 0, SEEK_END);
-		long file_size = ftell(bin_file);
-		if (file_size < expected_size)
-		{
-			printf("Padding track %d with additional %ld bytes\n", i, expected_size - file_size);
-			long new_pos = expected_size - 1;
-			fseek(bin_file, new_pos, SEEK_SET);
-			(void)fwrite(&zero, 1, 1, bin_file);  // suppress unused variable warning
-		}
+static void put_le16(uint8_t* p, uint32_t value)
+{
+	p[0] = (uint8_t)value;
+	p[1] = (uint8_t)(value >> 8);
+}
 
-		fclose(at3_file);
-		fclose(wav_file);
-		fclose(bin_file);
-		
-		// Verify track length against CUE file expectation
-		if (pregap_override != NULL && i - 2 < pregap_override->num_tracks)
-		{
-			const TIMESTAMP* expected_length = &pregap_override->track_lengths[i - 2];
-			int expected_frames = expected_length->mm * 60 * 75 + expected_length->ss * 75 + expected_length->ff;
-			int expected_bytes = expected_frames * SECTOR_SIZE;
-			
-			printf("Track %d length verification:\n", i);
-			printf("  Expected: %02d:%02d:%02d (%d bytes)\n", 
-				   expected_length->mm, expected_length->ss, expected_length->ff, expected_bytes);
-			printf("  Actual:   %ld bytes\n", file_size);
-			printf("  Result:   %s\n", (file_size == expected_bytes) ? "PASS" : "FAIL");
-		}
-	}
-	return num_tracks;
+static void put_le32(uint8_t* p, uint32_t value)
+{
+	put_le16(p, value);
+	put_le16(p + 2, value >> 16);
 }
 
-int copy_track_to_iso(FILE *bin_file, char *track_filename, int track_num)
+// Converts an ATRAC3 RIFF file to a 16-bit PCM WAV with a plain 44-byte header
+// using the built-in decoder. Returns 0 on success.
+static int convert_at3_to_wav(const char* input, const char* output)
 {
-	FILE* track_file = fopen(track_filename, "rb");
-	if (track_file == NULL)
+	FILE* in = fopen(input, "rb");
+	if (in == NULL)
 	{
-		// Check if this is an audio track BIN file that doesn't exist
-		if (strstr(track_filename, "TRACK") != NULL && strstr(track_filename, ".BIN") != NULL) {
-			printf("\tskipping %s (audio conversion was skipped)\n", track_filename);
-		} else {
-			printf("ERROR: %s cannot be opened\n", track_filename);
-		}
-		return -1;
+		printf("ERROR: Cannot open AT3 input file: %s\n", input);
+		return 1;
 	}
-	printf("\tadding %s\n", track_filename);
-	fseek(track_file, 0, SEEK_END);
-	long track_size = ftell(track_file);
-	fseek(track_file, 0, SEEK_SET);
-	
-	// Process file in 1MB chunks to avoid large memory allocations
-	const size_t chunk_size = 1024 * 1024; // 1MB chunks
-	unsigned char* chunk_data = (unsigned char*)malloc(chunk_size);
-	if (chunk_data == NULL)
+
+	ATRAC3_FORMAT format;
+	if (atrac3_read_header(in, &format) != 0)
 	{
-		printf("ERROR: could not allocate memory for chunk buffer, aborting...\n");
-		fclose(track_file);
-		return -1;
+		printf("ERROR: Input file is not ATRAC3 format: %s\n", input);
+		fclose(in);
+		return 1;
 	}
-	
-	long remaining = track_size;
-	while (remaining > 0)
+
+	FILE* out = fopen(output, "wb");
+	if (out == NULL)
 	{
-		size_t to_read = (remaining > chunk_size) ? chunk_size : remaining;
-		size_t read_bytes = fread(chunk_data, 1, to_read, track_file);
-		if (read_bytes != to_read)
-		{
-			printf("ERROR: failed to read chunk from track file\n");
-			free(chunk_data);
-			fclose(track_file);
-			return -1;
-		}
-		fwrite(chunk_data, 1, read_bytes, bin_file);
-		remaining -= read_bytes;
+		printf("ERROR: Cannot open output file: %s\n", output);
+		fclose(in);
+		return 1;
 	}
-	
-	fclose(track_file);
-	free(chunk_data);
-	return track_size;
-}
 
-int fix_iso(FILE *iso_table, char* data_track_file_name, char* data_fixed_file_path)
-{
-	// Patch ECC/EDC and build a new proper CD-ROM image for this ISO.
-	printf("Patching ECC/EDC data...\n");
-	int num_sectors_expected = data_track_sectors(iso_table);
-	if (num_sectors_expected < 0)
+	// Every frame decodes to the same number of samples, so the size is known
+	// up front.
+	uint32_t frames = format.data_size / format.block_align;
+	uint32_t block = format.channels * sizeof(int16_t);
+	uint32_t data_size = frames * ATRAC3_SAMPLES_PER_FRAME * block;
+
+	uint8_t header[44];
+	memcpy(header, "RIFF", 4);
+	put_le32(header + 4, 36 + data_size);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	put_le32(header + 16, 16);
+	put_le16(header + 20, 1);   // PCM
+	put_le16(header + 22, format.channels);
+	put_le32(header + 24, format.sample_rate);
+	put_le32(header + 28, format.sample_rate * block);
+	put_le16(header + 32, block);
+	put_le16(header + 34, 16);
+	memcpy(header + 36, "data", 4);
+	put_le32(header + 40, data_size);
+	fwrite(header, 1, sizeof(header), out);
+
+	WAV_SINK sink;
+	sink.file = out;
+	sink.channels = format.channels;
+	int bad_frames = 0;
+	int result = atrac3_decode_stream(in, &format, write_wav_samples, &sink, &bad_frames);
+
+	fclose(in);
+	if (fclose(out) != 0)
+		result = -1;
+
+	if (result != 0)
 	{
-		return -1;
+		printf("ERROR: ATRAC3 decoding of %s failed\n", input);
+		return 1;
 	}
-	int actual_data_sectors = make_cdrom(data_track_file_name, data_fixed_file_path, num_sectors_expected, true);
-	int gap = num_sectors_expected - actual_data_sectors + GAP_FRAMES;
-	printf("Gap after data track: %d sectors\n", gap);
+	if (bad_frames > 0)
+		printf("WARNING: %d corrupt ATRAC3 frames in %s were replaced with silence\n", bad_frames, input);
+	return 0;
+}
+
+// Takes one track from the PSAR straight into its region of the final BIN.
+// Decoding failures are reported through track->failed without stopping the
+// other tracks, see extract_and_convert_audio.
+static int process_audio_track(void *ctx, int index)
+{
+	AUDIO_JOB *job = (AUDIO_JOB*)ctx;
+	AUDIO_TRACK *track = &job->tracks[index];
+	CDDA_ENTRY *audio_entry = &track->entry;
+	int track_num = track->track_num;
+	long long track_offset = (long long)job->base_audio_offset + audio_entry->offset;
+
+	if (batch_cancelled())
+	{
+		track->failed = AUDIO_FAILED_EXTRACT;
+		return -1;
+	}
+
+	// An interrupted run may have finished the track already.
+	if (job->convert && checkpoint_track_done(job->checkpoint, job->disc_num, track_num, track->region_offset, track->region_size))
+	{
+		printf("Audio track %d is already in the BIN, skipping it\n", track_num);
+		return 0;
+	}
+
+	// The track is streamed, only its read window and write buffer count.
+	long long track_memory = AUDIO_READ_WINDOW + (job->convert ? AUDIO_WRITE_BUFFER : 0);
+	if (!batch_reserve_memory("an audio track", track_memory))
+	{
+		track->failed = AUDIO_FAILED_EXTRACT;
+		return -1;
+	}
+
+	// Locate the block offset in the DATA.PSAR.
+	printf("seeking to %x + %x (%x)\n", job->base_audio_offset, audio_entry->offset, job->base_audio_offset + audio_entry->offset);
+	printf("Extracting audio track %d (%d sectors, %d bytes)\n", track_num, track->track_size, audio_entry->size);
+
+	AT3_HEADER at3_header[sizeof(AT3_HEADER)];
+	fill_at3_header(at3_header, audio_entry, track->track_size);
+
+	// The AT3 file is only needed for debugging, or as the only audio output
+	// when there is no codec to convert it with.
+	FILE *at3_file = NULL;
+	if (g_keep_temp || !job->convert)
+	{
+		at3_file = open_track_at3(job->disc_num, track, at3_header);
+		if (at3_file == NULL)
+		{
+			batch_release_memory(track_memory);
+			track->failed = AUDIO_FAILED_EXTRACT;
+			return -1;
+		}
+	}
+
+	TRACK_WRITER writer;
+	memset(&writer, 0, sizeof(writer));
+	writer.bin = job->bin;
+	writer.offset = track->region_offset;
+	writer.audio_left = track->audio_size;
+	if (job->checkpoint != NULL && job->convert)
+		writer.hashing = md5_stream_begin(&writer.md5);
+
+	// Either decoder takes the track as it is read.
+	ATRAC3_DECODER *decoder = NULL;
+	AT3_ACM_DECODER *acm_decoder = NULL;
+	bool buffers_ok = true;
+	if (job->convert)
+	{
+		writer.buffer = (unsigned char*)malloc(AUDIO_WRITE_BUFFER);
+		buffers_ok = writer.buffer != NULL;
+	}
+	if (job->convert && !g_use_acm)
+	{
+		ATRAC3_FORMAT format;
+		at3_format(at3_header, &format);
+		decoder = atrac3_create(format.channels, format.block_align, format.joint_stereo);
+		buffers_ok = buffers_ok && decoder != NULL;
+	}
+	if (job->convert && g_use_acm)
+	{
+		// The fmt chunk of the AT3 header is the codec's WAVEFORMATEX.
+		acm_decoder = openAt3Decoder(job->at3hadid, (const WAVEFORMATEX*)&at3_header->codec_id);
+		buffers_ok = buffers_ok && acm_decoder != NULL;
+	}
+	unsigned char *window = (unsigned char*)malloc(AUDIO_READ_WINDOW);
+	if (window == NULL || !buffers_ok)
+	{
+		printf("Unable to allocate the audio buffers for track %d, aborting...\n", track_num);
+		free(window);
+		free(writer.buffer);
+		batch_release_memory(track_memory);
+		atrac3_destroy(decoder);
+		closeAt3Decoder(acm_decoder);
+		if (at3_file != NULL)
+			fclose(at3_file);
+		track->failed = AUDIO_FAILED_EXTRACT;
+		return -1;
+	}
+
+	int decode_result = 0;
+	if (job->convert && put_track_bytes(&writer, NULL, track->pregap_size) < 0)
+		decode_result = -1;
+
+	bool extracted = true;
+	int bad_frames = 0;
+	for (unsigned int pos = 0; pos < audio_entry->size; pos += AUDIO_READ_WINDOW)
+	{
+		// Once the decoder is done only the AT3 file still wants the rest.
+		bool decoding = (decoder != NULL || acm_decoder != NULL) && decode_result == 0;
+		if (!decoding && at3_file == NULL)
+			break;
+
+		int size = (int)(audio_entry->size - pos);
+		if (size > AUDIO_READ_WINDOW)
+			size = AUDIO_READ_WINDOW;
+		read_pbp_section(job->psar, track_offset + pos, window, size);
+		unscramble_atrac_data(window, size, audio_entry, (int)pos);
+
+		if (at3_file != NULL && fwrite(window, 1, size, at3_file) != (size_t)size)
+		{
+			printf("ERROR: Can't write audio track %d!\n", track_num);
+			extracted = false;
+			break;
+		}
+		if (decoding && decoder != NULL)
+			decode_result = atrac3_decode_window(decoder, window, size, put_track_audio, &writer, &bad_frames);
+		else if (decoding)
+			decode_result = decodeAt3Window(acm_decoder, window, size, pos + size >= audio_entry->size, put_track_audio, &writer);
+	}
+	free(window);
+	atrac3_destroy(decoder);
+	closeAt3Decoder(acm_decoder);
+	if (at3_file != NULL)
+		fclose(at3_file);
+
+	if (!extracted)
+	{
+		if (writer.hashing)
+			md5_stream_end(&writer.md5, NULL);
+		free(writer.buffer);
+		batch_release_memory(track_memory);
+		track->failed = AUDIO_FAILED_EXTRACT;
+		return -1;
+	}
+	if (!job->convert)
+	{
+		batch_release_memory(track_memory);
+		return 0;
+	}
+
+	if (bad_frames > 0)
+		printf("WARNING: %d corrupt ATRAC3 frames in track %d were replaced with silence\n", bad_frames, track_num);
+	if (decode_result >= 0)
+	{
+		// Pad the rest if needed
+		if (writer.audio_left > 0)
+			printf("Padding track %d with %d bytes to reach expected length\n", track_num, writer.audio_left);
+		int padding = writer.audio_left + (track->region_size - track->pregap_size - track->audio_size);
+		if (put_track_bytes(&writer, NULL, padding) == 0)
+			flush_track_writer(&writer);
+	}
+	free(writer.buffer);
+	batch_release_memory(track_memory);
+
+	// Record the track once its region is on disk, so a rerun can skip it.
+	char region_md5[33] = "";
+	bool complete = !writer.failed && decode_result >= 0;
+	if (writer.hashing)
+		md5_stream_end(&writer.md5, complete ? region_md5 : NULL);
+	if (complete && region_md5[0] != 0)
+	{
+		EnterCriticalSection(&job->bin->lock);
+		bool synced = checkpoint_sync(job->bin->file);
+		LeaveCriticalSection(&job->bin->lock);
+		if (synced)
+			checkpoint_track(job->checkpoint, job->disc_num, track_num, track->region_offset, track->region_size, region_md5);
+	}
+
+	if (writer.failed)
+	{
+		track->failed = AUDIO_FAILED_BIN;
+		return -1;
+	}
+	if (decode_result < 0)
+	{
+		track->failed = AUDIO_FAILED_DECODE;
+		return 0;
+	}
+
+	// Also leave a WAV of the whole track behind for debugging.
+	if (g_keep_temp)
+	{
+		char at3_filename[MAX_PATH];
+		char wav_filename[MAX_PATH];
+		audio_file_name(at3_filename, job->disc_num, track_num, (char*)"AT3");
+		audio_file_name(wav_filename, job->disc_num, track_num, (char*)"WAV");
+		if (g_use_acm)
+			convertAt3ToWav(at3_filename, wav_filename, job->at3hadid);
+		else
+			convert_at3_to_wav(at3_filename, wav_filename);
+	}
+
+	return 0;
+}
+
+// State shared by the data track workers and the in-order writer.
+typedef struct {
+	PBP_SECTION *psar;
+	long long iso_offset;
+	ISO_ENTRY *entries;
+	FILE *overdump;
+	char trash_filename[0x10];  // TRASH.BIN, per disc for multi-disc EBOOTs.
+	FILE *raw_copy;             // DATA_TRACK.BIN (keep-temp only).
+	FILE *fixed_copy;           // DATA_TRACK.BIN.ISO (keep-temp only).
+	FILE *bin;                  // Final BIN image, the data track comes first.
+	struct sectorFixer fixer;   // Patches ECC/EDC as the blocks stream through.
+	enum EDCMode form2EDCMode;  // Resolved before the workers start.
+	MD5_STREAM md5;
+	bool hashing;
+} DATA_TRACK_JOB;
+
+// Each run_ordered slot holds the fixed block, followed by the block as it was
+// decompressed when OVERDUMP.BIN or DATA_TRACK.BIN need the unpatched data.
+#define DATA_TRACK_SLOT_SIZE	(2 * (ISO_BLOCK_SIZE))
+
+static bool iso_block_needs_raw(DATA_TRACK_JOB *job, int index)
+{
+	return job->entries[index].marker == 0 || job->raw_copy != NULL;
+}
+
+// Decompress one ISO block.
+static int decompress_iso_block(void *ctx, int index, unsigned char *iso_block_decomp)
+{
+	DATA_TRACK_JOB *job = (DATA_TRACK_JOB *)ctx;
+	ISO_ENTRY *entry = &job->entries[index];
+	long long block_offset = job->iso_offset + entry->offset;
+
+	// Keep the kernel reading ahead of the compressed block stream.
+	if (index % ISO_READAHEAD_BLOCKS == 0)
+		advise_pbp_section(job->psar, block_offset, (long long)ISO_READAHEAD_BLOCKS * ISO_BLOCK_SIZE);
+
+	decompress_psar_block(job->psar, block_offset, entry->size, iso_block_decomp);
+	return 0;
+}
+
+// Worker side: decompress one ISO block into its slot and patch its ECC/EDC.
+static int prepare_iso_block(void *ctx, int index, unsigned char *slot)
+{
+	DATA_TRACK_JOB *job = (DATA_TRACK_JOB *)ctx;
+	decompress_iso_block(ctx, index, slot);
+	if (iso_block_needs_raw(job, index))
+		memcpy(slot + ISO_BLOCK_SIZE, slot, ISO_BLOCK_SIZE);
+
+	// Sectors past the end of the track are never written, so skip them.
+	int first = index * (ISO_BLOCK_SIZE / SECTOR_SIZE);
+	int count = ISO_BLOCK_SIZE / SECTOR_SIZE;
+	if (count > job->fixer.num_sectors - first)
+		count = job->fixer.num_sectors - first;
+	if (count > 0)
+		prepareSectors(job->form2EDCMode, slot, count, first);
+	return 0;
+}
+
+// Sector fixer output: the final BIN, plus the MD5 and the keep-temp copy.
+static int write_fixed_sector(void *ctx, const unsigned char *sector)
+{
+	DATA_TRACK_JOB *job = (DATA_TRACK_JOB *)ctx;
+
+	if (fwrite(sector, SECTOR_SIZE, 1, job->bin) != 1)
+		return -1;
+	if (job->fixed_copy != NULL)
+		fwrite(sector, SECTOR_SIZE, 1, job->fixed_copy);
+	if (job->hashing)
+		job->hashing = md5_stream_update(&job->md5, sector, SECTOR_SIZE);
+	return 0;
+}
+
+// Writer side: called in block order with each prepared slot.
+static int write_iso_block(void *ctx, int index, unsigned char *slot)
+{
+	DATA_TRACK_JOB *job = (DATA_TRACK_JOB *)ctx;
+	ISO_ENTRY *entry = &job->entries[index];
+	unsigned char *iso_block_decomp = iso_block_needs_raw(job, index) ? slot + ISO_BLOCK_SIZE : slot;
+
+	if (batch_cancelled())
+	{
+		printf("\nExtraction cancelled.\n");
+		return -1;
+	}
+
+	if (index % 100 == 0) printf(".");
+
+	// trash and overdump generating
+	if (entry->marker == 0)
+	{
+		int trash_start = 0, trash_size = 0;
+		unsigned int sector;
+		do
+		{
+			// search for first non 00 FF FF FF
+			sector = iso_block_decomp[trash_start] + 256 * (iso_block_decomp[trash_start + 1] + 256 * (iso_block_decomp[trash_start + 2] + 256 * iso_block_decomp[trash_start + 3]));
+			trash_start = trash_start + SECTOR_SIZE;
+		} while (sector == 0xFFFFFF00);
+		trash_start = trash_start - SECTOR_SIZE;
+		do
+		{
+			// search for first zero padding (4 bytes length)
+			sector = iso_block_decomp[trash_start + trash_size] + 256 * (iso_block_decomp[trash_start + trash_size + 1] + 256 * (iso_block_decomp[trash_start + trash_size + 2] + 256 * iso_block_decomp[trash_start + trash_size + 3]));
+			trash_size = trash_size + 4;
+		} while (sector != 0);
+		trash_size = trash_size - 4;
+		if (trash_size != 0)
+		{
+			FILE* trash = temp_fopen(job->trash_filename, "wb");
+			fwrite(iso_block_decomp + trash_start, trash_size, 1, trash);
+			fclose(trash);
+			fwrite(iso_block_decomp + trash_start + trash_size, ISO_BLOCK_SIZE - trash_start - trash_size, 1, job->overdump);
+		}
+		else
+			fwrite(iso_block_decomp, ISO_BLOCK_SIZE, 1, job->overdump);
+	}
+
+	// Keep the raw image around if asked to.
+	if (job->raw_copy != NULL)
+		fwrite(iso_block_decomp, ISO_BLOCK_SIZE, 1, job->raw_copy);
+
+	// The worker already patched ECC/EDC, pass the sectors on to the BIN.
+	feedPreparedSectors(&job->fixer, slot, ISO_BLOCK_SIZE / SECTOR_SIZE, index * (ISO_BLOCK_SIZE / SECTOR_SIZE));
+	if (job->fixer.status.errorcode == ERROR_OUTPUT_IO_ERROR)
+	{
+		printf("ERROR: Failed to write ISO block %d!\n", index);
+		return -1;
+	}
+	return 0;
+}
+
+// Decompress the data track, patch its ECC/EDC and write it to the start of
+// bin_file in a single pass. The MD5 of the fixed track goes to md5_string
+// (empty if it could not be computed). Returns the gap after the data track
+// in sectors, or -1 on error.
+int build_data_track(PBP_SECTION *psar, const ISO_HEADER *header, unsigned int disc_offset, int disc_num, FILE *bin_file, char *md5_string)
+{
+	md5_string[0] = 0;
+	if ((psar == NULL) || (header == NULL) || (bin_file == NULL))
+	{
+		printf("ERROR: Can't open input files for ISO!\n");
+		return -1;
+	}
+
+	int num_sectors_expected = data_track_sectors(header);
+	if (num_sectors_expected < 0)
+		return -1;
+
+	ISO_ENTRY *entries = header->blocks;
+	int block_count = header->num_blocks;
+
+	DATA_TRACK_JOB job;
+	memset(&job, 0, sizeof(job));
+	job.psar = psar;
+	job.iso_offset = ISO_BASE_OFFSET + disc_offset;  // Start of compressed ISO data.
+	job.entries = entries;
+	job.bin = bin_file;
+
+	// Hand the data track to the OS in large, 4 KiB aligned writes.
+	setvbuf(bin_file, NULL, _IOFBF, BIN_WRITE_BUFFER);
+
+	// Open a new file to write overdump. Discs of a multi-disc EBOOT may be
+	// built at the same time, so each gets its own.
+	char overdump_filename[0x10];
+	if (disc_num > 0)
+	{
+		sprintf(overdump_filename, "OVERDUMP_%d.BIN", disc_num);
+		sprintf(job.trash_filename, "TRASH_%d.BIN", disc_num);
+	}
+	else
+	{
+		sprintf(overdump_filename, "OVERDUMP.BIN");
+		sprintf(job.trash_filename, "TRASH.BIN");
+	}
+	job.overdump = temp_fopen(overdump_filename, "wb");
+
+	// The intermediate images are only written on request.
+	char iso_filename[0x10];
+	char iso_fixed_filename[0x20];
+	if (disc_num > 0)
+		sprintf(iso_filename, "DATA_%d.BIN", disc_num);  // multi-disc
+	else
+		sprintf(iso_filename, "DATA_TRACK.BIN");  // single disc
+	sprintf(iso_fixed_filename, "%s.ISO", iso_filename);
+	if (g_keep_temp)
+	{
+		job.raw_copy = temp_fopen(iso_filename, "wb");
+		job.fixed_copy = temp_fopen(iso_fixed_filename, "wb");
+		if (job.raw_copy == NULL || job.fixed_copy == NULL)
+			printf("WARNING: Can't write %s / %s, not keeping intermediate images.\n", iso_filename, iso_fixed_filename);
+	}
+
+	job.hashing = md5_stream_begin(&job.md5);
+
+	// Use the INFER method for EDC calculation (proved to be the more accurate approach).
+	initSectorFixer(&job.fixer, num_sectors_expected, INFER, write_fixed_sector, &job);
+
+	printf("ISO offset %llx\n", job.iso_offset);
+	printf("Patching ECC/EDC data while decompressing...\n");
+	printf("Processing %d sectors\n", num_sectors_expected);
+
+	// The first block holds the bootloader sectors used to pick the form 2 EDC
+	// mode. The workers patch sectors with it, so it is settled up front.
+	if (block_count > 0)
+	{
+		unsigned char *bootloader = (unsigned char *)malloc(ISO_BLOCK_SIZE);
+		if (bootloader != NULL)
+		{
+			decompress_iso_block(&job, 0, bootloader);
+			inferForm2EDCMode(&job.fixer, bootloader);
+			free(bootloader);
+		}
+	}
+	job.form2EDCMode = job.fixer.form2EDCMode;
+
+	// Blocks are independent, so decompress and patch them on all cores and
+	// write them back out in table order.
+	int threads = parallel_get_threads();
+	long long window_memory = (long long)run_ordered_window(block_count, threads) * DATA_TRACK_SLOT_SIZE;
+	int result = -1;
+	if (batch_reserve_memory("the data track", window_memory))
+	{
+		printf("Decompressing %d blocks on %d threads\n", block_count, threads);
+		result = run_ordered(block_count, DATA_TRACK_SLOT_SIZE, threads, prepare_iso_block, write_iso_block, &job);
+		batch_release_memory(window_memory);
+		printf("\n");
+	}
+
+	struct fixImageStatus status = finishSectorFixer(&job.fixer);
+	if (result == 0)
+	{
+		printFixImageStatus(status, true);
+		if (status.errorcode == ERROR_OUTPUT_IO_ERROR)
+			result = -1;
+	}
+
+	if (job.hashing)
+		md5_stream_end(&job.md5, (result == 0) ? md5_string : NULL);
+
+	if (job.overdump) fclose(job.overdump);
+	if (job.raw_copy) fclose(job.raw_copy);
+	if (job.fixed_copy) fclose(job.fixed_copy);
+	for (unsigned int i = 0; i < status.warningscount; i++)
+		free(status.warnings[i]);
+	free(status.warnings);
+
+	if (result < 0)
+		return -1;
+
+	int gap = num_sectors_expected - status.totalsectors + GAP_FRAMES;
+	printf("Gap after data track: %d sectors\n", gap);
+	return gap;
+}
+
+// Like build_data_track, but keeps the data track of an interrupted run if the
+// checkpoint vouches for it, and records a freshly built one.
+static int resume_data_track(CHECKPOINT *checkpoint, int checkpoint_disc, PBP_SECTION *psar, const ISO_HEADER *header, unsigned int disc_offset, int disc_num, FILE *bin_file, char *md5_string)
+{
+	long long data_bytes;
+	int gap;
+	if (checkpoint_data_done(checkpoint, checkpoint_disc, &data_bytes, &gap, md5_string) && _fseeki64(bin_file, data_bytes, SEEK_SET) == 0)
+	{
+		printf("The data track is already in the BIN, skipping it.\n");
+		printf("Gap after data track: %d sectors\n", gap);
+		return gap;
+	}
+
+	gap = build_data_track(psar, header, disc_offset, disc_num, bin_file, md5_string);
+	if (gap >= 0)
+		checkpoint_data(checkpoint, checkpoint_disc, bin_file, _ftelli64(bin_file), gap, md5_string);
 	return gap;
 }
 
-int build_bin_cue(FILE *iso_table, char *data_fixed_file_path, char *cdrom_file_name, char *cue_file_name, char *iso_disc_name, int disc_num, int data_gap, const PREGAP_OVERRIDE *pregap_override
+// The BIN already holds the data track followed by num_audio_tracks audio tracks.
+int build_bin_cue(const ISO_HEADER *header, int num_audio_tracks, char *cdrom_file_name, char *cue_file_name, char *iso_disc_name, int disc_num, int data_gap, const PREGAP_OVERRIDE *pregap_override
 )
 {
-	char cdrom_file_path[256];
 	char cue_file_path[256];
 	
 	// Build full paths using helper function
-	if (build_output_path(cdrom_file_name, cdrom_file_path, 256) != 0)
-	{
-		printf("ERROR: Failed to build CDROM file path\n");
-		return -1;
-	}
-	
 	if (build_output_path(cue_file_name, cue_file_path, 256) != 0)
 	{
 		printf("ERROR: Failed to build CUE file path\n");
@@ -1171,38 +1470,16 @@ int build_bin_cue(FILE *iso_table, char *data_fixed_file_path, char *cdrom_file_
 	fputs(cue, cue_file);
 
 	// genereating cue table
-	CUE_ENTRY cue_entry[sizeof(CUE_ENTRY)];
-	memset(cue_entry, 0, sizeof(cue_entry));
-
-	int cue_offset = 0x428;  // track 02 offset
+	const CUE_ENTRY *cue_entry = &header->tracks[1];  // track 02
 	int i = 1;
 
-	// Copy data track
-	FILE* bin_file = fopen(cdrom_file_path, "wb");
-	if (bin_file == NULL)
-	{
-		printf("ERROR: Can't open %s!\n", cdrom_file_path);
-		return -1;
-	}
-	int data_track_size = copy_track_to_iso(bin_file, data_fixed_file_path, 1);
-	if (data_track_size < 0)
-	{
-		printf("Error copying data track to CDROM.BIN, aborting...\n");
-		fclose(bin_file);
-		return -1;
-	}
-	// Read track 02
-	fseek(iso_table, cue_offset, SEEK_SET);
-	fread(cue_entry, sizeof(CUE_ENTRY), 1, iso_table);
 	int track_num = 2;
 	while (cue_entry->type)
 	{
-		char track_filename[0x10];
-		audio_file_name(track_filename, disc_num, track_num, (char*)"BIN");
-		int audio_track_size = copy_track_to_iso(bin_file, track_filename, track_num);
-		if (audio_track_size < 0)
+		// The audio tracks are already in the BIN, see extract_and_convert_audio.
+		if (track_num - 1 > num_audio_tracks)
 		{
-			// If audio track copy failed on track 2 just bail and generate valid cue for the data track.
+			// If there is no audio at all just bail and generate valid cue for the data track.
 			// This is mainly a workaround for RE2 EBOOT having audio track pointers but no audio tracks
 			if (track_num == 2)
 			{
@@ -1211,9 +1488,8 @@ int build_bin_cue(FILE *iso_table, char *data_fixed_file_path, char *cdrom_file_
 			}
 			else
 			{
-				printf("ERROR: failed to copy track %d to CDROM.BIN, aborting...\n", track_num);
+				printf("ERROR: track %d is missing from CDROM.BIN, aborting...\n", track_num);
 				fclose(cue_file);
-				fclose(bin_file);
 				return -1;
 			}
 		}
@@ -1253,65 +1529,137 @@ int build_bin_cue(FILE *iso_table, char *data_fixed_file_path, char *cdrom_file_
 		sprintf(cue, "    INDEX 01 %02d:%02d:%02d\n", mm1, ss1, ff1);
 		fputs(cue, cue_file);
 
-		cue_offset += sizeof(CUE_ENTRY);
-		// Read next track
-		fseek(iso_table, cue_offset, SEEK_SET);
-		fread(cue_entry, sizeof(CUE_ENTRY), 1, iso_table);
+		// Next track, the table ends with an empty entry.
+		cue_entry++;
 		track_num++;
 	}
 
 	fclose(cue_file);
-	fclose(bin_file);
 
 	return 0;
 }
 
-int extract_and_convert_audio(FILE *psar, FILE *iso_table, int base_audio_offset, unsigned char *pgd_key, int disc_num, int data_gap, const PREGAP_OVERRIDE* pregap_override)
+// Extracts the CDDA tracks of a disc and decodes them straight into the final
+// BIN, right after the data track. Returns the number of audio tracks in the
+// BIN (0 if there are none or they could not be converted), or -1 on errors.
+int extract_and_convert_audio(PBP_SECTION *psar, const ISO_HEADER *header, FILE *bin_file, int base_audio_offset, unsigned char *pgd_key, int disc_num, int data_gap, const PREGAP_OVERRIDE* pregap_override, CHECKPOINT *checkpoint)
 {
 	printf("\nAttempting to extract audio tracks...\n\n");
-	int num_tracks = build_audio_at3(psar, iso_table, base_audio_offset, pgd_key, disc_num, pregap_override);
+	AUDIO_TRACK tracks[MAX_AUDIO_TRACKS];
+	int num_tracks = collect_audio_tracks(header, pregap_override, tracks);
 	if (num_tracks < 0) {
 		printf("ERROR: Audio track extraction failed!\n");
 		return -1;
 	}
-	else if (num_tracks > 0)
-		printf("%d audio tracks extracted to ATRAC3\n", num_tracks);
+	if (num_tracks == 0)
+		return 0;
 
-	// Check for ATRAC3 driver availability before attempting conversion
-	if (num_tracks > 0) {
-		// psxtract_main() is the shared conversion path for every mode - direct
-		// command-line runs AND the child process the GUI spawns per extraction.
-		// Register the bundled ATRAC3 codec here so it is available regardless of
-		// how we were launched (per-process registration does not cross the GUI
-		// parent -> child boundary, so registering in the GUI alone is not enough).
+	AUDIO_BIN bin;
+	bin.file = bin_file;
+	InitializeCriticalSection(&bin.lock);
+
+	AUDIO_JOB job;
+	memset(&job, 0, sizeof(job));
+	job.psar = psar;
+	job.base_audio_offset = base_audio_offset;
+	job.disc_num = disc_num;
+	job.convert = true;
+	job.bin = &bin;
+	job.tracks = tracks;
+	job.checkpoint = checkpoint;
+
+	// The ACM codec is only needed when asked for, the built-in decoder is always there.
+	if (g_use_acm) {
+		AcquireSRWLockExclusive(&g_acm_lock);
+
+		// psxtract_main() is the shared conversion path for every mode, the
+		// command line and the GUI's batch jobs alike. Register the bundled
+		// ATRAC3 codec here so it is available however we were launched; it
+		// is registered once per process and found again afterwards.
 		registerBundledAtrac3Codec();
 
-		HACMDRIVERID at3hadid = nullptr;
-		findAt3Driver(&at3hadid);
-		if (!at3hadid) {
+		findAt3Driver(&job.at3hadid);
+		if (!job.at3hadid) {
 			printf("WARNING: ATRAC3 codec not available - skipping audio conversion\n");
 			printf("Audio tracks remain as ATRAC3 files (*.AT3)\n\n");
-			num_tracks = 0; // Set to 0 so we skip WAV to BIN conversion too
-		} else {
-			if (convert_at3_to_wav(disc_num, num_tracks) < 0)
-			{
-				printf("ATRAC3 to WAV conversion failed!\n\n");
-				return 0;
-			}
-			else
-				printf("%d audio tracks converted to WAV\n", num_tracks);
+			job.convert = false;
 		}
+		ReleaseSRWLockExclusive(&g_acm_lock);
+	}
+
+	// The tracks follow the data track back to back.
+	long long audio_start = _ftelli64(bin_file);
+	long long region_offset = audio_start;
+	for (int i = 0; i < num_tracks; i++) {
+		plan_audio_track(&tracks[i], data_gap, pregap_override);
+		tracks[i].region_offset = region_offset;
+		region_offset += tracks[i].region_size;
+	}
+
+	// Tracks are independent, so each one goes through the whole chain on its
+	// own worker. With the ACM codec only its conversion calls take turns, the
+	// reading, unscrambling and writing around them still run side by side.
+	int threads = parallel_get_threads();
+	if (job.convert)
+		printf("\nConverting %d audio tracks from ATRAC3 to BIN, this may take awhile...\n\n", num_tracks);
+	int result = run_parallel(num_tracks, threads, process_audio_track, &job);
+	DeleteCriticalSection(&bin.lock);
+
+	// Merge the outcome in track order. A track that failed to decode drops
+	// all the audio tracks (the CUE then only has the data track), anything
+	// else is fatal.
+	bool decode_failed = false;
+	for (int i = 0; i < num_tracks; i++) {
+		if (tracks[i].failed == AUDIO_FAILED_EXTRACT) {
+			printf("ERROR: Audio track extraction failed!\n");
+			return -1;
+		}
+		if (tracks[i].failed == AUDIO_FAILED_BIN) {
+			printf("ERROR: Writing audio track %d to the BIN failed!\n\n", tracks[i].track_num);
+			return -1;
+		}
+		if (tracks[i].failed == AUDIO_FAILED_DECODE)
+			decode_failed = true;
 	}
+	if (result < 0) {
+		printf("ERROR: Audio track extraction failed!\n");
+		return -1;
+	}
+	printf("%d audio tracks extracted\n", num_tracks);
+	if (!job.convert)
+		return 0;
 
-	if (num_tracks > 0) {
-		if (convert_wav_to_bin(data_gap, disc_num, num_tracks, pregap_override) < 0)
-		{
-			printf("ERROR: WAV to BIN conversion failed!\n\n");
+	if (decode_failed) {
+		// Cut the BIN back to the data track.
+		fflush(bin_file);
+		if (_chsize_s(_fileno(bin_file), audio_start) != 0) {
+			printf("ERROR: Can't remove the audio tracks from the BIN!\n");
 			return -1;
 		}
-		else
-			printf("%d audio tracks converted to BIN\n\n", num_tracks);
+		_fseeki64(bin_file, 0, SEEK_END);
+		printf("ATRAC3 conversion failed, continuing without audio tracks!\n\n");
+		return 0;
+	}
+	_fseeki64(bin_file, 0, SEEK_END);
+
+	// Verify track lengths against CUE file expectation
+	for (int i = 0; i < num_tracks && pregap_override != NULL; i++) {
+		int track_num = tracks[i].track_num;
+		if ((size_t)(track_num - 2) >= pregap_override->num_tracks)
+			break;
+
+		const TIMESTAMP* expected_length = &pregap_override->track_lengths[track_num - 2];
+		int expected_frames = expected_length->mm * 60 * 75 + expected_length->ss * 75 + expected_length->ff;
+		int expected_bytes = expected_frames * SECTOR_SIZE;
+		
+		printf("Track %d length verification:\n", track_num);
+		printf("  Expected: %02d:%02d:%02d (%d bytes)\n", 
+			   expected_length->mm, expected_length->ss, expected_length->ff, expected_bytes);
+		printf("  Actual:   %d bytes\n", tracks[i].region_size);
+		printf("  Result:   %s\n", (tracks[i].region_size == expected_bytes) ? "PASS" : "FAIL");
 	}
+
+	printf("%d audio tracks converted to BIN\n\n", num_tracks);
 	return num_tracks;
 }
 
@@ -1788,34 +2136,19 @@ int copy_prebaked_cue_file(char* disc_name, char* game_title, char* output_bin_n
     return 0;
 }
 
-int decrypt_single_disc(FILE* psar, long long psar_size, long long startdat_offset, unsigned char* pgd_key)
+int decrypt_single_disc(PBP_SECTION* psar, long long startdat_offset, unsigned char* pgd_key)
 {
 	// Decrypt the ISO header and get the block table.
 	// NOTE: In a single disc, the ISO header is located at offset 0x400 and has a length of 0xB6600.
-	if (decrypt_iso_header(psar, ISO_HEADER_OFFSET, pgd_key, 0) < 0)
+	ISO_HEADER iso_header;
+	if (decrypt_iso_header(psar, ISO_HEADER_OFFSET, pgd_key, 0, &iso_header) < 0)
 		return -1;
 
-	// Re-open in read mode (just to be safe).
-	FILE* iso_table = fopen("ISO_HEADER.BIN", "rb");
-	if (iso_table == NULL)
-	{
-		printf("ERROR: No decrypted ISO header found!\n");
-		return -1;
-	}
-
-	// Save the ISO disc name and title (UTF-8).
-	char iso_title[0x80];
-	char iso_disc_name[0x10];
-	memset(iso_title, 0, 0x80);
-	memset(iso_disc_name, 0, 0x10);
-
-	fseek(iso_table, 1, SEEK_SET);
-	fread(iso_disc_name, 0x0F, 1, iso_table);
-	fseek(iso_table, 0xE2C, SEEK_SET);
-	fread(iso_title, 0x80, 1, iso_table);
+	// The ISO disc name and title (UTF-8).
+	char *iso_disc_name = iso_header.disc_name;
 
 	printf("ISO disc: %s\n", iso_disc_name);
-	printf("ISO title: %s\n\n", iso_title);
+	printf("ISO title: %s\n\n", iso_header.title);
 
 	// Check if we have a prebaked CUE file for this disc
 	char game_title[256];
@@ -1824,7 +2157,7 @@ int decrypt_single_disc(FILE* psar, long long psar_size, long long startdat_offs
 	{
 		// User cancelled the CUE selection dialog - abort this extraction.
 		printf("Extraction cancelled by user.\n");
-		fclose(iso_table);
+		free_iso_header(&iso_header);
 		return -2;
 	}
 	bool use_prebaked_cue = (prebaked > 0);
@@ -1857,53 +2190,77 @@ int decrypt_single_disc(FILE* psar, long long psar_size, long long startdat_offs
 		}
 	}
 	
+	// Pick up what an interrupted run left behind.
+	CHECKPOINT* checkpoint = checkpoint_open(iso_disc_name, psar, pgd_key, g_use_acm ? "acm" : "atrac3");
+
 	// Check if output files already exist and prompt for overwrite
-	if (!check_output_files_overwrite(game_title, use_prebaked_cue)) {
+	CHECKPOINT_RESUME resume;
+	if (!check_output_files_overwrite(game_title, use_prebaked_cue, checkpoint, 1, &resume)) {
 		printf("Operation cancelled by user.\n");
-		fclose(iso_table);
+		checkpoint_close(checkpoint, false);
+		free_iso_header(&iso_header);
 		return -2;
 	}
 
-	// Seek inside the ISO table to find the special data offset.
-	int special_data_offset;
-	fseek(iso_table, 0xE20, SEEK_SET);  // Always at 0xE20.
-	fread(&special_data_offset, sizeof(special_data_offset), 1, iso_table);
+	// Use appropriate file names based on whether we have a prebaked CUE
+	char output_bin_name[256];
+	char output_cue_name[256];
+	output_file_names(game_title, use_prebaked_cue, output_bin_name, output_cue_name);
+
+	char data_md5[33];
+	if (resume == CHECKPOINT_DONE)
+	{
+		long long data_bytes;
+		int data_gap;
+		checkpoint_data_done(checkpoint, 1, &data_bytes, &data_gap, data_md5);
+		printf("\n=== MD5 VERIFICATION ===\n");
+		verify_data_track_md5_value(data_md5, iso_disc_name);
+		printf("========================\n\n");
+		checkpoint_close(checkpoint, true);
+		free_iso_header(&iso_header);
+		return 0;
+	}
 
 	// Decrypt the special data if it's present.
 	// NOTE: Special data is normally a PNG file with an intro screen of the game.
-	decrypt_special_data(psar, psar_size, special_data_offset);
-
-	// Seek inside the ISO table to find the unknown data offset.
-	int unknown_data_offset;
-	fseek(iso_table, 0xED4, SEEK_SET);  // Always at 0xED4.
-	fread(&unknown_data_offset, sizeof(unknown_data_offset), 1, iso_table);
+	decrypt_special_data(psar, iso_header.special_data_offset);
 
 	// Decrypt the unknown data if it's present.
 	// NOTE: Unknown data is a binary chunk with unknown purpose (memory snapshot?).
 	if (startdat_offset > 0)
-		decrypt_unknown_data(psar, unknown_data_offset, startdat_offset);
+		decrypt_unknown_data(psar, iso_header.unknown_data_offset, startdat_offset);
+
+	// The data track is written straight into the final BIN, audio is appended
+	// later. A resumed BIN keeps the stages the checkpoint vouches for.
+	char bin_file_path[256];
+	if (build_output_path(output_bin_name, bin_file_path, 256) != 0)
+	{
+		printf("ERROR: Failed to build BIN file path\n");
+		checkpoint_close(checkpoint, false);
+		free_iso_header(&iso_header);
+		return -1;
+	}
+	FILE* bin_file = fopen(bin_file_path, (resume == CHECKPOINT_PARTIAL) ? "r+b" : "wb");
+	if (bin_file == NULL)
+	{
+		printf("ERROR: Can't open %s!\n", bin_file_path);
+		checkpoint_close(checkpoint, false);
+		free_iso_header(&iso_header);
+		return -1;
+	}
 
 	// Build the data track image.
 	printf("Building the data track...\n");
-	if (build_data_track(psar, iso_table, 0, 0) < 0)
-		printf("ERROR: Failed to reconstruct the data track!\n");
-	else
-		printf("Data track successfully reconstructed!\n");
-
-	printf("\n");
-
-	char data_bin[16] = "DATA_TRACK.BIN";
-	char data_bin_fixed[256];
-	memset(data_bin_fixed, 0, 256);
-	strcat(data_bin_fixed, data_bin);
-	strcat(data_bin_fixed, ".ISO");
-	int data_gap = fix_iso(iso_table, data_bin, data_bin_fixed);
+	int data_gap = resume_data_track(checkpoint, 1, psar, &iso_header, 0, 0, bin_file, data_md5);
 	if (data_gap < 0)
 	{
-		printf("ERROR: unable to fix data track %s\n", data_bin);
-		fclose(iso_table);
+		printf("ERROR: Failed to reconstruct the data track!\n");
+		fclose(bin_file);
+		checkpoint_close(checkpoint, false);
+		free_iso_header(&iso_header);
 		return -1;
 	}
+	printf("Data track successfully reconstructed!\n");
 	printf("\n");
 
 
@@ -1913,117 +2270,43 @@ int decrypt_single_disc(FILE* psar, long long psar_size, long long startdat_offs
     }
 
 	// Handle audio tracks
-	if (extract_and_convert_audio(psar, iso_table, ISO_BASE_OFFSET, pgd_key, 1, data_gap, pregap_override) < 0)
+	int num_audio_tracks = extract_and_convert_audio(psar, &iso_header, bin_file, ISO_BASE_OFFSET, pgd_key, 1, data_gap, pregap_override, checkpoint);
+	if (num_audio_tracks < 0)
 	{
 		printf("ERROR: extract and convert audio failed, aborting...\n");
-		fclose(iso_table);
+		fclose(bin_file);
+		checkpoint_close(checkpoint, false);
+		free_iso_header(&iso_header);
 		return -1;
 	}
 
 	// Convert to BIN/CUE.
 	printf("Converting the final image to BIN/CUE...\n");
 	
-	// Use appropriate file names based on whether we have a prebaked CUE
-	char output_bin_name[256];
-	char output_cue_name[256];
-	
-	if (use_prebaked_cue)
-	{
-		sprintf(output_bin_name, "%s.bin", game_title);
-		sprintf(output_cue_name, "%s.cue", game_title);
-	}
-	else
-	{
-		strcpy(output_bin_name, "CDROM.BIN");
-		strcpy(output_cue_name, "CDROM.CUE");
-	}
-	
 	if (use_prebaked_cue)
 	{
 		// For prebaked CUE files, we only need to generate the BIN file
 		// and copy the prebaked CUE file with the correct BIN filename
 		printf("Using prebaked CUE file, generating BIN file only...\n");
 		
-		// Build the BIN file path using helper function
-		char bin_file_path[256];
+		// The audio tracks are already in the BIN.
+		if (num_audio_tracks == 0)
+			printf("Proceeding without audio tracks\n");
+		
+		fclose(bin_file);
 		
-		if (build_output_path(output_bin_name, bin_file_path, 256) != 0)
+		// Copy the prebaked CUE file
+		if (copy_prebaked_cue_file(iso_disc_name, game_title, game_title) < 0)
 		{
-			printf("ERROR: Failed to build BIN file path\n");
-			return -1;
-		}
-		
-		FILE* bin_file = fopen(bin_file_path, "wb");
-		if (bin_file == NULL)
-		{
-			printf("ERROR: Can't open %s!\n", bin_file_path);
-			fclose(iso_table);
-			return -1;
-		}
-		
-		// Copy data track
-		int data_track_size = copy_track_to_iso(bin_file, data_bin_fixed, 1);
-		if (data_track_size < 0)
-		{
-			printf("Error copying data track to %s, aborting...\n", output_bin_name);
-			fclose(bin_file);
-			fclose(iso_table);
-			return -1;
-		}
-		
-		// Handle audio tracks if present
-		int track_num = 2;
-		int cue_offset = 0x428;  // track 02 offset
-		
-		CUE_ENTRY cue_entry[sizeof(CUE_ENTRY)];
-		memset(cue_entry, 0, sizeof(cue_entry));
-		
-		// Read track 02
-		fseek(iso_table, cue_offset, SEEK_SET);
-		fread(cue_entry, sizeof(CUE_ENTRY), 1, iso_table);
-		
-		while (cue_entry->type)
-		{
-			char track_filename[0x10];
-			audio_file_name(track_filename, 1, track_num, (char*)"BIN");
-			int audio_track_size = copy_track_to_iso(bin_file, track_filename, track_num);
-			if (audio_track_size < 0)
-			{
-				// If audio track copy failed on track 2 just bail
-				if (track_num == 2)
-				{
-					printf("Proceeding without audio tracks\n");
-					break;
-				}
-				else
-				{
-					printf("ERROR: failed to copy track %d to %s, aborting...\n", track_num, output_bin_name);
-					fclose(bin_file);
-					fclose(iso_table);
-					return -1;
-				}
-			}
-			
-			cue_offset += sizeof(CUE_ENTRY);
-			// Read next track
-			fseek(iso_table, cue_offset, SEEK_SET);
-			fread(cue_entry, sizeof(CUE_ENTRY), 1, iso_table);
-			track_num++;
-		}
-		
-		fclose(bin_file);
-		
-		// Copy the prebaked CUE file
-		if (copy_prebaked_cue_file(iso_disc_name, game_title, game_title) < 0)
-		{
-			printf("ERROR: Failed to copy prebaked CUE file!\n");
-			fclose(iso_table);
+			printf("ERROR: Failed to copy prebaked CUE file!\n");
+			checkpoint_close(checkpoint, false);
+			free_iso_header(&iso_header);
 			return -1;
 		}
 		
 		// MD5 verification using prebaked CUE
 		printf("\n=== MD5 VERIFICATION ===\n");
-		verify_data_track_md5_cue(data_bin_fixed, iso_disc_name);
+		verify_data_track_md5_value(data_md5, iso_disc_name);
 		printf("========================\n\n");
 		
 		printf("Disc successfully converted using prebaked CUE file!\n");
@@ -2031,26 +2314,149 @@ int decrypt_single_disc(FILE* psar, long long psar_size, long long startdat_offs
 	else
 	{
 		// Generate CUE file normally
-		if (build_bin_cue(iso_table, data_bin_fixed, output_bin_name, output_cue_name, iso_disc_name, 1, data_gap, pregap_override))
+		int result = build_bin_cue(&iso_header, num_audio_tracks, output_bin_name, output_cue_name, iso_disc_name, 1, data_gap, pregap_override);
+		fclose(bin_file);
+		if (result)
 		{
 			printf("ERROR: Failed to convert to BIN/CUE!\n");
-			fclose(iso_table);
+			checkpoint_close(checkpoint, false);
+			free_iso_header(&iso_header);
 			return -1;
 		}
 		
 		// MD5 verification using prebaked CUE
 		printf("\n=== MD5 VERIFICATION ===\n");
-		verify_data_track_md5_cue(data_bin_fixed, iso_disc_name);
+		verify_data_track_md5_value(data_md5, iso_disc_name);
 		printf("========================\n\n");
 		
 		printf("Disc successfully converted to BIN/CUE format!\n");
 	}
 
-	fclose(iso_table);
+	// The title is done, so is its checkpoint.
+	checkpoint_close(checkpoint, true);
+	free_iso_header(&iso_header);
 	return 0;
 }
 
-int decrypt_multi_disc(FILE *psar, long long psar_size, long long startdat_offset, unsigned char *pgd_key)
+// A disc of a multi-disc EBOOT, with everything it needs settled before the
+// discs are built.
+typedef struct {
+	int disc_num;               // 1-based.
+	unsigned int offset;        // Offset of the disc in DATA.PSAR.
+	ISO_HEADER header;
+	bool has_header;
+	char serial[0x10];          // Disc serial before a CUE variant is picked.
+	bool use_prebaked_cue;
+	char game_title[256];
+	char md5[33];               // Data track MD5, computed while it is written.
+	CHECKPOINT_RESUME resume;   // What an interrupted run left of the BIN.
+	bool built;                 // BIN and CUE written.
+} MULTI_DISC;
+
+typedef struct {
+	PBP_SECTION *psar;
+	unsigned char *pgd_key;
+	CHECKPOINT *checkpoint;
+	MULTI_DISC *discs[MAX_DISCS];   // The discs to build.
+	int count;
+} MULTI_DISC_JOB;
+
+// Builds the BIN and CUE of one disc. Returns -1 on errors that abort the
+// whole extraction; a disc that is merely skipped is left unbuilt.
+static int build_disc(void *ctx, int index)
+{
+	MULTI_DISC_JOB *job = (MULTI_DISC_JOB *)ctx;
+	MULTI_DISC *disc = job->discs[index];
+	int disc_num = disc->disc_num;
+	char *disc_iso_disc_name = disc->header.disc_name;
+	if (batch_cancelled())
+		return -1;
+
+	// Use appropriate file names based on whether we have a prebaked CUE
+	char output_bin_name[256];
+	char output_cue_name[256];
+	output_file_names(disc->game_title, disc->use_prebaked_cue, output_bin_name, output_cue_name);
+
+	// The data track is written straight into the final BIN, audio is appended
+	// later. A resumed BIN keeps the stages the checkpoint vouches for.
+	char bin_file_path[256];
+	if (build_output_path(output_bin_name, bin_file_path, 256) != 0)
+	{
+		printf("ERROR: Failed to build BIN file path\n");
+		return -1;
+	}
+	FILE* bin_file = fopen(bin_file_path, (disc->resume == CHECKPOINT_PARTIAL) ? "r+b" : "wb");
+	if (bin_file == NULL)
+	{
+		printf("ERROR: Can't open %s!\n", bin_file_path);
+		return 0; // Continue with the other discs instead of aborting
+	}
+
+	// Build the data track.
+	printf("Building data track for disc %d...\n", disc_num);
+	int data_gap = resume_data_track(job->checkpoint, disc_num, job->psar, &disc->header, disc->offset, disc_num, bin_file, disc->md5);
+	if (data_gap < 0)
+	{
+		printf("ERROR: Failed to reconstruct data track for disc %d!\n", disc_num);
+		fclose(bin_file);
+		return -1;
+	}
+	printf("Data track successfully reconstructed for disc %d!\n", disc_num);
+	printf("\n");
+
+	// Attempt to extact and convert audio tracks
+	int num_audio_tracks = extract_and_convert_audio(job->psar, &disc->header, bin_file, disc->offset + ISO_BASE_OFFSET, job->pgd_key, disc_num, data_gap, NULL, job->checkpoint);
+	if (num_audio_tracks < 0)
+	{
+		printf("ERROR: extract and convert audio failed, aborting...\n");
+		fclose(bin_file);
+		return -1;
+	}
+
+	// Convert to BIN/CUE
+	printf("Converting disc %d to BIN/CUE...\n", disc_num);
+
+	if (disc->use_prebaked_cue)
+	{
+		// For prebaked CUE files, we only need to generate the BIN file
+		// and copy the prebaked CUE file with the correct BIN filename
+		printf("Using prebaked CUE file for disc %d, generating BIN file only...\n", disc_num);
+
+		// The audio tracks are already in the BIN.
+		if (num_audio_tracks == 0)
+			printf("Proceeding without audio tracks for disc %d\n", disc_num);
+
+		fclose(bin_file);
+
+		// Copy the prebaked CUE file
+		if (copy_prebaked_cue_file(disc_iso_disc_name, disc->game_title, disc->game_title) < 0)
+		{
+			printf("ERROR: Failed to copy prebaked CUE file for disc %d!\n", disc_num);
+			return 0;
+		}
+
+		printf("Disc %d successfully converted using prebaked CUE file!\n\n", disc_num);
+	}
+	else
+	{
+		// Generate CUE file normally
+		int result = build_bin_cue(&disc->header, num_audio_tracks, output_bin_name, output_cue_name, disc_iso_disc_name, disc_num, data_gap, NULL);
+		fclose(bin_file);
+		if (result)
+		{
+			printf("ERROR: Encountered issues converting disc %d to BIN/CUE!\n\n", disc_num);
+			return 0;
+		}
+		printf("Disc %d successfully converted to BIN/CUE format!\n\n", disc_num);
+	}
+
+	// Later discs may still fail, this one is kept for the rerun.
+	checkpoint_disc(job->checkpoint, disc_num);
+	disc->built = true;
+	return 0;
+}
+
+int decrypt_multi_disc(PBP_SECTION *psar, long long startdat_offset, unsigned char *pgd_key)
 {
 	// Decrypt the multidisc ISO map header and get the disc map.
 	// NOTE: The ISO map header is located at offset 0x200 and 
@@ -2059,7 +2465,7 @@ int decrypt_multi_disc(FILE *psar, long long psar_size, long long startdat_offse
 		printf("Aborting...\n");
 
 	// Re-open in read mode (just to be safe).
-	FILE* iso_map = fopen("ISO_MAP.BIN", "rb");
+	FILE* iso_map = temp_fopen("ISO_MAP.BIN", "rb");
 	if (iso_map == NULL)
 	{
 		printf("ERROR: No decrypted ISO disc map found!\n");
@@ -2100,277 +2506,176 @@ int decrypt_multi_disc(FILE *psar, long long psar_size, long long startdat_offse
 
 	// Decrypt the special data if it's present.
 	// NOTE: Special data is normally a PNG file with an intro screen of the game.
-	decrypt_special_data(psar, psar_size, special_data_offset);
-
-	// Build each valid ISO image.
-	int disc_count = 0;
-
-	for (int i = 0; i < MAX_DISCS; i++)
+	decrypt_special_data(psar, special_data_offset);
+
+	// Settle everything that may need the user for every disc first, so the
+	// discs can then be built without stopping.
+	MULTI_DISC discs[MAX_DISCS];
+	memset(discs, 0, sizeof(discs));
+	MULTI_DISC_JOB job;
+	job.psar = psar;
+	job.pgd_key = pgd_key;
+	job.checkpoint = checkpoint_open(iso_disc_name, psar, pgd_key, g_use_acm ? "acm" : "atrac3");
+	job.count = 0;
+
+	int result = 0;
+	for (int i = 0; i < MAX_DISCS && result == 0; i++)
 	{
-		if (disc_offset[i] > 0)
+		MULTI_DISC *disc = &discs[i];
+		disc->disc_num = i + 1;
+		disc->offset = disc_offset[i];
+		if (disc_offset[i] == 0)
+			continue;
+
+		// Decrypt the ISO header and get the block table.
+		// NOTE: In multidisc, the ISO header is located at the disc offset + 0x400 bytes. 
+		if (decrypt_iso_header(psar, disc_offset[i] + ISO_HEADER_OFFSET, pgd_key, i + 1, &disc->header) < 0)
 		{
-			// Decrypt the ISO header and get the block table.
-			// NOTE: In multidisc, the ISO header is located at the disc offset + 0x400 bytes. 
-			if (decrypt_iso_header(psar, disc_offset[i] + ISO_HEADER_OFFSET, pgd_key, i + 1) < 0)
-			{
-				fclose(iso_map);
-				return -1;
-			}
-			// Re-open in read mode (just to be safe).
-			char iso_header_filename[0x14];
-			sprintf(iso_header_filename, "ISO_HEADER_%d.BIN", i + 1);
-			FILE* iso_table = fopen(iso_header_filename, "rb");
-			if (iso_table == NULL)
-			{
-				printf("ERROR: No decrypted ISO header found!\n");
-				return -1;
-			}
-
-			// Extract the individual disc serial and title for this specific disc
-			char disc_iso_disc_name[0x10];
-			char disc_iso_title[0x80];
-			memset(disc_iso_disc_name, 0, 0x10);
-			memset(disc_iso_title, 0, 0x80);
-
-			fseek(iso_table, 1, SEEK_SET);
-			fread(disc_iso_disc_name, 0x0F, 1, iso_table);
-			fseek(iso_table, 0xE2C, SEEK_SET);
-			fread(disc_iso_title, 0x80, 1, iso_table);
-
-			printf("Disc %d serial: %s\n", i + 1, disc_iso_disc_name);
-			printf("Disc %d title: %s\n\n", i + 1, disc_iso_title);
-
-			// Check if we have a prebaked CUE file for this specific disc
-			char disc_game_title[256];
-			int prebaked = check_prebaked_cue_file(disc_iso_disc_name, disc_game_title);
-			if (prebaked < 0)
-			{
-				// User cancelled the CUE selection dialog - abort the extraction.
-				printf("Extraction cancelled by user.\n");
-				fclose(iso_table);
-				fclose(iso_map);
-				return -2;
-			}
-			bool use_prebaked_cue = (prebaked > 0);
-			
-			if (use_prebaked_cue)
-			{
-				printf("Found prebaked CUE file for disc %d (%s)\n", i + 1, disc_iso_disc_name);
-				printf("Game title from CUE: %s\n\n", disc_game_title);
-				
-				// Parse pregap overrides from the prebaked CUE file
-				if (g_dynamic_pregap_override != NULL)
-				{
-					// Clean up previous dynamic override
-					free((void*)g_dynamic_pregap_override->game_id);
-					free(g_dynamic_pregap_override);
-				}
-				g_dynamic_pregap_override = parse_prebaked_cue_pregaps(disc_iso_disc_name);
-			}
-			else
-			{
-				printf("No prebaked CUE file found for disc %d (%s), will generate CUE file\n\n", i + 1, disc_iso_disc_name);
-				sprintf(disc_game_title, "CDROM_%d", i + 1); // Default fallback
-				
-				// Clear any existing dynamic pregap override
-				if (g_dynamic_pregap_override != NULL)
-				{
-					free((void*)g_dynamic_pregap_override->game_id);
-					free(g_dynamic_pregap_override);
-					g_dynamic_pregap_override = NULL;
-				}
-			}
-			
-			// Declare variables that may be used after goto
-			char data_x_bin[0x10];
-			char data_x_bin_fixed[256];
-			int data_gap;
-			
-			// Check if output files already exist and prompt for overwrite
-			if (!check_output_files_overwrite(disc_game_title, use_prebaked_cue)) {
-				printf("Operation cancelled by user for disc %d.\n", i + 1);
-				fclose(iso_table);
-				goto next_disc;
-			}
-
-			// Build the data track.
-			printf("Building data track for disc %d...\n", i + 1);
-			if (build_data_track(psar, iso_table, disc_offset[i], i + 1) < 0)
-				printf("ERROR: Failed to reconstruct data track for disc %d!\n", i + 1);
-			else
-				printf("Data track successfully reconstructed for disc %d!\n", i + 1);
-			printf("\n");
-
-			sprintf(data_x_bin, "DATA_%d.BIN", i + 1);
-			memset(data_x_bin_fixed, 0, 256);
-			strcat(data_x_bin_fixed, data_x_bin);
-			strcat(data_x_bin_fixed, ".ISO");
-			data_gap = fix_iso(iso_table, data_x_bin, data_x_bin_fixed);
-			if (data_gap < 0)
-			{
-				printf("ERROR: unable to fix data track\n");
-				fclose(iso_table);
-				return -1;
-			}
-			printf("\n");
+			result = -1;
+			break;
+		}
+		disc->has_header = true;
 
+		// The individual disc serial and title for this specific disc
+		char *disc_iso_disc_name = disc->header.disc_name;
+		strcpy(disc->serial, disc->header.disc_name);
+		printf("Disc %d serial: %s\n", i + 1, disc_iso_disc_name);
+		printf("Disc %d title: %s\n\n", i + 1, disc->header.title);
 
-			// Attempt to extact and convert audio tracks
-			if (extract_and_convert_audio(psar, iso_table, disc_offset[i] + ISO_BASE_OFFSET, pgd_key, i + 1, data_gap, NULL) < 0)
-			{
-				printf("ERROR: extract and convert audio failed, aborting...\n");
-				fclose(iso_table);
-				return -1;
-			}
+		// Check if we have a prebaked CUE file for this specific disc
+		int prebaked = check_prebaked_cue_file(disc_iso_disc_name, disc->game_title);
+		if (prebaked < 0)
+		{
+			// User cancelled the CUE selection dialog - abort the extraction.
+			printf("Extraction cancelled by user.\n");
+			result = -2;
+			break;
+		}
+		disc->use_prebaked_cue = (prebaked > 0);
 
-			// Convert to BIN/CUE
-			printf("Converting disc %d to BIN/CUE...\n", i + 1);
+		if (disc->use_prebaked_cue)
+		{
+			printf("Found prebaked CUE file for disc %d (%s)\n", i + 1, disc_iso_disc_name);
+			printf("Game title from CUE: %s\n\n", disc->game_title);
+		}
+		else
+		{
+			printf("No prebaked CUE file found for disc %d (%s), will generate CUE file\n\n", i + 1, disc_iso_disc_name);
+			sprintf(disc->game_title, "CDROM_%d", i + 1); // Default fallback
+		}
 
-			// Use appropriate file names based on whether we have a prebaked CUE
-			char output_bin_name[256];
-			char output_cue_name[256];
-			
-			if (use_prebaked_cue)
-			{
-				sprintf(output_bin_name, "%s.bin", disc_game_title);
-				sprintf(output_cue_name, "%s.cue", disc_game_title);
-			}
-			else
-			{
-				sprintf(output_bin_name, "CDROM_%d.BIN", i + 1);
-				sprintf(output_cue_name, "CDROM_%d.CUE", i + 1);
-			}
-			
-			if (use_prebaked_cue)
-			{
-				// For prebaked CUE files, we only need to generate the BIN file
-				// and copy the prebaked CUE file with the correct BIN filename
-				printf("Using prebaked CUE file for disc %d, generating BIN file only...\n", i + 1);
-				
-				// Build the BIN file path using helper function
-				char bin_file_path[256];
-				
-				if (build_output_path(output_bin_name, bin_file_path, 256) != 0)
-				{
-					printf("ERROR: Failed to build BIN file path\n");
-					return -1;
-				}
-				
-				FILE* bin_file = fopen(bin_file_path, "wb");
-				if (bin_file == NULL)
-				{
-					printf("ERROR: Can't open %s!\n", bin_file_path);
-					fclose(iso_table);
-					goto next_disc; // Continue with next disc instead of aborting
-				}
-				
-				// Copy data track
-				int data_track_size = copy_track_to_iso(bin_file, data_x_bin_fixed, 1);
-				if (data_track_size < 0)
-				{
-					printf("Error copying data track to %s, aborting disc %d...\n", output_bin_name, i + 1);
-					fclose(bin_file);
-					fclose(iso_table);
-					goto next_disc;
-				}
-				
-				// Handle audio tracks if present
-				int track_num = 2;
-				int cue_offset = 0x428;  // track 02 offset
-				
-				CUE_ENTRY cue_entry[sizeof(CUE_ENTRY)];
-				memset(cue_entry, 0, sizeof(cue_entry));
-				
-				// Read track 02
-				fseek(iso_table, cue_offset, SEEK_SET);
-				fread(cue_entry, sizeof(CUE_ENTRY), 1, iso_table);
-				
-				while (cue_entry->type)
-				{
-					char track_filename[0x10];
-					audio_file_name(track_filename, i + 1, track_num, (char*)"BIN");
-					int audio_track_size = copy_track_to_iso(bin_file, track_filename, track_num);
-					if (audio_track_size < 0)
-					{
-						// If audio track copy failed on track 2 just bail
-						if (track_num == 2)
-						{
-							printf("Proceeding without audio tracks for disc %d\n", i + 1);
-							break;
-						}
-						else
-						{
-							printf("ERROR: failed to copy track %d to %s, aborting disc %d...\n", track_num, output_bin_name, i + 1);
-							fclose(bin_file);
-							fclose(iso_table);
-							goto next_disc;
-						}
-					}
-					
-					cue_offset += sizeof(CUE_ENTRY);
-					// Read next track
-					fseek(iso_table, cue_offset, SEEK_SET);
-					fread(cue_entry, sizeof(CUE_ENTRY), 1, iso_table);
-					track_num++;
-				}
-				
-				fclose(bin_file);
-				
-				// Copy the prebaked CUE file
-				if (copy_prebaked_cue_file(disc_iso_disc_name, disc_game_title, disc_game_title) < 0)
-				{
-					printf("ERROR: Failed to copy prebaked CUE file for disc %d!\n", i + 1);
-					fclose(iso_table);
-					goto next_disc;
-				}
-				
-				printf("Disc %d successfully converted using prebaked CUE file!\n\n", i + 1);
-			}
-			else
-			{
-				// Generate CUE file normally
-				if (build_bin_cue(iso_table, data_x_bin_fixed, output_bin_name, output_cue_name, disc_iso_disc_name, i + 1, data_gap, NULL))
-					printf("ERROR: Encountered issues converting disc %d to BIN/CUE!\n\n", i + 1);
-				else
-					printf("Disc %d successfully converted to BIN/CUE format!\n\n", i + 1);
-			}
+		// Check if output files already exist and prompt for overwrite
+		if (!check_output_files_overwrite(disc->game_title, disc->use_prebaked_cue, job.checkpoint, i + 1, &disc->resume))
+		{
+			printf("Operation cancelled by user for disc %d.\n", i + 1);
+			continue;
+		}
 
-			disc_count++;
-		next_disc:
-			fclose(iso_table);
+		// A disc finished by an interrupted run only needs its MD5 for the verification.
+		if (disc->resume == CHECKPOINT_DONE)
+		{
+			long long data_bytes;
+			int data_gap;
+			checkpoint_data_done(job.checkpoint, i + 1, &data_bytes, &data_gap, disc->md5);
+			disc->built = true;
+			continue;
 		}
+		job.discs[job.count++] = disc;
 	}
 
-	// MD5 verification using prebaked CUE files
-	printf("\n=== MD5 VERIFICATION ===\n");
-	// Verify each disc's data track
-	for (int i = 0; i < MAX_DISCS; i++) {
-		if (disc_offset[i] > 0) {
-			// Re-open the ISO header to get the disc serial
-			char iso_header_filename[0x14];
-			sprintf(iso_header_filename, "ISO_HEADER_%d.BIN", i + 1);
-			FILE* iso_table = fopen(iso_header_filename, "rb");
-			if (iso_table != NULL) {
-				// Read the disc serial
-				char disc_serial[0x10];
-				memset(disc_serial, 0, 0x10);
-				fseek(iso_table, 1, SEEK_SET);
-				fread(disc_serial, 0x0F, 1, iso_table);
-				fclose(iso_table);
-				
-				// Verify the data track
-				char data_track_file[256];
-				sprintf(data_track_file, "DATA_%d.BIN.ISO", i + 1);
-				verify_data_track_md5_cue(data_track_file, disc_serial);
+	// Build the discs. They only share the PSAR, so they run side by side and
+	// their blocks and tracks go to the same thread pool. Only the use of the
+	// ACM codec is serialized, see extract_and_convert_audio.
+	if (result == 0 && job.count > 0)
+	{
+		printf("Building %d discs at the same time...\n\n", job.count);
+		result = run_split(job.count, build_disc, &job);
+	}
+
+	int disc_count = 0;
+	bool finished = (result == 0);
+	if (result == 0)
+	{
+		// MD5 verification using prebaked CUE files
+		printf("\n=== MD5 VERIFICATION ===\n");
+		// Verify the data track of each disc that was built, declined or
+		// failed discs have no MD5.
+		for (int i = 0; i < MAX_DISCS; i++) {
+			if (discs[i].built) {
+				verify_data_track_md5_value(discs[i].md5, discs[i].serial);
 				printf("\n"); // Add spacing between disc verifications
+				disc_count++;
 			}
+			else if (discs[i].has_header)
+				finished = false;
 		}
+		printf("========================\n\n");
+
+		printf("Successfully reconstructed %d discs!\n", disc_count);
+	}
+
+	// Keep the checkpoint until every disc is done.
+	checkpoint_close(job.checkpoint, finished);
+	for (int i = 0; i < MAX_DISCS; i++)
+	{
+		if (discs[i].has_header)
+			free_iso_header(&discs[i].header);
 	}
-	printf("========================\n\n");
-	
-	printf("Successfully reconstructed %d discs!\n", disc_count);
 	fclose(iso_map);
-	return 0;
+	return result;
+}
+
+// Parses a byte count like 512M or 2G (K, M and G are powers of 1024, a
+// trailing B is allowed). Returns false if text is not one.
+static bool parse_memory_size(const char* text, long long* bytes)
+{
+	char* end = NULL;
+	double value = strtod(text, &end);
+	if (end == text || value <= 0)
+		return false;
+
+	long long unit = 1;
+	if (*end == 'K' || *end == 'k')
+		unit = 1024LL;
+	else if (*end == 'M' || *end == 'm')
+		unit = 1024LL * 1024;
+	else if (*end == 'G' || *end == 'g')
+		unit = 1024LL * 1024 * 1024;
+	if (unit > 1)
+		end++;
+	if (*end == 'B' || *end == 'b')
+		end++;
+	if (*end != 0)
+		return false;
+
+	*bytes = (long long)(value * unit);
+	return *bytes > 0;
+}
+
+// Progress lines of a batch (-b), one when each EBOOT starts and one when it's done.
+static void print_batch_status(void* ctx, int index, const BATCH_JOB* job)
+{
+	switch (job->status)
+	{
+	case BATCH_RUNNING:
+		printf("[%d] Extracting %s...\n", index + 1, job->pbp_file);
+		break;
+	case BATCH_SUCCEEDED:
+		printf("[%d] Done: %s (%.1f s)\n", index + 1, job->pbp_file, job->milliseconds / 1000.0);
+		break;
+	case BATCH_SKIPPED:
+		printf("[%d] Skipped: %s\n", index + 1, job->pbp_file);
+		break;
+	case BATCH_CANCELLED:
+		printf("[%d] Cancelled: %s\n", index + 1, job->pbp_file);
+		break;
+	default:
+		if (job->log_path[0] != 0)
+			printf("[%d] FAILED: %s (see %s)\n", index + 1, job->pbp_file, job->log_path);
+		else
+			printf("[%d] FAILED: %s\n", index + 1, job->pbp_file);
+		break;
+	}
 }
 
 int main(int argc, char **argv)
@@ -2440,32 +2745,24 @@ int main(int argc, char **argv)
 		return showGUI();
 	}
 	
-	if (argc > 5)
-	{
-		printf("*****************************************************\n");
-		printf("psxtract - Convert your PSOne Classics to BIN/CUE format.\n");
-		printf("         - Written by Hykem (C).\n");
-		printf("*****************************************************\n\n");
-		printf("Usage: psxtract [-c] <EBOOT.PBP> [DOCUMENT.DAT] [KEYS.BIN]\n");
-		printf("[-c] - Clean up temporary files after finishing.\n");
-		printf("EBOOT.PBP - Your PSOne Classic main PBP.\n");
-		printf("DOCUMENT.DAT - Game manual file (optional).\n");
-		printf("KEYS.BIN - Key file (optional).\n");
-		
-		// Clean up allocated arguments
-		for (int i = 0; i < argc; i++) {
-			free(utf8_argv[i]);
-		}
-		free(utf8_argv);
-		return 0;
-	}
-
 	// Keep track of the each argument's offset.
 	int arg_offset = 0;
 
 	// Check if we want to clean up temp files before exiting.
 	bool cleanup = false;
 	bool verbose = false;
+
+	// Catalog EBOOTs instead of extracting them (--inspect).
+	const char* inspect_path = NULL;
+	bool inspect_boot = false;
+
+	// Extract every EBOOT given (or found in the folders given), jobs at a time.
+	bool batch = false;
+	int jobs = 1;
+
+	// Memory the jobs' large buffers may take together (--max-memory), 0 for no limit.
+	long long max_memory = 0;
+	bool bad_argument = false;
 	
 	// Parse command line arguments
 	for (int i = 1; i < argc; i++) {
@@ -2478,18 +2775,161 @@ int main(int argc, char **argv)
 		} else if (!strcmp(argv[i], "--verbose") || !strcmp(argv[i], "-v")) {
 			verbose = true;
 			arg_offset++;
+		} else if (!strcmp(argv[i], "--unpack-pbp") || !strcmp(argv[i], "-u")) {
+			g_unpack_pbp = true;
+			arg_offset++;
+		} else if (!strcmp(argv[i], "--keep-temp") || !strcmp(argv[i], "-k")) {
+			g_keep_temp = true;
+			arg_offset++;
+		} else if (!strcmp(argv[i], "--acm") || !strcmp(argv[i], "-a")) {
+			g_use_acm = true;
+			arg_offset++;
+		} else if (!strcmp(argv[i], "--native-atrac3") || !strcmp(argv[i], "-n")) {
+			g_use_acm = false;
+			arg_offset++;
+		} else if (!strcmp(argv[i], "--index") || !strcmp(argv[i], "-i")) {
+			g_use_index = true;
+			arg_offset++;
+		} else if ((!strcmp(argv[i], "--threads") || !strcmp(argv[i], "-t")) && i + 1 < argc) {
+			parallel_set_threads(atoi(argv[i + 1]));
+			arg_offset += 2;
+			i++;
+		} else if (!strcmp(argv[i], "--batch") || !strcmp(argv[i], "-b")) {
+			batch = true;
+			arg_offset++;
+		} else if ((!strcmp(argv[i], "--jobs") || !strcmp(argv[i], "-j")) && i + 1 < argc) {
+			jobs = atoi(argv[i + 1]);
+			if (jobs < 1)
+				jobs = 1;
+			arg_offset += 2;
+			i++;
+		} else if (!strcmp(argv[i], "--max-memory") && i + 1 < argc) {
+			if (!parse_memory_size(argv[i + 1], &max_memory)) {
+				printf("ERROR: Invalid memory size %s\n\n", argv[i + 1]);
+				bad_argument = true;
+			}
+			arg_offset += 2;
+			i++;
+		} else if (!strcmp(argv[i], "--boot")) {
+			inspect_boot = true;
+			arg_offset++;
+		} else if (!strcmp(argv[i], "--inspect") && i + 1 < argc) {
+			inspect_path = argv[i + 1];
+			arg_offset += 2;
+			i++;
 		} else {
 			break; // Stop at first non-flag argument
 		}
 	}
 
-	// Call the main extraction function
-	int result = psxtract_main(argv[arg_offset + 1], 
-	                           (argc - arg_offset) >= 3 ? argv[arg_offset + 2] : NULL,
-	                           (argc - arg_offset) >= 4 ? argv[arg_offset + 3] : NULL,
-	                           cleanup,
-	                           verbose,
-	                           NULL);
+	if (inspect_path != NULL)
+	{
+		int result = inspect_main(inspect_path, NULL, g_use_index, inspect_boot);
+		for (int i = 0; i < argc; i++) {
+			free(utf8_argv[i]);
+		}
+		free(utf8_argv);
+		return result;
+	}
+
+	// Expect the EBOOT plus at most DOCUMENT.DAT and KEYS.BIN after the flags,
+	// or any number of EBOOTs and folders in batch mode.
+	int positional = argc - 1 - arg_offset;
+	if (bad_argument || positional < 1 || (!batch && positional > 3))
+	{
+		printf("*****************************************************\n");
+		printf("psxtract - Convert your PSOne Classics to BIN/CUE format.\n");
+		printf("         - Written by Hykem (C).\n");
+		printf("*****************************************************\n\n");
+		printf("Usage: psxtract [-c] [-u] [-k] [-a|-n] [-i] [-t N] <EBOOT.PBP> [DOCUMENT.DAT] [KEYS.BIN]\n");
+		printf("       psxtract -b [-j N] [--max-memory SIZE] [-c] [-a|-n] [-i] [-t N] <EBOOT.PBP|folder>...\n");
+		printf("[-c] - Clean up temporary files after finishing.\n");
+		printf("[-u] - Also unpack the PBP sections to TEMP/PBP (debugging).\n");
+		printf("[-k] - Keep the intermediate DATA_TRACK.BIN / DATA_TRACK.BIN.ISO images and the AT3/WAV of each audio track.\n");
+		printf("[-a] - Decode audio tracks with the Sony ATRAC3 ACM codec (default).\n");
+		printf("[-n] - Decode audio tracks with the built-in ATRAC3 decoder instead (experimental).\n");
+		printf("[-i] - Keep the decrypted disc layout in EBOOT.PBP.pxidx and reuse it on later runs.\n");
+		printf("[-t N] - Number of worker threads (default: one per CPU).\n");
+		printf("[-b] - Batch mode: extract every EBOOT given, and every EBOOT found in the folders given.\n");
+		printf("[-j N] - Extract N EBOOTs at the same time in batch mode, each logging to <EBOOT name>.log (default: 1).\n");
+		printf("[--max-memory SIZE] - Hold back EBOOTs and stages while their buffers would take more than SIZE (e.g. 512M, 2G).\n");
+		printf("--inspect <EBOOT.PBP|folder> - Print the disc layout of every EBOOT as JSON lines, without extracting.\n");
+		printf("[--boot] - With --inspect, also report the BOOT line of SYSTEM.CNF (decompresses a few data blocks).\n");
+		printf("EBOOT.PBP - Your PSOne Classic main PBP.\n");
+		printf("DOCUMENT.DAT - Game manual file (optional).\n");
+		printf("KEYS.BIN - Key file (optional).\n");
+		printf("An interrupted extraction leaves <serial>.checkpoint in the output folder, run it again to resume.\n");
+		
+		// Clean up allocated arguments
+		for (int i = 0; i < argc; i++) {
+			free(utf8_argv[i]);
+		}
+		free(utf8_argv);
+		return bad_argument ? 1 : 0;
+	}
+
+	PATH_LIST list = { NULL, 0, 0 };
+	BATCH_JOB single;
+	BATCH_JOB* batch_jobs = &single;
+	int job_count = 1;
+	memset(&single, 0, sizeof(single));
+	if (batch)
+	{
+		for (int i = arg_offset + 1; i < argc; i++)
+			batch_add_eboots(&list, argv[i]);
+		job_count = list.count;
+		batch_jobs = (BATCH_JOB*)calloc(job_count ? job_count : 1, sizeof(BATCH_JOB));
+		if (batch_jobs == NULL)
+		{
+			printf("ERROR: Failed to allocate memory for %d jobs\n", job_count);
+			job_count = 0;
+		}
+		for (int i = 0; i < job_count; i++)
+			batch_jobs[i].pbp_file = list.paths[i];
+		if (list.count == 0)
+			printf("ERROR: No EBOOTs found.\n");
+	}
+	else
+	{
+		single.pbp_file = argv[arg_offset + 1];
+		single.document_file = (positional >= 2) ? argv[arg_offset + 2] : NULL;
+		single.keys_file = (positional >= 3) ? argv[arg_offset + 3] : NULL;
+	}
+
+	BATCH_OPTIONS options;
+	memset(&options, 0, sizeof(options));
+	options.concurrency = batch ? jobs : 1;
+	options.cleanup = cleanup;
+	options.verbose = verbose;
+	options.echo = true;
+	options.max_memory = max_memory;
+	// A GUI child keeps its own log, as do jobs that share the console.
+	options.log_files = isGUIMode() || options.concurrency > 1;
+	options.notify = batch ? print_batch_status : NULL;
+
+	int failures = batch_run(batch_jobs, job_count, &options);
+
+	int result;
+	if (!batch)
+	{
+		result = single.exit_code;
+	}
+	else
+	{
+		int succeeded = 0, skipped = 0;
+		for (int i = 0; i < job_count; i++)
+		{
+			if (batch_jobs[i].status == BATCH_SUCCEEDED)
+				succeeded++;
+			else if (batch_jobs[i].status == BATCH_SKIPPED)
+				skipped++;
+		}
+		printf("\nBatch done: %d succeeded, %d skipped, %d failed.\n", succeeded, skipped, failures);
+		result = (failures > 0 || job_count == 0) ? 1 : 0;
+		if (batch_jobs != NULL)
+			free(batch_jobs);
+		batch_free_paths(&list);
+	}
 	
 	// Clean up allocated arguments
 	for (int i = 0; i < argc; i++) {
@@ -2500,45 +2940,33 @@ int main(int argc, char **argv)
 	return result;
 }
 
-static bool g_verbose = false;
+// Verbose flag of the job running on this thread; batch jobs run side by side
+// and each sets its own.
+static thread_local bool g_verbose = false;
+
 
 bool isVerboseMode() {
     return g_verbose;
 }
 
-int psxtract_main(const char* pbp_file, const char* document_file, const char* keys_file, bool cleanup, bool verbose, const char* output_dir)
+// Extracts one EBOOT. Runs as a job of batch_run (see batch.h), which starts
+// KIRK and picks the output folder and the job's TEMP directory.
+int psxtract_main(const char* pbp_file, const char* document_file, const char* keys_file, bool cleanup, bool verbose)
 {
 	// Set global verbose flag
 	g_verbose = verbose;
-	
-	// If in GUI mode, open log file for writing
-	if (isGUIMode()) {
-		openLogFileForWriting(pbp_file);
-	}
-	
-	// Change to output directory if specified
-	char original_dir[MAX_PATH];
-	if (output_dir && strcmp(output_dir, ".") != 0) {
-		if (_getcwd(original_dir, sizeof(original_dir)) == NULL) {
-			printf("ERROR: Failed to get current directory\n");
-			return 1;
-		}
-		if (_chdir(output_dir) != 0) {
-			printf("ERROR: Failed to change to output directory: %s\n", output_dir);
-			return 1;
-		}
-		printf("Changed to output directory: %s\n", output_dir);
-	}
-	FILE* input = fopen(pbp_file, "rb");
-	if (input == NULL) {
+
+	INPUT_READER reader;
+	if (reader_open(&reader, pbp_file) < 0) {
 		printf("ERROR: Can't open input PBP file: %s\n", pbp_file);
 		return 1;
 	}
+	INPUT_READER* input = &reader;
 
-	// Start KIRK.
-	kirk_init();
-	
-
+	// The index sits next to the EBOOT, so it needs the full path.
+	g_index_eboot[0] = 0;
+	if (g_use_index && _fullpath(g_index_eboot, pbp_file, MAX_PATH) == NULL)
+		g_index_eboot[0] = 0;
 
 	// Set an empty PGD key.
 	unsigned char pgd_key[0x10] = {};
@@ -2567,96 +2995,98 @@ int psxtract_main(const char* pbp_file, const char* document_file, const char* k
 			printf("%02X", pgd_key[i]);
 		printf("\n\n");
 	}
+
+	// Intermediate data goes to the job's own TEMP directory.
+	const char* temp_dir = batch_temp_dir();
+
 	// Check if TEMP directory already exists from a previous run
-	struct stat temp_stat;
-	if (stat("TEMP", &temp_stat) == 0 && (temp_stat.st_mode & S_IFDIR)) {
+	if (utf8_file_exists(temp_dir) == 0) {
 		if (cleanup) {
 			// In cleanup mode, automatically remove TEMP directory
 			printf("TEMP directory exists from previous run. Removing automatically (cleanup mode)...\n");
-			system("rmdir /S /Q TEMP");
+			utf8_remove_directory(temp_dir);
 		} else {
+			bool remove_temp;
 			if (isGUIMode()) {
 				// GUI mode - use dialog only
-				if (gui_prompt("TEMP directory already exists from a previous run.\nThis may contain files that could interfere with the current extraction.\n\nDelete TEMP directory and continue?", "TEMP Directory Exists")) {
-					printf("Removing existing TEMP directory...\n");
-					system("rmdir /S /Q TEMP");
-				} else {
-					printf("Extraction cancelled. Please manually remove TEMP directory and try again.\n");
-					return 1;
-				}
+				remove_temp = gui_prompt("TEMP directory already exists from a previous run.\nThis may contain files that could interfere with the current extraction.\n\nDelete TEMP directory and continue?", "TEMP Directory Exists");
 			} else {
 				// Console mode - use text prompt
-				printf("WARNING: TEMP directory already exists from a previous run.\n");
+				printf("WARNING: TEMP directory %s already exists from a previous run.\n", temp_dir);
 				printf("This may contain files that could interfere with the current extraction.\n");
-				printf("Do you want to delete TEMP directory and continue? (y/N): ");
-				
-				char input[10];
-				if (fgets(input, sizeof(input), stdin) != NULL) {
-					char response = input[0];
-					if (response == 'y' || response == 'Y') {
-						printf("Removing existing TEMP directory...\n");
-						system("rmdir /S /Q TEMP");
-					} else {
-						printf("Extraction cancelled. Please manually remove TEMP directory and try again.\n");
-						return 1;
-					}
-				} else {
-					printf("Extraction cancelled. Please manually remove TEMP directory and try again.\n");
-					return 1;
-				}
+				remove_temp = gui_prompt("Do you want to delete TEMP directory and continue?", "TEMP Directory Exists");
+			}
+			if (remove_temp) {
+				printf("Removing existing TEMP directory...\n");
+				utf8_remove_directory(temp_dir);
+			} else {
+				printf("Extraction cancelled. Please manually remove TEMP directory and try again.\n");
+				reader_close(&reader);
+				return 1;
 			}
 		}
 	}
 	
 	// Make a new directory for intermediate data.
-	_mkdir("TEMP");
-	_chdir("TEMP");
+	utf8_mkdir(temp_dir);
 
-	printf("Unpacking PBP %s...\n", pbp_file);
+	printf("Reading PBP %s...\n", pbp_file);
 
-	// Setup a new directory to output the unpacked contents.
-	_mkdir("PBP");
-	_chdir("PBP");
+	if (input->mapping == NULL)
+		printf("Could not memory-map %s, falling back to buffered reads.\n", pbp_file);
 
-	// Unpack the EBOOT.PBP file.
-	if (unpack_pbp(input))
+	// Map out the EBOOT.PBP sections; everything below reads them in place.
+	PBP_SECTION sections[8];
+	if (open_pbp_sections(input, sections))
 	{
-		printf("ERROR: Failed to unpack %s!", pbp_file);
-		_chdir("..");
-		_rmdir("PBP");
+		printf("ERROR: Failed to read %s!", pbp_file);
+		reader_close(input);
 		return -1;
 	}
-	else
-		printf("Successfully unpacked %s!\n\n", pbp_file);
 
-	_chdir("..");
+	// Only dump the sections to disk when explicitly requested.
+	if (g_unpack_pbp)
+	{
+		printf("Unpacking PBP sections to TEMP/PBP...\n");
+		char pbp_dir[MAX_PATH];
+		batch_temp_path("PBP", pbp_dir, MAX_PATH);
+		utf8_mkdir(pbp_dir);
+		int unpack_result = unpack_pbp(sections, pbp_dir);
+
+		if (unpack_result)
+		{
+			printf("ERROR: Failed to unpack %s!", pbp_file);
+			reader_close(input);
+			return -1;
+		}
+		else
+			printf("Successfully unpacked %s!\n", pbp_file);
+	}
+	printf("\n");
 
 	// Locate DATA.PSAR.
-	FILE* psar = fopen("PBP/DATA.PSAR", "rb");
-	if (psar == NULL)
+	PBP_SECTION* psar = &sections[PBP_DATA_PSAR];
+	if (psar->size == 0)
 	{
 		printf("ERROR: No DATA.PSAR found!\n");
+		reader_close(input);
 		return -1;
 	}
 
-	// Get DATA.PSAR size.
-	_fseeki64(psar, 0, SEEK_END);
-	const long long psar_size = _ftelli64(psar);
-	_fseeki64(psar, 0, SEEK_SET);
-
 	// Check PSISOIMG0000 or PSTITLEIMG0000 magic.
 	// NOTE: If the file represents a single disc, then PSISOIMG0000 is used.
 	// However, for multidisc ISOs, the PSTITLEIMG0000 additional header
 	// is used to hold data relative to the different discs.
 	unsigned char magic[0x10];
 	bool isMultidisc;
-	fread(magic, sizeof(magic), 1, psar);
+	read_pbp_section(psar, 0, magic, sizeof(magic));
 
 	if (memcmp(magic, iso_magic, 0xC) != 0)
 	{
 		if (memcmp(magic, multi_iso_magic, 0x10) != 0)
 		{
 			printf("ERROR: Not a valid ISO image!\n");
+			reader_close(input);
 			return -1;
 		}
 		else
@@ -2677,38 +3107,24 @@ int psxtract_main(const char* pbp_file, const char* document_file, const char* k
 
 	// Decrypt the disc(s).
 	int decrypt_result;
-	if (isMultidisc)
-		decrypt_result = decrypt_multi_disc(psar, psar_size, startdat_offset, pgd_key);
+	if (batch_cancelled())
+		decrypt_result = -2;
+	else if (isMultidisc)
+		decrypt_result = decrypt_multi_disc(psar, startdat_offset, pgd_key);
 	else
-		decrypt_result = decrypt_single_disc(psar, psar_size, startdat_offset, pgd_key);
-	
-	if (decrypt_result < 0) {
-		fclose(psar);
-		fclose(input);
-		
-		// Clean up dynamic pregap override
-		if (g_dynamic_pregap_override != NULL) {
-			free((void*)g_dynamic_pregap_override->game_id);
-			free(g_dynamic_pregap_override);
-			g_dynamic_pregap_override = NULL;
-		}
-		
-		// Restore original directory if we changed it
-		if (output_dir && strcmp(output_dir, ".") != 0) {
-			if (_chdir(original_dir) != 0) {
-				printf("Warning: Failed to restore original directory\n");
-			}
-		}
-		
-		return decrypt_result;
-	}
+		decrypt_result = decrypt_single_disc(psar, startdat_offset, pgd_key);
 
-	// Change the directory back.
-	_chdir("..");
+	reader_close(input);
 
-	fclose(psar);
-	fclose(input);
+	// Clean up dynamic pregap override
+	if (g_dynamic_pregap_override != NULL) {
+		free((void*)g_dynamic_pregap_override->game_id);
+		free(g_dynamic_pregap_override);
+		g_dynamic_pregap_override = NULL;
+	}
 
+	if (decrypt_result < 0)
+		return decrypt_result;
 
 	if (cleanup)
 	{
@@ -2716,22 +3132,7 @@ int psxtract_main(const char* pbp_file, const char* document_file, const char* k
 		if (!isGUIMode()) {
 			printf("[If you see errors above try running without -c to leave TEMP files in place in order to debug.]\n");
 		}
-		system("rmdir /S /Q TEMP");
-	}
-	
-	
-	// Clean up dynamic pregap override
-	if (g_dynamic_pregap_override != NULL) {
-		free((void*)g_dynamic_pregap_override->game_id);
-		free(g_dynamic_pregap_override);
-		g_dynamic_pregap_override = NULL;
-	}
-	
-	// Restore original directory if we changed it
-	if (output_dir && strcmp(output_dir, ".") != 0) {
-		if (_chdir(original_dir) != 0) {
-			printf("Warning: Failed to restore original directory\n");
-		}
+		utf8_remove_directory(temp_dir);
 	}
 	
 	return 0;
@@ -6,6 +6,7 @@
 
 #include <cstdint>
 #include <direct.h>
+#include <io.h>
 #include <sys/stat.h>
 #include <windows.h>
 #include <shlwapi.h>
@@ -14,19 +15,15 @@
 #include <stdio.h>
 
 #include "cdrom.h"
+#include "iso_header.h"
 #include "lz.h"
 #include "crypto.h"
 
 // Main extraction function that can be called from GUI or command line
-int psxtract_main(const char* pbp_file, const char* document_file, const char* keys_file, bool cleanup, bool verbose, const char* output_dir);
+int psxtract_main(const char* pbp_file, const char* document_file, const char* keys_file, bool cleanup, bool verbose);
 
-#define GAP_FRAMES	2 * 75	// 2 seconds
-#define GAP_SIZE	GAP_FRAMES * SECTOR_SIZE  // 2 seconds * 75 frames * 2352 sector size
-#define ISO_BLOCK_SIZE	16 * SECTOR_SIZE
-#define ISO_HEADER_OFFSET 0x400
-#define ISO_HEADER_SIZE	0xB6600
-#define ISO_BASE_OFFSET	0x100000
-#define CUE_LEADOUT_OFFSET	0x414
+#define ISO_READAHEAD_BLOCKS	256	// Blocks to prefetch ahead of the decompressor
+#define BIN_WRITE_BUFFER	(256 * SECTOR_SIZE)	// Smallest whole number of sectors that is a multiple of 4 KiB
 #define MAX_DISCS	5
 #define NBYTES		0x180
 
@@ -66,36 +63,6 @@ char iso_magic[0xC] = {
 	0x30   // 0
 };
 
-// CUE structure
-typedef struct {
-	unsigned short    type;		    // Track Type = 41h for DATA, 01h for CDDA, A2h for lead out
-	unsigned char    number;		// Track Number (01h to 99h)
-	unsigned char    I0m;		    // INDEX 00 MM
-	unsigned char    I0s;		    // INDEX 00 SS
-	unsigned char    I0f;		    // INDEX 00 FF
-	unsigned char	 padding;       // NULL
-	unsigned char    I1m;		    // INDEX 01 MM
-	unsigned char    I1s;		    // INDEX 01 SS
-	unsigned char    I1f;		    // INDEX 01 FF
-} CUE_ENTRY;
-
-// CDDA table entry structure.
-typedef struct {
-	unsigned int     offset;
-	unsigned int     size;
-	unsigned char    padding[0x4];
-	unsigned int	 checksum;
-} CDDA_ENTRY;
-
-// ISO table entry structure.
-typedef struct {
-	unsigned int     offset;
-	unsigned short   size;
-	unsigned short   marker;			// 0x01 or 0x00
-	unsigned char	 checksum[0x10];	// first 0x10 bytes of sha1 sum of 0x10 disc sectors
-	unsigned char	 padding[0x8];
-} ISO_ENTRY;
-
 // STARTDAT header structure.
 typedef struct {
 	unsigned char    magic[8];		// STARTDAT
@@ -0,0 +1,159 @@
+#include "pxidx.h"
+#include "iso_header.h"
+#include "md5_verify.h"
+#include "gui.h"
+#include <stdint.h>
+
+#define PXIDX_PSAR_HEADER_SIZE  0x500   // PSISOIMG/PSTITLEIMG header and, for multi-disc games, the disc map PGD.
+#define PXIDX_PGD_HEADER_SIZE   0x100   // Header of the ISO header PGD, MACs included.
+
+static const char pxidx_magic[8] = { 'P', 'X', 'I', 'D', 'X', 0, 0, 0 };
+
+typedef struct {
+    char            magic[8];
+    uint32_t        version;
+    uint32_t        header_size;        // Bytes of decrypted ISO header that follow.
+    char            psar_hash[0x24];    // MD5 (hex) of the PSAR data the index belongs to.
+    char            header_hash[0x24];  // MD5 (hex) of the decrypted ISO header that follows.
+    unsigned char   pgd_key[0x10];      // All zero when the key came from the PGD MAC.
+    uint32_t        disc_offset;
+    uint32_t        has_sector_info;
+    int32_t         form2_edc_mode;
+    int32_t         last_data_sector;
+} PXIDX_FILE_HEADER;
+
+void pxidx_path(const char* eboot, int disc_num, char* path, int size)
+{
+    if (disc_num > 0)
+        snprintf(path, size, "%s.disc%d.pxidx", eboot, disc_num);
+    else
+        snprintf(path, size, "%s.pxidx", eboot);
+}
+
+// Hashes the PSAR size, the PSAR header and the header of the disc's ISO
+// header PGD. Returns false if MD5 is not available.
+static bool hash_psar(PBP_SECTION* psar, unsigned int disc_offset, char* hash)
+{
+    unsigned char psar_header[PXIDX_PSAR_HEADER_SIZE];
+    unsigned char pgd_header[PXIDX_PGD_HEADER_SIZE];
+    read_pbp_section(psar, 0, psar_header, sizeof(psar_header));
+    read_pbp_section(psar, (long long)disc_offset + ISO_HEADER_OFFSET, pgd_header, sizeof(pgd_header));
+
+    MD5_STREAM md5;
+    if (!md5_stream_begin(&md5))
+        return false;
+    md5_stream_update(&md5, &psar->size, sizeof(psar->size));
+    md5_stream_update(&md5, psar_header, sizeof(psar_header));
+    md5_stream_update(&md5, pgd_header, sizeof(pgd_header));
+    memset(hash, 0, 0x24);
+    return md5_stream_end(&md5, hash);
+}
+
+// MD5 of the stored header, which no longer has the PGD MAC to vouch for it.
+static bool hash_header(const unsigned char* iso_header, int size, char* hash)
+{
+    MD5_STREAM md5;
+    if (!md5_stream_begin(&md5))
+        return false;
+    md5_stream_update(&md5, iso_header, size);
+    memset(hash, 0, 0x24);
+    return md5_stream_end(&md5, hash);
+}
+
+// Bytes of the decrypted header up to and including the empty entry that
+// ends the block table.
+static int used_header_size(const unsigned char* iso_header, int size)
+{
+    int used = ISO_TABLE_OFFSET;
+    while (used + (int)sizeof(ISO_ENTRY) <= size) {
+        const ISO_ENTRY* entry = (const ISO_ENTRY*)(iso_header + used);
+        used += sizeof(ISO_ENTRY);
+        if (entry->size == 0)
+            break;
+    }
+    return (used < size) ? used : size;
+}
+
+unsigned char* pxidx_load(const char* path, PBP_SECTION* psar, const unsigned char* pgd_key, int* header_size, PXIDX_INFO* info)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+
+    PXIDX_FILE_HEADER header;
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, pxidx_magic, sizeof(pxidx_magic)) != 0
+        || header.version != PXIDX_VERSION
+        || header.header_size < ISO_TABLE_OFFSET || header.header_size > ISO_HEADER_SIZE) {
+        printf("Ignoring unreadable index %s\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    unsigned char key[0x10] = {};
+    if (pgd_key != NULL)
+        memcpy(key, pgd_key, sizeof(key));
+    char hash[0x24];
+    if (!hash_psar(psar, header.disc_offset, hash)
+        || memcmp(hash, header.psar_hash, sizeof(hash)) != 0
+        || memcmp(key, header.pgd_key, sizeof(key)) != 0) {
+        printf("Ignoring stale index %s\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    unsigned char* iso_header = new unsigned char[header.header_size];
+    if (fread(iso_header, header.header_size, 1, file) != 1) {
+        printf("Ignoring truncated index %s\n", path);
+        delete[] iso_header;
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+
+    if (!hash_header(iso_header, header.header_size, hash) || memcmp(hash, header.header_hash, sizeof(hash)) != 0) {
+        printf("Ignoring corrupt index %s\n", path);
+        delete[] iso_header;
+        return NULL;
+    }
+
+    *header_size = (int)header.header_size;
+    info->disc_offset = header.disc_offset;
+    info->has_sector_info = header.has_sector_info != 0;
+    info->form2EDCMode = header.form2_edc_mode;
+    info->last_data_sector = header.last_data_sector;
+    return iso_header;
+}
+
+int pxidx_save(const char* path, PBP_SECTION* psar, const unsigned char* pgd_key, const unsigned char* iso_header, int header_size, const PXIDX_INFO* info)
+{
+    PXIDX_FILE_HEADER header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, pxidx_magic, sizeof(pxidx_magic));
+    header.version = PXIDX_VERSION;
+    header.header_size = used_header_size(iso_header, header_size);
+    if (pgd_key != NULL)
+        memcpy(header.pgd_key, pgd_key, sizeof(header.pgd_key));
+    header.disc_offset = info->disc_offset;
+    header.has_sector_info = info->has_sector_info ? 1 : 0;
+    header.form2_edc_mode = info->form2EDCMode;
+    header.last_data_sector = info->last_data_sector;
+    if (!hash_psar(psar, info->disc_offset, header.psar_hash)
+        || !hash_header(iso_header, header.header_size, header.header_hash))
+        return -1;
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        printf("WARNING: Can't write index %s\n", path);
+        return -1;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(iso_header, header.header_size, 1, file) == 1;
+    if (fclose(file) != 0)
+        ok = false;
+    if (!ok) {
+        printf("WARNING: Can't write index %s\n", path);  // A truncated index is ignored on load.
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "crypto.h"
+
+// Optional .pxidx sidecar next to an EBOOT, so reopening a disc skips the PGD
+// decryption of its 0xB6600-byte ISO header.
+//
+// The index holds the part of the decrypted header that parse_iso_header uses
+// (disc name, CUE and CDDA tables, and the block table with every block's
+// offset and size), the PGD key and the disc offset. It is keyed by an MD5 of
+// the PSAR header and of the header PGD's own header, whose MACs cover the
+// whole encrypted header, so an index left over from another EBOOT, another
+// version of the same one or another key is detected and ignored. The header
+// itself is checked against an MD5 stored with it, so a damaged or edited
+// index is ignored as well. parse_iso_header also rejects blocks larger than
+// ISO_BLOCK_SIZE, wherever the header came from.
+
+#define PXIDX_VERSION 2
+
+typedef struct {
+    unsigned int disc_offset;   // Offset of the disc in DATA.PSAR (0 for single disc games).
+    bool has_sector_info;       // The fields below are set (see vdisc.cpp).
+    int form2EDCMode;
+    int last_data_sector;
+} PXIDX_INFO;
+
+// Sidecar path for disc disc_num of eboot (1-based, 0 for single disc games).
+void pxidx_path(const char* eboot, int disc_num, char* path, int size);
+
+// Returns the decrypted ISO header stored in the index at path (delete[] by
+// the caller) and fills header_size and info. Returns NULL if there is no
+// index or it does not match the PSAR or pgd_key (NULL for none).
+unsigned char* pxidx_load(const char* path, PBP_SECTION* psar, const unsigned char* pgd_key, int* header_size, PXIDX_INFO* info);
+
+// Writes the index for a freshly decrypted ISO header. Returns 0 on success;
+// callers carry on without an index otherwise.
+int pxidx_save(const char* path, PBP_SECTION* psar, const unsigned char* pgd_key, const unsigned char* iso_header, int header_size, const PXIDX_INFO* info);
@@ -0,0 +1,237 @@
+#include "reader.h"
+#include "utils.h"
+#include <string.h>
+#include <stdlib.h>
+
+// PrefetchVirtualMemory only exists on Windows 8 and later, so look it up at
+// runtime instead of linking against it.
+typedef struct {
+    PVOID VirtualAddress;
+    SIZE_T NumberOfBytes;
+} PREFETCH_RANGE_ENTRY;
+typedef BOOL (WINAPI *PrefetchVirtualMemoryFn)(HANDLE, ULONG_PTR, PREFETCH_RANGE_ENTRY*, ULONG);
+
+static PrefetchVirtualMemoryFn get_prefetch_function()
+{
+    static bool resolved = false;
+    static PrefetchVirtualMemoryFn fn = NULL;
+    if (!resolved) {
+        HMODULE kernel32 = GetModuleHandleW(L"kernel32.dll");
+        if (kernel32)
+            fn = (PrefetchVirtualMemoryFn)GetProcAddress(kernel32, "PrefetchVirtualMemory");
+        resolved = true;
+    }
+    return fn;
+}
+
+static bool map_file(INPUT_READER* reader, const char* filename)
+{
+    int wlen = MultiByteToWideChar(CP_UTF8, 0, filename, -1, NULL, 0);
+    wchar_t* wfilename = (wchar_t*)malloc(wlen * sizeof(wchar_t));
+    if (!wfilename)
+        return false;
+    MultiByteToWideChar(CP_UTF8, 0, filename, -1, wfilename, wlen);
+
+    // The compressed block stream is consumed front to back, let the cache
+    // manager read ahead aggressively.
+    reader->file_handle = CreateFileW(wfilename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                      OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    free(wfilename);
+    if (reader->file_handle == INVALID_HANDLE_VALUE) {
+        reader->file_handle = NULL;
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(reader->file_handle, &size) || size.QuadPart == 0) {
+        CloseHandle(reader->file_handle);
+        reader->file_handle = NULL;
+        return false;
+    }
+    reader->size = size.QuadPart;
+
+    // Only the file mapping object is created here, windows of it are
+    // mapped into the address space as they are needed.
+    reader->mapping = CreateFileMappingW(reader->file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (reader->mapping == NULL) {
+        CloseHandle(reader->file_handle);
+        reader->file_handle = NULL;
+        return false;
+    }
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    reader->granularity = info.dwAllocationGranularity;
+    InitializeCriticalSection(&reader->lock);
+    return true;
+}
+
+// Maps the window of the file that holds [offset, offset + size) into the
+// unused slot window. Returns NULL if the range doesn't fit in a window or
+// the view can't be mapped. Called with the lock held.
+static READER_WINDOW* map_window(INPUT_READER* reader, READER_WINDOW* window, long long offset, long long size)
+{
+    long long base = offset - offset % reader->granularity;
+    long long bytes = reader->size - base;
+    if (bytes > READER_WINDOW_SIZE)
+        bytes = READER_WINDOW_SIZE;
+    if (offset + size > base + bytes)
+        return NULL;
+
+    if (window->data != NULL)
+        UnmapViewOfFile(window->data);
+    window->data = (const unsigned char*)MapViewOfFile(reader->mapping, FILE_MAP_READ,
+                                                       (DWORD)(base >> 32), (DWORD)base, (SIZE_T)bytes);
+    if (window->data == NULL)
+        return NULL;
+    window->offset = base;
+    window->size = bytes;
+    return window;
+}
+
+int reader_open(INPUT_READER* reader, const char* filename)
+{
+    memset(reader, 0, sizeof(INPUT_READER));
+
+    if (map_file(reader, filename))
+        return 0;
+
+    // Fall back to buffered reads.
+    reader->file = fopen(filename, "rbS");
+    if (reader->file == NULL)
+        return -1;
+
+    _fseeki64(reader->file, 0, SEEK_END);
+    reader->size = _ftelli64(reader->file);
+    _fseeki64(reader->file, 0, SEEK_SET);
+    if (reader->size < 0) {
+        fclose(reader->file);
+        reader->file = NULL;
+        return -1;
+    }
+    InitializeCriticalSection(&reader->lock);
+    return 0;
+}
+
+void reader_close(INPUT_READER* reader)
+{
+    for (int i = 0; i < READER_WINDOWS; i++) {
+        if (reader->windows[i].data)
+            UnmapViewOfFile(reader->windows[i].data);
+    }
+    if (reader->mapping)
+        CloseHandle(reader->mapping);
+    if (reader->file_handle)
+        CloseHandle(reader->file_handle);
+    if (reader->file)
+        fclose(reader->file);
+    if (reader->mapping || reader->file)
+        DeleteCriticalSection(&reader->lock);
+    memset(reader, 0, sizeof(INPUT_READER));
+}
+
+int reader_read(INPUT_READER* reader, long long offset, void* buf, int size)
+{
+    if (offset < 0 || size <= 0 || offset >= reader->size)
+        return 0;
+    if (offset + size > reader->size)
+        size = (int)(reader->size - offset);
+
+    if (reader->mapping) {
+        const unsigned char* view = reader_view(reader, offset, size);
+        if (view) {
+            memcpy(buf, view, size);
+            reader_release_view(reader, view);
+            return size;
+        }
+
+        // Every window is busy, read at offset without moving a shared position.
+        OVERLAPPED overlapped;
+        memset(&overlapped, 0, sizeof(overlapped));
+        overlapped.Offset = (DWORD)offset;
+        overlapped.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD read = 0;
+        if (!ReadFile(reader->file_handle, buf, (DWORD)size, &read, &overlapped))
+            return -1;
+        return (int)read;
+    }
+
+    int read = -1;
+    EnterCriticalSection(&reader->lock);
+    if (_fseeki64(reader->file, offset, SEEK_SET) == 0)
+        read = (int)fread(buf, 1, size, reader->file);
+    LeaveCriticalSection(&reader->lock);
+    return read;
+}
+
+const unsigned char* reader_view(INPUT_READER* reader, long long offset, long long size)
+{
+    if (reader->mapping == NULL || offset < 0 || size < 0 || offset + size > reader->size)
+        return NULL;
+
+    const unsigned char* view = NULL;
+    EnterCriticalSection(&reader->lock);
+    READER_WINDOW* window = NULL;
+    READER_WINDOW* spare = NULL;    // Free slot, or else the least recently used idle window.
+    for (int i = 0; i < READER_WINDOWS; i++) {
+        READER_WINDOW* candidate = &reader->windows[i];
+        if (candidate->data != NULL && offset >= candidate->offset && offset + size <= candidate->offset + candidate->size) {
+            window = candidate;
+            break;
+        }
+        if (candidate->users == 0 && (spare == NULL ||
+            (spare->data != NULL && (candidate->data == NULL || candidate->last_used < spare->last_used))))
+            spare = candidate;
+    }
+    if (window == NULL && spare != NULL)
+        window = map_window(reader, spare, offset, size);
+    if (window != NULL) {
+        window->users++;
+        window->last_used = ++reader->stamp;
+        view = window->data + (offset - window->offset);
+    }
+    LeaveCriticalSection(&reader->lock);
+    return view;
+}
+
+void reader_release_view(INPUT_READER* reader, const unsigned char* view)
+{
+    if (view == NULL)
+        return;
+    EnterCriticalSection(&reader->lock);
+    for (int i = 0; i < READER_WINDOWS; i++) {
+        READER_WINDOW* window = &reader->windows[i];
+        if (window->data != NULL && view >= window->data && view < window->data + window->size) {
+            window->users--;
+            break;
+        }
+    }
+    LeaveCriticalSection(&reader->lock);
+}
+
+void reader_advise_sequential(INPUT_READER* reader, long long offset, long long size)
+{
+    if (reader->mapping == NULL || offset < 0 || offset >= reader->size)
+        return;
+    if (offset + size > reader->size)
+        size = reader->size - offset;
+
+    PrefetchVirtualMemoryFn prefetch = get_prefetch_function();
+    if (prefetch == NULL)
+        return;
+
+    // Only what the window holding offset covers, the next window is
+    // prefetched when the reads get there.
+    long long window_left = READER_WINDOW_SIZE - offset % reader->granularity;
+    if (size > window_left)
+        size = window_left;
+    const unsigned char* view = reader_view(reader, offset, size);
+    if (view == NULL)
+        return;
+
+    PREFETCH_RANGE_ENTRY range;
+    range.VirtualAddress = (PVOID)view;
+    range.NumberOfBytes = (SIZE_T)size;
+    prefetch(GetCurrentProcess(), 1, &range, 0);
+    reader_release_view(reader, view);
+}
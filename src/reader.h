@@ -0,0 +1,50 @@
+#pragma once
+
+#include <windows.h>
+#include <stdio.h>
+
+// Read-only access to an input file (the EBOOT.PBP).
+//
+// The file is mapped with CreateFileMapping when possible, but only a few
+// windows of it are mapped into the address space at a time, so a batch
+// extracting several EBOOTs in a 32-bit process doesn't run out of address
+// space. Callers borrow pointers into a window with reader_view() and give
+// them back with reader_release_view(). When the file can't be mapped, reads
+// transparently fall back to stdio and reader_view() returns NULL.
+#define READER_WINDOW_SIZE  (16 * 1024 * 1024)  // Bytes mapped per window.
+#define READER_WINDOWS      4                   // Windows mapped at most at once.
+
+typedef struct {
+    const unsigned char* data;  // Mapped view (NULL while the slot is free).
+    long long offset;           // File offset of data.
+    long long size;
+    int users;                  // Views borrowed from the window.
+    unsigned int last_used;     // Stamp of the last borrow, picks what to unmap.
+} READER_WINDOW;
+
+typedef struct {
+    long long size;             // File size in bytes.
+    FILE* file;                 // stdio fallback handle.
+    CRITICAL_SECTION lock;      // Serializes seek + read on the fallback handle, or guards the windows.
+    HANDLE file_handle;
+    HANDLE mapping;
+    READER_WINDOW windows[READER_WINDOWS];
+    unsigned int stamp;
+    long long granularity;      // Windows start at multiples of it.
+} INPUT_READER;
+
+int reader_open(INPUT_READER* reader, const char* filename);
+void reader_close(INPUT_READER* reader);
+
+// Copy size bytes at offset into buf. Returns the number of bytes read.
+// Safe to call from several threads at once.
+int reader_read(INPUT_READER* reader, long long offset, void* buf, int size);
+
+// Pointer to size bytes at offset inside a mapped window, or NULL if the file
+// is not mapped, the range is out of bounds or larger than a window, or every
+// window is in use. A non-NULL view stays valid until reader_release_view.
+const unsigned char* reader_view(INPUT_READER* reader, long long offset, long long size);
+void reader_release_view(INPUT_READER* reader, const unsigned char* view);
+
+// Hint that [offset, offset + size) is about to be read sequentially.
+void reader_advise_sequential(INPUT_READER* reader, long long offset, long long size);
@@ -0,0 +1,198 @@
+#include "unscramble.h"
+#include "parallel.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define UNSCRAMBLE_SSE2_X86
+#include <cpuid.h>
+#define UNSCRAMBLE_SSE2_TARGET __attribute__((target("sse2")))
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#define UNSCRAMBLE_SSE2_X86
+#include <intrin.h>
+#define UNSCRAMBLE_SSE2_TARGET
+#endif
+
+#ifdef UNSCRAMBLE_SSE2_X86
+#include <emmintrin.h>
+#endif
+
+#define ATRAC_CHUNK_WORDS   (ATRAC_CHUNK_SIZE / 4)
+#define ATRAC_KEY_MULTIPLIER 123456789u
+
+// Chunks handed to a worker at a time (384 KiB). Tracks smaller than two
+// ranges are not worth waking the other threads for.
+#define UNSCRAMBLE_RANGE_CHUNKS 1024
+
+static inline uint32_t rotr32(uint32_t v, int n)
+{
+    n &= 31;
+    return (n == 0) ? v : (v >> n) | (v << (32 - n));
+}
+
+// Unscrambles `count` chunks, the first of which has the given key.
+typedef void (*UNSCRAMBLE_KERNEL)(uint8_t* data, size_t count, uint32_t key);
+static UNSCRAMBLE_KERNEL g_unscramble_kernel;
+
+static void unscramble_kernel_scalar(uint8_t* data, size_t count, uint32_t key)
+{
+    for (size_t c = 0; c < count; c++) {
+        uint8_t* chunk = data + c * ATRAC_CHUNK_SIZE;
+        uint32_t prev = 0;  // Makes the first key word the chunk key itself.
+        for (int k = 0; k < ATRAC_CHUNK_WORDS; k++) {
+            uint32_t value;
+            memcpy(&value, chunk + 4 * k, 4);
+            uint32_t out = value ^ (key + prev * ATRAC_KEY_MULTIPLIER);
+            memcpy(chunk + 4 * k, &out, 4);
+            prev = value;
+        }
+        key = rotr32(key, 1);
+    }
+}
+
+#ifdef UNSCRAMBLE_SSE2_X86
+// Low 32 bits of four 32x32 products (SSE4.1 has this as one instruction).
+UNSCRAMBLE_SSE2_TARGET static inline __m128i mullo32_128(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// Eight words per step, as two independent halves so the multiplies overlap.
+// The previous scrambled word of every lane comes from the current and the
+// previous load, so no stored output is ever read back.
+UNSCRAMBLE_SSE2_TARGET static void unscramble_kernel_sse2(uint8_t* data, size_t count, uint32_t key)
+{
+    const __m128i multiplier = _mm_set1_epi32((int)ATRAC_KEY_MULTIPLIER);
+    for (size_t c = 0; c < count; c++) {
+        uint8_t* chunk = data + c * ATRAC_CHUNK_SIZE;
+        __m128i keys = _mm_set1_epi32((int)key);
+        __m128i last = _mm_setzero_si128();
+        for (int k = 0; k < ATRAC_CHUNK_WORDS; k += 8) {
+            __m128i value0 = _mm_loadu_si128((const __m128i*)(chunk + 4 * k));
+            __m128i value1 = _mm_loadu_si128((const __m128i*)(chunk + 4 * k + 16));
+            __m128i prev0 = _mm_or_si128(_mm_slli_si128(value0, 4), _mm_srli_si128(last, 12));
+            __m128i prev1 = _mm_or_si128(_mm_slli_si128(value1, 4), _mm_srli_si128(value0, 12));
+            __m128i stream0 = _mm_add_epi32(keys, mullo32_128(prev0, multiplier));
+            __m128i stream1 = _mm_add_epi32(keys, mullo32_128(prev1, multiplier));
+            _mm_storeu_si128((__m128i*)(chunk + 4 * k), _mm_xor_si128(value0, stream0));
+            _mm_storeu_si128((__m128i*)(chunk + 4 * k + 16), _mm_xor_si128(value1, stream1));
+            last = value1;
+        }
+        key = rotr32(key, 1);
+    }
+}
+
+static int sse2_supported()
+{
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 1);
+    return (regs[3] & (1 << 26)) != 0;
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return (edx & (1u << 26)) != 0;
+#endif
+}
+#endif
+
+typedef struct {
+    uint8_t* data;
+    size_t chunks;
+    size_t first_chunk;         // Chunk number of data[0] within the track.
+    uint32_t checksum;
+} UNSCRAMBLE_JOB;
+
+static int unscramble_range(void* ctx, int index)
+{
+    UNSCRAMBLE_JOB* job = (UNSCRAMBLE_JOB*)ctx;
+    size_t first = (size_t)index * UNSCRAMBLE_RANGE_CHUNKS;
+    size_t count = job->chunks - first;
+    if (count > UNSCRAMBLE_RANGE_CHUNKS)
+        count = UNSCRAMBLE_RANGE_CHUNKS;
+    g_unscramble_kernel(job->data + first * ATRAC_CHUNK_SIZE, count, rotr32(job->checksum, (int)((job->first_chunk + first) & 31)));
+    return 0;
+}
+
+void unscramble_atrac(uint8_t* data, size_t size, uint32_t checksum)
+{
+    unscramble_atrac_window(data, size, checksum, 0);
+}
+
+void unscramble_atrac_window(uint8_t* data, size_t size, uint32_t checksum, size_t first_chunk)
+{
+    UNSCRAMBLE_JOB job;
+    job.data = data;
+    job.chunks = size / ATRAC_CHUNK_SIZE;
+    job.first_chunk = first_chunk;
+    job.checksum = checksum;
+
+    int ranges = (int)((job.chunks + UNSCRAMBLE_RANGE_CHUNKS - 1) / UNSCRAMBLE_RANGE_CHUNKS);
+    if (ranges < 2)
+        g_unscramble_kernel(data, job.chunks, rotr32(checksum, (int)(first_chunk & 31)));
+    else
+        run_parallel(ranges, parallel_get_threads(), unscramble_range, &job);
+}
+
+void unscramble_atrac_reference(uint8_t* data, size_t size, uint32_t checksum)
+{
+    unsigned int blocks = (unsigned int)((size / ATRAC_CHUNK_SIZE) / 0x10);
+    unsigned int chunks_rest = (unsigned int)((size / ATRAC_CHUNK_SIZE) % 0x10);
+    unsigned int *ptr = (unsigned int*)data;
+    unsigned int tmp = 0, tmp2 = checksum, value = 0;
+
+    // for each block
+    while(blocks)
+    {
+        // for each chunk of block
+        for(int i = 0; i < 0x10; i++)
+        {
+            tmp = tmp2;
+
+            // for each value of chunk
+            for(int k = 0; k < ATRAC_CHUNK_WORDS; k++)
+            {
+                value = ptr[k];
+                ptr[k] = (tmp ^ value);
+                tmp = tmp2 + (value * ATRAC_KEY_MULTIPLIER);
+            }
+
+            tmp2 = rotr32(tmp2, 1);
+            ptr += ATRAC_CHUNK_WORDS; // pointer on next chunk
+        }
+
+        blocks--;
+    }
+
+    // do rest chunks
+    for(unsigned int i = 0; i < chunks_rest; i++)
+    {
+        tmp = tmp2;
+
+        // for each value of chunk
+        for(int k = 0; k < ATRAC_CHUNK_WORDS; k++)
+        {
+            value = ptr[k];
+            ptr[k] = (tmp ^ value);
+            tmp = tmp2 + (value * ATRAC_KEY_MULTIPLIER);
+        }
+
+        tmp2 = rotr32(tmp2, 1);
+        ptr += ATRAC_CHUNK_WORDS; // next chunk
+    }
+}
+
+// Runs before main(), so worker threads only ever read the kernel pointer.
+static struct UnscrambleInit {
+    UnscrambleInit()
+    {
+        g_unscramble_kernel = unscramble_kernel_scalar;
+#ifdef UNSCRAMBLE_SSE2_X86
+        if (sse2_supported())
+            g_unscramble_kernel = unscramble_kernel_sse2;
+#endif
+    }
+} g_unscramble_init;
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes per scrambled chunk of a CDDA track (same as NBYTES in psxtract.h).
+#define ATRAC_CHUNK_SIZE 0x180
+
+// Undoes the scrambling of the ATRAC3 audio tracks in place. Every chunk of
+// 96 little-endian words is XORed with a key stream where
+//     key[0] = checksum rotated right by the chunk number
+//     key[k] = key[0] + 123456789 * word[k - 1]   (scrambled word)
+// so chunks are independent of each other and words only depend on the
+// scrambled data. A trailing partial chunk is left untouched.
+
+// Splits large tracks over the worker threads and uses SSE2 when available.
+void unscramble_atrac(uint8_t* data, size_t size, uint32_t checksum);
+
+// Same for a window of a track that starts at chunk first_chunk, so a track
+// can be unscrambled piece by piece as it is read.
+void unscramble_atrac_window(uint8_t* data, size_t size, uint32_t checksum, size_t first_chunk);
+
+// Original one-word-at-a-time version, kept for cross-checking.
+void unscramble_atrac_reference(uint8_t* data, size_t size, uint32_t checksum);
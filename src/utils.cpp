@@ -77,6 +77,18 @@ void save_original_working_directory()
 	}
 }
 
+// Points build_output_path at another folder (NULL or "." keeps the working directory)
+void set_output_directory(const char* dir)
+{
+	if (dir == NULL || strcmp(dir, ".") == 0)
+	{
+		save_original_working_directory();
+		return;
+	}
+	if (_fullpath(g_original_working_dir, dir, _MAX_PATH) == NULL)
+		strncpy(g_original_working_dir, dir, _MAX_PATH - 1);
+}
+
 // Helper function to build a full path in the original working directory
 int build_output_path(const char* filename, char* output_path, int output_path_size)
 {
@@ -142,4 +154,62 @@ FILE* utf8_fopen(const char* filename, const char* mode)
 	free(wmode);
 	
 	return file;
-}
\ No newline at end of file
+}
+
+int utf8_remove(const char* filename)
+{
+	int wlen = MultiByteToWideChar(CP_UTF8, 0, filename, -1, NULL, 0);
+	wchar_t* wfilename = (wchar_t*)malloc(wlen * sizeof(wchar_t));
+	if (!wfilename) {
+		return -1;
+	}
+	MultiByteToWideChar(CP_UTF8, 0, filename, -1, wfilename, wlen);
+
+	int result = _wremove(wfilename);
+	free(wfilename);
+
+	return result;
+}
+
+// Renames from to to, replacing to if it exists. The rename is atomic, so to
+// is either the old file or the new one.
+int utf8_replace_file(const char* from, const char* to)
+{
+	wchar_t wfrom[_MAX_PATH];
+	wchar_t wto[_MAX_PATH];
+	if (MultiByteToWideChar(CP_UTF8, 0, from, -1, wfrom, _MAX_PATH) == 0 ||
+		MultiByteToWideChar(CP_UTF8, 0, to, -1, wto, _MAX_PATH) == 0) {
+		return -1;
+	}
+
+	return MoveFileExW(wfrom, wto, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) ? 0 : -1;
+}
+
+int utf8_mkdir(const char* dirname)
+{
+	int wlen = MultiByteToWideChar(CP_UTF8, 0, dirname, -1, NULL, 0);
+	wchar_t* wdirname = (wchar_t*)malloc(wlen * sizeof(wchar_t));
+	if (!wdirname) {
+		return -1;
+	}
+	MultiByteToWideChar(CP_UTF8, 0, dirname, -1, wdirname, wlen);
+
+	int result = _wmkdir(wdirname);
+	free(wdirname);
+
+	return result;
+}
+
+// Deletes a directory and everything in it (rmdir /S /Q)
+int utf8_remove_directory(const char* dirname)
+{
+	wchar_t wcommand[_MAX_PATH + 32];
+	wchar_t wdirname[_MAX_PATH];
+	if (MultiByteToWideChar(CP_UTF8, 0, dirname, -1, wdirname, _MAX_PATH) == 0) {
+		return -1;
+	}
+	_snwprintf(wcommand, _MAX_PATH + 32, L"rmdir /S /Q \"%ls\"", wdirname);
+	wcommand[_MAX_PATH + 31] = 0;
+
+	return _wsystem(wcommand);
+}
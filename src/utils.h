@@ -13,9 +13,14 @@ int se32(int i);
 u64 se64(u64 i);
 int get_exe_directory(char* buffer, int buffer_size);
 void save_original_working_directory();
+void set_output_directory(const char* dir);
 int build_output_path(const char* filename, char* output_path, int output_path_size);
 int utf8_file_exists(const char* filename);
 FILE* utf8_fopen(const char* filename, const char* mode);
+int utf8_remove(const char* filename);
+int utf8_replace_file(const char* from, const char* to);
+int utf8_mkdir(const char* dirname);
+int utf8_remove_directory(const char* dirname);
 
 // Automatically replace all fopen calls with Unicode-aware version
 #define fopen utf8_fopen
\ No newline at end of file
@@ -0,0 +1,304 @@
+#include "vdisc.h"
+#include "iso_header.h"
+#include "crypto.h"
+#include "reader.h"
+#include "pxidx.h"
+#include "gui.h"
+
+#define VDISC_BLOCK_SECTORS (ISO_BLOCK_SIZE / SECTOR_SIZE)
+
+typedef struct {
+    int block;                  // Block held by data, -1 when unused.
+    unsigned int last_used;     // Value of the use counter at the last hit.
+    unsigned char* data;        // ISO_BLOCK_SIZE bytes of patched sectors.
+} VDISC_CACHE_ENTRY;
+
+struct VIRTUAL_DISC {
+    INPUT_READER reader;
+    PBP_SECTION sections[8];
+    PBP_SECTION* psar;
+    long long iso_offset;       // Start of the compressed blocks in DATA.PSAR.
+    ISO_HEADER header;
+    int num_sectors;
+    int last_data_sector;       // Last input sector that is not all zero.
+    enum EDCMode form2EDCMode;
+
+    CRITICAL_SECTION cache_lock;
+    unsigned int use_counter;
+    VDISC_CACHE_ENTRY cache[VDISC_CACHE_BLOCKS];
+    unsigned char* cache_data;
+};
+
+// Decompresses ISO block index into out (ISO_BLOCK_SIZE bytes). Blocks past
+// the end of the table read as zeros, like the padding written on extraction.
+static void decompress_block(VIRTUAL_DISC* disc, int index, unsigned char* out)
+{
+    memset(out, 0, ISO_BLOCK_SIZE);
+    if (index >= disc->header.num_blocks)
+        return;
+
+    ISO_ENTRY* entry = &disc->header.blocks[index];
+    decompress_psar_block(disc->psar, disc->iso_offset + entry->offset, entry->size, out);
+}
+
+// Decompresses block index and patches the sectors of it that belong to the
+// data track. Returns 0 or -1 if the fixer rejects a sector.
+static int decode_block(VIRTUAL_DISC* disc, int index, unsigned char* out)
+{
+    decompress_block(disc, index, out);
+
+    int first = index * VDISC_BLOCK_SECTORS;
+    int count = VDISC_BLOCK_SECTORS;
+    if (count > disc->num_sectors - first)
+        count = disc->num_sectors - first;
+    int error = fixSectorsAt(disc->form2EDCMode, out, count, first, disc->last_data_sector);
+    if (error != 0) {
+        printf("ERROR: Can't patch sectors of block %d (error %d)!\n", index, error);
+        return -1;
+    }
+    return 0;
+}
+
+// Reads the disc offsets out of the multi-disc ISO map (0x200 bytes of data
+// in a PGD at 0x200, the first 0x14 bytes are the offsets of up to 5 discs).
+static long long multi_disc_offset(PBP_SECTION* psar, int disc_index, unsigned char* pgd_key)
+{
+    int map_size;
+    unsigned char* iso_map = decrypt_psar_pgd(psar, 0x200, 0x2A0, pgd_key, &map_size);
+    if (iso_map == NULL) {
+        printf("ERROR: PGD decryption failed for the ISO disc map!\n");
+        return -1;
+    }
+
+    unsigned int disc_offset = 0;
+    if (map_size >= 0x14)
+        memcpy(&disc_offset, iso_map + disc_index * sizeof(unsigned int), sizeof(unsigned int));
+    delete[] iso_map;
+
+    if (disc_offset == 0) {
+        printf("ERROR: Disc %d is not present in this EBOOT!\n", disc_index + 1);
+        return -1;
+    }
+    return disc_offset;
+}
+
+// Settles what the streaming fixer learns along the way: the form 2 EDC mode
+// from the bootloader sectors and where the input data ends.
+static int scan_sector_info(VIRTUAL_DISC* disc)
+{
+    unsigned char* block = (unsigned char*)malloc(ISO_BLOCK_SIZE);
+    if (block == NULL)
+        return -1;
+    struct sectorFixer fixer;
+    initSectorFixer(&fixer, 0, INFER, NULL, NULL);
+    decompress_block(disc, 0, block);
+    inferForm2EDCMode(&fixer, block);
+    disc->form2EDCMode = fixer.form2EDCMode;
+
+    disc->last_data_sector = -1;
+    for (int i = disc->header.num_blocks - 1; i >= 0; i--) {
+        decompress_block(disc, i, block);
+        int last = lastDataSector(block, VDISC_BLOCK_SECTORS);
+        if (last >= 0) {
+            disc->last_data_sector = i * VDISC_BLOCK_SECTORS + last;
+            break;
+        }
+    }
+    free(block);
+    return 0;
+}
+
+static int load_disc(VIRTUAL_DISC* disc, const char* eboot, int disc_index, unsigned char* pgd_key, bool use_index)
+{
+    if (reader_open(&disc->reader, eboot) != 0) {
+        printf("ERROR: Can't open %s!\n", eboot);
+        return -1;
+    }
+    disc->psar = &disc->sections[PBP_DATA_PSAR];   // Also marks the reader as open.
+    if (open_pbp_sections(&disc->reader, disc->sections) < 0)
+        return -1;
+    if (disc->psar->size == 0) {
+        printf("ERROR: No DATA.PSAR found!\n");
+        return -1;
+    }
+
+    // PSISOIMG0000 for single disc games, PSTITLEIMG000000 and a disc map
+    // for multi-disc ones.
+    unsigned char magic[0x10];
+    read_pbp_section(disc->psar, 0, magic, sizeof(magic));
+    bool multi_disc;
+    if (memcmp(magic, "PSISOIMG0000", 0xC) == 0)
+        multi_disc = false;
+    else if (memcmp(magic, "PSTITLEIMG000000", 0x10) == 0)
+        multi_disc = true;
+    else {
+        printf("ERROR: Not a valid ISO image!\n");
+        return -1;
+    }
+    if (disc_index < 0 || disc_index >= (multi_disc ? 5 : 1)) {
+        printf("ERROR: Disc %d is not present in this EBOOT!\n", disc_index + 1);
+        return -1;
+    }
+
+    char index_path[MAX_PATH];
+    PXIDX_INFO info;
+    memset(&info, 0, sizeof(info));
+    int header_size = 0;
+    unsigned char* iso_header = NULL;
+    if (use_index) {
+        pxidx_path(eboot, multi_disc ? disc_index + 1 : 0, index_path, sizeof(index_path));
+        iso_header = pxidx_load(index_path, disc->psar, pgd_key, &header_size, &info);
+    }
+    bool from_index = iso_header != NULL;
+
+    if (!from_index) {
+        if (multi_disc) {
+            long long disc_offset = multi_disc_offset(disc->psar, disc_index, pgd_key);
+            if (disc_offset < 0)
+                return -1;
+            info.disc_offset = (unsigned int)disc_offset;
+        }
+        iso_header = decrypt_psar_pgd(disc->psar, (long long)info.disc_offset + ISO_HEADER_OFFSET, ISO_HEADER_SIZE, pgd_key, &header_size);
+        if (iso_header == NULL) {
+            printf("ERROR: PGD decryption failed for the ISO header!\n");
+            return -1;
+        }
+    }
+
+    int result = parse_iso_header(iso_header, header_size, &disc->header);
+    if (result == 0) {
+        disc->num_sectors = data_track_sectors(&disc->header);
+        if (disc->num_sectors < 0)
+            result = -1;
+    }
+    disc->iso_offset = ISO_BASE_OFFSET + (long long)info.disc_offset;
+
+    if (result == 0 && info.has_sector_info) {
+        disc->form2EDCMode = (enum EDCMode)info.form2EDCMode;
+        disc->last_data_sector = info.last_data_sector;
+    } else if (result == 0) {
+        result = scan_sector_info(disc);
+        if (result == 0 && use_index) {
+            info.has_sector_info = true;
+            info.form2EDCMode = disc->form2EDCMode;
+            info.last_data_sector = disc->last_data_sector;
+            pxidx_save(index_path, disc->psar, pgd_key, iso_header, header_size, &info);
+        }
+    }
+    delete[] iso_header;
+    return result;
+}
+
+VIRTUAL_DISC* vdisc_open(const char* eboot, int disc_index, const unsigned char* pgd_key, bool use_index)
+{
+    VIRTUAL_DISC* disc = (VIRTUAL_DISC*)calloc(1, sizeof(VIRTUAL_DISC));
+    if (disc == NULL)
+        return NULL;
+    disc->cache_data = (unsigned char*)malloc((size_t)VDISC_CACHE_BLOCKS * ISO_BLOCK_SIZE);
+    if (disc->cache_data == NULL) {
+        free(disc);
+        return NULL;
+    }
+    for (int i = 0; i < VDISC_CACHE_BLOCKS; i++) {
+        disc->cache[i].block = -1;
+        disc->cache[i].data = disc->cache_data + (size_t)i * ISO_BLOCK_SIZE;
+    }
+    InitializeCriticalSection(&disc->cache_lock);
+
+    unsigned char key[0x10] = {};
+    if (pgd_key != NULL)
+        memcpy(key, pgd_key, sizeof(key));
+
+    if (load_disc(disc, eboot, disc_index, key, use_index) < 0) {
+        vdisc_close(disc);
+        return NULL;
+    }
+    return disc;
+}
+
+void vdisc_close(VIRTUAL_DISC* disc)
+{
+    if (disc == NULL)
+        return;
+    free_iso_header(&disc->header);
+    if (disc->psar != NULL)
+        reader_close(&disc->reader);
+    DeleteCriticalSection(&disc->cache_lock);
+    free(disc->cache_data);
+    free(disc);
+}
+
+int vdisc_sector_count(const VIRTUAL_DISC* disc)
+{
+    return disc->num_sectors;
+}
+
+const char* vdisc_serial(const VIRTUAL_DISC* disc)
+{
+    return disc->header.disc_name;
+}
+
+// Copies sectors [first, first + count) of block index into out, decoding the
+// block into the least recently used cache entry on a miss. The lock is not
+// held while decoding, so threads reading different blocks do not wait on
+// each other; two threads missing on the same block just both decode it.
+static int read_block_sectors(VIRTUAL_DISC* disc, int index, int first, int count, unsigned char* out)
+{
+    EnterCriticalSection(&disc->cache_lock);
+    for (int i = 0; i < VDISC_CACHE_BLOCKS; i++) {
+        VDISC_CACHE_ENTRY* entry = &disc->cache[i];
+        if (entry->block == index) {
+            entry->last_used = ++disc->use_counter;
+            memcpy(out, entry->data + first * SECTOR_SIZE, count * SECTOR_SIZE);
+            LeaveCriticalSection(&disc->cache_lock);
+            return 0;
+        }
+    }
+    LeaveCriticalSection(&disc->cache_lock);
+
+    unsigned char block[ISO_BLOCK_SIZE];
+    if (decode_block(disc, index, block) < 0)
+        return -1;
+    memcpy(out, block + first * SECTOR_SIZE, count * SECTOR_SIZE);
+
+    EnterCriticalSection(&disc->cache_lock);
+    VDISC_CACHE_ENTRY* victim = &disc->cache[0];
+    for (int i = 0; i < VDISC_CACHE_BLOCKS; i++) {
+        VDISC_CACHE_ENTRY* entry = &disc->cache[i];
+        if (entry->block == index) {    // Decoded by another thread meanwhile.
+            victim = entry;
+            break;
+        }
+        if (entry->block < 0 || entry->last_used < victim->last_used)
+            victim = entry;
+        if (entry->block < 0)
+            break;
+    }
+    victim->block = index;
+    victim->last_used = ++disc->use_counter;
+    memcpy(victim->data, block, ISO_BLOCK_SIZE);
+    LeaveCriticalSection(&disc->cache_lock);
+    return 0;
+}
+
+int vdisc_read_sectors(VIRTUAL_DISC* disc, int lba, int count, unsigned char* buf)
+{
+    if (lba < 0 || count < 0)
+        return -1;
+    if (count > disc->num_sectors - lba)
+        count = disc->num_sectors - lba;
+
+    int done = 0;
+    while (done < count) {
+        int sector = lba + done;
+        int index = sector / VDISC_BLOCK_SECTORS;
+        int first = sector % VDISC_BLOCK_SECTORS;
+        int n = VDISC_BLOCK_SECTORS - first;
+        if (n > count - done)
+            n = count - done;
+        if (read_block_sectors(disc, index, first, n, buf + (size_t)done * SECTOR_SIZE) < 0)
+            return -1;
+        done += n;
+    }
+    return (count > 0) ? count : 0;
+}
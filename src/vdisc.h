@@ -0,0 +1,31 @@
+#pragma once
+
+// Random access to the data track of a disc inside an EBOOT.PBP, without
+// extracting it first.
+//
+// Sectors come out as the raw 2352-byte sectors of the final BIN: the ISO
+// blocks holding them are decompressed on demand and their ECC/EDC is patched
+// exactly as during extraction. The last VDISC_CACHE_BLOCKS blocks used are
+// kept, so sequential reads and repeated lookups (filesystem metadata) only
+// decompress every block once. Audio tracks are not served.
+
+#define VDISC_CACHE_BLOCKS 32   // 1.2 MB of decoded sectors per open disc.
+
+typedef struct VIRTUAL_DISC VIRTUAL_DISC;
+
+// Opens disc disc_index (0 for single disc games, 0 to 4 for multi-disc ones).
+// pgd_key is the 16-byte KEYS.BIN key, or NULL to derive it from the PGD MAC.
+// With use_index the disc layout is taken from the .pxidx sidecar of the EBOOT
+// when it is up to date, and the sidecar is (re)written otherwise. KIRK must
+// have been started with kirk_init() beforehand. Returns NULL on errors.
+VIRTUAL_DISC* vdisc_open(const char* eboot, int disc_index, const unsigned char* pgd_key, bool use_index);
+void vdisc_close(VIRTUAL_DISC* disc);
+
+// Number of sectors of the data track, and the disc serial from the ISO header.
+int vdisc_sector_count(const VIRTUAL_DISC* disc);
+const char* vdisc_serial(const VIRTUAL_DISC* disc);
+
+// Copies count sectors starting at lba into buf (count * SECTOR_SIZE bytes).
+// Returns the number of sectors copied, which is short at the end of the
+// track, or -1 on errors. Safe to call from several threads at once.
+int vdisc_read_sectors(VIRTUAL_DISC* disc, int lba, int count, unsigned char* buf);
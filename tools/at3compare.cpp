@@ -0,0 +1,269 @@
+// Compares the built-in ATRAC3 decoder with the ACM codec.
+//
+// Usage: at3compare FILE.AT3...
+//
+// Every file (e.g. the TEMP\Dxx_TRACKyy.AT3 files kept by psxtract -k) is
+// decoded completely in memory by both decoders. The two outputs are lined up
+// on the lag with the smallest difference, since the codec may add a few
+// samples of delay, and compared sample by sample. A track passes when the
+// signal-to-noise ratio of the built-in decoder against ACM is at least
+// AT3COMPARE_MIN_SNR dB. The exit code is 0 when every track passes.
+
+#include "../src/at3acm.h"
+#include "../src/atrac3.h"
+#include "../src/utils.h"
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// at3acm.cpp prints through the GUI redirection, which is not linked here.
+int gui_printf_impl(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int ret = vprintf(format, args);
+    va_end(args);
+    return ret;
+}
+
+#define AT3COMPARE_MIN_SNR  50.0
+#define AT3COMPARE_MAX_LAG  2048    // Samples per channel.
+#define AT3COMPARE_LAG_SPAN 65536   // Samples per channel used to find the lag.
+
+// Bytes of frame data handed to the decoders at a time, like psxtract does.
+#define AT3COMPARE_WINDOW   (64 * 1024)
+
+typedef struct {
+    int16_t* samples;
+    int channels;
+    size_t frames;              // Samples per channel.
+    size_t capacity;
+} PCM_BUFFER;
+
+static int collect_pcm(void* ctx, const int16_t* samples, int frames)
+{
+    PCM_BUFFER* pcm = (PCM_BUFFER*)ctx;
+    if (pcm->frames + frames > pcm->capacity) {
+        size_t capacity = pcm->capacity ? pcm->capacity * 2 : 1 << 20;
+        while (capacity < pcm->frames + frames)
+            capacity *= 2;
+        int16_t* grown = (int16_t*)realloc(pcm->samples, capacity * pcm->channels * sizeof(int16_t));
+        if (grown == NULL)
+            return -1;
+        pcm->samples = grown;
+        pcm->capacity = capacity;
+    }
+    memcpy(pcm->samples + pcm->frames * pcm->channels, samples, frames * pcm->channels * sizeof(int16_t));
+    pcm->frames += frames;
+    return 0;
+}
+
+// Finds the "fmt " and "data" chunks of a RIFF file held in memory.
+static int find_chunks(const unsigned char* file, size_t size, const unsigned char** fmt, const unsigned char** data, uint32_t* data_size)
+{
+    *fmt = NULL;
+    *data = NULL;
+    if (size < 12 || memcmp(file, "RIFF", 4) != 0 || memcmp(file + 8, "WAVE", 4) != 0)
+        return -1;
+
+    size_t pos = 12;
+    while (pos + 8 <= size) {
+        uint32_t length = file[pos + 4] | (file[pos + 5] << 8) | (file[pos + 6] << 16) | ((uint32_t)file[pos + 7] << 24);
+        if (memcmp(file + pos, "fmt ", 4) == 0) {
+            *fmt = file + pos + 8;
+        } else if (memcmp(file + pos, "data", 4) == 0) {
+            *data = file + pos + 8;
+            *data_size = (uint32_t)((length < size - pos - 8) ? length : size - pos - 8);
+            break;
+        }
+        pos += 8 + length + (length & 1);
+    }
+    return (*fmt != NULL && *data != NULL) ? 0 : -1;
+}
+
+static int decode_native(const char* path, const unsigned char* data, uint32_t data_size, PCM_BUFFER* pcm, int* bad_frames)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        printf("ERROR: Can't open %s!\n", path);
+        return -1;
+    }
+    ATRAC3_FORMAT format;
+    int ret = atrac3_read_header(file, &format);
+    fclose(file);
+    if (ret < 0) {
+        printf("ERROR: %s is not an ATRAC3 file!\n", path);
+        return -1;
+    }
+    if (format.data_size < data_size)
+        data_size = format.data_size;
+
+    ATRAC3_DECODER* decoder = atrac3_create(format.channels, format.block_align, format.joint_stereo);
+    if (decoder == NULL)
+        return -1;
+    pcm->channels = format.channels;
+    *bad_frames = 0;
+    for (uint32_t pos = 0; pos < data_size && ret == 0; pos += AT3COMPARE_WINDOW) {
+        uint32_t size = data_size - pos;
+        if (size > AT3COMPARE_WINDOW)
+            size = AT3COMPARE_WINDOW;
+        ret = atrac3_decode_window(decoder, data + pos, size, collect_pcm, pcm, bad_frames);
+    }
+    atrac3_destroy(decoder);
+
+    // The fact chunk gives the real length; the last frame is padding past it.
+    if (ret >= 0 && format.total_samples != 0 && format.total_samples < pcm->frames)
+        pcm->frames = format.total_samples;
+    return (ret < 0) ? -1 : 0;
+}
+
+static int decode_acm(HACMDRIVERID at3hadid, const unsigned char* fmt, const unsigned char* data, uint32_t data_size, PCM_BUFFER* pcm)
+{
+    const WAVEFORMATEX* format = (const WAVEFORMATEX*)fmt;
+    AT3_ACM_DECODER* decoder = openAt3Decoder(at3hadid, format);
+    if (decoder == NULL)
+        return -1;
+    pcm->channels = format->nChannels;
+    int ret = 0;
+    for (uint32_t pos = 0; pos < data_size && ret == 0; pos += AT3COMPARE_WINDOW) {
+        uint32_t size = data_size - pos;
+        if (size > AT3COMPARE_WINDOW)
+            size = AT3COMPARE_WINDOW;
+        ret = decodeAt3Window(decoder, data + pos, size, pos + size >= data_size, collect_pcm, pcm);
+    }
+    closeAt3Decoder(decoder);
+    return (ret < 0) ? -1 : 0;
+}
+
+// Sum of squared differences of native against acm shifted by lag samples
+// per channel, over at most span samples.
+static double squared_error(const PCM_BUFFER* native, const PCM_BUFFER* acm, int lag, size_t span, size_t* compared)
+{
+    size_t first = (lag < 0) ? (size_t)-lag : 0;
+    size_t count = 0;
+    double error = 0;
+    for (size_t i = first; i < native->frames && i + lag < acm->frames && count < span; i++, count++) {
+        for (int c = 0; c < native->channels; c++) {
+            double d = native->samples[i * native->channels + c] - acm->samples[(i + lag) * acm->channels + c];
+            error += d * d;
+        }
+    }
+    *compared = count;
+    return error;
+}
+
+static int compare_track(HACMDRIVERID at3hadid, const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        printf("ERROR: Can't open %s!\n", path);
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char* contents = (unsigned char*)malloc(size > 0 ? size : 1);
+    if (contents == NULL || fread(contents, 1, size, file) != (size_t)size) {
+        printf("ERROR: Can't read %s!\n", path);
+        fclose(file);
+        free(contents);
+        return -1;
+    }
+    fclose(file);
+
+    const unsigned char* fmt;
+    const unsigned char* data;
+    uint32_t data_size;
+    if (find_chunks(contents, size, &fmt, &data, &data_size) < 0) {
+        printf("ERROR: %s is not a RIFF WAVE file!\n", path);
+        free(contents);
+        return -1;
+    }
+
+    PCM_BUFFER native, acm;
+    memset(&native, 0, sizeof(native));
+    memset(&acm, 0, sizeof(acm));
+    int bad_frames = 0;
+    int ret = -1;
+    if (decode_native(path, data, data_size, &native, &bad_frames) < 0) {
+        printf("ERROR: The built-in decoder failed on %s!\n", path);
+    } else if (decode_acm(at3hadid, fmt, data, data_size, &acm) < 0) {
+        printf("ERROR: The ACM codec failed on %s!\n", path);
+    } else if (native.channels != acm.channels) {
+        printf("ERROR: %s decodes to %d channels natively but %d with ACM!\n", path, native.channels, acm.channels);
+    } else {
+        // Line the outputs up on the lag with the smallest error at the start
+        // of the track, then compare everything that overlaps.
+        int best_lag = 0;
+        double best_error = -1;
+        for (int lag = -AT3COMPARE_MAX_LAG; lag <= AT3COMPARE_MAX_LAG; lag++) {
+            size_t compared;
+            double error = squared_error(&native, &acm, lag, AT3COMPARE_LAG_SPAN, &compared);
+            if (compared == 0)
+                continue;
+            error /= compared;
+            if (best_error < 0 || error < best_error) {
+                best_error = error;
+                best_lag = lag;
+            }
+        }
+
+        size_t first = (best_lag < 0) ? (size_t)-best_lag : 0;
+        double signal = 0, noise = 0;
+        int max_diff = 0;
+        size_t compared = 0;
+        for (size_t i = first; i < native.frames && i + best_lag < acm.frames; i++, compared++) {
+            for (int c = 0; c < native.channels; c++) {
+                int a = acm.samples[(i + best_lag) * acm.channels + c];
+                int d = native.samples[i * native.channels + c] - a;
+                signal += (double)a * a;
+                noise += (double)d * d;
+                if (abs(d) > max_diff)
+                    max_diff = abs(d);
+            }
+        }
+        double snr = (noise == 0) ? INFINITY : 10 * log10(signal / noise);
+        bool pass = compared > 0 && snr >= AT3COMPARE_MIN_SNR;
+
+        printf("%s: %s\n", path, pass ? "OK" : "MISMATCH");
+        printf("  samples:    %u built-in, %u ACM, %u compared\n", (unsigned)native.frames, (unsigned)acm.frames, (unsigned)compared);
+        printf("  lag:        %d\n", best_lag);
+        printf("  max diff:   %d\n", max_diff);
+        printf("  SNR:        %.1f dB\n", snr);
+        if (bad_frames)
+            printf("  bad frames: %d\n", bad_frames);
+        ret = pass ? 0 : 1;
+    }
+
+    free(native.samples);
+    free(acm.samples);
+    free(contents);
+    return ret;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        printf("Usage: at3compare FILE.AT3...\n");
+        printf("Decodes ATRAC3 files with the built-in decoder and the ACM codec and compares the output.\n");
+        return 2;
+    }
+
+    HACMDRIVERID at3hadid = NULL;
+    registerBundledAtrac3Codec();
+    findAt3Driver(&at3hadid);
+    if (at3hadid == NULL) {
+        printf("ERROR: The ATRAC3 ACM codec is not available!\n");
+        return 2;
+    }
+
+    int failed = 0;
+    for (int i = 1; i < argc; i++) {
+        if (compare_track(at3hadid, argv[i]) != 0)
+            failed++;
+    }
+    printf("%d of %d tracks match.\n", argc - 1 - failed, argc - 1);
+    return failed ? 1 : 0;
+}
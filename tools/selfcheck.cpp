@@ -0,0 +1,108 @@
+// Cross-checks the fast CD routines against the reference versions kept next
+// to them.
+//
+// Usage: selfcheck
+//
+// Runs on generated data, so it needs no input files. Prints one line per
+// check and exits with 0 when all of them pass.
+
+#include "../src/edc.h"
+#include "../src/unscramble.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Same data on every run, so a failure can be reproduced.
+static void fill_random(uint8_t* data, size_t size, uint32_t seed)
+{
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        data[i] = (uint8_t)(seed >> 24);
+    }
+}
+
+// edc_compute and edc_update against edc_compute_bytewise, for every size
+// around the sector layouts and the SIMD block sizes, at every alignment.
+static bool check_edc()
+{
+    static const size_t MAX_SIZE = 2400;
+    uint8_t* buf = (uint8_t*)malloc(MAX_SIZE + 16);
+    if (buf == NULL)
+        return false;
+    fill_random(buf, MAX_SIZE + 16, 1);
+
+    bool ok = true;
+    for (size_t offset = 0; offset < 16 && ok; offset++) {
+        const uint8_t* data = buf + offset;
+        for (size_t size = 0; size <= MAX_SIZE && ok; size++) {
+            uint32_t expected = edc_compute_bytewise(data, size);
+            if (edc_compute(data, size) != expected) {
+                printf("  edc_compute differs at offset %u, size %u\n", (unsigned)offset, (unsigned)size);
+                ok = false;
+            }
+            size_t split = size / 3;
+            if (ok && edc_update(edc_compute(data, split), data + split, size - split) != expected) {
+                printf("  edc_update differs at offset %u, size %u, split %u\n", (unsigned)offset, (unsigned)size, (unsigned)split);
+                ok = false;
+            }
+        }
+    }
+    free(buf);
+    return ok;
+}
+
+// unscramble_atrac, and unscramble_atrac_window fed in uneven pieces, against
+// unscramble_atrac_reference. The track is long enough to be split over the
+// worker threads and ends in a partial chunk, which must stay untouched.
+static bool check_unscramble()
+{
+    static const size_t SIZE = 3000 * ATRAC_CHUNK_SIZE + 100;
+    static const uint32_t CHECKSUM = 0x9E3779B9;
+    uint8_t* scrambled = (uint8_t*)malloc(SIZE);
+    uint8_t* expected = (uint8_t*)malloc(SIZE);
+    uint8_t* actual = (uint8_t*)malloc(SIZE);
+    bool ok = scrambled != NULL && expected != NULL && actual != NULL;
+    if (ok) {
+        fill_random(scrambled, SIZE, 2);
+        memcpy(expected, scrambled, SIZE);
+        unscramble_atrac_reference(expected, SIZE, CHECKSUM);
+
+        memcpy(actual, scrambled, SIZE);
+        unscramble_atrac(actual, SIZE, CHECKSUM);
+        if (memcmp(actual, expected, SIZE) != 0) {
+            printf("  unscramble_atrac differs\n");
+            ok = false;
+        }
+
+        memcpy(actual, scrambled, SIZE);
+        size_t chunk = 0, chunks = SIZE / ATRAC_CHUNK_SIZE;
+        for (size_t step = 1; chunk < chunks; step = step * 3 + 1) {
+            size_t count = (step < chunks - chunk) ? step : chunks - chunk;
+            unscramble_atrac_window(actual + chunk * ATRAC_CHUNK_SIZE, count * ATRAC_CHUNK_SIZE, CHECKSUM, chunk);
+            chunk += count;
+        }
+        if (memcmp(actual, expected, SIZE) != 0) {
+            printf("  unscramble_atrac_window differs\n");
+            ok = false;
+        }
+    }
+    free(scrambled);
+    free(expected);
+    free(actual);
+    return ok;
+}
+
+int main()
+{
+    int failed = 0;
+
+    bool edc = check_edc();
+    printf("EDC: %s\n", edc ? "OK" : "FAILED");
+    failed += !edc;
+
+    bool unscramble = check_unscramble();
+    printf("Unscramble: %s\n", unscramble ? "OK" : "FAILED");
+    failed += !unscramble;
+
+    return failed ? 1 : 0;
+}